@@ -7,6 +7,18 @@ ELSE()
 	SET(ENABLE_UDEV OFF CACHE INTERNAL "Enable UDEV for the 'query' command." FORCE)
 ENDIF()
 
+# Enable the io_uring I/O backend on Linux.
+IF(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+	OPTION(ENABLE_IO_URING "Enable the io_uring I/O backend for disc images and RVT-H Readers." ON)
+ELSE()
+	SET(ENABLE_IO_URING OFF CACHE INTERNAL "Enable the io_uring I/O backend for disc images and RVT-H Readers." FORCE)
+ENDIF()
+
+# Compression libraries for WIA and RVZ disc images.
+# If a library isn't found, images using that compression
+# method can't be read.
+OPTION(ENABLE_WIA_COMPRESSION "Enable bzip2, LZMA, and Zstandard support for WIA and RVZ disc images." ON)
+
 # Enable D-Bus for DockManager / Unity API.
 IF(UNIX AND NOT APPLE)
 	OPTION(ENABLE_DBUS	"Enable D-Bus support for DockManager / Unity API." 1)
@@ -0,0 +1,901 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ChunkStore.cpp: Content-addressed chunk store for disc images.          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ChunkStore.hpp"
+#include "RefFile.hpp"
+#include "byteswap.h"
+#include "nhcd_structs.h"
+#include "reader/store_manifest.h"
+
+// C includes.
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+# include <io.h>
+# include <process.h>
+# define getpid() _getpid()
+#else /* !_WIN32 */
+# include <dirent.h>
+# include <sys/file.h>
+# include <unistd.h>
+#endif /* _WIN32 */
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+using std::string;
+using std::tstring;
+using std::unordered_set;
+using std::vector;
+
+// SHA-1
+#include <nettle/sha1.h>
+
+const unsigned int StoreManifest::DIGEST_SIZE;
+
+StoreManifest::StoreManifest()
+	: m_lba_len(0)
+	, m_chunkLbaLen(0)
+	, m_firstLbaLen(0)
+	, m_chunkCount(0)
+{ }
+
+/**
+ * Get the number of chunks needed for a disc image.
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @param chunkLbaLen	[in] Chunk size, in LBAs.
+ * @param firstLbaLen	[in] Length of the first chunk, in LBAs.
+ * @return Number of chunks.
+ */
+static inline uint32_t chunkCountFor(uint32_t lba_len, uint32_t chunkLbaLen, uint32_t firstLbaLen)
+{
+	if (lba_len <= firstLbaLen) {
+		return 1;
+	}
+	return 1 + static_cast<uint32_t>(
+		((uint64_t)(lba_len - firstLbaLen) + chunkLbaLen - 1) / chunkLbaLen);
+}
+
+/**
+ * Initialize an empty manifest for a new disc image.
+ * All digests are set to zero.
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @param chunk_size	[in] Chunk size, in bytes. (multiple of LBA_SIZE)
+ * @param first_lba_len	[in] Length of the first chunk, in LBAs. (1 to chunk size)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int StoreManifest::init(uint32_t lba_len, unsigned int chunk_size, uint32_t first_lba_len)
+{
+	assert(chunk_size % LBA_SIZE == 0);
+	if (lba_len == 0 || chunk_size < LBA_SIZE || chunk_size > STORE_MAX_CHUNK_SIZE ||
+	    chunk_size % LBA_SIZE != 0 ||
+	    first_lba_len == 0 || first_lba_len > BYTES_TO_LBA(chunk_size))
+	{
+		return -EINVAL;
+	}
+
+	m_lba_len = lba_len;
+	m_chunkLbaLen = static_cast<uint32_t>(BYTES_TO_LBA(chunk_size));
+	m_firstLbaLen = first_lba_len;
+	m_chunkCount = chunkCountFor(m_lba_len, m_chunkLbaLen, m_firstLbaLen);
+	m_digests.assign((size_t)m_chunkCount * DIGEST_SIZE, 0);
+	return 0;
+}
+
+/**
+ * Is a given file a chunk store manifest?
+ * @param sbuf	[in] Start of the file.
+ * @param size	[in] Size of sbuf.
+ * @return True if this is a manifest; false if not.
+ */
+bool StoreManifest::isManifest(const uint8_t *sbuf, size_t size)
+{
+	static_assert(sizeof(STORE_MANIFEST_MAGIC)-1 == sizeof(store_manifest_header_t::magic),
+		"STORE_MANIFEST_MAGIC is the wrong size.");
+	if (size < sizeof(store_manifest_header_t)) {
+		return false;
+	}
+	return !memcmp(sbuf, STORE_MANIFEST_MAGIC, sizeof(store_manifest_header_t::magic));
+}
+
+/**
+ * Load a manifest from a file.
+ * @param file	[in] Manifest file.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int StoreManifest::load(RefFile *file)
+{
+	store_manifest_header_t header;
+	errno = 0;
+	size_t size = file->preadAt(0, &header, sizeof(header));
+	if (size != sizeof(header)) {
+		// Short read.
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	if (!isManifest(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) ||
+	    le32_to_cpu(header.header_size) < sizeof(header) ||
+	    header.hash_type != STORE_HASH_SHA1 ||
+	    header.digest_size != DIGEST_SIZE)
+	{
+		// Not a supported manifest.
+		return -EIO;
+	}
+
+	const uint32_t chunk_size = le32_to_cpu(header.chunk_size);
+	const uint32_t chunkCount = le32_to_cpu(header.chunk_count);
+	int ret = init(le32_to_cpu(header.lba_len), chunk_size, le32_to_cpu(header.first_lba_len));
+	if (ret != 0) {
+		// Invalid chunk layout.
+		return -EIO;
+	}
+	if (chunkCount != m_chunkCount) {
+		// Chunk count doesn't match the layout.
+		m_chunkCount = 0;
+		m_digests.clear();
+		return -EIO;
+	}
+
+	errno = 0;
+	size = file->preadAt(le32_to_cpu(header.header_size), m_digests.data(), m_digests.size());
+	if (size != m_digests.size()) {
+		// Short read.
+		m_chunkCount = 0;
+		m_digests.clear();
+		return (errno != 0 ? -errno : -EIO);
+	}
+	return 0;
+}
+
+/**
+ * Write a file's data to the disk.
+ * @param f File.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int syncFile(FILE *f)
+{
+	if (fflush(f) != 0) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+#ifdef _WIN32
+	if (_commit(_fileno(f)) != 0) {
+		return -errno;
+	}
+#else /* !_WIN32 */
+	if (fsync(fileno(f)) != 0) {
+		return -errno;
+	}
+#endif /* _WIN32 */
+	return 0;
+}
+
+/**
+ * Write a directory's entries to the disk, e.g. after renaming
+ * a file into it, so the new file is still there after a crash.
+ * NOTE: Directories can't be synced on Windows, so this is a no-op.
+ * @param dir Directory.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int syncDir(const tstring &dir)
+{
+#ifdef _WIN32
+	UNUSED(dir);
+	return 0;
+#else /* !_WIN32 */
+	int fd;
+	do {
+		fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0) {
+		return -errno;
+	}
+	const int ret = (fsync(fd) == 0 ? 0 : -errno);
+	close(fd);
+	return ret;
+#endif /* _WIN32 */
+}
+
+/**
+ * Save the manifest.
+ * The manifest is written to a temporary file, which is
+ * then renamed, so the manifest is never partially written.
+ * @param filename	[in] Manifest filename.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int StoreManifest::save(const TCHAR *filename) const
+{
+	assert(m_chunkCount > 0);
+	if (m_chunkCount == 0) {
+		return -EINVAL;
+	}
+
+	store_manifest_header_t header;
+	memcpy(header.magic, STORE_MANIFEST_MAGIC, sizeof(header.magic));
+	header.header_size = cpu_to_le32(static_cast<uint32_t>(sizeof(header)));
+	header.chunk_size = cpu_to_le32(static_cast<uint32_t>(LBA_TO_BYTES(m_chunkLbaLen)));
+	header.lba_len = cpu_to_le32(m_lba_len);
+	header.first_lba_len = cpu_to_le32(m_firstLbaLen);
+	header.chunk_count = cpu_to_le32(m_chunkCount);
+	header.hash_type = STORE_HASH_SHA1;
+	header.digest_size = DIGEST_SIZE;
+	header.reserved[0] = 0;
+	header.reserved[1] = 0;
+
+	TCHAR pid_buf[16];
+	_sntprintf(pid_buf, ARRAY_SIZE(pid_buf), _T(".%u"), static_cast<unsigned int>(getpid()));
+	const tstring tmpFile = tstring(filename) + pid_buf;
+	FILE *f = _tfopen(tmpFile.c_str(), _T("wb"));
+	if (!f) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	bool ok = (fwrite(&header, 1, sizeof(header), f) == sizeof(header));
+	ok &= (fwrite(m_digests.data(), 1, m_digests.size(), f) == m_digests.size());
+	ok &= (syncFile(f) == 0);
+	ok &= (fclose(f) == 0);
+	if (!ok) {
+		const int err = (errno != 0 ? errno : EIO);
+		_tremove(tmpFile.c_str());
+		return -err;
+	}
+
+#ifdef _WIN32
+	// Windows can't rename over an existing file.
+	_tremove(filename);
+#endif /* _WIN32 */
+	if (_trename(tmpFile.c_str(), filename) != 0) {
+		const int err = (errno != 0 ? errno : EIO);
+		_tremove(tmpFile.c_str());
+		return -err;
+	}
+	return syncDir(ChunkStore::dirForManifest(filename));
+}
+
+/**
+ * Is a chunk empty, i.e. all zeroes?
+ * @param idx Chunk index.
+ * @return True if the chunk is empty.
+ */
+bool StoreManifest::isEmpty(uint32_t idx) const
+{
+	const uint8_t *const p = digest(idx);
+	for (unsigned int i = 0; i < DIGEST_SIZE; i++) {
+		if (p[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+/** ChunkStore **/
+
+/**
+ * Create a directory if it doesn't exist.
+ * @param dir Directory.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int mkdirIfMissing(const tstring &dir)
+{
+#ifdef _WIN32
+	int ret = _tmkdir(dir.c_str());
+#else /* !_WIN32 */
+	int ret = _tmkdir(dir.c_str(), 0777);
+#endif /* _WIN32 */
+	if (ret != 0 && errno != EEXIST) {
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Get the size of a file.
+ * @param filename Filename.
+ * @return File size, or negative POSIX error code on error.
+ */
+static int64_t getFileSize(const tstring &filename)
+{
+#ifdef _WIN32
+	struct _stati64 sb;
+	if (_tstati64(filename.c_str(), &sb) != 0) {
+		return -errno;
+	}
+#else /* !_WIN32 */
+	struct stat sb;
+	if (stat(filename.c_str(), &sb) != 0) {
+		return -errno;
+	}
+#endif /* _WIN32 */
+	return static_cast<int64_t>(sb.st_size);
+}
+
+/**
+ * Calculate the digest of a stored chunk.
+ * @param filename	[in] Chunk filename.
+ * @param digest	[out] Digest. (StoreManifest::DIGEST_SIZE bytes)
+ * @return Size of the chunk, or negative POSIX error code on error.
+ */
+static int64_t hashChunkFile(const tstring &filename, uint8_t *digest)
+{
+	FILE *f = _tfopen(filename.c_str(), _T("rb"));
+	if (!f) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	vector<uint8_t> buf(64*1024);
+	int64_t size = 0;
+	size_t len;
+	while ((len = fread(buf.data(), 1, buf.size(), f)) > 0) {
+		sha1_update(&sha1, len, buf.data());
+		size += len;
+	}
+	if (ferror(f)) {
+		size = (errno != 0 ? -errno : -EIO);
+	}
+	fclose(f);
+	sha1_digest(&sha1, SHA1_DIGEST_SIZE, digest);
+	return size;
+}
+
+/**
+ * List the files in a directory.
+ * "." and ".." are skipped.
+ * @param dir	[in] Directory.
+ * @param func	[in] Called for each entry: (name, isDir)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int listDir(const tstring &dir, const std::function<void(const TCHAR *name, bool isDir)> &func)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA findData;
+	const tstring pattern = dir + _T("\\*");
+	HANDLE hFind = FindFirstFile(pattern.c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		const DWORD dwErr = GetLastError();
+		return (dwErr == ERROR_FILE_NOT_FOUND || dwErr == ERROR_PATH_NOT_FOUND ? -ENOENT : -EIO);
+	}
+	do {
+		const TCHAR *const name = findData.cFileName;
+		if (!_tcscmp(name, _T(".")) || !_tcscmp(name, _T("..")))
+			continue;
+		func(name, !!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY));
+	} while (FindNextFile(hFind, &findData));
+	FindClose(hFind);
+#else /* !_WIN32 */
+	DIR *const pDir = opendir(dir.c_str());
+	if (!pDir) {
+		return -errno;
+	}
+	struct dirent *d;
+	while ((d = readdir(pDir)) != nullptr) {
+		const char *const name = d->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+
+		bool isDir;
+#ifdef DT_DIR
+		if (d->d_type != DT_UNKNOWN) {
+			isDir = (d->d_type == DT_DIR);
+		} else
+#endif /* DT_DIR */
+		{
+			// File system doesn't report the file type.
+			struct stat sb;
+			const string path = dir + '/' + name;
+			isDir = (stat(path.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode));
+		}
+		func(name, isDir);
+	}
+	closedir(pDir);
+#endif /* _WIN32 */
+	return 0;
+}
+
+/**
+ * Convert a hexadecimal string to binary.
+ * @param data	[out] Data.
+ * @param size	[in] Size of data, in bytes.
+ * @param str	[in] Hexadecimal string. (must be exactly size*2 characters)
+ * @return True on success; false if str isn't valid.
+ */
+static bool fromHex(uint8_t *data, size_t size, const TCHAR *str)
+{
+	for (size_t i = 0; i < size * 2; i++) {
+		const TCHAR chr = str[i];
+		uint8_t nybble;
+		if (chr >= _T('0') && chr <= _T('9')) {
+			nybble = chr - _T('0');
+		} else if (chr >= _T('a') && chr <= _T('f')) {
+			nybble = chr - _T('a') + 10;
+		} else {
+			// Invalid character. (or end of string)
+			return false;
+		}
+		if (i % 2 == 0) {
+			data[i / 2] = nybble << 4;
+		} else {
+			data[i / 2] |= nybble;
+		}
+	}
+	return (str[size * 2] == 0);
+}
+
+/**
+ * Convert a binary value to a hexadecimal string.
+ * @param str	[in,out] String to append to.
+ * @param data	[in] Data.
+ * @param size	[in] Size of data, in bytes.
+ */
+static void appendHex(tstring &str, const uint8_t *data, size_t size)
+{
+	static const TCHAR hex_digits[] = _T("0123456789abcdef");
+	for (; size > 0; size--, data++) {
+		str += hex_digits[*data >> 4];
+		str += hex_digits[*data & 0x0F];
+	}
+}
+
+/**
+ * Open a chunk store.
+ * The directory doesn't need to exist yet.
+ * @param dir Store directory.
+ */
+ChunkStore::ChunkStore(const TCHAR *dir)
+	: m_dir(dir)
+{
+	m_chunkDir = m_dir;
+	m_chunkDir += _T("/chunks/");
+}
+
+/**
+ * Get the store directory for a manifest.
+ * @param manifest_filename Manifest filename.
+ * @return Store directory.
+ */
+tstring ChunkStore::dirForManifest(const TCHAR *manifest_filename)
+{
+	tstring dir(manifest_filename);
+#ifdef _WIN32
+	const size_t slash_pos = dir.find_last_of(_T("/\\"));
+#else /* !_WIN32 */
+	const size_t slash_pos = dir.rfind(_T('/'));
+#endif /* _WIN32 */
+	if (slash_pos == tstring::npos) {
+		// No directory. Use the current directory.
+		return _T(".");
+	}
+	// NOTE: Keep the slash if it's the root directory.
+	dir.resize(slash_pos > 0 ? slash_pos : 1);
+	return dir;
+}
+
+/**
+ * Calculate the digest of a chunk.
+ * @param digest	[out] Digest. (StoreManifest::DIGEST_SIZE bytes)
+ * @param data		[in] Chunk data.
+ * @param size		[in] Size of the chunk, in bytes.
+ */
+void ChunkStore::hash(uint8_t *digest, const uint8_t *data, size_t size)
+{
+	static_assert(StoreManifest::DIGEST_SIZE == SHA1_DIGEST_SIZE, "DIGEST_SIZE is wrong.");
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, size, data);
+	sha1_digest(&sha1, SHA1_DIGEST_SIZE, digest);
+}
+
+/**
+ * Get the filename of a chunk.
+ * @param digest Digest.
+ * @return Chunk filename.
+ */
+tstring ChunkStore::chunkFilename(const uint8_t *digest) const
+{
+	tstring filename(m_chunkDir);
+	filename.reserve(m_chunkDir.size() + (StoreManifest::DIGEST_SIZE * 2) + 1);
+	appendHex(filename, digest, 1);
+	filename += _T('/');
+	appendHex(filename, digest + 1, StoreManifest::DIGEST_SIZE - 1);
+	return filename;
+}
+
+/**
+ * Add a chunk to the store if it isn't already there.
+ * @param digest	[in] Digest.
+ * @param data		[in] Chunk data.
+ * @param size		[in] Size of the chunk, in bytes.
+ * @param pAdded	[out,opt] Set to true if the chunk was added; false if it was already stored.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ChunkStore::put(const uint8_t *digest, const uint8_t *data, size_t size, bool *pAdded)
+{
+	// Temporary files are unique within this process, since
+	// multiple threads may be writing the same chunk.
+	static std::atomic<unsigned int> tmpCounter(0);
+
+	if (pAdded) {
+		*pAdded = false;
+	}
+
+	// A stored chunk with the right size is assumed to be valid.
+	// Chunks that were truncated by a crash are replaced.
+	// NOTE: Use scan() with SCAN_VERIFY to check the digests.
+	const tstring filename = chunkFilename(digest);
+	const int64_t stored_size = getFileSize(filename);
+	if (stored_size == (int64_t)size) {
+		// Chunk is already stored.
+		return 0;
+	}
+
+	TCHAR tmp_buf[32];
+	_sntprintf(tmp_buf, ARRAY_SIZE(tmp_buf), _T(".%u.%u"),
+		static_cast<unsigned int>(getpid()), tmpCounter.fetch_add(1, std::memory_order_relaxed));
+	const tstring tmpFile = filename + tmp_buf;
+	const tstring subdir = filename.substr(0, m_chunkDir.size() + 2);
+	FILE *f = _tfopen(tmpFile.c_str(), _T("wb"));
+	if (!f && errno == ENOENT) {
+		// Create the chunk directory.
+		int ret = mkdirIfMissing(m_dir);
+		if (ret == 0) {
+			ret = mkdirIfMissing(m_chunkDir);
+		}
+		if (ret == 0) {
+			ret = mkdirIfMissing(subdir);
+		}
+		if (ret != 0) {
+			return ret;
+		}
+		std::lock_guard<std::mutex> lock(m_syncMutex);
+		m_unsyncedDirs.insert(m_dir);
+		m_unsyncedDirs.insert(m_chunkDir);
+		f = _tfopen(tmpFile.c_str(), _T("wb"));
+	}
+	if (!f) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	// NOTE: The chunk isn't synced to the disk here.
+	// sync() syncs all new chunks at once.
+	bool ok = (fwrite(data, 1, size, f) == size);
+	ok &= (fclose(f) == 0);
+	if (!ok) {
+		const int err = (errno != 0 ? errno : EIO);
+		_tremove(tmpFile.c_str());
+		return -err;
+	}
+
+#ifdef _WIN32
+	if (stored_size >= 0) {
+		// Replacing a truncated chunk.
+		// Windows can't rename over an existing file.
+		_tremove(filename.c_str());
+	}
+#endif /* _WIN32 */
+	if (_trename(tmpFile.c_str(), filename.c_str()) != 0) {
+		// Another thread or process may have stored the same chunk.
+		// NOTE: Windows can't rename over an existing file.
+		const int err = (errno != 0 ? errno : EIO);
+		_tremove(tmpFile.c_str());
+		return (getFileSize(filename) == (int64_t)size ? 0 : -err);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_syncMutex);
+		m_unsyncedChunks.push_back(filename);
+		m_unsyncedDirs.insert(subdir);
+	}
+	if (pAdded) {
+		*pAdded = true;
+	}
+	return 0;
+}
+
+/**
+ * Write the chunks that were added by put() to the disk,
+ * along with the directories they were added to.
+ * This must be done before saving a manifest that
+ * references the new chunks.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ChunkStore::sync(void)
+{
+	vector<tstring> chunks;
+	unordered_set<tstring> dirs;
+	{
+		std::lock_guard<std::mutex> lock(m_syncMutex);
+		chunks.swap(m_unsyncedChunks);
+		dirs.swap(m_unsyncedDirs);
+	}
+
+	for (const tstring &filename : chunks) {
+		FILE *const f = _tfopen(filename.c_str(), _T("r+b"));
+		if (!f) {
+			return (errno != 0 ? -errno : -EIO);
+		}
+		const int ret = syncFile(f);
+		fclose(f);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	for (const tstring &dir : dirs) {
+		const int ret = syncDir(dir);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read part of a chunk.
+ * @param digest	[in] Digest.
+ * @param offset	[in] Offset in the chunk, in bytes.
+ * @param buf		[out] Output buffer.
+ * @param size		[in] Number of bytes to read.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ChunkStore::get(const uint8_t *digest, size_t offset, uint8_t *buf, size_t size) const
+{
+	assert(offset + size <= STORE_MAX_CHUNK_SIZE);
+	FILE *f = _tfopen(chunkFilename(digest).c_str(), _T("rb"));
+	if (!f) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	int ret = 0;
+	if (offset > 0 && fseek(f, static_cast<long>(offset), SEEK_SET) != 0) {
+		ret = (errno != 0 ? -errno : -EIO);
+	} else if (fread(buf, 1, size, f) != size) {
+		// Short read. The chunk is truncated.
+		ret = (ferror(f) && errno != 0 ? -errno : -EIO);
+	} else if (offset == 0 && fgetc(f) == EOF && !ferror(f)) {
+		// The entire chunk was read. Verify the digest.
+		uint8_t check[StoreManifest::DIGEST_SIZE];
+		hash(check, buf, size);
+		if (memcmp(check, digest, sizeof(check)) != 0) {
+			// Chunk is corrupt.
+			ret = -EIO;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+/**
+ * Scan the store.
+ * All manifests in the store directory are loaded,
+ * and the referenced chunks are compared to the
+ * stored chunks.
+ *
+ * If SCAN_REMOVE_UNREFERENCED is set, chunks that aren't
+ * referenced by any manifest are deleted. The statistics
+ * describe the store from before they were deleted.
+ * The store is locked exclusively while scanning, so this
+ * fails with -EBUSY if disc images are being added.
+ *
+ * @param pStats	[out] Statistics.
+ * @param flags		[in] Flags. (See ScanFlags.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ChunkStore::scan(Stats *pStats, unsigned int flags)
+{
+	assert(pStats != nullptr);
+	memset(pStats, 0, sizeof(*pStats));
+	if (!(flags & SCAN_REMOVE_UNREFERENCED)) {
+		return doScan(pStats, flags);
+	}
+
+	// NOTE: Locking the store creates the store directory,
+	// so make sure it exists first.
+	const int64_t ret = getFileSize(m_dir);
+	if (ret < 0) {
+		return static_cast<int>(ret);
+	}
+	const Lock lock(*this, true, false);
+	if (lock.error() != 0) {
+		return lock.error();
+	}
+	return doScan(pStats, flags);
+}
+
+/**
+ * Scan the store. (internal function)
+ * The store must be locked if SCAN_REMOVE_UNREFERENCED is set.
+ * @param pStats	[out] Statistics. (must be zeroed)
+ * @param flags		[in] Flags. (See ScanFlags.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ChunkStore::doScan(Stats *pStats, unsigned int flags)
+{
+	const bool removeUnreferenced = !!(flags & SCAN_REMOVE_UNREFERENCED);
+
+	// Load the manifests.
+	// Digests are stored as binary strings.
+	unordered_set<string> referenced;
+	int err = 0;
+	int ret = listDir(m_dir, [this, pStats, &referenced, &err](const TCHAR *name, bool isDir) {
+		if (isDir || err != 0)
+			return;
+
+		const tstring filename = m_dir + _T('/') + name;
+		RefFile *const file = new RefFile(filename.c_str());
+		if (!file->isOpen()) {
+			file->unref();
+			return;
+		}
+
+		uint8_t sbuf[sizeof(store_manifest_header_t)];
+		if (file->preadAt(0, sbuf, sizeof(sbuf)) == sizeof(sbuf) &&
+		    StoreManifest::isManifest(sbuf, sizeof(sbuf)))
+		{
+			StoreManifest manifest;
+			const int ret = manifest.load(file);
+			if (ret != 0) {
+				// Don't delete any chunks if a manifest can't be loaded,
+				// since they might be referenced by that manifest.
+				err = ret;
+			} else {
+				pStats->manifests++;
+				pStats->image_bytes += LBA_TO_BYTES((uint64_t)manifest.lba_len());
+				for (uint32_t i = 0; i < manifest.chunkCount(); i++) {
+					if (!manifest.isEmpty(i)) {
+						referenced.emplace(reinterpret_cast<const char*>(manifest.digest(i)),
+							StoreManifest::DIGEST_SIZE);
+					}
+				}
+			}
+		}
+		file->unref();
+	});
+	if (ret != 0) {
+		return ret;
+	} else if (err != 0) {
+		return err;
+	}
+
+	// Check the stored chunks.
+	// Temporary files and other unrecognized files are ignored.
+	uint64_t found = 0;
+	const tstring chunkDir = m_chunkDir.substr(0, m_chunkDir.size() - 1);
+	ret = listDir(chunkDir, [this, pStats, &referenced, &found, &err, flags, removeUnreferenced](const TCHAR *subdir, bool isDir) {
+		uint8_t digest[StoreManifest::DIGEST_SIZE];
+		if (!isDir || !fromHex(digest, 1, subdir))
+			return;
+
+		const tstring dir = m_chunkDir + subdir;
+		int ret = listDir(dir, [&](const TCHAR *name, bool isDir) {
+			if (isDir || !fromHex(digest + 1, sizeof(digest) - 1, name))
+				return;
+
+			const tstring filename = dir + _T('/') + name;
+			const int64_t size = getFileSize(filename);
+			if (size < 0)
+				return;
+			pStats->chunks++;
+			pStats->chunk_bytes += size;
+
+			if (flags & SCAN_VERIFY) {
+				uint8_t check[StoreManifest::DIGEST_SIZE];
+				if (hashChunkFile(filename, check) != size ||
+				    memcmp(check, digest, sizeof(check)) != 0)
+				{
+					// Chunk is corrupt.
+					pStats->corrupt++;
+				}
+			}
+
+			if (referenced.count(string(reinterpret_cast<const char*>(digest), sizeof(digest))) != 0) {
+				found++;
+				return;
+			}
+
+			pStats->unreferenced++;
+			pStats->unreferenced_bytes += size;
+			if (removeUnreferenced && _tremove(filename.c_str()) != 0 && err == 0) {
+				err = (errno != 0 ? -errno : -EIO);
+			}
+		});
+		if (ret != 0 && err == 0) {
+			err = ret;
+		}
+	});
+	if (ret != 0 && ret != -ENOENT) {
+		// NOTE: The chunk directory doesn't exist if
+		// nothing has been stored yet.
+		return ret;
+	}
+
+	pStats->missing = referenced.size() - found;
+	return err;
+}
+
+/** ChunkStore::Lock **/
+
+/**
+ * Lock a chunk store.
+ * The store directory is created if it doesn't exist.
+ * @param store		[in] Chunk store.
+ * @param exclusive	[in] If true, lock exclusively; otherwise, use a shared lock.
+ * @param wait		[in] If true, wait for the lock; otherwise, fail with -EBUSY.
+ */
+ChunkStore::Lock::Lock(const ChunkStore &store, bool exclusive, bool wait)
+	: m_fd(-1)
+	, m_err(0)
+{
+	m_err = mkdirIfMissing(store.m_dir);
+	if (m_err != 0) {
+		return;
+	}
+
+	const tstring filename = store.m_dir + _T("/.lock");
+#ifdef _WIN32
+	m_fd = _topen(filename.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+	if (m_fd < 0) {
+		m_err = -errno;
+		return;
+	}
+
+	OVERLAPPED ov;
+	memset(&ov, 0, sizeof(ov));
+	const DWORD dwFlags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) |
+			      (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+	if (!LockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(m_fd)), dwFlags, 0, 1, 0, &ov)) {
+		m_err = (GetLastError() == ERROR_LOCK_VIOLATION ? -EBUSY : -EIO);
+		_close(m_fd);
+		m_fd = -1;
+	}
+#else /* !_WIN32 */
+	do {
+		m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	} while (m_fd < 0 && errno == EINTR);
+	if (m_fd < 0) {
+		m_err = -errno;
+		return;
+	}
+
+	const int op = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+	int ret;
+	do {
+		ret = flock(m_fd, op);
+	} while (ret != 0 && errno == EINTR);
+	if (ret != 0) {
+		m_err = (errno == EWOULDBLOCK ? -EBUSY : -errno);
+		close(m_fd);
+		m_fd = -1;
+	}
+#endif /* _WIN32 */
+}
+
+ChunkStore::Lock::~Lock()
+{
+	if (m_fd < 0)
+		return;
+
+#ifdef _WIN32
+	OVERLAPPED ov;
+	memset(&ov, 0, sizeof(ov));
+	UnlockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(m_fd)), 0, 1, 0, &ov);
+	_close(m_fd);
+#else /* !_WIN32 */
+	// Closing the lock file releases the lock.
+	close(m_fd);
+#endif /* _WIN32 */
+}
@@ -0,0 +1,342 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ChunkStore.hpp: Content-addressed chunk store for disc images.          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_CHUNKSTORE_HPP__
+#define __RVTHTOOL_LIBRVTH_CHUNKSTORE_HPP__
+
+#include "libwiicrypto/common.h"
+#include "tcharx.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class RefFile;
+
+/**
+ * Chunk store manifest. (See store_manifest.h.)
+ *
+ * Chunk 0 starts at LBA 0 and is firstLbaLen() LBAs long.
+ * The remaining chunks are chunkLbaLen() LBAs long, except
+ * for the last chunk, which ends at the end of the disc image.
+ */
+class StoreManifest
+{
+	public:
+		StoreManifest();
+
+	public:
+		/**
+		 * Size of each digest, in bytes. (SHA-1)
+		 */
+		static const unsigned int DIGEST_SIZE = 20;
+
+		/**
+		 * Initialize an empty manifest for a new disc image.
+		 * All digests are set to zero.
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 * @param chunk_size	[in] Chunk size, in bytes. (multiple of LBA_SIZE)
+		 * @param first_lba_len	[in] Length of the first chunk, in LBAs. (1 to chunk size)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int init(uint32_t lba_len, unsigned int chunk_size, uint32_t first_lba_len);
+
+		/**
+		 * Load a manifest from a file.
+		 * @param file	[in] Manifest file.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int load(RefFile *file);
+
+		/**
+		 * Save the manifest.
+		 * The manifest is written to a temporary file, which is
+		 * then renamed, so the manifest is never partially written.
+		 * @param filename	[in] Manifest filename.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(const TCHAR *filename) const;
+
+		/**
+		 * Is a given file a chunk store manifest?
+		 * @param sbuf	[in] Start of the file.
+		 * @param size	[in] Size of sbuf.
+		 * @return True if this is a manifest; false if not.
+		 */
+		static bool isManifest(const uint8_t *sbuf, size_t size);
+
+	public:
+		/** Accessors **/
+
+		inline uint32_t lba_len(void) const { return m_lba_len; }
+		inline uint32_t chunkLbaLen(void) const { return m_chunkLbaLen; }
+		inline uint32_t firstLbaLen(void) const { return m_firstLbaLen; }
+		inline uint32_t chunkCount(void) const { return m_chunkCount; }
+
+		/**
+		 * Get the chunk containing an LBA.
+		 * @param lba LBA. (must be less than lba_len())
+		 * @return Chunk index.
+		 */
+		inline uint32_t chunkAt(uint32_t lba) const
+		{
+			return (lba < m_firstLbaLen ? 0 : 1 + ((lba - m_firstLbaLen) / m_chunkLbaLen));
+		}
+
+		/**
+		 * Get the first LBA of a chunk.
+		 * @param idx Chunk index.
+		 * @return First LBA of the chunk.
+		 */
+		inline uint32_t chunkStart(uint32_t idx) const
+		{
+			return (idx == 0 ? 0 : m_firstLbaLen + ((idx - 1) * m_chunkLbaLen));
+		}
+
+		/**
+		 * Get the length of a chunk, in LBAs.
+		 * @param idx Chunk index.
+		 * @return Length of the chunk, in LBAs.
+		 */
+		inline uint32_t chunkLen(uint32_t idx) const
+		{
+			const uint32_t start = chunkStart(idx);
+			const uint32_t len = (idx == 0 ? m_firstLbaLen : m_chunkLbaLen);
+			return (len < m_lba_len - start ? len : m_lba_len - start);
+		}
+
+		/**
+		 * Get a chunk's digest.
+		 * @param idx Chunk index.
+		 * @return Digest. (DIGEST_SIZE bytes; all zeroes if the chunk is empty)
+		 */
+		inline const uint8_t *digest(uint32_t idx) const
+		{
+			return &m_digests[(size_t)idx * DIGEST_SIZE];
+		}
+
+		inline uint8_t *digest(uint32_t idx)
+		{
+			return &m_digests[(size_t)idx * DIGEST_SIZE];
+		}
+
+		/**
+		 * Is a chunk empty, i.e. all zeroes?
+		 * @param idx Chunk index.
+		 * @return True if the chunk is empty.
+		 */
+		bool isEmpty(uint32_t idx) const;
+
+	private:
+		uint32_t m_lba_len;		// Length of the disc image, in LBAs
+		uint32_t m_chunkLbaLen;		// Chunk size, in LBAs
+		uint32_t m_firstLbaLen;		// Length of the first chunk, in LBAs
+		uint32_t m_chunkCount;		// Number of chunks
+		std::vector<uint8_t> m_digests;	// Chunk digests
+};
+
+/**
+ * Content-addressed chunk store.
+ *
+ * Disc images are stored as a manifest plus a set of chunks.
+ * Chunks are named after their SHA-1 digests, so a chunk that's
+ * used by more than one disc image, e.g. consecutive builds of
+ * the same title, is only stored once.
+ *
+ * The store is the directory containing the manifests:
+ * - STORE/NAME.rvts: Manifest for each disc image.
+ * - STORE/chunks/xx/yyyy...: Chunk with digest xxyyyy...
+ *
+ * Chunks are written to a temporary file, which is then renamed,
+ * so multiple threads and processes can add chunks at the same time.
+ * New chunks are synced to disk all at once by sync(), which must be
+ * called before saving a manifest that references them.
+ *
+ * Disc images are added while holding a shared Lock. scan() takes an
+ * exclusive Lock before deleting chunks, so chunks that were stored
+ * for a disc image whose manifest hasn't been saved yet aren't deleted.
+ *
+ * Thread-safety: All functions are thread-safe.
+ */
+class ChunkStore
+{
+	public:
+		/**
+		 * Open a chunk store.
+		 * The directory doesn't need to exist yet.
+		 * @param dir Store directory.
+		 */
+		explicit ChunkStore(const TCHAR *dir);
+
+	private:
+		DISABLE_COPY(ChunkStore)
+
+	public:
+		/**
+		 * Get the store directory for a manifest.
+		 * @param manifest_filename Manifest filename.
+		 * @return Store directory.
+		 */
+		static std::tstring dirForManifest(const TCHAR *manifest_filename);
+
+		/**
+		 * Calculate the digest of a chunk.
+		 * @param digest	[out] Digest. (StoreManifest::DIGEST_SIZE bytes)
+		 * @param data		[in] Chunk data.
+		 * @param size		[in] Size of the chunk, in bytes.
+		 */
+		static void hash(uint8_t *digest, const uint8_t *data, size_t size);
+
+		/**
+		 * Get the filename of a chunk.
+		 * @param digest Digest.
+		 * @return Chunk filename.
+		 */
+		std::tstring chunkFilename(const uint8_t *digest) const;
+
+		/**
+		 * Add a chunk to the store if it isn't already there.
+		 * A stored chunk with the right size is assumed to be valid.
+		 * If it has the wrong size, e.g. after a crash, it's replaced.
+		 * @param digest	[in] Digest.
+		 * @param data		[in] Chunk data.
+		 * @param size		[in] Size of the chunk, in bytes.
+		 * @param pAdded	[out,opt] Set to true if the chunk was added; false if it was already stored.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int put(const uint8_t *digest, const uint8_t *data, size_t size, bool *pAdded = nullptr);
+
+		/**
+		 * Write the chunks that were added by put() to the disk,
+		 * along with the directories they were added to.
+		 * This must be done before saving a manifest that
+		 * references the new chunks.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int sync(void);
+
+		/**
+		 * Read part of a chunk.
+		 * If the entire chunk is read, its digest is verified.
+		 * @param digest	[in] Digest.
+		 * @param offset	[in] Offset in the chunk, in bytes.
+		 * @param buf		[out] Output buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @return 0 on success; -EIO if the chunk is corrupt;
+		 *         other negative POSIX error code on error.
+		 */
+		int get(const uint8_t *digest, size_t offset, uint8_t *buf, size_t size) const;
+
+	public:
+		/**
+		 * Store statistics.
+		 */
+		struct Stats {
+			unsigned int manifests;		// Number of manifests
+			uint64_t image_bytes;		// Total size of all disc images
+			uint64_t chunks;		// Number of stored chunks
+			uint64_t chunk_bytes;		// Total size of all stored chunks
+			uint64_t missing;		// Referenced chunks that aren't stored
+			uint64_t unreferenced;		// Stored chunks that aren't referenced
+			uint64_t unreferenced_bytes;	// Total size of unreferenced chunks
+			uint64_t corrupt;		// Stored chunks that don't match their digests (SCAN_VERIFY)
+		};
+
+		/**
+		 * scan() flags.
+		 */
+		enum ScanFlags {
+			// Delete chunks that aren't referenced by any manifest.
+			SCAN_REMOVE_UNREFERENCED	= (1U << 0),
+			// Read all stored chunks and check their digests.
+			SCAN_VERIFY			= (1U << 1),
+		};
+
+		/**
+		 * Scan the store.
+		 * All manifests in the store directory are loaded,
+		 * and the referenced chunks are compared to the
+		 * stored chunks.
+		 *
+		 * If SCAN_REMOVE_UNREFERENCED is set, chunks that aren't
+		 * referenced by any manifest are deleted. The statistics
+		 * describe the store from before they were deleted.
+		 * The store is locked exclusively while scanning, so this
+		 * fails with -EBUSY if disc images are being added.
+		 *
+		 * @param pStats	[out] Statistics.
+		 * @param flags		[in] Flags. (See ScanFlags.)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int scan(Stats *pStats, unsigned int flags);
+
+	public:
+		/**
+		 * Chunk store lock. (STORE/.lock)
+		 * The lock is released when this object is deleted.
+		 */
+		class Lock
+		{
+			public:
+				/**
+				 * Lock a chunk store.
+				 * The store directory is created if it doesn't exist.
+				 * @param store		[in] Chunk store.
+				 * @param exclusive	[in] If true, lock exclusively; otherwise, use a shared lock.
+				 * @param wait		[in] If true, wait for the lock; otherwise, fail with -EBUSY.
+				 */
+				Lock(const ChunkStore &store, bool exclusive, bool wait);
+				~Lock();
+
+			private:
+				DISABLE_COPY(Lock)
+
+			public:
+				/**
+				 * Was the store locked?
+				 * @return 0 if locked; negative POSIX error code on error.
+				 */
+				inline int error(void) const { return m_err; }
+
+			private:
+				int m_fd;	// Lock file
+				int m_err;	// Error code
+		};
+
+		/**
+		 * Get the store directory.
+		 * @return Store directory.
+		 */
+		inline const std::tstring &dir(void) const { return m_dir; }
+
+	private:
+		/**
+		 * Scan the store. (internal function)
+		 * The store must be locked if SCAN_REMOVE_UNREFERENCED is set.
+		 * @param pStats	[out] Statistics. (must be zeroed)
+		 * @param flags		[in] Flags. (See ScanFlags.)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int doScan(Stats *pStats, unsigned int flags);
+
+	private:
+		std::tstring m_dir;		// Store directory
+		std::tstring m_chunkDir;	// Chunk directory, with a trailing separator
+
+		// Chunks and directories that haven't been synced yet.
+		std::mutex m_syncMutex;
+		std::vector<std::tstring> m_unsyncedChunks;
+		std::unordered_set<std::tstring> m_unsyncedDirs;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_CHUNKSTORE_HPP__ */
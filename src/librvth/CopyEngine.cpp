@@ -0,0 +1,206 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CopyEngine.cpp: Double-buffered asynchronous copy engine.               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "CopyEngine.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Buffers are aligned for O_DIRECT.
+#include "aligned_malloc.h"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+
+// C++ includes.
+#include <thread>
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+/**
+ * Create a copy engine.
+ * @param bufCount	[in] Number of chunk buffers in the ring. (minimum 2)
+ * @param chunkLBAs	[in] Size of each chunk, in LBAs.
+ */
+CopyEngine::CopyEngine(unsigned int bufCount, uint32_t chunkLBAs)
+	: m_chunkLBAs(chunkLBAs)
+	, m_lba_start(0)
+	, m_lba_end(0)
+	, m_readFn(nullptr)
+	, m_abort(false)
+	, m_err(0)
+{
+	assert(chunkLBAs != 0);
+	if (m_chunkLBAs == 0) {
+		m_chunkLBAs = 1;
+	}
+
+	// At least two buffers are needed to read and write at the same time.
+	if (bufCount < 2) {
+		bufCount = 2;
+	}
+
+	m_slots.resize(bufCount);
+	for (Slot &slot : m_slots) {
+		slot.buf = static_cast<uint8_t*>(aligned_malloc(RVTH_IO_DIRECT_ALIGNMENT, LBA_TO_BYTES(m_chunkLBAs)));
+		slot.lba = 0;
+		slot.count = 0;
+		slot.hole = false;
+		slot.state = SLOT_FREE;
+		if (!slot.buf) {
+			// Error allocating memory.
+			for (Slot &slot2 : m_slots) {
+				aligned_free(slot2.buf);
+			}
+			m_slots.clear();
+			errno = ENOMEM;
+			break;
+		}
+	}
+}
+
+CopyEngine::~CopyEngine()
+{
+	for (Slot &slot : m_slots) {
+		aligned_free(slot.buf);
+	}
+}
+
+/**
+ * Set the error code and abort the copy.
+ * NOTE: m_mutex must be locked by the caller.
+ * @param err Error code.
+ */
+void CopyEngine::setError_locked(int err)
+{
+	if (m_err == 0) {
+		m_err = err;
+	}
+	m_abort = true;
+	m_condReader.notify_all();
+	m_condWriter.notify_all();
+}
+
+/**
+ * Reader thread function.
+ */
+void CopyEngine::readerThread(void)
+{
+	const unsigned int slotCount = static_cast<unsigned int>(m_slots.size());
+	unsigned int idx = 0;
+	for (uint32_t lba = m_lba_start; lba < m_lba_end; lba += m_chunkLBAs, idx++) {
+		// Chunks are assigned to slots round-robin. The writer
+		// frees slots in order, so this slot will be the next
+		// one to become available.
+		Slot *const slot = &m_slots[idx % slotCount];
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_condReader.wait(lock, [this, slot]() {
+				return m_abort || slot->state == SLOT_FREE;
+			});
+			if (m_abort)
+				break;
+		}
+
+		uint32_t count = m_lba_end - lba;
+		if (count > m_chunkLBAs) {
+			count = m_chunkLBAs;
+		}
+		const int ret = (*m_readFn)(lba, count, slot->buf);
+
+		unique_lock<mutex> lock(m_mutex);
+		if (ret < 0) {
+			setError_locked(ret);
+			break;
+		}
+		slot->lba = lba;
+		slot->count = count;
+		slot->hole = (ret == READ_HOLE);
+		slot->state = SLOT_READ;
+		m_condWriter.notify_one();
+	}
+}
+
+/**
+ * Copy a range of LBAs.
+ * The last chunk may be smaller than the chunk size.
+ * @param lba_start	[in] First LBA to copy.
+ * @param lba_end	[in] LBA after the last LBA to copy.
+ * @param readFn	[in] Reader stage function.
+ * @param writeFn	[in] Writer stage function.
+ * @param progressFn	[in,opt] Progress function.
+ * @return 0 on success; -ECANCELED if cancelled;
+ *         otherwise, the first error code returned by a stage function.
+ */
+int CopyEngine::run(uint32_t lba_start, uint32_t lba_end,
+	const ReadFn &readFn, const WriteFn &writeFn,
+	const ProgressFn &progressFn)
+{
+	assert(isValid());
+	if (!isValid()) {
+		return -ENOMEM;
+	}
+	if (lba_start >= lba_end) {
+		// Nothing to copy.
+		return 0;
+	}
+
+	// Reset the engine state.
+	m_lba_start = lba_start;
+	m_lba_end = lba_end;
+	m_readFn = &readFn;
+	for (Slot &slot : m_slots) {
+		slot.state = SLOT_FREE;
+	}
+	m_abort = false;
+	m_err = 0;
+
+	// Start the reader thread.
+	thread tReader(&CopyEngine::readerThread, this);
+
+	// Writer stage: Write chunks in order.
+	const unsigned int slotCount = static_cast<unsigned int>(m_slots.size());
+	unsigned int idx = 0;
+	for (uint32_t lba = lba_start; lba < lba_end; lba += m_chunkLBAs, idx++) {
+		if (progressFn && !progressFn(lba)) {
+			// Stop processing.
+			unique_lock<mutex> lock(m_mutex);
+			setError_locked(-ECANCELED);
+			break;
+		}
+
+		Slot *const slot = &m_slots[idx % slotCount];
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_condWriter.wait(lock, [this, slot, lba]() {
+				return m_abort || (slot->state == SLOT_READ && slot->lba == lba);
+			});
+			if (m_abort)
+				break;
+		}
+
+		const int ret = writeFn(slot->lba, slot->count, (slot->hole ? nullptr : slot->buf));
+
+		unique_lock<mutex> lock(m_mutex);
+		if (ret < 0) {
+			setError_locked(ret);
+			break;
+		}
+		slot->state = SLOT_FREE;
+		m_condReader.notify_one();
+	}
+
+	// Wait for the reader thread to finish.
+	tReader.join();
+
+	m_readFn = nullptr;
+	return m_err;
+}
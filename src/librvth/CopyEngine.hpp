@@ -0,0 +1,157 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CopyEngine.hpp: Double-buffered asynchronous copy engine.               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_COPYENGINE_HPP__
+#define __RVTHTOOL_LIBRVTH_COPYENGINE_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * Asynchronous copy engine for sequential LBA ranges.
+ *
+ * A reader thread reads chunks into a ring of buffers while the writer
+ * writes previously-read chunks, so the source and destination devices
+ * are busy at the same time. This matters when importing to an RVT-H
+ * Reader, where the USB link would otherwise be idle during every read.
+ *
+ * The writer stage runs on the thread that called run(), so progress
+ * callbacks are still called on the caller's thread.
+ */
+class CopyEngine
+{
+	public:
+		/**
+		 * Create a copy engine.
+		 * @param bufCount	[in] Number of chunk buffers in the ring. (minimum 2)
+		 * @param chunkLBAs	[in] Size of each chunk, in LBAs.
+		 */
+		CopyEngine(unsigned int bufCount, uint32_t chunkLBAs);
+		~CopyEngine();
+
+	private:
+		DISABLE_COPY(CopyEngine)
+
+	public:
+		/**
+		 * Return value for ReadFn if the chunk is known to be all zeroes.
+		 * The buffer isn't filled in, and WriteFn gets a NULL buffer.
+		 */
+		static const int READ_HOLE = 1;
+
+		/**
+		 * Reader stage function. Runs on the reader thread.
+		 * @param lba	[in] Starting LBA of the chunk.
+		 * @param count	[in] Number of LBAs in the chunk.
+		 * @param buf	[out] Chunk buffer.
+		 * @return 0 on success; READ_HOLE if the chunk is a hole; negative POSIX error code to abort.
+		 */
+		typedef std::function<int(uint32_t lba, uint32_t count, uint8_t *buf)> ReadFn;
+
+		/**
+		 * Writer stage function. Runs on the thread that called run().
+		 * Chunks are always passed to this function in order.
+		 * @param lba	[in] Starting LBA of the chunk.
+		 * @param count	[in] Number of LBAs in the chunk.
+		 * @param buf	[in] Chunk buffer. (NULL if the chunk is a hole)
+		 * @return 0 on success; negative POSIX error code to abort.
+		 */
+		typedef std::function<int(uint32_t lba, uint32_t count, const uint8_t *buf)> WriteFn;
+
+		/**
+		 * Progress function. Runs on the thread that called run(),
+		 * before each chunk is written.
+		 * @param lba	[in] Starting LBA of the chunk.
+		 * @return True to continue; false to cancel.
+		 */
+		typedef std::function<bool(uint32_t lba)> ProgressFn;
+
+		/**
+		 * Copy a range of LBAs.
+		 * The last chunk may be smaller than the chunk size.
+		 * @param lba_start	[in] First LBA to copy.
+		 * @param lba_end	[in] LBA after the last LBA to copy.
+		 * @param readFn	[in] Reader stage function.
+		 * @param writeFn	[in] Writer stage function.
+		 * @param progressFn	[in,opt] Progress function.
+		 * @return 0 on success; -ECANCELED if cancelled;
+		 *         otherwise, the first error code returned by a stage function.
+		 */
+		int run(uint32_t lba_start, uint32_t lba_end,
+			const ReadFn &readFn, const WriteFn &writeFn,
+			const ProgressFn &progressFn = nullptr);
+
+		/**
+		 * Get the chunk size.
+		 * @return Chunk size, in LBAs.
+		 */
+		inline uint32_t chunkLBAs(void) const
+		{
+			return m_chunkLBAs;
+		}
+
+		/**
+		 * Check if the copy engine was allocated successfully.
+		 * @return True if the buffers were allocated; false if not.
+		 */
+		inline bool isValid(void) const
+		{
+			return !m_slots.empty();
+		}
+
+	private:
+		enum SlotState {
+			SLOT_FREE,	// Available for the reader
+			SLOT_READ,	// Read; waiting for the writer
+		};
+
+		struct Slot {
+			uint8_t *buf;
+			uint32_t lba;
+			uint32_t count;
+			bool hole;
+			SlotState state;
+		};
+
+		/**
+		 * Set the error code and abort the copy.
+		 * NOTE: m_mutex must be locked by the caller.
+		 * @param err Error code.
+		 */
+		void setError_locked(int err);
+
+		/**
+		 * Reader thread function.
+		 */
+		void readerThread(void);
+
+	private:
+		uint32_t m_chunkLBAs;
+		std::vector<Slot> m_slots;
+
+		// Current run.
+		uint32_t m_lba_start;
+		uint32_t m_lba_end;
+		const ReadFn *m_readFn;
+
+		std::mutex m_mutex;
+		std::condition_variable m_condReader;	// Slot freed by the writer
+		std::condition_variable m_condWriter;	// Slot read by the reader
+		bool m_abort;
+		int m_err;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_COPYENGINE_HPP__ */
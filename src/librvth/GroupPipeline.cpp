@@ -0,0 +1,234 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * GroupPipeline.cpp: Multi-threaded group processing pipeline.            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "GroupPipeline.hpp"
+
+// Buffers are aligned for O_DIRECT.
+#include "aligned_malloc.h"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+
+// C++ includes.
+#include <thread>
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+/**
+ * Create a group processing pipeline.
+ * @param workerCount	[in] Number of worker threads. (0 for the number of CPUs)
+ * @param inSize	[in] Size of each input buffer, in bytes.
+ * @param outSize	[in] Size of each output buffer, in bytes. (may be 0)
+ */
+GroupPipeline::GroupPipeline(unsigned int workerCount, size_t inSize, size_t outSize)
+	: m_workerCount(workerCount)
+	, m_inSize(inSize)
+	, m_outSize(outSize)
+	, m_groupCount(0)
+	, m_readFn(nullptr)
+	, m_workFn(nullptr)
+	, m_readerDone(false)
+	, m_abort(false)
+	, m_err(0)
+{
+	if (m_workerCount == 0) {
+		m_workerCount = thread::hardware_concurrency();
+		if (m_workerCount == 0) {
+			// Unable to determine the number of CPUs.
+			m_workerCount = 1;
+		}
+	}
+
+	// Allocate enough slots to keep every worker busy
+	// while the reader and writer are working on other groups.
+	const unsigned int slotCount = m_workerCount + 4;
+	m_slots.resize(slotCount);
+	for (Slot &slot : m_slots) {
+		slot.inBuf = static_cast<uint8_t*>(aligned_malloc(RVTH_IO_DIRECT_ALIGNMENT, inSize));
+		slot.outBuf = (outSize != 0 ? static_cast<uint8_t*>(aligned_malloc(RVTH_IO_DIRECT_ALIGNMENT, outSize)) : nullptr);
+		slot.idx = 0;
+		slot.state = SLOT_FREE;
+		if (!slot.inBuf || (outSize != 0 && !slot.outBuf)) {
+			// Error allocating memory.
+			for (Slot &slot2 : m_slots) {
+				aligned_free(slot2.inBuf);
+				aligned_free(slot2.outBuf);
+			}
+			m_slots.clear();
+			errno = ENOMEM;
+			break;
+		}
+	}
+}
+
+GroupPipeline::~GroupPipeline()
+{
+	for (Slot &slot : m_slots) {
+		aligned_free(slot.inBuf);
+		aligned_free(slot.outBuf);
+	}
+}
+
+/**
+ * Set the error code and abort the pipeline.
+ * NOTE: m_mutex must be locked by the caller.
+ * @param err Error code.
+ */
+void GroupPipeline::setError_locked(int err)
+{
+	if (m_err == 0) {
+		m_err = err;
+	}
+	m_abort = true;
+	m_condReader.notify_all();
+	m_condWorker.notify_all();
+	m_condWriter.notify_all();
+}
+
+/**
+ * Reader thread function.
+ */
+void GroupPipeline::readerThread(void)
+{
+	const unsigned int slotCount = static_cast<unsigned int>(m_slots.size());
+	for (unsigned int idx = 0; idx < m_groupCount; idx++) {
+		// Groups are assigned to slots round-robin. The writer
+		// frees slots in order, so this slot will be the next
+		// one to become available.
+		Slot *const slot = &m_slots[idx % slotCount];
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_condReader.wait(lock, [this, slot]() {
+				return m_abort || slot->state == SLOT_FREE;
+			});
+			if (m_abort)
+				break;
+		}
+
+		const int ret = (*m_readFn)(idx, slot->inBuf);
+
+		unique_lock<mutex> lock(m_mutex);
+		if (ret != 0) {
+			setError_locked(ret);
+			break;
+		}
+		slot->idx = idx;
+		slot->state = SLOT_READ;
+		m_workQueue.push_back(slot);
+		m_condWorker.notify_one();
+	}
+
+	unique_lock<mutex> lock(m_mutex);
+	m_readerDone = true;
+	m_condWorker.notify_all();
+}
+
+/**
+ * Worker thread function.
+ * @param workerIdx Worker index.
+ */
+void GroupPipeline::workerThread(unsigned int workerIdx)
+{
+	for (;;) {
+		Slot *slot;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_condWorker.wait(lock, [this]() {
+				return m_abort || !m_workQueue.empty() || m_readerDone;
+			});
+			if (m_abort || m_workQueue.empty())
+				break;
+			slot = m_workQueue.front();
+			m_workQueue.pop_front();
+		}
+
+		const int ret = (*m_workFn)(workerIdx, slot->idx, slot->inBuf, slot->outBuf);
+
+		unique_lock<mutex> lock(m_mutex);
+		if (ret != 0) {
+			setError_locked(ret);
+			break;
+		}
+		slot->state = SLOT_DONE;
+		m_condWriter.notify_one();
+	}
+}
+
+/**
+ * Run the pipeline.
+ * @param groupCount	[in] Number of groups to process.
+ * @param readFn	[in] Reader stage function.
+ * @param workFn	[in] Worker stage function.
+ * @param writeFn	[in] Writer stage function.
+ * @return 0 on success; otherwise, the first error code returned by a stage function.
+ */
+int GroupPipeline::run(unsigned int groupCount, const ReadFn &readFn, const WorkFn &workFn, const WriteFn &writeFn)
+{
+	assert(isValid());
+	if (!isValid()) {
+		return -ENOMEM;
+	}
+
+	// Reset the pipeline state.
+	m_groupCount = groupCount;
+	m_readFn = &readFn;
+	m_workFn = &workFn;
+	for (Slot &slot : m_slots) {
+		slot.state = SLOT_FREE;
+	}
+	m_workQueue.clear();
+	m_readerDone = false;
+	m_abort = false;
+	m_err = 0;
+
+	// Start the reader and worker threads.
+	thread tReader(&GroupPipeline::readerThread, this);
+	vector<thread> tWorkers;
+	tWorkers.reserve(m_workerCount);
+	for (unsigned int i = 0; i < m_workerCount; i++) {
+		tWorkers.push_back(thread(&GroupPipeline::workerThread, this, i));
+	}
+
+	// Writer stage: Process groups in order.
+	const unsigned int slotCount = static_cast<unsigned int>(m_slots.size());
+	for (unsigned int idx = 0; idx < groupCount; idx++) {
+		Slot *const slot = &m_slots[idx % slotCount];
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_condWriter.wait(lock, [this, slot, idx]() {
+				return m_abort || (slot->state == SLOT_DONE && slot->idx == idx);
+			});
+			if (m_abort)
+				break;
+		}
+
+		const int ret = writeFn(idx, slot->inBuf, slot->outBuf);
+
+		unique_lock<mutex> lock(m_mutex);
+		if (ret != 0) {
+			setError_locked(ret);
+			break;
+		}
+		slot->state = SLOT_FREE;
+		m_condReader.notify_one();
+	}
+
+	// Wait for all threads to finish.
+	tReader.join();
+	for (thread &tWorker : tWorkers) {
+		tWorker.join();
+	}
+
+	m_readFn = nullptr;
+	m_workFn = nullptr;
+	return m_err;
+}
@@ -0,0 +1,163 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * GroupPipeline.hpp: Multi-threaded group processing pipeline.            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_GROUPPIPELINE_HPP__
+#define __RVTHTOOL_LIBRVTH_GROUPPIPELINE_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * Multi-threaded pipeline for processing independent groups of data,
+ * e.g. 2 MB Wii partition groups.
+ *
+ * The pipeline has three stages:
+ * - Reader: A single thread reads groups in order into input buffers.
+ * - Workers: N threads process groups from the input buffers into the
+ *   output buffers. Groups may be processed out of order.
+ * - Writer: The thread that called run() receives the processed groups
+ *   in order. This stage can also report progress and cancel the run.
+ *
+ * Each group is owned by exactly one stage at a time, so the stage
+ * functions don't need to do any locking on the buffers.
+ */
+class GroupPipeline
+{
+	public:
+		/**
+		 * Create a group processing pipeline.
+		 * @param workerCount	[in] Number of worker threads. (0 for the number of CPUs)
+		 * @param inSize	[in] Size of each input buffer, in bytes.
+		 * @param outSize	[in] Size of each output buffer, in bytes. (may be 0)
+		 */
+		GroupPipeline(unsigned int workerCount, size_t inSize, size_t outSize);
+		~GroupPipeline();
+
+	private:
+		DISABLE_COPY(GroupPipeline)
+
+	public:
+		/**
+		 * Reader stage function. Runs on the reader thread.
+		 * @param idx	[in] Group index.
+		 * @param inBuf	[out] Input buffer.
+		 * @return 0 on success; non-zero error code to abort.
+		 */
+		typedef std::function<int(unsigned int idx, uint8_t *inBuf)> ReadFn;
+
+		/**
+		 * Worker stage function. Runs on a worker thread.
+		 * @param workerIdx	[in] Worker index, for per-worker contexts. [0, workerCount())
+		 * @param idx		[in] Group index.
+		 * @param inBuf		[in,out] Input buffer.
+		 * @param outBuf	[out] Output buffer. (NULL if outSize == 0)
+		 * @return 0 on success; non-zero error code to abort.
+		 */
+		typedef std::function<int(unsigned int workerIdx, unsigned int idx, uint8_t *inBuf, uint8_t *outBuf)> WorkFn;
+
+		/**
+		 * Writer stage function. Runs on the thread that called run().
+		 * Groups are always passed to this function in order.
+		 * @param idx		[in] Group index.
+		 * @param inBuf		[in] Input buffer.
+		 * @param outBuf	[in] Output buffer. (NULL if outSize == 0)
+		 * @return 0 on success; non-zero error code to abort.
+		 */
+		typedef std::function<int(unsigned int idx, const uint8_t *inBuf, const uint8_t *outBuf)> WriteFn;
+
+		/**
+		 * Run the pipeline.
+		 * @param groupCount	[in] Number of groups to process.
+		 * @param readFn	[in] Reader stage function.
+		 * @param workFn	[in] Worker stage function.
+		 * @param writeFn	[in] Writer stage function.
+		 * @return 0 on success; otherwise, the first error code returned by a stage function.
+		 */
+		int run(unsigned int groupCount, const ReadFn &readFn, const WorkFn &workFn, const WriteFn &writeFn);
+
+		/**
+		 * Get the number of worker threads.
+		 * @return Number of worker threads.
+		 */
+		inline unsigned int workerCount(void) const
+		{
+			return m_workerCount;
+		}
+
+		/**
+		 * Check if the pipeline was allocated successfully.
+		 * @return True if the buffers were allocated; false if not.
+		 */
+		inline bool isValid(void) const
+		{
+			return !m_slots.empty();
+		}
+
+	private:
+		enum SlotState {
+			SLOT_FREE,	// Available for the reader
+			SLOT_READ,	// Read; waiting for a worker
+			SLOT_DONE,	// Processed; waiting for the writer
+		};
+
+		struct Slot {
+			uint8_t *inBuf;
+			uint8_t *outBuf;
+			unsigned int idx;
+			SlotState state;
+		};
+
+		/**
+		 * Set the error code and abort the pipeline.
+		 * NOTE: m_mutex must be locked by the caller.
+		 * @param err Error code.
+		 */
+		void setError_locked(int err);
+
+		/**
+		 * Reader thread function.
+		 */
+		void readerThread(void);
+
+		/**
+		 * Worker thread function.
+		 * @param workerIdx Worker index.
+		 */
+		void workerThread(unsigned int workerIdx);
+
+	private:
+		unsigned int m_workerCount;
+		size_t m_inSize;
+		size_t m_outSize;
+		std::vector<Slot> m_slots;
+
+		// Current run.
+		unsigned int m_groupCount;
+		const ReadFn *m_readFn;
+		const WorkFn *m_workFn;
+
+		std::mutex m_mutex;
+		std::condition_variable m_condReader;	// Slot freed by the writer
+		std::condition_variable m_condWorker;	// Slot read by the reader
+		std::condition_variable m_condWriter;	// Slot processed by a worker
+		std::deque<Slot*> m_workQueue;
+		bool m_readerDone;
+		bool m_abort;
+		int m_err;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_GROUPPIPELINE_HPP__ */
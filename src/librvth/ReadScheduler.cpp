@@ -0,0 +1,429 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadScheduler.cpp: Sequential read scheduler for concurrent streams.    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ReadScheduler.hpp"
+#include "reader/Reader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+/**
+ * Reader for a scheduled stream.
+ * Reads are served from the stream's prefetched chunks.
+ */
+class ReadScheduler::StreamReader : public Reader
+{
+	public:
+		StreamReader(ReadScheduler *sched, Stream *stream)
+			: super(stream->src->file(), stream->src->lba_start(), stream->src->lba_len())
+			, m_sched(sched)
+			, m_stream(stream)
+		{
+			m_type = stream->src->type();
+		}
+
+		virtual ~StreamReader()
+		{
+			m_sched->streamClose(m_stream);
+		}
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(StreamReader)
+
+	public:
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final
+		{
+			return m_sched->streamRead(m_stream, static_cast<uint8_t*>(ptr), lba_start, lba_len);
+		}
+
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final
+		{
+			// Scheduled streams are read-only.
+			UNUSED(ptr);
+			UNUSED(lba_start);
+			UNUSED(lba_len);
+			errno = EROFS;
+			return 0;
+		}
+
+		bool isLinear(void) const final
+		{
+			// Copy offloading would bypass the scheduler,
+			// so scheduled streams aren't reported as linear.
+			return false;
+		}
+
+		bool hasReadahead(void) const final
+		{
+			// The prefetch thread reads ahead.
+			return true;
+		}
+
+		int findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd) final
+		{
+			lock_guard<mutex> srcLock(m_stream->srcMutex);
+			return m_stream->src->findData(lba, pLbaStart, pLbaEnd);
+		}
+
+	private:
+		ReadScheduler *const m_sched;
+		Stream *const m_stream;
+};
+
+/**
+ * Create a read scheduler.
+ * @param chunkLBAs	[in] Size of each prefetch read, in LBAs.
+ * @param windowChunks	[in] Number of chunks to read from a stream before
+ *			switching to the next stream. This is also the
+ *			maximum number of buffered chunks per stream.
+ */
+ReadScheduler::ReadScheduler(uint32_t chunkLBAs, unsigned int windowChunks)
+	: m_chunkLBAs(chunkLBAs)
+	, m_windowChunks(windowChunks)
+	, m_running(false)
+	, m_stop(false)
+{
+	assert(m_chunkLBAs != 0);
+	assert(m_windowChunks != 0);
+	if (m_chunkLBAs == 0) {
+		m_chunkLBAs = 1;
+	}
+	if (m_windowChunks == 0) {
+		m_windowChunks = 1;
+	}
+}
+
+ReadScheduler::~ReadScheduler()
+{
+	stop();
+
+	for (Stream *s : m_streams) {
+		for (const Chunk &chunk : s->chunks) {
+			free(chunk.buf);
+		}
+		delete s;
+	}
+	for (uint8_t *buf : m_freeBufs) {
+		free(buf);
+	}
+}
+
+/**
+ * Add a stream to the scheduler.
+ * This must be called before start().
+ *
+ * Streams should be added in ascending LBA order so that
+ * switching between windows moves forward on the source.
+ *
+ * @param src	[in] Source reader. (not owned; must outlive the scheduler)
+ * @return Reader for the stream, or nullptr on error. (Caller must delete it.)
+ */
+Reader *ReadScheduler::addStream(Reader *src)
+{
+	assert(src != nullptr);
+	assert(!m_running);
+	if (!src || !src->isOpen() || m_running) {
+		errno = EINVAL;
+		return nullptr;
+	}
+
+	Stream *const s = new Stream;
+	s->src = src;
+	s->fetch_lba = 0;
+	s->generation = 0;
+	s->fetching = false;
+	s->failed = false;
+	s->closed = false;
+
+	StreamReader *const reader = new StreamReader(this, s);
+	if (!reader->isOpen()) {
+		const int err = (errno != 0 ? errno : EIO);
+		delete reader;
+		delete s;
+		errno = err;
+		return nullptr;
+	}
+
+	m_streams.push_back(s);
+	return reader;
+}
+
+/**
+ * Start the prefetch thread.
+ */
+void ReadScheduler::start(void)
+{
+	if (m_running || m_streams.empty())
+		return;
+
+	m_stop = false;
+	m_running = true;
+	m_thread = thread(&ReadScheduler::prefetchThread, this);
+}
+
+/**
+ * Stop the prefetch thread.
+ * Any stream Readers that are still open will read
+ * directly from the source afterwards.
+ */
+void ReadScheduler::stop(void)
+{
+	if (!m_running)
+		return;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+		m_running = false;
+	}
+	m_condFetch.notify_all();
+	m_condData.notify_all();
+	m_thread.join();
+}
+
+/**
+ * Is a stream eligible for prefetching?
+ * NOTE: m_mutex must be locked by the caller.
+ * @param s Stream.
+ * @return True if the stream can be prefetched.
+ */
+bool ReadScheduler::canFetch_locked(const Stream *s) const
+{
+	return (!s->closed && !s->failed &&
+		s->fetch_lba < s->src->lba_len() &&
+		s->chunks.size() < m_windowChunks);
+}
+
+/**
+ * Discard all chunks in a stream.
+ * NOTE: m_mutex must be locked by the caller.
+ * @param s Stream.
+ */
+void ReadScheduler::clearChunks_locked(Stream *s)
+{
+	for (const Chunk &chunk : s->chunks) {
+		m_freeBufs.push_back(chunk.buf);
+	}
+	s->chunks.clear();
+}
+
+/**
+ * Prefetch thread function.
+ */
+void ReadScheduler::prefetchThread(void)
+{
+	const size_t streamCount = m_streams.size();
+	size_t cur = 0;			// Current stream.
+	unsigned int burst = 0;		// Chunks read from the current stream.
+
+	unique_lock<mutex> lock(m_mutex);
+	while (!m_stop) {
+		// Stay on the current stream until its window is done.
+		// Otherwise, switch to the next stream that needs data.
+		Stream *s = nullptr;
+		if (burst < m_windowChunks && canFetch_locked(m_streams[cur])) {
+			s = m_streams[cur];
+		} else {
+			for (size_t i = 1; i <= streamCount; i++) {
+				const size_t idx = (cur + i) % streamCount;
+				if (canFetch_locked(m_streams[idx])) {
+					cur = idx;
+					s = m_streams[idx];
+					burst = 0;
+					break;
+				}
+			}
+		}
+		if (!s) {
+			// Nothing to do right now.
+			m_condFetch.wait(lock);
+			continue;
+		}
+
+		// Get a buffer.
+		uint8_t *buf;
+		if (!m_freeBufs.empty()) {
+			buf = m_freeBufs.back();
+			m_freeBufs.pop_back();
+		} else {
+			buf = static_cast<uint8_t*>(malloc(LBA_TO_BYTES(m_chunkLBAs)));
+			if (!buf) {
+				// Out of memory. Let the streams read directly.
+				for (Stream *s2 : m_streams) {
+					s2->failed = true;
+				}
+				m_condData.notify_all();
+				break;
+			}
+		}
+
+		Chunk chunk;
+		chunk.buf = buf;
+		chunk.lba = s->fetch_lba;
+		chunk.count = s->src->lba_len() - s->fetch_lba;
+		if (chunk.count > m_chunkLBAs) {
+			chunk.count = m_chunkLBAs;
+		}
+		s->fetch_lba += chunk.count;
+		s->fetching = true;
+		const unsigned int generation = s->generation;
+
+		// Read the chunk without holding the scheduler lock.
+		lock.unlock();
+		uint32_t lba_size;
+		{
+			lock_guard<mutex> srcLock(s->srcMutex);
+			lba_size = s->src->read(buf, chunk.lba, chunk.count);
+		}
+		lock.lock();
+
+		s->fetching = false;
+		if (generation != s->generation) {
+			// Stream was repositioned or closed while reading.
+			m_freeBufs.push_back(buf);
+		} else if (lba_size != chunk.count) {
+			// Read error. The stream will read directly from
+			// the source so the error is reported to the caller.
+			m_freeBufs.push_back(buf);
+			s->failed = true;
+		} else {
+			s->chunks.push_back(chunk);
+		}
+		burst++;
+		m_condData.notify_all();
+	}
+}
+
+/**
+ * Read data for a stream.
+ * Called by StreamReader::read().
+ * @param s		[in] Stream.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t ReadScheduler::streamRead(Stream *s, uint8_t *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba_cur = lba_start;
+
+	unique_lock<mutex> lock(m_mutex);
+	if (lba_len == 0 || lba_end > s->src->lba_len() || lba_end < lba_start) {
+		// Let the source reader handle invalid requests.
+		goto direct;
+	}
+
+	// Chunks are contiguous, starting at the first chunk's LBA
+	// and ending at fetch_lba. (The last chunk may still be in flight.)
+	if (lba_start < (s->chunks.empty() ? s->fetch_lba : s->chunks.front().lba)) {
+		// Backwards read. Don't disturb the prefetched data.
+		goto direct;
+	} else if (lba_start >= s->fetch_lba) {
+		// Skipped past the prefetched data.
+		// Restart prefetching at the new position.
+		clearChunks_locked(s);
+		if (s->fetching) {
+			// Discard the chunk that's currently being read.
+			s->generation++;
+			s->fetching = false;
+		}
+		s->fetch_lba = lba_start;
+		m_condFetch.notify_all();
+	}
+
+	while (lba_cur < lba_end) {
+		if (!m_running || s->failed) {
+			// Prefetching isn't available.
+			goto direct;
+		}
+
+		// Release chunks that were fully consumed.
+		bool released = false;
+		while (!s->chunks.empty() &&
+		       s->chunks.front().lba + s->chunks.front().count <= lba_cur)
+		{
+			m_freeBufs.push_back(s->chunks.front().buf);
+			s->chunks.pop_front();
+			released = true;
+		}
+		if (released) {
+			m_condFetch.notify_all();
+		}
+
+		if (s->chunks.empty() || s->chunks.front().lba > lba_cur) {
+			// Wait for the prefetch thread.
+			if (s->chunks.empty() && lba_cur >= s->fetch_lba && !s->fetching) {
+				// Data was consumed faster than the window. Restart here.
+				s->fetch_lba = lba_cur;
+				m_condFetch.notify_all();
+			}
+			m_condData.wait(lock);
+			continue;
+		}
+
+		// Copy from the first chunk.
+		const Chunk &chunk = s->chunks.front();
+		const uint32_t offset = lba_cur - chunk.lba;
+		uint32_t count = chunk.count - offset;
+		if (count > lba_end - lba_cur) {
+			count = lba_end - lba_cur;
+		}
+		memcpy(ptr, chunk.buf + LBA_TO_BYTES(offset), LBA_TO_BYTES(count));
+		ptr += LBA_TO_BYTES(count);
+		lba_cur += count;
+	}
+
+	// Release the last chunk if it was fully consumed.
+	if (!s->chunks.empty() &&
+	    s->chunks.front().lba + s->chunks.front().count <= lba_cur)
+	{
+		m_freeBufs.push_back(s->chunks.front().buf);
+		s->chunks.pop_front();
+		m_condFetch.notify_all();
+	}
+	return lba_len;
+
+direct:
+	// Read directly from the source.
+	lock.unlock();
+	lock_guard<mutex> srcLock(s->srcMutex);
+	const uint32_t lba_size = s->src->read(ptr, lba_cur, lba_end - lba_cur);
+	if (lba_size != lba_end - lba_cur) {
+		return 0;
+	}
+	return lba_len;
+}
+
+/**
+ * Close a stream.
+ * Called by StreamReader's destructor.
+ * @param s Stream.
+ */
+void ReadScheduler::streamClose(Stream *s)
+{
+	lock_guard<mutex> lock(m_mutex);
+	s->closed = true;
+	s->generation++;
+	clearChunks_locked(s);
+	m_condFetch.notify_all();
+}
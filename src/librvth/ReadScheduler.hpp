@@ -0,0 +1,157 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadScheduler.hpp: Sequential read scheduler for concurrent streams.    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READSCHEDULER_HPP__
+#define __RVTHTOOL_LIBRVTH_READSCHEDULER_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Reader;
+
+/**
+ * Read scheduler for multiple streams that share a single source device.
+ *
+ * Extracting multiple banks concurrently would otherwise have every
+ * bank thread reading from a different area of the source HDD, which
+ * results in constant seeking. Instead, a single prefetch thread reads
+ * each stream in large sequential windows, switching to the next stream
+ * in LBA order after each window. The stream threads consume the
+ * prefetched data through a Reader wrapper, so any code that takes a
+ * Reader can be used unmodified.
+ *
+ * Each stream is expected to be read mostly sequentially. Reads that
+ * go backwards are handled by reading directly from the source; reads
+ * that skip ahead restart prefetching at the new position.
+ */
+class ReadScheduler
+{
+	public:
+		/**
+		 * Create a read scheduler.
+		 * @param chunkLBAs	[in] Size of each prefetch read, in LBAs.
+		 * @param windowChunks	[in] Number of chunks to read from a stream before
+		 *			switching to the next stream. This is also the
+		 *			maximum number of buffered chunks per stream.
+		 */
+		ReadScheduler(uint32_t chunkLBAs, unsigned int windowChunks);
+		~ReadScheduler();
+
+	private:
+		DISABLE_COPY(ReadScheduler)
+
+	public:
+		/**
+		 * Add a stream to the scheduler.
+		 * This must be called before start().
+		 *
+		 * Streams should be added in ascending LBA order so that
+		 * switching between windows moves forward on the source.
+		 *
+		 * @param src	[in] Source reader. (not owned; must outlive the scheduler)
+		 * @return Reader for the stream, or nullptr on error. (Caller must delete it.)
+		 */
+		Reader *addStream(Reader *src);
+
+		/**
+		 * Start the prefetch thread.
+		 */
+		void start(void);
+
+		/**
+		 * Stop the prefetch thread.
+		 * Any stream Readers that are still open will read
+		 * directly from the source afterwards.
+		 */
+		void stop(void);
+
+	private:
+		class StreamReader;
+		friend class StreamReader;
+
+		// Prefetched chunk.
+		struct Chunk {
+			uint8_t *buf;
+			uint32_t lba;	// Relative to the stream.
+			uint32_t count;
+		};
+
+		struct Stream {
+			Reader *src;
+			std::mutex srcMutex;	// Protects src.
+
+			std::deque<Chunk> chunks;
+			uint32_t fetch_lba;	// Next LBA to prefetch.
+			unsigned int generation;	// Incremented on seek.
+			bool fetching;		// Prefetch thread is reading this stream.
+			bool failed;		// Prefetch read error. (use direct reads)
+			bool closed;		// Stream reader was deleted.
+		};
+
+		/**
+		 * Prefetch thread function.
+		 */
+		void prefetchThread(void);
+
+		/**
+		 * Is a stream eligible for prefetching?
+		 * NOTE: m_mutex must be locked by the caller.
+		 * @param s Stream.
+		 * @return True if the stream can be prefetched.
+		 */
+		bool canFetch_locked(const Stream *s) const;
+
+		/**
+		 * Discard all chunks in a stream.
+		 * NOTE: m_mutex must be locked by the caller.
+		 * @param s Stream.
+		 */
+		void clearChunks_locked(Stream *s);
+
+		/**
+		 * Read data for a stream.
+		 * Called by StreamReader::read().
+		 * @param s		[in] Stream.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t streamRead(Stream *s, uint8_t *ptr, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Close a stream.
+		 * Called by StreamReader's destructor.
+		 * @param s Stream.
+		 */
+		void streamClose(Stream *s);
+
+	private:
+		uint32_t m_chunkLBAs;
+		unsigned int m_windowChunks;
+		std::vector<Stream*> m_streams;
+		std::vector<uint8_t*> m_freeBufs;
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_condFetch;	// Chunk consumed or stream changed
+		std::condition_variable m_condData;	// Chunk prefetched
+		bool m_running;
+		bool m_stop;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READSCHEDULER_HPP__ */
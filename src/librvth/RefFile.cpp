@@ -1,6 +1,6 @@
 /***************************************************************************
  * RVT-H Tool (librvth)                                                    *
- * RefFile.cpp: Reference-counted FILE*.                                   *
+ * RefFile.cpp: Reference-counted file handle.                             *
  *                                                                         *
  * Copyright (c) 2018 by David Korth.                                      *
  *                                                                         *
@@ -21,6 +21,8 @@
 #include "config.librvth.h"
 
 #include "RefFile.hpp"
+#include "SplitFile.hpp"
+#include "reader/io_backend.h"
 
 // C includes.
 #include <stdlib.h>
@@ -30,10 +32,15 @@
 #include <cerrno>
 #include <cstring>
 
+// C++ includes.
+#include <algorithm>
+
+#include <fcntl.h>
 #ifdef _WIN32
 # include <windows.h>
 # include <io.h>
 # include <winioctl.h>
+# include <sys/stat.h>
 #else /* !_WIN32 */
 # include <sys/ioctl.h>
 # include <sys/types.h>
@@ -64,8 +71,12 @@
 RefFile::RefFile(const TCHAR *filename, bool create)
 	: m_refCount(1)
 	, m_lastError(0)
-	, m_file(nullptr)
+	, m_fd(-1)
 	, m_isWritable(false)
+	, m_unbuffered(false)
+	, m_split(nullptr)
+	, m_directFd(-1)
+	, m_directAlign(RVTH_IO_DIRECT_ALIGNMENT)
 {
 	if (!filename) {
 		// No filename...
@@ -76,10 +87,67 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 	// Save the filename.
 	m_filename = filename;
 
+	// Check for split files.
+	std::tstring basename;
+	const int64_t splitSize = (create ? rvth_io_get_split_size() : 0);
+	if (splitSize > 0) {
+		// Create a new split file.
+		m_split = new SplitFile(filename, true, splitSize);
+	} else if (!create && SplitFile::isFirstPart(filename, &basename)) {
+		// Open an existing split file.
+		m_split = new SplitFile(basename.c_str(), false);
+	} else {
+		init(create ? OPEN_CREATE : OPEN_READ_ONLY);
+		if (m_fd >= 0 || create || m_lastError != ENOENT) {
+			return;
+		}
+
+		// File not found. Check if it was split.
+		// If FILENAME.part0 doesn't exist either,
+		// the error will still be ENOENT.
+		m_split = new SplitFile(filename, false);
+	}
+
+	if (!m_split->isOpen()) {
+		// Could not open the split file.
+		m_lastError = (m_split->lastError() != 0 ? m_split->lastError() : EIO);
+		delete m_split;
+		m_split = nullptr;
+		return;
+	}
+	m_lastError = 0;
+	m_isWritable = create;
+}
+
+/**
+ * Open a single file as a reference-counted file.
+ * Split files are not detected. (used by SplitFile)
+ * @param filename Filename.
+ * @param mode Open mode.
+ */
+RefFile::RefFile(const TCHAR *filename, OpenMode mode)
+	: m_refCount(1)
+	, m_lastError(0)
+	, m_fd(-1)
+	, m_isWritable(false)
+	, m_unbuffered(false)
+	, m_split(nullptr)
+	, m_directFd(-1)
+	, m_directAlign(RVTH_IO_DIRECT_ALIGNMENT)
+{
+	m_filename = filename;
+	init(mode);
+}
+
+/**
+ * Open the file descriptor for m_filename.
+ * @param mode Open mode.
+ */
+void RefFile::init(OpenMode mode)
+{
 	// Open the file.
-	const TCHAR *const mode = (create ? _T("wb+") : _T("rb"));
-	m_file = _tfopen(filename, mode);
-	if (!m_file) {
+	m_fd = openFd(m_filename.c_str(), mode);
+	if (m_fd < 0) {
 		// Could not open the file.
 		m_lastError = errno;
 		if (m_lastError == 0) {
@@ -90,14 +158,64 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 
 	// If the file was opened with 'create',
 	// it should be considered writable.
-	m_isWritable = create;
+	m_isWritable = (mode != OPEN_READ_ONLY);
+
+	// Check if unbuffered writes should be used.
+	// RVT-H Reader devices use unbuffered writes by default.
+	const RvtH_IO_Unbuffered_e policy = rvth_io_get_unbuffered();
+	if (policy == RVTH_IO_UNBUFFERED_ALWAYS ||
+	    (policy == RVTH_IO_UNBUFFERED_AUTO && isDevice()))
+	{
+		// NOTE: If O_DIRECT isn't supported,
+		// buffered writes will be used.
+		setUnbuffered(true);
+	}
 }
 
 RefFile::~RefFile()
 {
-	if (m_file) {
-		fclose(m_file);
+	delete m_split;
+	closeDirectFd();
+	if (m_fd >= 0) {
+#ifdef _WIN32
+		_close(m_fd);
+#else /* !_WIN32 */
+		::close(m_fd);
+#endif /* _WIN32 */
+	}
+}
+
+/**
+ * Open a file descriptor.
+ * @param filename Filename.
+ * @param mode Open mode.
+ * @return File descriptor, or -1 on error. (check errno)
+ */
+int RefFile::openFd(const TCHAR *filename, OpenMode mode)
+{
+	int flags;
+	switch (mode) {
+		default:
+		case OPEN_READ_ONLY:
+			flags = O_RDONLY;
+			break;
+		case OPEN_READ_WRITE:
+			flags = O_RDWR;
+			break;
+		case OPEN_CREATE:
+			flags = O_RDWR | O_CREAT | O_TRUNC;
+			break;
 	}
+
+#ifdef _WIN32
+	return _topen(filename, flags | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else /* !_WIN32 */
+	int fd;
+	do {
+		fd = ::open(filename, flags | O_CLOEXEC, 0666);
+	} while (fd < 0 && errno == EINTR);
+	return fd;
+#endif /* _WIN32 */
 }
 
 /**
@@ -110,35 +228,158 @@ int RefFile::makeWritable(void)
 	if (m_isWritable) {
 		// File is already writable.
 		return 0;
-	} else if (!m_file) {
+	} else if (m_split) {
+		// Reopen all of the parts.
+		int ret = m_split->makeWritable();
+		if (ret == 0) {
+			m_isWritable = true;
+		}
+		return ret;
+	} else if (m_fd < 0) {
 		// File is not open.
 		return -EBADF;
 	}
 
-	// Get the current position.
-	int64_t pos = ftello(m_file);
-
-	// Close and reopen the file as writable.
-	// TODO: Potential race condition...
-	int ret = 0;
-	fclose(m_file);
-	m_file = _tfopen(m_filename.c_str(), _T("rb+"));
-	if (m_file) {
-		// File reopened as writable.
-		m_isWritable = true;
-	} else {
+	// Open a new file descriptor with write access.
+	// The original descriptor is only replaced if this succeeds.
+	// NOTE: Since all I/O is positional, there's no
+	// file pointer that needs to be preserved.
+	const int fd = openFd(m_filename.c_str(), OPEN_READ_WRITE);
+	if (fd < 0) {
 		// Could not reopen as writable.
-		ret = -errno;
-		// Reopen as read-only.
-		m_file = _tfopen(m_filename.c_str(), _T("rb"));
-		assert(m_file != nullptr);
-		// FIXME: If it's NULL, something's wrong...
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
 	}
 
-	// Seek to the original position.
-	// TODO: Check for errors.
-	fseeko(m_file, pos, SEEK_SET);
-	return ret;
+	// File reopened as writable.
+#ifdef _WIN32
+	_close(m_fd);
+#else /* !_WIN32 */
+	::close(m_fd);
+#endif /* _WIN32 */
+	m_fd = fd;
+	m_isWritable = true;
+
+	// Reopen the O_DIRECT file descriptor as writable, too.
+	if (m_directFd.load(std::memory_order_relaxed) >= 0) {
+		closeDirectFd();
+		if (directFd() < 0) {
+			// Can't use unbuffered writes anymore.
+			m_unbuffered = false;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Get a file descriptor for O_DIRECT I/O.
+ * The file is reopened with O_DIRECT on first use.
+ * The descriptor is writable if the file is writable.
+ * @return File descriptor, or negative POSIX error code on error.
+ */
+int RefFile::directFd(void)
+{
+	int fd = m_directFd.load(std::memory_order_acquire);
+	if (fd >= 0) {
+		return fd;
+	} else if (m_fd < 0) {
+		// File is not open.
+		return -EBADF;
+	}
+
+#if !defined(_WIN32) && defined(O_DIRECT)
+	std::lock_guard<std::mutex> lock(m_directMutex);
+	fd = m_directFd.load(std::memory_order_relaxed);
+	if (fd >= 0) {
+		// Another thread opened the descriptor.
+		return fd;
+	}
+
+	do {
+		fd = ::open(m_filename.c_str(),
+			(m_isWritable ? O_RDWR : O_RDONLY) | O_DIRECT | O_CLOEXEC);
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0) {
+		// O_DIRECT isn't supported by this file system.
+		const int err = (errno != 0 ? errno : EIO);
+		return -err;
+	}
+
+	// Get the alignment required for O_DIRECT.
+	// Devices use the logical sector size, which is usually
+	// smaller than the file system block size.
+	m_directAlign = RVTH_IO_DIRECT_ALIGNMENT;
+#if defined(__linux__) && defined(BLKSSZGET)
+	if (isDevice()) {
+		int sector_size = 0;
+		if (ioctl(fd, BLKSSZGET, &sector_size) == 0 &&
+		    sector_size >= 512 && sector_size <= RVTH_IO_DIRECT_ALIGNMENT)
+		{
+			m_directAlign = static_cast<unsigned int>(sector_size);
+		}
+	}
+#endif /* __linux__ && BLKSSZGET */
+
+	m_directFd.store(fd, std::memory_order_release);
+	return fd;
+#else /* _WIN32 || !O_DIRECT */
+	// TODO: FILE_FLAG_NO_BUFFERING on Windows; F_NOCACHE on macOS.
+	return -ENOTSUP;
+#endif /* !_WIN32 && O_DIRECT */
+}
+
+/**
+ * Close the O_DIRECT file descriptor.
+ */
+void RefFile::closeDirectFd(void)
+{
+#ifndef _WIN32
+	const int fd = m_directFd.exchange(-1);
+	if (fd >= 0) {
+		::close(fd);
+	}
+#endif /* !_WIN32 */
+}
+
+/**
+ * Enable or disable unbuffered writes.
+ *
+ * In unbuffered mode, aligned writes bypass the page cache
+ * using O_DIRECT, and other writes are submitted to the device
+ * before pwriteAt() returns. Reads are not affected.
+ *
+ * NOTE: The device's own write cache isn't flushed.
+ *
+ * Aligned writes must have the buffer address, file offset,
+ * and size aligned to directAlignment().
+ *
+ * @param unbuffered True to enable unbuffered writes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::setUnbuffered(bool unbuffered)
+{
+	if (m_split) {
+		// Each part has its own O_DIRECT file descriptor.
+		int ret = m_split->setUnbuffered(unbuffered);
+		if (ret == 0) {
+			m_unbuffered = unbuffered;
+		}
+		return ret;
+	}
+
+	if (unbuffered) {
+		const int fd = directFd();
+		if (fd < 0) {
+			// O_DIRECT isn't available.
+			return fd;
+		}
+	}
+
+	m_unbuffered = unbuffered;
+	return 0;
 }
 
 /**
@@ -147,7 +388,7 @@ int RefFile::makeWritable(void)
  */
 bool RefFile::isDevice(void) const
 {
-	if (!m_file) {
+	if (m_fd < 0) {
 		// No file...
 		return false;
 	}
@@ -163,7 +404,7 @@ bool RefFile::isDevice(void) const
 #else /* !_WIN32 */
 	// Other: Use fstat().
 	struct stat buf;
-	int ret = fstat(fileno(m_file), &buf);
+	int ret = fstat(m_fd, &buf);
 	if (ret != 0) {
 		// fstat() failed.
 		return false;
@@ -182,6 +423,11 @@ bool RefFile::isDevice(void) const
  */
 int RefFile::makeSparse(int64_t size)
 {
+	if (m_split) {
+		// Each part is set to its own size.
+		return m_split->makeSparse(size);
+	}
+
 #ifdef _WIN32
 	wchar_t root_dir[4];		// Root directory.
 	wchar_t *p_root_dir;		// Pointer to root_dir, or NULL if relative.
@@ -211,7 +457,7 @@ int RefFile::makeSparse(int64_t size)
 	if (bRet != 0 && (dwFileSystemFlags & FILE_SUPPORTS_SPARSE_FILES)) {
 		// File system supports sparse files.
 		// Mark the file as sparse.
-		HANDLE h_extract = (HANDLE)_get_osfhandle(_fileno(m_file));
+		HANDLE h_extract = (HANDLE)_get_osfhandle(m_fd);
 		if (h_extract != NULL && h_extract != INVALID_HANDLE_VALUE) {
 			DWORD bytesReturned;
 			FILE_SET_SPARSE_BUFFER fssb;
@@ -235,7 +481,7 @@ int RefFile::makeSparse(int64_t size)
 		return 0;
 	}
 
-	int ret = ftruncate(fileno(m_file), size);
+	int ret = ftruncate(m_fd, size);
 	if (ret != 0) {
 		// Error setting the file size.
 		// Allow all errors except for EINVAL or EFBIG,
@@ -262,7 +508,9 @@ int RefFile::makeSparse(int64_t size)
  */
 int64_t RefFile::size(void)
 {
-	if (!m_file) {
+	if (m_split) {
+		return m_split->size();
+	} else if (m_fd < 0) {
 		// No file...
 		return -1;
 	}
@@ -273,7 +521,7 @@ int64_t RefFile::size(void)
 	if (this->isDevice()) {
 #ifdef _WIN32
 		// Windows version.
-		HANDLE hDevice = (HANDLE)_get_osfhandle(_fileno(m_file));
+		HANDLE hDevice = (HANDLE)_get_osfhandle(m_fd);
 		if (hDevice && hDevice != INVALID_HANDLE_VALUE) {
 			// Reference: https://docs.microsoft.com/en-us/windows/desktop/api/winioctl/ni-winioctl-ioctl_disk_get_length_info
 			GET_LENGTH_INFORMATION gli;
@@ -295,7 +543,7 @@ int64_t RefFile::size(void)
 		// Linux version.
 		// Reference: http://www.microhowto.info/howto/get_the_size_of_a_linux_block_special_device_in_c.html
 		int64_t ret = -1;
-		if (ioctl(fileno(m_file), BLKGETSIZE64, &ret) == 0) {
+		if (ioctl(m_fd, BLKGETSIZE64, &ret) == 0) {
 			// Size obtained successfully.
 			return ret;
 		}
@@ -303,22 +551,466 @@ int64_t RefFile::size(void)
 	}
 
 	// Not a device, or the OS-specific device size function failed.
-	// Use this->seeko() / this->tello().
-	int64_t orig_pos = this->tello();
-	if (orig_pos < 0) {
-		// Error.
-		return -1;
+	// Seek to the end of the file to get the size.
+	// NOTE: The file pointer isn't used for I/O, so it
+	// doesn't need to be restored afterwards.
+#ifdef _WIN32
+	return _lseeki64(m_fd, 0, SEEK_END);
+#else /* !_WIN32 */
+	return lseek(m_fd, 0, SEEK_END);
+#endif /* _WIN32 */
+}
+
+/**
+ * Read data from the file at the specified offset.
+ * Short reads are retried until the requested amount of data
+ * has been read, EOF is reached, or an error occurs.
+ * @param offset	[in] File offset, in bytes.
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @return Number of bytes read. (If less than size, check errno.)
+ */
+size_t RefFile::preadAt(int64_t offset, void *ptr, size_t size)
+{
+	if (m_split) {
+		return m_split->preadAt(offset, ptr, size);
 	}
-	int err = this->seeko(0, SEEK_END);
-	if (err != 0) {
-		// Error.
-		return -1;
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	size_t total = 0;
+
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(m_fd);
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		errno = EBADF;
+		return 0;
 	}
-	int64_t ret = this->tello();
-	err = this->seeko(orig_pos, SEEK_SET);
-	if (err != 0) {
-		// Error.
-		return -1;
+
+	while (total < size) {
+		// ReadFile() takes a DWORD size, so read at most 1 GB at a time.
+		const DWORD dwToRead = (DWORD)std::min<size_t>(size - total, 1U << 30);
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)(offset & 0xFFFFFFFFU);
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD dwRead = 0;
+		if (!ReadFile(hFile, ptr8, dwToRead, &dwRead, &ov)) {
+			if (GetLastError() == ERROR_HANDLE_EOF) {
+				// End of file.
+				break;
+			}
+			errno = EIO;
+			break;
+		} else if (dwRead == 0) {
+			// End of file.
+			break;
+		}
+
+		ptr8 += dwRead;
+		offset += dwRead;
+		total += dwRead;
 	}
-	return ret;
+#else /* !_WIN32 */
+	while (total < size) {
+		ssize_t ret = pread(m_fd, ptr8, size - total, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			// End of file.
+			break;
+		}
+
+		ptr8 += ret;
+		offset += ret;
+		total += ret;
+	}
+#endif /* _WIN32 */
+
+	return total;
+}
+
+/**
+ * Write data to the file at the specified offset.
+ * Short writes are retried until the requested amount of data
+ * has been written or an error occurs.
+ * If unbuffered writes are enabled, the data has been submitted
+ * to the device when this function returns.
+ * @param offset	[in] File offset, in bytes.
+ * @param ptr		[in] Write buffer.
+ * @param size		[in] Number of bytes to write.
+ * @return Number of bytes written. (If less than size, check errno.)
+ */
+size_t RefFile::pwriteAt(int64_t offset, const void *ptr, size_t size)
+{
+	if (m_split) {
+		return m_split->pwriteAt(offset, ptr, size);
+	}
+
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	size_t total = 0;
+
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(m_fd);
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		errno = EBADF;
+		return 0;
+	}
+
+	while (total < size) {
+		// WriteFile() takes a DWORD size, so write at most 1 GB at a time.
+		const DWORD dwToWrite = (DWORD)std::min<size_t>(size - total, 1U << 30);
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)(offset & 0xFFFFFFFFU);
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD dwWritten = 0;
+		if (!WriteFile(hFile, ptr8, dwToWrite, &dwWritten, &ov) || dwWritten == 0) {
+			errno = (GetLastError() == ERROR_DISK_FULL ? ENOSPC : EIO);
+			break;
+		}
+
+		ptr8 += dwWritten;
+		offset += dwWritten;
+		total += dwWritten;
+	}
+#else /* !_WIN32 */
+	if (m_unbuffered && isDirectAligned(ptr8, offset, size))
+	{
+		// Aligned write. Bypass the page cache.
+		total = pwriteFd(m_directFd.load(std::memory_order_relaxed), offset, ptr8, size);
+		if (total == size || errno != EINVAL) {
+			return total;
+		}
+
+		// The device has stricter alignment requirements.
+		// Write the rest of the data using buffered I/O.
+		ptr8 += total;
+		offset += total;
+	}
+
+	const size_t written = pwriteFd(m_fd, offset, ptr8, size - total);
+	if (m_unbuffered && written != 0) {
+		// Wait for the data to be submitted to the device.
+		// NOTE: This doesn't flush the device's write cache.
+		const int err = errno;
+		int ret;
+#ifdef __linux__
+		ret = sync_file_range(m_fd, offset, written,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else /* !__linux__ */
+		ret = fsync(m_fd);
+#endif /* __linux__ */
+		if (ret != 0) {
+			// Data may not have been written.
+			return total;
+		}
+		errno = err;
+	}
+	total += written;
+#endif /* _WIN32 */
+
+	return total;
+}
+
+#ifndef _WIN32
+/**
+ * Write data to a file descriptor at the specified offset.
+ * Short writes are retried until the requested amount of data
+ * has been written or an error occurs.
+ * @param fd		[in] File descriptor.
+ * @param offset	[in] File offset, in bytes.
+ * @param ptr		[in] Write buffer.
+ * @param size		[in] Number of bytes to write.
+ * @return Number of bytes written. (If less than size, check errno.)
+ */
+size_t RefFile::pwriteFd(int fd, int64_t offset, const uint8_t *ptr, size_t size)
+{
+	size_t total = 0;
+	while (total < size) {
+		ssize_t ret = pwrite(fd, ptr, size - total, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			// Shouldn't happen for regular files...
+			errno = EIO;
+			break;
+		}
+
+		ptr += ret;
+		offset += ret;
+		total += ret;
+	}
+	return total;
+}
+#endif /* !_WIN32 */
+
+/**
+ * Find the next data region in a sparse file.
+ * (SEEK_DATA / SEEK_HOLE)
+ *
+ * NOTE: This uses lseek(), but since the offset is always
+ * specified, it's safe to call this from multiple threads.
+ *
+ * @param offset	[in] Starting offset, in bytes.
+ * @param pDataStart	[out] Start of the first data region at or after offset.
+ * @param pDataEnd	[out] End of the data region. (start of the next hole)
+ * @return 0 on success; -ENXIO if there's no data at or after offset;
+ *         other negative POSIX error code if holes can't be detected.
+ */
+int RefFile::findDataRegion(int64_t offset, int64_t *pDataStart, int64_t *pDataEnd)
+{
+	assert(pDataStart != nullptr);
+	assert(pDataEnd != nullptr);
+	if (offset < 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (m_split) {
+		return m_split->findDataRegion(offset, pDataStart, pDataEnd);
+	}
+
+#if !defined(_WIN32) && defined(SEEK_DATA) && defined(SEEK_HOLE)
+	const off_t dataStart = lseek(m_fd, offset, SEEK_DATA);
+	if (dataStart < 0) {
+		// ENXIO: No more data.
+		// EINVAL: SEEK_DATA isn't supported by this file system.
+		const int err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+	const off_t dataEnd = lseek(m_fd, dataStart, SEEK_HOLE);
+	if (dataEnd < 0) {
+		const int err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+
+	*pDataStart = dataStart;
+	*pDataEnd = dataEnd;
+	return 0;
+#else /* _WIN32 || !SEEK_DATA || !SEEK_HOLE */
+	// TODO: FSCTL_QUERY_ALLOCATED_RANGES on Windows.
+	errno = ENOTSUP;
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Clone a range of data from another file into this file.
+ * The data blocks are shared with the source file using
+ * copy-on-write, so no data is read or written.
+ * (Linux: FICLONERANGE; supported by e.g. btrfs and XFS.)
+ *
+ * Offsets and size must usually be aligned to the file system
+ * block size, and both files must be on the same file system.
+ *
+ * @param src		[in] Source file.
+ * @param srcOffset	[in] Source offset, in bytes.
+ * @param dstOffset	[in] Destination offset, in bytes.
+ * @param size		[in] Number of bytes to clone.
+ * @return 0 on success; negative POSIX error code on error.
+ *         -EINVAL usually means the range isn't aligned; any
+ *         other error means cloning isn't supported.
+ */
+int RefFile::cloneRangeFrom(RefFile *src, int64_t srcOffset, int64_t dstOffset, int64_t size)
+{
+	assert(src != nullptr);
+	if (!src || srcOffset < 0 || dstOffset < 0 || size < 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (size == 0) {
+		// Nothing to do.
+		return 0;
+	} else if (m_split || src->m_split) {
+		// Split files don't have a single file descriptor.
+		errno = ENOTSUP;
+		return -ENOTSUP;
+	}
+
+#if defined(__linux__) && defined(FICLONERANGE)
+	struct file_clone_range fcr;
+	fcr.src_fd = src->m_fd;
+	fcr.src_offset = static_cast<uint64_t>(srcOffset);
+	fcr.src_length = static_cast<uint64_t>(size);
+	fcr.dest_offset = static_cast<uint64_t>(dstOffset);
+	if (ioctl(m_fd, FICLONERANGE, &fcr) != 0) {
+		int err = errno;
+		if (err == 0 || err == ENOTTY) {
+			// ENOTTY: ioctl isn't supported on this file.
+			err = EOPNOTSUPP;
+		}
+		errno = err;
+		return -err;
+	}
+	return 0;
+#else /* !(__linux__ && FICLONERANGE) */
+	// TODO: FSCTL_DUPLICATE_EXTENTS_TO_FILE on Windows. (ReFS only)
+	errno = ENOTSUP;
+	return -ENOTSUP;
+#endif /* __linux__ && FICLONERANGE */
+}
+
+/**
+ * Copy a range of data from another file into this file
+ * without copying it through user space.
+ * (Linux: copy_file_range())
+ *
+ * Depending on the file system, this may share data blocks
+ * (XFS, btrfs), use a server-side copy (NFS, SMB), or copy
+ * the data within the kernel.
+ *
+ * @param src		[in] Source file.
+ * @param srcOffset	[in] Source offset, in bytes.
+ * @param dstOffset	[in] Destination offset, in bytes.
+ * @param size		[in] Number of bytes to copy.
+ * @return Number of bytes copied. (If less than size, check errno.)
+ */
+int64_t RefFile::copyRangeFrom(RefFile *src, int64_t srcOffset, int64_t dstOffset, int64_t size)
+{
+	assert(src != nullptr);
+	if (!src || srcOffset < 0 || dstOffset < 0 || size < 0) {
+		errno = EINVAL;
+		return 0;
+	} else if (m_split || src->m_split) {
+		// Split files don't have a single file descriptor.
+		errno = ENOTSUP;
+		return 0;
+	}
+
+#ifdef HAVE_COPY_FILE_RANGE
+	int64_t total = 0;
+	while (total < size) {
+		// copy_file_range() updates the offsets.
+		loff_t off_in = srcOffset + total;
+		loff_t off_out = dstOffset + total;
+		const size_t len = static_cast<size_t>(std::min<int64_t>(size - total, 1LL << 30));
+		ssize_t ret = copy_file_range(src->m_fd, &off_in, m_fd, &off_out, len, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			// End of source file.
+			errno = EIO;
+			break;
+		}
+		total += ret;
+	}
+	return total;
+#else /* !HAVE_COPY_FILE_RANGE */
+	errno = ENOTSUP;
+	return 0;
+#endif /* HAVE_COPY_FILE_RANGE */
+}
+
+/**
+ * Ask the OS to start reading a range of the file in the background,
+ * so a later preadAt() for that range doesn't have to wait for it.
+ * @param offset	[in] File offset, in bytes.
+ * @param size		[in] Number of bytes to prefetch.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::prefetch(int64_t offset, int64_t size)
+{
+	if (m_split || m_fd < 0) {
+		// SplitFile prefetches the parts on its own.
+		return -ENOTSUP;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	// NOTE: posix_fadvise() returns the error code
+	// instead of setting errno.
+	const int ret = posix_fadvise(m_fd, offset, size, POSIX_FADV_WILLNEED);
+	return -ret;
+#else /* !HAVE_POSIX_FADVISE */
+	// TODO: PrefetchVirtualMemory() on Windows?
+	UNUSED(offset);
+	UNUSED(size);
+	return -ENOTSUP;
+#endif /* HAVE_POSIX_FADVISE */
+}
+
+/**
+ * Give the OS advice about how a range of the file will be accessed.
+ * This only affects page cache usage; the data isn't modified.
+ * @param offset	[in] File offset, in bytes.
+ * @param size		[in] Size, in bytes. (0 for the rest of the file)
+ * @param advice	[in] Advice.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::advise(int64_t offset, int64_t size, Advice advice)
+{
+	if (m_split) {
+		return m_split->advise(offset, size, advice);
+	} else if (m_fd < 0) {
+		return -EBADF;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	int fadv;
+	switch (advice) {
+		case ADVICE_SEQUENTIAL:
+			fadv = POSIX_FADV_SEQUENTIAL;
+			break;
+		case ADVICE_WILLNEED:
+			fadv = POSIX_FADV_WILLNEED;
+			break;
+		case ADVICE_DONTNEED:
+			fadv = POSIX_FADV_DONTNEED;
+			break;
+		default:
+			assert(!"Invalid advice.");
+			return -EINVAL;
+	}
+
+	// NOTE: posix_fadvise() returns the error code
+	// instead of setting errno.
+	const int ret = posix_fadvise(m_fd, offset, size, fadv);
+	return -ret;
+#else /* !HAVE_POSIX_FADVISE */
+	UNUSED(offset);
+	UNUSED(size);
+	UNUSED(advice);
+	return -ENOTSUP;
+#endif /* HAVE_POSIX_FADVISE */
+}
+
+/**
+ * Write back dirty pages in a range of the file.
+ * This doesn't flush the disk's write cache.
+ * (Linux: sync_file_range())
+ * @param offset	[in] File offset, in bytes.
+ * @param size		[in] Size, in bytes.
+ * @param wait		[in] If true, wait for the writeback to finish.
+ *			If false, only start the writeback.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::syncRange(int64_t offset, int64_t size, bool wait)
+{
+	if (m_split) {
+		return m_split->syncRange(offset, size, wait);
+	} else if (m_fd < 0) {
+		return -EBADF;
+	}
+
+#ifdef __linux__
+	const unsigned int flags = (wait
+		? (SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)
+		: SYNC_FILE_RANGE_WRITE);
+	if (sync_file_range(m_fd, offset, size, flags) != 0) {
+		return -errno;
+	}
+	return 0;
+#else /* !__linux__ */
+	// TODO: FlushFileBuffers() on Windows? (not range-based)
+	UNUSED(offset);
+	UNUSED(size);
+	UNUSED(wait);
+	return -ENOTSUP;
+#endif /* __linux__ */
 }
@@ -1,6 +1,6 @@
 /***************************************************************************
  * RVT-H Tool (librvth)                                                    *
- * RefFile.hpp: Reference-counted FILE*.                                   *
+ * RefFile.hpp: Reference-counted file handle.                             *
  *                                                                         *
  * Copyright (c) 2018-2020 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
@@ -20,11 +20,38 @@
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
-#include <cstdio>
 
 // C++ includes.
+#include <atomic>
+#include <mutex>
 #include <string>
 
+class SplitFile;
+
+/**
+ * Reference-counted file handle.
+ *
+ * Thread-safety:
+ * - ref() and unref() are thread-safe. Multiple threads may each hold
+ *   a reference to the same RefFile, e.g. one Reader per bank.
+ * - preadAt() and pwriteAt() are thread-safe, since they don't use the
+ *   file pointer. Concurrent writes to overlapping ranges are not
+ *   ordered with respect to each other.
+ * - size(), isDevice(), and the accessors are thread-safe.
+ * - directFd() is thread-safe.
+ * - makeWritable(), makeSparse(), and setUnbuffered() are NOT thread-safe.
+ *   They must not be called while other threads are using the file.
+ * - lastError() is not synchronized; it's only meaningful on the thread
+ *   that called the function that set it.
+ *
+ * Split files:
+ * - If the filename ends with ".part0", or if the file doesn't exist but
+ *   FILENAME.part0 does, all parts are opened as a single file.
+ * - If a split size is set using rvth_io_set_split_size(), new files are
+ *   created as FILENAME.part0, FILENAME.part1, etc.
+ * - Split files don't have a single file descriptor, so fd() returns -1
+ *   and copy offloading isn't supported.
+ */
 class RefFile
 {
 	public:
@@ -48,6 +75,7 @@ class RefFile
 
 	private:
 		DISABLE_COPY(RefFile)
+		friend class SplitFile;
 
 	public:
 		/**
@@ -56,8 +84,9 @@ class RefFile
 		 */
 		inline RefFile *ref(void)
 		{
-			// TODO: Atomic increment?
-			m_refCount++;
+			// NOTE: The caller already holds a reference,
+			// so relaxed ordering is sufficient here.
+			m_refCount.fetch_add(1, std::memory_order_relaxed);
 			return this;
 		}
 
@@ -66,9 +95,11 @@ class RefFile
 		 */
 		inline void unref(void)
 		{
-			// TODO: Atomic decrement?
-			assert(m_refCount > 0);
-			if (--m_refCount <= 0) {
+			// NOTE: acq_rel ensures all accesses by other threads
+			// happen-before the object is deleted.
+			const int oldCount = m_refCount.fetch_sub(1, std::memory_order_acq_rel);
+			assert(oldCount > 0);
+			if (oldCount <= 1) {
 				// Delete the object.
 				delete this;
 			}
@@ -80,7 +111,16 @@ class RefFile
 		 */
 		inline bool isOpen(void) const
 		{
-			return (m_file != nullptr);
+			return (m_fd >= 0 || m_split != nullptr);
+		}
+
+		/**
+		 * Is this a split file?
+		 * @return True if the file is split into multiple parts.
+		 */
+		inline bool isSplit(void) const
+		{
+			return (m_split != nullptr);
 		}
 
 		/**
@@ -117,53 +157,195 @@ class RefFile
 		 */
 		int64_t size(void);
 
-	public:
-		/** Convenience wrappers for stdio functions. **/
-		// NOTE: These functions set errno, **NOT** m_lastError!
+		/**
+		 * Enable or disable unbuffered writes.
+		 *
+		 * In unbuffered mode, aligned writes bypass the page cache
+		 * using O_DIRECT, and other writes are submitted to the device
+		 * before pwriteAt() returns. Reads are not affected.
+		 *
+		 * NOTE: The device's own write cache isn't flushed.
+		 *
+		 * Aligned writes must have the buffer address, file offset,
+		 * and size aligned to directAlignment().
+		 *
+		 * @param unbuffered True to enable unbuffered writes.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int setUnbuffered(bool unbuffered);
 
-		inline size_t read(void *ptr, size_t size, size_t nmemb)
+		/**
+		 * Are unbuffered writes enabled?
+		 * @return True if enabled; false if not.
+		 */
+		inline bool isUnbuffered(void) const
 		{
-			return ::fread(ptr, size, nmemb, m_file);
+			return m_unbuffered;
 		}
 
-		inline size_t write(const void *ptr, size_t size, size_t nmemb)
-		{
-			return ::fwrite(ptr, size, nmemb, m_file);
-		}
+		/**
+		 * Get a file descriptor for O_DIRECT I/O.
+		 * The file is reopened with O_DIRECT on first use.
+		 * The descriptor is writable if the file is writable.
+		 * @return File descriptor, or negative POSIX error code on error.
+		 */
+		int directFd(void);
 
-		inline int seeko(int64_t offset, int whence)
+		/**
+		 * Get the alignment required for O_DIRECT I/O.
+		 * This is only valid if directFd() succeeded.
+		 * @return Alignment, in bytes.
+		 */
+		inline unsigned int directAlignment(void) const
 		{
-			return ::fseeko(m_file, offset, whence);
+			return m_directAlign;
 		}
 
-		inline int64_t tello(void)
+		/**
+		 * Is a request aligned for O_DIRECT I/O?
+		 * @param ptr		[in] Buffer.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param size		[in] Size, in bytes.
+		 * @return True if aligned; false if not.
+		 */
+		inline bool isDirectAligned(const void *ptr, int64_t offset, size_t size) const
 		{
-			return ::ftello(m_file);
+			return (((uintptr_t)ptr % m_directAlign) == 0 &&
+				(offset % m_directAlign) == 0 &&
+				(size % m_directAlign) == 0);
 		}
 
-		inline int64_t flush(void)
-		{
-			return ::fflush(m_file);
-		}
+	public:
+		/** Positional I/O functions. **/
+		// NOTE: These functions set errno, **NOT** m_lastError!
+		// NOTE: These functions don't use or modify the file pointer,
+		// so multiple Readers can access the same file without seeking.
 
-		inline void rewind(void)
-		{
-			::rewind(m_file);
-		}
+		/**
+		 * Read data from the file at the specified offset.
+		 * Short reads are retried until the requested amount of data
+		 * has been read, EOF is reached, or an error occurs.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param ptr		[out] Read buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @return Number of bytes read. (If less than size, check errno.)
+		 */
+		size_t preadAt(int64_t offset, void *ptr, size_t size);
 
-		/** Convenience wrappers. **/
+		/**
+		 * Write data to the file at the specified offset.
+		 * Short writes are retried until the requested amount of data
+		 * has been written or an error occurs.
+		 * If unbuffered writes are enabled, the data has been submitted
+		 * to the device when this function returns.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param ptr		[in] Write buffer.
+		 * @param size		[in] Number of bytes to write.
+		 * @return Number of bytes written. (If less than size, check errno.)
+		 */
+		size_t pwriteAt(int64_t offset, const void *ptr, size_t size);
 
-		inline size_t seekoAndRead(int64_t offset, int whence, void *ptr, size_t size, size_t nmemb)
-		{
-			int ret = this->seeko(offset, whence);
-			if (ret != 0) {
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
-			}
+		/**
+		 * Find the next data region in a sparse file.
+		 * (SEEK_DATA / SEEK_HOLE)
+		 *
+		 * NOTE: This uses lseek(), but since the offset is always
+		 * specified, it's safe to call this from multiple threads.
+		 *
+		 * @param offset	[in] Starting offset, in bytes.
+		 * @param pDataStart	[out] Start of the first data region at or after offset.
+		 * @param pDataEnd	[out] End of the data region. (start of the next hole)
+		 * @return 0 on success; -ENXIO if there's no data at or after offset;
+		 *         other negative POSIX error code if holes can't be detected.
+		 */
+		int findDataRegion(int64_t offset, int64_t *pDataStart, int64_t *pDataEnd);
+
+		/**
+		 * Ask the OS to start reading a range of the file in the background,
+		 * so a later preadAt() for that range doesn't have to wait for it.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param size		[in] Number of bytes to prefetch.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int prefetch(int64_t offset, int64_t size);
+
+		/**
+		 * Access pattern advice for a range of the file.
+		 * (See posix_fadvise().)
+		 */
+		enum Advice {
+			ADVICE_SEQUENTIAL,	// Range will be read sequentially
+			ADVICE_WILLNEED,	// Range will be read soon
+			ADVICE_DONTNEED,	// Range won't be read again
+		};
 
-			return this->read(ptr, size, nmemb);
+		/**
+		 * Give the OS advice about how a range of the file will be accessed.
+		 * This only affects page cache usage; the data isn't modified.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param size		[in] Size, in bytes. (0 for the rest of the file)
+		 * @param advice	[in] Advice.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int advise(int64_t offset, int64_t size, Advice advice);
+
+		/**
+		 * Write back dirty pages in a range of the file.
+		 * This doesn't flush the disk's write cache.
+		 * (Linux: sync_file_range())
+		 * @param offset	[in] File offset, in bytes.
+		 * @param size		[in] Size, in bytes.
+		 * @param wait		[in] If true, wait for the writeback to finish.
+		 *			If false, only start the writeback.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int syncRange(int64_t offset, int64_t size, bool wait);
+
+		/**
+		 * Clone a range of data from another file into this file.
+		 * The data blocks are shared with the source file using
+		 * copy-on-write, so no data is read or written.
+		 * (Linux: FICLONERANGE; supported by e.g. btrfs and XFS.)
+		 *
+		 * Offsets and size must usually be aligned to the file system
+		 * block size, and both files must be on the same file system.
+		 *
+		 * @param src		[in] Source file.
+		 * @param srcOffset	[in] Source offset, in bytes.
+		 * @param dstOffset	[in] Destination offset, in bytes.
+		 * @param size		[in] Number of bytes to clone.
+		 * @return 0 on success; negative POSIX error code on error.
+		 *         -EINVAL usually means the range isn't aligned; any
+		 *         other error means cloning isn't supported.
+		 */
+		int cloneRangeFrom(RefFile *src, int64_t srcOffset, int64_t dstOffset, int64_t size);
+
+		/**
+		 * Copy a range of data from another file into this file
+		 * without copying it through user space.
+		 * (Linux: copy_file_range())
+		 *
+		 * Depending on the file system, this may share data blocks
+		 * (XFS, btrfs), use a server-side copy (NFS, SMB), or copy
+		 * the data within the kernel.
+		 *
+		 * @param src		[in] Source file.
+		 * @param srcOffset	[in] Source offset, in bytes.
+		 * @param dstOffset	[in] Destination offset, in bytes.
+		 * @param size		[in] Number of bytes to copy.
+		 * @return Number of bytes copied. (If less than size, check errno.)
+		 */
+		int64_t copyRangeFrom(RefFile *src, int64_t srcOffset, int64_t dstOffset, int64_t size);
+
+		/**
+		 * Flush the file buffers.
+		 * Writes go directly to the file descriptor, so there are
+		 * no user-space buffers to flush.
+		 * @return 0 on success; non-zero on error.
+		 */
+		inline int flush(void)
+		{
+			return 0;
 		}
 
 		/** Convenience wrappers for various RefFile fields. **/
@@ -178,12 +360,78 @@ class RefFile
 			return m_isWritable;
 		}
 
+		/**
+		 * Get the file descriptor.
+		 * This is used by I/O backends that submit their own requests.
+		 * NOTE: The descriptor changes if makeWritable() reopens the file.
+		 * @return File descriptor, or -1 if not open or if this is a split file.
+		 */
+		inline int fd(void) const
+		{
+			return m_fd;
+		}
+
 	private:
-		int m_refCount;			// Reference count
+		enum OpenMode {
+			OPEN_READ_ONLY,		// Read-only
+			OPEN_READ_WRITE,	// Read/write
+			OPEN_CREATE,		// Read/write; create or truncate
+		};
+
+		/**
+		 * Open a file descriptor.
+		 * @param filename Filename.
+		 * @param mode Open mode.
+		 * @return File descriptor, or -1 on error. (check errno)
+		 */
+		static int openFd(const TCHAR *filename, OpenMode mode);
+
+		/**
+		 * Open a single file as a reference-counted file.
+		 * Split files are not detected. (used by SplitFile)
+		 * @param filename Filename.
+		 * @param mode Open mode.
+		 */
+		RefFile(const TCHAR *filename, OpenMode mode);
+
+		/**
+		 * Open the file descriptor for m_filename.
+		 * @param mode Open mode.
+		 */
+		void init(OpenMode mode);
+
+		/**
+		 * Close the O_DIRECT file descriptor.
+		 */
+		void closeDirectFd(void);
+
+#ifndef _WIN32
+		/**
+		 * Write data to a file descriptor at the specified offset.
+		 * Short writes are retried until the requested amount of data
+		 * has been written or an error occurs.
+		 * @param fd		[in] File descriptor.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param ptr		[in] Write buffer.
+		 * @param size		[in] Number of bytes to write.
+		 * @return Number of bytes written. (If less than size, check errno.)
+		 */
+		static size_t pwriteFd(int fd, int64_t offset, const uint8_t *ptr, size_t size);
+#endif /* !_WIN32 */
+
+	private:
+		std::atomic<int> m_refCount;	// Reference count
 		int m_lastError;		// Last error code
-		FILE *m_file;			// FILE pointer
+		int m_fd;			// File descriptor
 		std::tstring m_filename;	// Filename for reopening as writable
 		bool m_isWritable;		// Is the file writable?
+		bool m_unbuffered;		// Use unbuffered writes?
+
+		SplitFile *m_split;		// Split file parts (if split)
+
+		std::atomic<int> m_directFd;	// O_DIRECT file descriptor (opened on first use)
+		std::mutex m_directMutex;	// Mutex for opening m_directFd
+		unsigned int m_directAlign;	// O_DIRECT alignment, in bytes
 };
 
 #else /* !__cplusplus */
@@ -0,0 +1,575 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * SplitFile.cpp: Disc image split into multiple files.                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "SplitFile.hpp"
+#include "RefFile.hpp"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+using std::lock_guard;
+using std::mutex;
+using std::tstring;
+
+// Part filename suffix.
+#define PART_SUFFIX _T(".part")
+
+// Amount of the next part to prefetch.
+// The next part is prefetched once a read is this close
+// to the end of the current part.
+#define SPLIT_PREFETCH_SIZE (32LL*1024LL*1024LL)
+
+/**
+ * Open a split file.
+ *
+ * If create is false, all existing parts are opened,
+ * and the part boundaries are determined by their sizes.
+ *
+ * If create is true, BASENAME.part0 is created, and more
+ * parts are created as needed when writing past the end
+ * of the last part.
+ *
+ * Check isOpen() after constructing the object to determine
+ * if the file was opened successfully.
+ *
+ * @param basename	[in] Filename without the ".partN" suffix.
+ * @param create	[in] If true, create a new split file.
+ * @param splitSize	[in] Part size, in bytes. (required if creating)
+ */
+SplitFile::SplitFile(const TCHAR *basename, bool create, int64_t splitSize)
+	: m_basename(basename)
+	, m_splitSize(create ? splitSize : 0)
+	, m_lastError(0)
+	, m_unbuffered(false)
+	, m_prefetchedPart(0)
+{
+	assert(!create || splitSize > 0);
+	if (create) {
+		if (splitSize <= 0) {
+			m_lastError = EINVAL;
+			return;
+		}
+
+		// Create the first part.
+		// The other parts are created when they're written to.
+		lock_guard<mutex> lock(m_mutex);
+		int ret = addPart_locked();
+		if (ret != 0) {
+			m_lastError = -ret;
+		}
+		return;
+	}
+
+	// Open the existing parts.
+	int64_t offset = 0;
+	for (unsigned int idx = 0; ; idx++) {
+		RefFile *const file = new RefFile(partName(m_basename, idx).c_str(), RefFile::OPEN_READ_ONLY);
+		if (!file->isOpen()) {
+			const int err = file->lastError();
+			file->unref();
+			if (idx > 0 && err == ENOENT) {
+				// No more parts.
+				break;
+			}
+			m_lastError = (err != 0 ? err : EIO);
+			break;
+		}
+
+		const int64_t partSize = file->size();
+		if (partSize < 0) {
+			m_lastError = (errno != 0 ? errno : EIO);
+			file->unref();
+			break;
+		}
+		m_parts.push_back({file, offset});
+		offset += partSize;
+	}
+
+	if (m_lastError != 0) {
+		// Error opening a part.
+		for (const Part &part : m_parts) {
+			part.file->unref();
+		}
+		m_parts.clear();
+	}
+}
+
+SplitFile::~SplitFile()
+{
+	for (const Part &part : m_parts) {
+		part.file->unref();
+	}
+}
+
+/**
+ * Check if a filename is the first part of a split file.
+ * @param filename	[in] Filename.
+ * @param pBasename	[out,opt] Filename without the ".part0" suffix.
+ * @return True if the filename ends with ".part0".
+ */
+bool SplitFile::isFirstPart(const TCHAR *filename, tstring *pBasename)
+{
+	static const TCHAR suffix[] = PART_SUFFIX _T("0");
+	static const size_t suffix_len = ARRAY_SIZE(suffix) - 1;
+
+	const size_t len = _tcslen(filename);
+	if (len <= suffix_len || _tcsicmp(&filename[len - suffix_len], suffix) != 0) {
+		return false;
+	}
+	if (pBasename) {
+		pBasename->assign(filename, len - suffix_len);
+	}
+	return true;
+}
+
+/**
+ * Get the filename of a part.
+ * @param basename	[in] Filename without the ".partN" suffix.
+ * @param idx		[in] Part index.
+ * @return Part filename.
+ */
+tstring SplitFile::partName(const tstring &basename, unsigned int idx)
+{
+	TCHAR buf[24];
+	_sntprintf(buf, ARRAY_SIZE(buf), PART_SUFFIX _T("%u"), idx);
+	return basename + buf;
+}
+
+/**
+ * Get the number of parts.
+ * @return Number of parts.
+ */
+unsigned int SplitFile::partCount(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	return static_cast<unsigned int>(m_parts.size());
+}
+
+/**
+ * Create a new part after the last part.
+ * NOTE: m_mutex must be locked by the caller.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitFile::addPart_locked(void)
+{
+	assert(m_splitSize > 0);
+	const unsigned int idx = static_cast<unsigned int>(m_parts.size());
+	if (idx > 0) {
+		// Make sure the previous part is full-size.
+		// Otherwise, the part boundaries would be wrong
+		// when the split file is opened again.
+		RefFile *const prev = m_parts[idx - 1].file;
+		const int64_t prevSize = prev->size();
+		if (prevSize < m_splitSize) {
+			static const uint8_t zero = 0;
+			errno = 0;
+			if (prev->pwriteAt(m_splitSize - 1, &zero, 1) != 1) {
+				return (errno != 0 ? -errno : -EIO);
+			}
+		}
+	}
+
+	RefFile *const file = new RefFile(partName(m_basename, idx).c_str(), RefFile::OPEN_CREATE);
+	if (!file->isOpen()) {
+		const int err = (file->lastError() != 0 ? file->lastError() : EIO);
+		file->unref();
+		return -err;
+	}
+	if (m_unbuffered) {
+		// NOTE: If O_DIRECT isn't supported,
+		// buffered writes will be used.
+		file->setUnbuffered(true);
+	}
+
+	m_parts.push_back({file, idx * m_splitSize});
+	return 0;
+}
+
+/**
+ * Find the part containing an offset.
+ * @param offset	[in] Offset, in bytes.
+ * @param create	[in] If true, create the part if it doesn't exist.
+ * @param pPartIdx	[out] Part index.
+ * @param pPartOffset	[out] Offset of the part in the split file.
+ * @param pPartEnd	[out] End of the part in the split file. (INT64_MAX if unbounded)
+ * @return Part, or nullptr if the offset is past the last part. (check errno if creating)
+ */
+RefFile *SplitFile::findPart(int64_t offset, bool create,
+	unsigned int *pPartIdx, int64_t *pPartOffset, int64_t *pPartEnd)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_parts.empty()) {
+		errno = EBADF;
+		return nullptr;
+	}
+
+	size_t idx;
+	if (m_splitSize > 0) {
+		// All parts have the same size.
+		idx = static_cast<size_t>(offset / m_splitSize);
+		if (idx >= m_parts.size()) {
+			if (!create) {
+				// Past the last part.
+				errno = 0;
+				return nullptr;
+			}
+
+			// Create the missing parts.
+			// Skipped parts are extended to the full
+			// part size, so they're read as zero.
+			while (idx >= m_parts.size()) {
+				int ret = addPart_locked();
+				if (ret != 0) {
+					errno = -ret;
+					return nullptr;
+				}
+			}
+		}
+		*pPartEnd = m_parts[idx].offset + m_splitSize;
+	} else {
+		// Part sizes are determined by the existing parts.
+		// The last part can be extended if writing.
+		auto iter = std::upper_bound(m_parts.begin(), m_parts.end(), offset,
+			[](int64_t off, const Part &part) {
+				return off < part.offset;
+			});
+		assert(iter != m_parts.begin());
+		idx = (iter - m_parts.begin()) - 1;
+		*pPartEnd = (iter != m_parts.end() ? iter->offset : INT64_MAX);
+	}
+
+	*pPartIdx = static_cast<unsigned int>(idx);
+	*pPartOffset = m_parts[idx].offset;
+	return m_parts[idx].file;
+}
+
+/**
+ * Prefetch the beginning of the part after the specified part
+ * if a read is getting close to the end of the current part.
+ * @param partIdx	[in] Current part index.
+ * @param remain	[in] Bytes remaining in the current part after the read.
+ */
+void SplitFile::prefetchNext(unsigned int partIdx, int64_t remain)
+{
+	if (remain > SPLIT_PREFETCH_SIZE) {
+		// Not close enough to the end yet.
+		return;
+	}
+
+	// Only prefetch each part once.
+	const unsigned int next = partIdx + 1;
+	unsigned int prev = m_prefetchedPart.load(std::memory_order_relaxed);
+	if (next <= prev || !m_prefetchedPart.compare_exchange_strong(prev, next)) {
+		return;
+	}
+
+	RefFile *file = nullptr;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if (next < m_parts.size()) {
+			file = m_parts[next].file;
+		}
+	}
+	if (file) {
+		// The OS reads the next part in the background
+		// while the current part is still being read.
+		file->prefetch(0, SPLIT_PREFETCH_SIZE);
+	}
+}
+
+/**
+ * Reopen all parts with write access.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitFile::makeWritable(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	for (const Part &part : m_parts) {
+		int ret = part.file->makeWritable();
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Try to make this file a sparse file.
+ * Each part is set to its final size.
+ * @param size If not zero, try to set the file to this size.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitFile::makeSparse(int64_t size)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_splitSize > 0) {
+		// Create all of the parts.
+		while (size > (int64_t)m_parts.size() * m_splitSize) {
+			int ret = addPart_locked();
+			if (ret != 0) {
+				return ret;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < m_parts.size(); i++) {
+		const Part &part = m_parts[i];
+		int64_t partSize = size - part.offset;
+		if (i + 1 < m_parts.size()) {
+			partSize = std::min(partSize, m_parts[i + 1].offset - part.offset);
+		}
+		if (size != 0 && partSize <= 0) {
+			// This part isn't needed.
+			continue;
+		}
+
+		int ret = part.file->makeSparse(size != 0 ? partSize : 0);
+		if (ret != 0) {
+			m_lastError = part.file->lastError();
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Get the size of the file.
+ * @return Size of file, or -1 on error.
+ */
+int64_t SplitFile::size(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_parts.empty()) {
+		return -1;
+	}
+
+	const Part &last = m_parts.back();
+	const int64_t lastSize = last.file->size();
+	if (lastSize < 0) {
+		return -1;
+	}
+	return last.offset + lastSize;
+}
+
+/**
+ * Enable or disable unbuffered writes for all parts.
+ * @param unbuffered True to enable unbuffered writes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitFile::setUnbuffered(bool unbuffered)
+{
+	lock_guard<mutex> lock(m_mutex);
+	for (const Part &part : m_parts) {
+		int ret = part.file->setUnbuffered(unbuffered);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	m_unbuffered = unbuffered;
+	return 0;
+}
+
+/**
+ * Read data from the file at the specified offset.
+ * Reads that cross a part boundary are split.
+ * @param offset	[in] File offset, in bytes.
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @return Number of bytes read. (If less than size, check errno.)
+ */
+size_t SplitFile::preadAt(int64_t offset, void *ptr, size_t size)
+{
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	size_t total = 0;
+
+	while (total < size) {
+		unsigned int partIdx;
+		int64_t partOffset, partEnd;
+		RefFile *const file = findPart(offset, false, &partIdx, &partOffset, &partEnd);
+		if (!file) {
+			// End of file.
+			break;
+		}
+
+		const size_t len = static_cast<size_t>(std::min<int64_t>(size - total, partEnd - offset));
+		errno = 0;
+		const size_t ret = file->preadAt(offset - partOffset, ptr8, len);
+		prefetchNext(partIdx, partEnd - (offset + (int64_t)ret));
+		if (ret < len) {
+			if (errno != 0 || partIdx + 1 >= partCount()) {
+				// Read error, or end of the last part.
+				total += ret;
+				break;
+			}
+
+			// Part is shorter than the part size.
+			// This can happen if the split file was written
+			// sparsely, so treat the rest of the part as zero.
+			memset(ptr8 + ret, 0, len - ret);
+		}
+
+		ptr8 += len;
+		offset += len;
+		total += len;
+	}
+
+	return total;
+}
+
+/**
+ * Write data to the file at the specified offset.
+ * Writes that cross a part boundary are split.
+ * If creating, new parts are created as needed.
+ * @param offset	[in] File offset, in bytes.
+ * @param ptr		[in] Write buffer.
+ * @param size		[in] Number of bytes to write.
+ * @return Number of bytes written. (If less than size, check errno.)
+ */
+size_t SplitFile::pwriteAt(int64_t offset, const void *ptr, size_t size)
+{
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	size_t total = 0;
+
+	while (total < size) {
+		unsigned int partIdx;
+		int64_t partOffset, partEnd;
+		RefFile *const file = findPart(offset, true, &partIdx, &partOffset, &partEnd);
+		if (!file) {
+			// Unable to create the part.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			break;
+		}
+
+		const size_t len = static_cast<size_t>(std::min<int64_t>(size - total, partEnd - offset));
+		const size_t ret = file->pwriteAt(offset - partOffset, ptr8, len);
+		total += ret;
+		if (ret < len) {
+			// Write error.
+			break;
+		}
+
+		ptr8 += len;
+		offset += len;
+	}
+
+	return total;
+}
+
+/**
+ * Find the next data region in the split file.
+ * Data regions don't extend past the end of a part.
+ * @param offset	[in] Starting offset, in bytes.
+ * @param pDataStart	[out] Start of the first data region at or after offset.
+ * @param pDataEnd	[out] End of the data region. (start of the next hole)
+ * @return 0 on success; -ENXIO if there's no data at or after offset;
+ *         other negative POSIX error code if holes can't be detected.
+ */
+int SplitFile::findDataRegion(int64_t offset, int64_t *pDataStart, int64_t *pDataEnd)
+{
+	while (true) {
+		unsigned int partIdx;
+		int64_t partOffset, partEnd;
+		RefFile *const file = findPart(offset, false, &partIdx, &partOffset, &partEnd);
+		if (!file) {
+			// No more parts.
+			errno = ENXIO;
+			return -ENXIO;
+		}
+
+		int64_t dataStart, dataEnd;
+		int ret = file->findDataRegion(offset - partOffset, &dataStart, &dataEnd);
+		if (ret == 0) {
+			*pDataStart = partOffset + dataStart;
+			*pDataEnd = std::min(partOffset + dataEnd, partEnd);
+			if (*pDataStart < partEnd) {
+				return 0;
+			}
+		} else if (ret != -ENXIO) {
+			// Holes can't be detected.
+			return ret;
+		}
+
+		// No more data in this part.
+		if (partEnd == INT64_MAX) {
+			errno = ENXIO;
+			return -ENXIO;
+		}
+		offset = partEnd;
+	}
+}
+
+/**
+ * Call a function for each part overlapping a range.
+ * @param offset	[in] Offset, in bytes.
+ * @param size		[in] Size, in bytes. (0 for the rest of the file)
+ * @param func		[in] Function: (part, offset in part, size in part)
+ * @return 0 on success; negative POSIX error code from the first failed part.
+ */
+int SplitFile::forEachPart(int64_t offset, int64_t size,
+	const std::function<int(RefFile*, int64_t, int64_t)> &func)
+{
+	const int64_t end = (size > 0 ? offset + size : INT64_MAX);
+	int ret = 0;
+	while (offset < end) {
+		unsigned int partIdx;
+		int64_t partOffset, partEnd;
+		RefFile *const file = findPart(offset, false, &partIdx, &partOffset, &partEnd);
+		if (!file) {
+			// No more parts.
+			break;
+		}
+
+		// NOTE: A size of 0 covers the rest of the part.
+		const int64_t len = (std::min(end, partEnd) == INT64_MAX
+			? 0 : std::min(end, partEnd) - offset);
+		const int partRet = func(file, offset - partOffset, len);
+		if (partRet != 0 && ret == 0) {
+			ret = partRet;
+		}
+
+		if (partEnd == INT64_MAX) {
+			break;
+		}
+		offset = partEnd;
+	}
+	return ret;
+}
+
+/**
+ * Give the OS advice about how a range of the file will be accessed.
+ * @param offset	[in] Offset, in bytes.
+ * @param size		[in] Size, in bytes. (0 for the rest of the file)
+ * @param advice	[in] Advice.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitFile::advise(int64_t offset, int64_t size, RefFile::Advice advice)
+{
+	return forEachPart(offset, size, [advice](RefFile *file, int64_t partOffset, int64_t partSize) {
+		return file->advise(partOffset, partSize, advice);
+	});
+}
+
+/**
+ * Write back dirty pages in a range of the file.
+ * @param offset	[in] Offset, in bytes.
+ * @param size		[in] Size, in bytes.
+ * @param wait		[in] If true, wait for the writeback to finish.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitFile::syncRange(int64_t offset, int64_t size, bool wait)
+{
+	return forEachPart(offset, size, [wait](RefFile *file, int64_t partOffset, int64_t partSize) {
+		return file->syncRange(partOffset, partSize, wait);
+	});
+}
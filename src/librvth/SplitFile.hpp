@@ -0,0 +1,175 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * SplitFile.hpp: Disc image split into multiple files.                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_SPLITFILE_HPP__
+#define __RVTHTOOL_LIBRVTH_SPLITFILE_HPP__
+
+#include "libwiicrypto/common.h"
+#include "tcharx.h"
+#include "RefFile.hpp"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Disc image split into multiple files, e.g. for FAT32 file systems.
+ * The parts are named BASENAME.part0, BASENAME.part1, etc.
+ *
+ * The parts are presented as a single file. Each part is a separate
+ * RefFile with its own file descriptor, so the next part can be
+ * prefetched while the current part is being read.
+ *
+ * This is used by RefFile; Readers don't access it directly.
+ *
+ * Thread-safety: Same as RefFile.
+ */
+class SplitFile
+{
+	public:
+		/**
+		 * Open a split file.
+		 *
+		 * If create is false, all existing parts are opened,
+		 * and the part boundaries are determined by their sizes.
+		 *
+		 * If create is true, BASENAME.part0 is created, and more
+		 * parts are created as needed when writing past the end
+		 * of the last part.
+		 *
+		 * Check isOpen() after constructing the object to determine
+		 * if the file was opened successfully.
+		 *
+		 * @param basename	[in] Filename without the ".partN" suffix.
+		 * @param create	[in] If true, create a new split file.
+		 * @param splitSize	[in] Part size, in bytes. (required if creating)
+		 */
+		SplitFile(const TCHAR *basename, bool create, int64_t splitSize = 0);
+		~SplitFile();
+
+	private:
+		DISABLE_COPY(SplitFile)
+
+	public:
+		/**
+		 * Check if a filename is the first part of a split file.
+		 * @param filename	[in] Filename.
+		 * @param pBasename	[out,opt] Filename without the ".part0" suffix.
+		 * @return True if the filename ends with ".part0".
+		 */
+		static bool isFirstPart(const TCHAR *filename, std::tstring *pBasename = nullptr);
+
+		/**
+		 * Get the filename of a part.
+		 * @param basename	[in] Filename without the ".partN" suffix.
+		 * @param idx		[in] Part index.
+		 * @return Part filename.
+		 */
+		static std::tstring partName(const std::tstring &basename, unsigned int idx);
+
+		/**
+		 * Is the file open?
+		 * @return True if open; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return !m_parts.empty();
+		}
+
+		/**
+		 * Get the last error.
+		 * @return Last error.
+		 */
+		inline int lastError(void) const
+		{
+			return m_lastError;
+		}
+
+		/**
+		 * Get the number of parts.
+		 * @return Number of parts.
+		 */
+		unsigned int partCount(void);
+
+	public:
+		/** RefFile functions **/
+		// See RefFile for details.
+
+		int makeWritable(void);
+		int makeSparse(int64_t size);
+		int64_t size(void);
+		int setUnbuffered(bool unbuffered);
+
+		size_t preadAt(int64_t offset, void *ptr, size_t size);
+		size_t pwriteAt(int64_t offset, const void *ptr, size_t size);
+		int findDataRegion(int64_t offset, int64_t *pDataStart, int64_t *pDataEnd);
+		int advise(int64_t offset, int64_t size, RefFile::Advice advice);
+		int syncRange(int64_t offset, int64_t size, bool wait);
+
+	private:
+		/**
+		 * Find the part containing an offset.
+		 * @param offset	[in] Offset, in bytes.
+		 * @param create	[in] If true, create the part if it doesn't exist.
+		 * @param pPartIdx	[out] Part index.
+		 * @param pPartOffset	[out] Offset of the part in the split file.
+		 * @param pPartEnd	[out] End of the part in the split file. (INT64_MAX if unbounded)
+		 * @return Part, or nullptr if the offset is past the last part. (check errno if creating)
+		 */
+		RefFile *findPart(int64_t offset, bool create,
+			unsigned int *pPartIdx, int64_t *pPartOffset, int64_t *pPartEnd);
+
+		/**
+		 * Call a function for each part overlapping a range.
+		 * @param offset	[in] Offset, in bytes.
+		 * @param size		[in] Size, in bytes. (0 for the rest of the file)
+		 * @param func		[in] Function: (part, offset in part, size in part)
+		 * @return 0 on success; negative POSIX error code from the first failed part.
+		 */
+		int forEachPart(int64_t offset, int64_t size,
+			const std::function<int(RefFile*, int64_t, int64_t)> &func);
+
+		/**
+		 * Create a new part after the last part.
+		 * NOTE: m_mutex must be locked by the caller.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int addPart_locked(void);
+
+		/**
+		 * Prefetch the beginning of the part after the specified part
+		 * if a read is getting close to the end of the current part.
+		 * @param partIdx	[in] Current part index.
+		 * @param remain	[in] Bytes remaining in the current part after the read.
+		 */
+		void prefetchNext(unsigned int partIdx, int64_t remain);
+
+	private:
+		struct Part {
+			RefFile *file;
+			int64_t offset;		// Offset in the split file
+		};
+
+		std::tstring m_basename;	// Filename without the ".partN" suffix
+		int64_t m_splitSize;		// Part size (0 if determined by the existing parts)
+		std::vector<Part> m_parts;
+		std::mutex m_mutex;		// Locked when accessing m_parts
+		int m_lastError;
+		bool m_unbuffered;
+
+		// Last part that was prefetched.
+		std::atomic<unsigned int> m_prefetchedPart;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_SPLITFILE_HPP__ */
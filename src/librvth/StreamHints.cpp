@@ -0,0 +1,142 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * StreamHints.cpp: Page cache hints for bulk transfers.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "StreamHints.hpp"
+#include "RefFile.hpp"
+#include "nhcd_structs.h"
+#include "reader/Reader.hpp"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+
+const int64_t StreamHints::WINDOW_SIZE;
+
+/**
+ * Start a bulk transfer.
+ * Hints are disabled if rvth_io_get_stream_hints() is false.
+ * @param reader	[in] Reader.
+ * @param mode		[in] Transfer direction.
+ * @param lba_len	[in] Number of LBAs that will be transferred.
+ */
+StreamHints::StreamHints(Reader *reader, Mode mode, uint32_t lba_len)
+	: m_file(nullptr)
+	, m_mode(mode)
+	, m_readahead(false)
+	, m_offset(0)
+	, m_size(LBA_TO_BYTES(lba_len))
+	, m_pos(0)
+	, m_prefetched(0)
+	, m_synced(0)
+	, m_dropped(0)
+{
+	assert(reader != nullptr);
+	if (!rvth_io_get_stream_hints() || !reader->isLinear()) {
+		// Hints are disabled, or file offsets don't
+		// match the disc image.
+		return;
+	}
+
+	RefFile *const file = reader->file();
+	if (mode == MODE_WRITE && file->isUnbuffered()) {
+		// Unbuffered writes don't use the page cache.
+		return;
+	}
+
+	m_file = file->ref();
+	m_offset = LBA_TO_BYTES(reader->lba_start());
+
+	if (mode == MODE_READ) {
+		// Increase the OS's readahead for the source.
+		m_file->advise(m_offset, m_size, RefFile::ADVICE_SEQUENTIAL);
+
+		// Readers that read ahead on their own, e.g. scheduled
+		// streams, would be disrupted by explicit readahead.
+		m_readahead = !reader->hasReadahead();
+		advance(0);
+	}
+}
+
+StreamHints::~StreamHints()
+{
+	if (!m_file) {
+		return;
+	}
+
+	if (m_mode == MODE_READ) {
+		// Drop the rest of the consumed data.
+		if (m_pos > m_dropped) {
+			m_file->advise(m_offset + m_dropped, m_pos - m_dropped, RefFile::ADVICE_DONTNEED);
+		}
+	} else {
+		// Drop the window that's being written back, and start
+		// writing back the rest. The last window isn't waited
+		// for, so the transfer doesn't have to wait for the disk.
+		if (m_synced > m_dropped) {
+			m_file->syncRange(m_offset + m_dropped, m_synced - m_dropped, true);
+			m_file->advise(m_offset + m_dropped, m_synced - m_dropped, RefFile::ADVICE_DONTNEED);
+		}
+		if (m_pos > m_synced) {
+			m_file->syncRange(m_offset + m_synced, m_pos - m_synced, false);
+		}
+	}
+
+	m_file->unref();
+}
+
+/**
+ * Report the transfer position.
+ * @param lba All LBAs before this one have been read or written.
+ */
+void StreamHints::advance(uint32_t lba)
+{
+	if (!m_file) {
+		return;
+	}
+
+	const int64_t pos = LBA_TO_BYTES(lba);
+	assert(pos >= m_pos);
+	if (pos > m_pos) {
+		m_pos = pos;
+	}
+
+	if (m_mode == MODE_READ) {
+		// Keep at least one window of readahead in flight.
+		if (m_readahead && m_prefetched < m_size && m_prefetched - m_pos < WINDOW_SIZE) {
+			const int64_t start = (m_prefetched > m_pos ? m_prefetched : m_pos);
+			int64_t end = m_pos + (WINDOW_SIZE * 2);
+			if (end > m_size) {
+				end = m_size;
+			}
+			m_file->advise(m_offset + start, end - start, RefFile::ADVICE_WILLNEED);
+			m_prefetched = end;
+		}
+
+		// Drop consumed data one window at a time.
+		if (m_pos - m_dropped >= WINDOW_SIZE) {
+			m_file->advise(m_offset + m_dropped, m_pos - m_dropped, RefFile::ADVICE_DONTNEED);
+			m_dropped = m_pos;
+		}
+		return;
+	}
+
+	// MODE_WRITE
+	if (m_pos - m_synced >= WINDOW_SIZE) {
+		// Wait for the previous window to reach the disk,
+		// then drop it from the page cache.
+		if (m_synced > m_dropped) {
+			m_file->syncRange(m_offset + m_dropped, m_synced - m_dropped, true);
+			m_file->advise(m_offset + m_dropped, m_synced - m_dropped, RefFile::ADVICE_DONTNEED);
+			m_dropped = m_synced;
+		}
+
+		// Start writing back the new window.
+		m_file->syncRange(m_offset + m_synced, m_pos - m_synced, false);
+		m_synced = m_pos;
+	}
+}
@@ -0,0 +1,101 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * StreamHints.hpp: Page cache hints for bulk transfers.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_STREAMHINTS_HPP__
+#define __RVTHTOOL_LIBRVTH_STREAMHINTS_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stdint.h>
+
+class Reader;
+class RefFile;
+
+/**
+ * Page cache hints for a bulk transfer through a Reader.
+ *
+ * Extracting or importing a bank streams gigabytes of data through
+ * the page cache, which would otherwise evict everything else.
+ * The data is only used once, so it's dropped as soon as possible:
+ *
+ * - Sources are marked as sequential, and the next readahead window
+ *   is requested explicitly. Data that has been consumed is dropped
+ *   from the page cache.
+ * - Destinations start writeback for each window as soon as it has
+ *   been written. Once the previous window has reached the disk,
+ *   it's dropped from the page cache.
+ *
+ * Call advance() after each chunk is read or written. LBAs must be
+ * processed in ascending order, though holes may be skipped.
+ *
+ * Hints are only used for linear Readers, since the file offsets of
+ * other formats don't match the disc image. Unbuffered destinations
+ * don't use the page cache, so they don't need hints either.
+ *
+ * Thread-safety: A StreamHints object must only be used by one
+ * thread at a time.
+ */
+class StreamHints
+{
+	public:
+		enum Mode {
+			MODE_READ,	// Source stream
+			MODE_WRITE,	// Destination stream
+		};
+
+		/**
+		 * Start a bulk transfer.
+		 * Hints are disabled if rvth_io_get_stream_hints() is false.
+		 * @param reader	[in] Reader.
+		 * @param mode		[in] Transfer direction.
+		 * @param lba_len	[in] Number of LBAs that will be transferred.
+		 */
+		StreamHints(Reader *reader, Mode mode, uint32_t lba_len);
+		~StreamHints();
+
+	private:
+		DISABLE_COPY(StreamHints)
+
+	public:
+		/**
+		 * Size of each hint window, in bytes.
+		 * Sources are read ahead by up to two windows.
+		 */
+		static const int64_t WINDOW_SIZE = 8*1024*1024;
+
+		/**
+		 * Are hints being applied for this transfer?
+		 * @return True if hints are being applied.
+		 */
+		inline bool isActive(void) const
+		{
+			return (m_file != nullptr);
+		}
+
+		/**
+		 * Report the transfer position.
+		 * @param lba All LBAs before this one have been read or written.
+		 */
+		void advance(uint32_t lba);
+
+	private:
+		RefFile *m_file;	// File (ref()'d; nullptr if hints are disabled)
+		Mode m_mode;
+		bool m_readahead;	// Request readahead? (MODE_READ only)
+		int64_t m_offset;	// File offset of LBA 0
+		int64_t m_size;		// Size of the transfer, in bytes
+
+		// Positions, relative to m_offset.
+		int64_t m_pos;		// Current position
+		int64_t m_prefetched;	// End of the requested readahead (MODE_READ)
+		int64_t m_synced;	// End of the range being written back (MODE_WRITE)
+		int64_t m_dropped;	// End of the range dropped from the page cache
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_STREAMHINTS_HPP__ */
@@ -0,0 +1,60 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * aligned_malloc.h: Aligned memory allocation.                            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__
+#define __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__
+
+// C includes.
+#include <stddef.h>
+#include <stdlib.h>
+#ifdef _WIN32
+# include <malloc.h>
+#endif /* _WIN32 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate aligned memory.
+ * Memory must be freed using aligned_free().
+ * @param alignment	[in] Alignment. (power of two, multiple of sizeof(void*))
+ * @param size		[in] Size.
+ * @return Allocated memory, or NULL on error.
+ */
+static inline void *aligned_malloc(size_t alignment, size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else /* !_WIN32 */
+	void *ptr;
+	if (posix_memalign(&ptr, alignment, size) != 0) {
+		return NULL;
+	}
+	return ptr;
+#endif /* _WIN32 */
+}
+
+/**
+ * Free memory allocated using aligned_malloc().
+ * @param ptr Memory.
+ */
+static inline void aligned_free(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else /* !_WIN32 */
+	free(ptr);
+#endif /* _WIN32 */
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__ */
@@ -0,0 +1,683 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * bank_cache.cpp: RVT-H bank metadata cache.                              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+#include "rvth.hpp"
+#include "RefFile.hpp"
+#include "reader/Reader.hpp"
+#include "reader/CachedReader.hpp"
+#include "reader/io_backend.h"
+
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/wii_structs.h"
+
+#ifdef HAVE_QUERY
+# include "query.h"
+#endif /* HAVE_QUERY */
+
+// C includes.
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+# include <process.h>
+# define getpid() _getpid()
+#else /* !_WIN32 */
+# include <dirent.h>
+# include <unistd.h>
+#endif /* _WIN32 */
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+using std::pair;
+using std::tstring;
+using std::vector;
+
+// SHA-1 is used for the validation hash.
+#include <nettle/sha1.h>
+
+/**
+ * Bank metadata cache file format.
+ *
+ * Cache files are only read by the system that wrote them, so they're
+ * stored in host-endian using the native structure layout. The header
+ * and entry sizes are checked when loading the file in case the
+ * layout is changed.
+ *
+ * The header is followed by one BankCache_Entry per bank.
+ * Partition tables aren't cached; they're loaded when needed.
+ * They're included in the validation hash, though, along with
+ * the game partition's ticket and TMD, since the cached crypto
+ * and signature fields are read from them.
+ */
+#define BANK_CACHE_MAGIC "RVTHBC01"
+typedef struct _BankCache_Header {
+	char magic[8];			// BANK_CACHE_MAGIC
+	uint32_t header_size;		// sizeof(BankCache_Header)
+	uint32_t entry_size;		// sizeof(BankCache_Entry)
+	uint32_t bank_count;		// Number of banks.
+	uint32_t details;		// Banks whose deferred fields are valid. (bitfield)
+	uint8_t hash[SHA1_DIGEST_SIZE];	// Validation hash.
+	uint8_t image_type;		// RvtH_ImageType_e
+	uint8_t nhcd_status;		// NHCD_Status_e
+	uint8_t reserved[2];
+} BankCache_Header;
+
+typedef struct _BankCache_Entry {
+	int64_t timestamp;		// Timestamp. (-1 for none)
+	uint32_t lba_start;		// Starting LBA.
+	uint32_t lba_len;		// Length, in LBAs.
+	uint32_t reader_lba_len;	// Reader length, in LBAs. (0 if no reader)
+	uint32_t aplerr_val[3];		// AppLoader values.
+	uint8_t type;			// Bank type.
+	uint8_t region_code;		// Region code.
+	uint8_t is_deleted;		// If non-zero, this entry was deleted.
+	uint8_t aplerr;			// AppLoader error.
+	uint8_t crypto_type;		// Encryption type.
+	uint8_t ios_version;		// IOS version.
+	RvtH_SigInfo ticket;		// Ticket encryption/signature.
+	RvtH_SigInfo tmd;		// TMD encryption/signature.
+	GCN_DiscHeader discHeader;	// Disc header.
+} BankCache_Entry;
+
+// Maximum number of cache files.
+// The oldest cache files are deleted when a cache file is saved.
+#define BANK_CACHE_MAX_FILES 32
+
+/**
+ * Get the bank metadata cache directory.
+ * - Windows: %LOCALAPPDATA%\rvthtool
+ * - Other: $XDG_CACHE_HOME/rvthtool, or ~/.cache/rvthtool
+ * @param pParent [out,opt] Parent directory, which might not exist either.
+ * @return Cache directory, or empty string if it can't be determined.
+ */
+static tstring getCacheDir(tstring *pParent = nullptr)
+{
+	tstring dir;
+
+#ifdef _WIN32
+	const TCHAR *const localAppData = _tgetenv(_T("LOCALAPPDATA"));
+	if (!localAppData || localAppData[0] == 0) {
+		return tstring();
+	}
+	dir = localAppData;
+	if (pParent) {
+		*pParent = dir;
+	}
+	dir += _T("\\rvthtool");
+#else /* !_WIN32 */
+	// XDG Base Directory Specification:
+	// XDG_CACHE_HOME must be an absolute path.
+	const char *const xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] == '/') {
+		dir = xdg_cache_home;
+	} else {
+		const char *const home = getenv("HOME");
+		if (!home || home[0] == 0) {
+			return tstring();
+		}
+		dir = home;
+		dir += "/.cache";
+	}
+	if (pParent) {
+		*pParent = dir;
+	}
+	dir += "/rvthtool";
+#endif /* _WIN32 */
+
+	return dir;
+}
+
+/**
+ * Create a directory if it doesn't exist.
+ * @param dir Directory.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int mkdirIfMissing(const tstring &dir)
+{
+#ifdef _WIN32
+	int ret = _tmkdir(dir.c_str());
+#else /* !_WIN32 */
+	int ret = _tmkdir(dir.c_str(), 0700);
+#endif /* _WIN32 */
+	if (ret != 0 && errno != EEXIST) {
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Delete the oldest cache files if there are too many of them.
+ *
+ * HDD image cache files are keyed by file ID, so the cache files
+ * for images that were deleted or copied are never used again.
+ * They're deleted once there are more than BANK_CACHE_MAX_FILES
+ * cache files. The cache files that were saved least recently
+ * are deleted first.
+ *
+ * @param cacheDir Cache directory.
+ */
+static void pruneCacheDir(const tstring &cacheDir)
+{
+	// Cache files and their modification times.
+	vector<pair<int64_t, tstring> > files;
+
+#ifdef _WIN32
+	WIN32_FIND_DATA findData;
+	const tstring pattern = cacheDir + _T("\\*.cache");
+	HANDLE hFind = FindFirstFile(pattern.c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	do {
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		const int64_t mtime = ((int64_t)findData.ftLastWriteTime.dwHighDateTime << 32) |
+		                      findData.ftLastWriteTime.dwLowDateTime;
+		files.emplace_back(mtime, cacheDir + _T('\\') + findData.cFileName);
+	} while (FindNextFile(hFind, &findData));
+	FindClose(hFind);
+#else /* !_WIN32 */
+	DIR *const pDir = opendir(cacheDir.c_str());
+	if (!pDir) {
+		return;
+	}
+	struct dirent *d;
+	while ((d = readdir(pDir)) != nullptr) {
+		// Temporary files from saveBankCache() don't end with ".cache".
+		const size_t len = strlen(d->d_name);
+		if (len <= 6 || strcmp(&d->d_name[len - 6], ".cache") != 0)
+			continue;
+
+		const tstring filename = cacheDir + '/' + d->d_name;
+		struct stat sb;
+		if (stat(filename.c_str(), &sb) != 0 || !S_ISREG(sb.st_mode))
+			continue;
+		files.emplace_back(static_cast<int64_t>(sb.st_mtime), filename);
+	}
+	closedir(pDir);
+#endif /* _WIN32 */
+
+	if (files.size() <= BANK_CACHE_MAX_FILES) {
+		// Not too many cache files.
+		return;
+	}
+
+	// Delete the oldest cache files.
+	std::sort(files.begin(), files.end());
+	const size_t count = files.size() - BANK_CACHE_MAX_FILES;
+	for (size_t i = 0; i < count; i++) {
+		_tremove(files[i].second.c_str());
+	}
+}
+
+/**
+ * Convert a binary value to a hexadecimal string.
+ * @param data Data.
+ * @param size Size of data, in bytes.
+ * @return Hexadecimal string.
+ */
+static tstring toHex(const uint8_t *data, size_t size)
+{
+	static const TCHAR hex_digits[] = _T("0123456789abcdef");
+	tstring str;
+	str.reserve(size * 2);
+	for (; size > 0; size--, data++) {
+		str += hex_digits[*data >> 4];
+		str += hex_digits[*data & 0x0F];
+	}
+	return str;
+}
+
+/**
+ * Add a bank's partition tables and game partition ticket and TMD
+ * to the validation hash.
+ *
+ * The crypto type, IOS version, and signature status are read from
+ * the ticket and TMD, so the cached values are only used if these
+ * haven't changed. (The TMD has the H3 table hash, which covers the
+ * rest of the game partition, including the AppLoader.)
+ *
+ * NOTE: The bank types aren't known yet, so this is done for all banks.
+ * For other types of banks, only the partition table area is hashed.
+ *
+ * @param sha1		[in,out] Validation hash.
+ * @param f_img		[in] RefFile*
+ * @param bank_addr	[in] Bank address, in bytes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int hashBankPartitions(struct sha1_ctx *sha1, RefFile *f_img, int64_t bank_addr)
+{
+	// Volume group table and partition tables.
+	// NOTE: Same size as ptbl_t in ptbl.cpp.
+	uint8_t ptbl[LBA_SIZE*2];
+	errno = 0;
+	size_t size = f_img->preadAt(bank_addr + RVL_VolumeGroupTable_ADDRESS, ptbl, sizeof(ptbl));
+	if (size == 0 && errno != 0) {
+		// Read error.
+		return -errno;
+	}
+	sha1_update(sha1, size, ptbl);
+	if (size != sizeof(ptbl)) {
+		// End of the disk image.
+		return 0;
+	}
+
+	const RVL_VolumeGroupTable *const vgtbl = reinterpret_cast<const RVL_VolumeGroupTable*>(ptbl);
+	for (unsigned int vg = 0; vg < ARRAY_SIZE(vgtbl->vg); vg++) {
+		const uint32_t count = be32_to_cpu(vgtbl->vg[vg].count);
+		const int64_t ptbl_offset = ((int64_t)be32_to_cpu(vgtbl->vg[vg].addr) << 2) - RVL_VolumeGroupTable_ADDRESS;
+		if (count == 0 || ptbl_offset < (int64_t)sizeof(*vgtbl) ||
+		    ptbl_offset + ((int64_t)count * sizeof(RVL_PartitionTableEntry)) > (int64_t)sizeof(ptbl))
+		{
+			// No partitions, or the partition table is invalid.
+			continue;
+		}
+
+		const RVL_PartitionTableEntry *pte =
+			reinterpret_cast<const RVL_PartitionTableEntry*>(&ptbl[ptbl_offset]);
+		for (uint32_t i = 0; i < count; i++, pte++) {
+			if (be32_to_cpu(pte->type) != 0) {
+				// Not the game partition.
+				continue;
+			}
+
+			// Ticket and TMD location.
+			const int64_t part_addr = bank_addr + ((int64_t)be32_to_cpu(pte->addr) << 2);
+			RVL_PartitionHeader header;
+			static const size_t header_size = offsetof(RVL_PartitionHeader, data);
+			errno = 0;
+			size = f_img->preadAt(part_addr, &header, header_size);
+			if (size == 0 && errno != 0) {
+				// Read error.
+				return -errno;
+			}
+			sha1_update(sha1, size, header.u8);
+			if (size != header_size) {
+				// End of the disk image.
+				return 0;
+			}
+
+			// TMD. Only the part that's in the partition header is used.
+			const int64_t tmd_offset = (int64_t)be32_to_cpu(header.tmd_offset) << 2;
+			const uint32_t tmd_size = be32_to_cpu(header.tmd_size);
+			if (tmd_offset < (int64_t)header_size || tmd_offset >= (int64_t)sizeof(header))
+				continue;
+			const size_t tmd_read = std::min<size_t>(tmd_size, sizeof(header) - tmd_offset);
+			errno = 0;
+			size = f_img->preadAt(part_addr + tmd_offset, &header.u8[tmd_offset], tmd_read);
+			if (size == 0 && errno != 0 && tmd_read != 0) {
+				// Read error.
+				return -errno;
+			}
+			sha1_update(sha1, size, &header.u8[tmd_offset]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Get a bank's starting LBA.
+ * The starting LBA from the bank table is used if it's valid,
+ * the same as in RvtH::initBankEntries().
+ * @param nhcd_entries	[in,opt] NHCD bank table entries. (NULL for the default bank table)
+ * @param bank		[in] Bank number.
+ * @param bankCount	[in] Number of banks.
+ * @return Starting LBA.
+ */
+static uint32_t getBankStartLBA(const NHCD_BankEntry *nhcd_entries, unsigned int bank, unsigned int bankCount)
+{
+	if (nhcd_entries) {
+		const NHCD_BankEntry *const nhcd_entry = &nhcd_entries[bank];
+		switch (be32_to_cpu(nhcd_entry->type)) {
+			case NHCD_BankType_GCN:
+			case NHCD_BankType_Wii_SL:
+			case NHCD_BankType_Wii_DL: {
+				const uint32_t lba_start = be32_to_cpu(nhcd_entry->lba_start);
+				const uint32_t lba_len = be32_to_cpu(nhcd_entry->lba_len);
+				if (lba_start != 0 && lba_len != 0) {
+					return lba_start;
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	// Default starting LBA.
+	return NHCD_BANK_START_LBA(bank, bankCount);
+}
+
+/**
+ * Load the bank entries from the bank metadata cache.
+ *
+ * The cache file is selected using the RVT-H Reader's serial
+ * number, or the HDD image's file ID. It's only used if the
+ * raw bank table, the first LBA of each bank, and each bank's
+ * partition tables, ticket, and TMD match the values that were
+ * hashed when the cache file was saved.
+ *
+ * m_entries, m_bankCount, m_imageType, and m_NHCD_status
+ * must have already been set.
+ *
+ * If the cache can be used but doesn't have a valid entry,
+ * the bank entries will be saved by saveBankCache().
+ *
+ * @param f_img		[in] RefFile*
+ * @param nhcd_table	[in] Raw bank table, as read from the disk.
+ * @param nhcd_size	[in] Size of nhcd_table, in bytes.
+ * @return 0 if the bank entries were loaded; negative POSIX error code if not.
+ */
+int RvtH::loadBankCache(RefFile *f_img, const void *nhcd_table, size_t nhcd_size)
+{
+	assert(m_entries != nullptr);
+	assert(m_bankCount <= NHCD_BANK_COUNT_MAX);
+	if (!rvth_io_get_bank_cache()) {
+		// Bank metadata cache is disabled.
+		return -ENOTSUP;
+	}
+
+	const tstring cacheDir = getCacheDir();
+	if (cacheDir.empty()) {
+		return -ENOENT;
+	}
+
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+
+	// Determine the cache key.
+	// - RVT-H Reader: Device serial number.
+	// - HDD image: File ID.
+	tstring key;
+	if (f_img->isDevice()) {
+#ifdef HAVE_QUERY
+		// NOTE: Device filenames may be reassigned to other
+		// devices, so the serial number is required.
+		TCHAR *const serial = rvth_get_device_serial_number(f_img->filename(), nullptr);
+		if (!serial) {
+			return -ENOENT;
+		}
+		key = _T("rvth-");
+		for (const TCHAR *p = serial; *p != 0; p++) {
+			const TCHAR chr = *p;
+			if ((chr >= _T('0') && chr <= _T('9')) ||
+			    (chr >= _T('A') && chr <= _T('Z')) ||
+			    (chr >= _T('a') && chr <= _T('z')))
+			{
+				key += chr;
+			}
+		}
+		free(serial);
+#else /* !HAVE_QUERY */
+		// Can't get the device serial number.
+		return -ENOTSUP;
+#endif /* HAVE_QUERY */
+	} else {
+		// Use the file's device and inode numbers (and the filename,
+		// in case inode numbers aren't supported) as the key.
+		// The file's size and modification time are hashed for validation.
+#ifdef _WIN32
+		struct _stati64 sb;
+		if (_tstati64(f_img->filename(), &sb) != 0) {
+			return -errno;
+		}
+#else /* !_WIN32 */
+		struct stat sb;
+		if (stat(f_img->filename(), &sb) != 0) {
+			return -errno;
+		}
+#endif /* _WIN32 */
+
+		struct sha1_ctx sha1_key;
+		uint8_t digest[SHA1_DIGEST_SIZE];
+		const uint64_t dev = sb.st_dev;
+		const uint64_t ino = sb.st_ino;
+		sha1_init(&sha1_key);
+		sha1_update(&sha1_key, _tcslen(f_img->filename()) * sizeof(TCHAR),
+			reinterpret_cast<const uint8_t*>(f_img->filename()));
+		sha1_update(&sha1_key, sizeof(dev), reinterpret_cast<const uint8_t*>(&dev));
+		sha1_update(&sha1_key, sizeof(ino), reinterpret_cast<const uint8_t*>(&ino));
+		sha1_digest(&sha1_key, sizeof(digest), digest);
+		key = _T("img-");
+		key += toHex(digest, 8);
+
+		const int64_t size = sb.st_size;
+		const int64_t mtime = sb.st_mtime;
+		sha1_update(&sha1, sizeof(size), reinterpret_cast<const uint8_t*>(&size));
+		sha1_update(&sha1, sizeof(mtime), reinterpret_cast<const uint8_t*>(&mtime));
+	}
+
+	// Validation hash: Bank table, plus the first LBA and
+	// the partition tables, ticket, and TMD of each bank.
+	const uint8_t hdr_info[3] = {
+		static_cast<uint8_t>(m_imageType),
+		static_cast<uint8_t>(m_NHCD_status),
+		static_cast<uint8_t>(m_bankCount),
+	};
+	sha1_update(&sha1, sizeof(hdr_info), hdr_info);
+	sha1_update(&sha1, nhcd_size, static_cast<const uint8_t*>(nhcd_table));
+
+	// Bank table entries, if the bank table is valid.
+	const NHCD_BankEntry *nhcd_entries = nullptr;
+	if (nhcd_size >= sizeof(NHCD_BankTable_Header) + (m_bankCount * sizeof(NHCD_BankEntry))) {
+		nhcd_entries = reinterpret_cast<const NHCD_BankEntry*>(
+			static_cast<const uint8_t*>(nhcd_table) + sizeof(NHCD_BankTable_Header));
+	}
+
+	for (unsigned int i = 0; i < m_bankCount; i++) {
+		const int64_t bank_addr = LBA_TO_BYTES((int64_t)getBankStartLBA(nhcd_entries, i, m_bankCount));
+		uint8_t sector_buf[LBA_SIZE];
+		errno = 0;
+		const size_t size = f_img->preadAt(bank_addr, sector_buf, sizeof(sector_buf));
+		if (size == 0 && errno != 0) {
+			// Read error.
+			return -errno;
+		}
+		sha1_update(&sha1, size, sector_buf);
+
+		const int ret = hashBankPartitions(&sha1, f_img, bank_addr);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	sha1_digest(&sha1, sizeof(m_bankCacheHash), m_bankCacheHash);
+
+	// Entries will be saved to this file by saveBankCache().
+	m_bankCacheFile = cacheDir;
+#ifdef _WIN32
+	m_bankCacheFile += _T('\\');
+#else /* !_WIN32 */
+	m_bankCacheFile += '/';
+#endif /* _WIN32 */
+	m_bankCacheFile += key;
+	m_bankCacheFile += _T(".cache");
+	m_bankCacheHit = false;
+
+	// Load the cache file.
+	FILE *f_cache = _tfopen(m_bankCacheFile.c_str(), _T("rb"));
+	if (!f_cache) {
+		// No cache file.
+		return -ENOENT;
+	}
+
+	BankCache_Header header;
+	vector<BankCache_Entry> cache_entries(m_bankCount);
+	size_t size = fread(&header, 1, sizeof(header), f_cache);
+	if (size != sizeof(header) ||
+	    memcmp(header.magic, BANK_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.header_size != sizeof(header) ||
+	    header.entry_size != sizeof(BankCache_Entry) ||
+	    header.bank_count != m_bankCount ||
+	    header.image_type != m_imageType ||
+	    header.nhcd_status != m_NHCD_status ||
+	    memcmp(header.hash, m_bankCacheHash, sizeof(header.hash)) != 0)
+	{
+		// Cache file is invalid or out of date.
+		fclose(f_cache);
+		return -ESTALE;
+	}
+	size = fread(cache_entries.data(), sizeof(BankCache_Entry), m_bankCount, f_cache);
+	fclose(f_cache);
+	if (size != m_bankCount) {
+		// Cache file is truncated.
+		return -ESTALE;
+	}
+
+	// Initialize the bank entries.
+	for (unsigned int i = 0; i < m_bankCount; i++) {
+		const BankCache_Entry *const ce = &cache_entries[i];
+		RvtH_BankEntry *const entry = &m_entries[i];
+
+		entry->lba_start = ce->lba_start;
+		entry->lba_len = ce->lba_len;
+		entry->timestamp = static_cast<time_t>(ce->timestamp);
+		entry->type = ce->type;
+		entry->region_code = ce->region_code;
+		entry->is_deleted = !!ce->is_deleted;
+		entry->aplerr = ce->aplerr;
+		memcpy(entry->aplerr_val, ce->aplerr_val, sizeof(entry->aplerr_val));
+		memcpy(&entry->discHeader, &ce->discHeader, sizeof(entry->discHeader));
+		entry->crypto_type = ce->crypto_type;
+		entry->ios_version = ce->ios_version;
+		entry->ticket = ce->ticket;
+		entry->tmd = ce->tmd;
+
+		if (ce->reader_lba_len != 0) {
+			// Initialize the disc image reader.
+			entry->reader = CachedReader::wrap(Reader::open(f_img, ce->lba_start, ce->reader_lba_len));
+			if (!entry->reader) {
+				// Unable to open the reader.
+				// Clear the entries so they can be reinitialized.
+				const int err = (errno != 0 ? errno : EIO);
+				for (unsigned int j = 0; j < i; j++) {
+					delete m_entries[j].reader;
+				}
+				memset(m_entries, 0, m_bankCount * sizeof(*m_entries));
+				return -err;
+			}
+		}
+	}
+
+	// Deferred fields were only saved for banks that had them.
+	m_bankDetailsLoaded.store(header.details);
+	m_bankCacheDetails = header.details;
+	m_bankCacheHit = true;
+	return 0;
+}
+
+/**
+ * Save the bank entries to the bank metadata cache.
+ * This is called by the destructor.
+ *
+ * If the disk image was made writable, the cache file is
+ * deleted instead, since the banks may have been changed.
+ */
+void RvtH::saveBankCache(void)
+{
+	if (m_bankCacheFile.empty()) {
+		// Not cached.
+		return;
+	}
+
+	if (m_file->isWritable()) {
+		// The banks may have been changed.
+		// The disk will need to be rescanned.
+		_tremove(m_bankCacheFile.c_str());
+		return;
+	}
+
+	const uint32_t details = m_bankDetailsLoaded.load();
+	if (m_bankCacheHit && details == m_bankCacheDetails) {
+		// Cache file is up to date.
+		return;
+	}
+
+	// Make sure the cache directory exists.
+	tstring cacheParentDir;
+	const tstring cacheDir = getCacheDir(&cacheParentDir);
+	if (mkdirIfMissing(cacheParentDir) != 0 || mkdirIfMissing(cacheDir) != 0) {
+		// Unable to create the cache directory.
+		return;
+	}
+
+	BankCache_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BANK_CACHE_MAGIC, sizeof(header.magic));
+	header.header_size = sizeof(header);
+	header.entry_size = sizeof(BankCache_Entry);
+	header.bank_count = m_bankCount;
+	header.details = details;
+	memcpy(header.hash, m_bankCacheHash, sizeof(header.hash));
+	header.image_type = m_imageType;
+	header.nhcd_status = m_NHCD_status;
+
+	vector<BankCache_Entry> cache_entries(m_bankCount);
+	memset(cache_entries.data(), 0, m_bankCount * sizeof(BankCache_Entry));
+	for (unsigned int i = 0; i < m_bankCount; i++) {
+		BankCache_Entry *const ce = &cache_entries[i];
+		const RvtH_BankEntry *const entry = &m_entries[i];
+
+		ce->timestamp = entry->timestamp;
+		ce->lba_start = entry->lba_start;
+		ce->lba_len = entry->lba_len;
+		ce->reader_lba_len = (entry->reader ? entry->reader->lba_len() : 0);
+		memcpy(ce->aplerr_val, entry->aplerr_val, sizeof(ce->aplerr_val));
+		ce->type = entry->type;
+		ce->region_code = entry->region_code;
+		ce->is_deleted = entry->is_deleted;
+		ce->aplerr = entry->aplerr;
+		ce->crypto_type = entry->crypto_type;
+		ce->ios_version = entry->ios_version;
+		ce->ticket = entry->ticket;
+		ce->tmd = entry->tmd;
+		memcpy(&ce->discHeader, &entry->discHeader, sizeof(ce->discHeader));
+	}
+
+	// Write to a temporary file, then rename it.
+	// Another process might be using the same cache file.
+	TCHAR pid_buf[16];
+	_sntprintf(pid_buf, ARRAY_SIZE(pid_buf), _T(".%u"), static_cast<unsigned int>(getpid()));
+	const tstring tmpFile = m_bankCacheFile + pid_buf;
+	FILE *f_cache = _tfopen(tmpFile.c_str(), _T("wb"));
+	if (!f_cache) {
+		// Unable to create the cache file.
+		return;
+	}
+	bool ok = (fwrite(&header, 1, sizeof(header), f_cache) == sizeof(header));
+	ok &= (fwrite(cache_entries.data(), sizeof(BankCache_Entry), m_bankCount, f_cache) == m_bankCount);
+	ok &= (fclose(f_cache) == 0);
+	if (!ok) {
+		_tremove(tmpFile.c_str());
+		return;
+	}
+
+#ifdef _WIN32
+	// Windows can't rename over an existing file.
+	_tremove(m_bankCacheFile.c_str());
+#endif /* _WIN32 */
+	if (_trename(tmpFile.c_str(), m_bankCacheFile.c_str()) != 0) {
+		_tremove(tmpFile.c_str());
+		return;
+	}
+
+	// Don't let cache files for old HDD images pile up.
+	pruneCacheDir(cacheDir);
+}
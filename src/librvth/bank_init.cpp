@@ -31,6 +31,7 @@
 #include "rvth_time.h"
 #include "rvth_error.h"
 #include "reader/Reader.hpp"
+#include "reader/CachedReader.hpp"
 
 // C includes. (C++ namespace)
 #include <cassert>
@@ -110,17 +111,22 @@ int rvth_init_BankEntry_region(RvtH_BankEntry *entry)
 /**
  * Set the crypto_type and sig_type fields in an RvtH_BankEntry.
  * The reader and discHeader fields must have already been set.
+ *
+ * NOTE: The signatures aren't validated here.
+ * Use rvth_init_BankEntry_sig() to set the sig_status fields.
+ *
  * @param entry		[in,out] RvtH_BankEntry
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
 int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 {
 	const pt_entry_t *game_pte;	// Game partition entry.
-	uint32_t lba_size;
-	uint32_t tmd_size;
 
 	// Partition header.
-	RVL_PartitionHeader header;
+	// NOTE: If the Reader is memory-mapped, the header is
+	// borrowed from the mapping instead of being copied.
+	RVL_PartitionHeader header_buf;
+	const RVL_PartitionHeader *header;
 	const RVL_TMD_Header *tmdHeader;
 
 	assert(entry->reader != NULL);
@@ -172,14 +178,15 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 
 	// Found the game partition.
 	// Read the partition header.
-	lba_size = entry->reader->read(&header, game_pte->lba_start, BYTES_TO_LBA(sizeof(header)));
-	if (lba_size != BYTES_TO_LBA(sizeof(header))) {
+	header = static_cast<const RVL_PartitionHeader*>(entry->reader->mapOrRead(
+		&header_buf, game_pte->lba_start, BYTES_TO_LBA(sizeof(header_buf))));
+	if (!header) {
 		// Error reading the partition header.
 		return -EIO;
 	}
 
 	// Check the ticket signature issuer.
-	switch (cert_get_issuer_from_name(header.ticket.issuer)) {
+	switch (cert_get_issuer_from_name(header->ticket.issuer)) {
 		case RVL_CERT_ISSUER_RETAIL_TICKET:
 			// Retail certificate.
 			entry->ticket.sig_type = RVL_SigType_Retail;
@@ -193,13 +200,9 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 			break;
 	}
 
-	// Validate the signature.
-	entry->ticket.sig_status = sig_verify(
-		(const uint8_t*)&header.ticket, sizeof(header.ticket));
-
 	// Check the TMD signature issuer.
-	// TODO: Verify header.tmd_offset?
-	tmdHeader = (const RVL_TMD_Header*)header.data;
+	// TODO: Verify header->tmd_offset?
+	tmdHeader = (const RVL_TMD_Header*)header->data;
 	switch (cert_get_issuer_from_name(tmdHeader->issuer)) {
 		case RVL_CERT_ISSUER_RETAIL_TMD:
 			// Retail certificate.
@@ -214,13 +217,6 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 			break;
 	}
 
-	// Check the TMD size.
-	tmd_size = be32_to_cpu(header.tmd_size);
-	if (tmd_size <= sizeof(header.data)) {
-		// TMD is not too big. We can validate the signature.
-		entry->tmd.sig_status = sig_verify(header.data, tmd_size);
-	}
-
 	// Get the required IOS version.
 	if (be32_to_cpu(tmdHeader->sys_version.hi) == 1) {
 		uint32_t ios_tid_lo = be32_to_cpu(tmdHeader->sys_version.lo);
@@ -238,7 +234,7 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 		switch (entry->ticket.sig_type) {
 			case RVL_SigType_Retail:
 				// Retail may be either Common Key or Korean Key.
-				switch (header.ticket.common_key_index) {
+				switch (header->ticket.common_key_index) {
 					case 0:
 						entry->crypto_type = RVL_CryptoType_Retail;
 						break;
@@ -253,7 +249,7 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 
 			case RVL_SigType_Debug:
 				// There's only one debug key.
-				if (header.ticket.common_key_index == 0) {
+				if (header->ticket.common_key_index == 0) {
 					entry->crypto_type = RVL_CryptoType_Debug;
 				} else {
 					entry->crypto_type = RVL_CryptoType_Unknown;
@@ -270,6 +266,83 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 	return 0;
 }
 
+/**
+ * Set the sig_status fields in an RvtH_BankEntry.
+ * The reader field must have already been set, and
+ * rvth_init_BankEntry_crypto() must have already been called.
+ *
+ * This is separate from rvth_init_BankEntry_crypto(), since
+ * validating the signatures is slower than reading the issuers.
+ *
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_init_BankEntry_sig(RvtH_BankEntry *entry)
+{
+	const pt_entry_t *game_pte;	// Game partition entry.
+	uint32_t tmd_size;
+
+	// Partition header.
+	RVL_PartitionHeader header_buf;
+	const RVL_PartitionHeader *header;
+
+	assert(entry->reader != NULL);
+
+	// Clear the signature status initially.
+	entry->ticket.sig_status = RVL_SigStatus_Unknown;
+	entry->tmd.sig_status = RVL_SigStatus_Unknown;
+
+	switch (entry->type) {
+		case RVTH_BankType_Empty:
+			// Empty bank.
+			return RVTH_ERROR_BANK_EMPTY;
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank.
+			return RVTH_ERROR_BANK_UNKNOWN;
+		case RVTH_BankType_GCN:
+			// GameCube image. No signatures.
+			return 0;
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			return RVTH_ERROR_BANK_DL_2;
+
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Wii disc image.
+			break;
+	}
+
+	// Find the game partition.
+	game_pte = rvth_ptbl_find_game(entry);
+	if (!game_pte) {
+		// No game partition...
+		return RVTH_ERROR_NO_GAME_PARTITION;
+	}
+
+	// Read the partition header.
+	header = static_cast<const RVL_PartitionHeader*>(entry->reader->mapOrRead(
+		&header_buf, game_pte->lba_start, BYTES_TO_LBA(sizeof(header_buf))));
+	if (!header) {
+		// Error reading the partition header.
+		return -EIO;
+	}
+
+	// Validate the ticket signature.
+	entry->ticket.sig_status = sig_verify(
+		(const uint8_t*)&header->ticket, sizeof(header->ticket));
+
+	// Check the TMD size.
+	tmd_size = be32_to_cpu(header->tmd_size);
+	if (tmd_size <= sizeof(header->data)) {
+		// TMD is not too big. We can validate the signature.
+		entry->tmd.sig_status = sig_verify(header->data, tmd_size);
+	}
+
+	return 0;
+}
+
 /**
  * Check the address limit for a DOL header.
  * @param dol DOL header.
@@ -585,8 +658,46 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 	return 0;
 }
 
+/**
+ * Get the maximum LBA length for a bank's Reader.
+ * - GCN or Wii SL: Full bank size.
+ * - Wii DL: Dual-layer bank size.
+ * - First bank in extended bank table: Smaller bank size.
+ * @param type		[in] Bank type. (See RvtH_BankType_e.)
+ * @param lba_start	[in] Starting LBA.
+ * @return Maximum LBA length.
+ */
+static uint32_t rvth_bank_reader_lba_len(uint8_t type, uint32_t lba_start)
+{
+	if (lba_start < NHCD_BANKTABLE_ADDRESS_LBA) {
+		// Bank starts before the bank table.
+		// This is a relocated Bank 1 on a device with
+		// an extended bank table, so it can only support
+		// GCN disc images.
+		return NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA;
+	}
+
+	// Use the default LBA length based on bank type.
+	switch (type) {
+		default:
+		case RVTH_BankType_Empty:
+		case RVTH_BankType_Unknown:
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Full bank.
+			return NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
+
+		case RVTH_BankType_Wii_DL:
+			// Dual-layer bank.
+			return NHCD_BANK_WII_DL_SIZE_RVTR_LBA;
+	}
+}
+
 /**
  * Initialize an RVT-H bank entry from an opened HDD image.
+ * The signature and AppLoader fields are initialized later
+ * by rvth_init_BankEntry_details().
  * @param entry			[out] RvtH_BankEntry
  * @param f_img			[in] RefFile*
  * @param type			[in] Bank type. (See RvtH_BankType_e.)
@@ -620,13 +731,26 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		return 0;
 	}
 
+	// Initialize the disc image reader.
+	// Small metadata reads go through the block cache, so each
+	// region of the bank only needs to be read from the disk once.
+	reader_lba_len = rvth_bank_reader_lba_len(type, lba_start);
+	entry->reader = CachedReader::wrap(Reader::open(f_img, lba_start, reader_lba_len));
+	if (!entry->reader) {
+		// Unable to open the bank.
+		ret = -errno;
+		return (ret != 0 ? ret : -EIO);
+	}
+
 	// Read the GCN disc header.
 	// TODO: For non-deleted banks, verify the magic number?
-	ret = rvth_disc_header_get(f_img, lba_start, &entry->discHeader, &isDeleted);
+	ret = rvth_disc_header_get(entry->reader, &entry->discHeader, &isDeleted);
 	if (ret < 0) {
 		// Error...
 		// TODO: Mark the bank as invalid?
 		memset(&entry->discHeader, 0, sizeof(entry->discHeader));
+		delete entry->reader;
+		entry->reader = nullptr;
 		return ret;
 	}
 
@@ -637,35 +761,12 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		// Bank type was determined by rvth_disc_header_get().
 		type = (uint8_t)ret;
 		entry->type = type;
-	}
 
-	// Determine the maximum LBA length for the Reader:
-	// - GCN or Wii SL: Full bank size.
-	// - Wii DL: Dual-layer bank size.
-	// - First bank in extended bank table: Smaller bank size.
-	if (lba_start < NHCD_BANKTABLE_ADDRESS_LBA) {
-		// Bank starts before the bank table.
-		// This is a relocated Bank 1 on a device with
-		// an extended bank table, so it can only support
-		// GCN disc images.
-		reader_lba_len = NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA;
-	} else {
-		// Use the default LBA length based on bank type.
-		switch (type) {
-			default:
-			case RVTH_BankType_Empty:
-			case RVTH_BankType_Unknown:
-			case RVTH_BankType_GCN:
-			case RVTH_BankType_Wii_SL:
-			case RVTH_BankType_Wii_DL_Bank2:
-				// Full bank.
-				reader_lba_len = NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
-				break;
-
-			case RVTH_BankType_Wii_DL:
-				// Dual-layer bank.
-				reader_lba_len = NHCD_BANK_WII_DL_SIZE_RVTR_LBA;
-				break;
+		// The Reader length may need to be adjusted for the new type.
+		if (rvth_bank_reader_lba_len(type, lba_start) != reader_lba_len) {
+			reader_lba_len = rvth_bank_reader_lba_len(type, lba_start);
+			delete entry->reader;
+			entry->reader = CachedReader::wrap(Reader::open(f_img, lba_start, reader_lba_len));
 		}
 	}
 
@@ -680,10 +781,6 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 	// Set the bank entry's LBA length.
 	entry->lba_len = lba_len;
 
-	// Initialize the disc image reader.
-	// TODO: Error handling.
-	entry->reader = Reader::open(f_img, lba_start, reader_lba_len);
-
 	if (type == RVTH_BankType_Empty) {
 		// We're done here.
 		return 0;
@@ -694,14 +791,44 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		entry->timestamp = rvth_timestamp_parse(nhcd_timestamp);
 	}
 
+	if (!entry->reader) {
+		// No reader. Can't read anything else.
+		return 0;
+	}
+
 	// TODO: Error handling.
 	// Initialize the region code.
 	rvth_init_BankEntry_region(entry);
 	// Initialize the encryption status.
 	rvth_init_BankEntry_crypto(entry);
-	// Initialize the AppLoader error status.
-	rvth_init_BankEntry_AppLoader(entry);
+
+	// NOTE: The signature status and AppLoader error status
+	// are initialized later by rvth_init_BankEntry_details().
 
 	// We're done here.
 	return 0;
 }
+
+/**
+ * Initialize the slower RvtH_BankEntry fields:
+ * - Ticket and TMD signature status
+ * - AppLoader error status
+ *
+ * These fields aren't needed to identify the bank, so RvtH
+ * defers them until the bank entry is first requested.
+ *
+ * @param entry		[in,out] RvtH_BankEntry
+ */
+void rvth_init_BankEntry_details(RvtH_BankEntry *entry)
+{
+	if (!entry->reader) {
+		// No reader. The bank is either empty or invalid.
+		return;
+	}
+
+	// TODO: Error handling.
+	// Initialize the signature status.
+	rvth_init_BankEntry_sig(entry);
+	// Initialize the AppLoader error status.
+	rvth_init_BankEntry_AppLoader(entry);
+}
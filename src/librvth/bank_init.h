@@ -51,6 +51,15 @@ int rvth_init_BankEntry_region(RvtH_BankEntry *entry);
  */
 int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry);
 
+/**
+ * Set the sig_status fields in an RvtH_BankEntry.
+ * The reader field must have already been set, and
+ * rvth_init_BankEntry_crypto() must have already been called.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_init_BankEntry_sig(RvtH_BankEntry *entry);
+
 /**
  * Set the apploader_error field in an RvtH_BankEntry.
  * The reader field must have already been set.
@@ -61,6 +70,8 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry);
 
 /**
  * Initialize an RVT-H bank entry from an opened HDD image.
+ * The signature and AppLoader fields are initialized later
+ * by rvth_init_BankEntry_details().
  * @param entry			[out] RvtH_BankEntry
  * @param f_img			[in] RefFile*
  * @param type			[in] Bank type. (See RvtH_BankType_e.)
@@ -73,6 +84,18 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 	uint8_t type, uint32_t lba_start, uint32_t lba_len,
 	const char *nhcd_timestamp);
 
+/**
+ * Initialize the slower RvtH_BankEntry fields:
+ * - Ticket and TMD signature status
+ * - AppLoader error status
+ *
+ * These fields aren't needed to identify the bank, so RvtH
+ * defers them until the bank entry is first requested.
+ *
+ * @param entry		[in,out] RvtH_BankEntry
+ */
+void rvth_init_BankEntry_details(RvtH_BankEntry *entry);
+
 #ifdef __cplusplus
 }
 #endif
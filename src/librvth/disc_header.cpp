@@ -23,7 +23,7 @@
 #include "rvth_enums.h"
 #include "rvth.hpp"	// for RvtH::isBlockEmpty()
 
-#include "RefFile.hpp"
+#include "reader/Reader.hpp"
 
 #include "libwiicrypto/byteswap.h"
 #include "libwiicrypto/aesw.h"
@@ -152,17 +152,16 @@ static uint32_t rvth_find_GamePartition_int(const ptbl_t *pt)
  * NOTE: This function cannot currently distinguish between Wii SL
  * and Wii DL images.
  *
- * @param f_img		[in] Disc image file.
- * @param lba_start	[in] Starting LBA.
+ * @param reader	[in] Reader for the bank.
  * @param discHeader	[out] GCN disc header. (Not filled in if empty or unknown types.)
  * @param pIsDeleted	[out,opt] Set to true if the image appears to be "deleted".
  * @return Bank type, or negative POSIX error code. (See RvtH_BankType_e.)
  */
-int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
+int rvth_disc_header_get(Reader *reader,
 	GCN_DiscHeader *discHeader, bool *pIsDeleted)
 {
 	int ret = 0;	// errno setting
-	size_t size;
+	uint32_t lba_size;
 	bool isDeleted = false;
 
 	// Sector buffer.
@@ -176,15 +175,15 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 
 	// Wii partition header.
 	RVL_PartitionHeader *pthdr = NULL;
-	int64_t data_offset;
+	uint32_t data_offset, data_lba;
 	const uint8_t *common_key;
 	uint8_t title_key[16];
 	uint8_t iv[16];
 	AesCtx *aesw = NULL;
 
-	assert(f_img != NULL);
+	assert(reader != NULL);
 	assert(discHeader != NULL);
-	if (!f_img || !discHeader) {
+	if (!reader || !discHeader) {
 		errno = EINVAL;
 		return -EINVAL;
 	}
@@ -193,14 +192,9 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	memset(discHeader, 0, sizeof(*discHeader));
 
 	// Read the disc header.
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		goto end;
-	}
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
-	if (size != sizeof(sbuf.u8)) {
+	lba_size = reader->read(sbuf.u8, 0, 1);
+	if (lba_size != 1) {
 		// Read error.
 		ret = -errno;
 		if (ret == 0) {
@@ -243,18 +237,9 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	bankType = ret;
 
 	// Get the volume group table.
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start) + RVL_VolumeGroupTable_ADDRESS, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		goto end;
-	}
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
-	if (size != sizeof(sbuf.u8)) {
+	lba_size = reader->read(sbuf.u8, BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS), 1);
+	if (lba_size != 1) {
 		// Read error.
 		ret = -errno;
 		if (ret == 0) {
@@ -265,8 +250,10 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 
 	// Find the game partition.
 	game_lba = rvth_find_GamePartition_int(&sbuf.pt);
-	if (game_lba == 0) {
-		// No game partition.
+	if (game_lba == 0 ||
+	    game_lba + BYTES_TO_LBA(sizeof(*pthdr)) > reader->lba_len())
+	{
+		// No game partition, or it's out of range.
 		ret = bankType;
 		goto end;
 	}
@@ -283,18 +270,9 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 		}
 		goto end;
 	}
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start + game_lba), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		goto end;
-	}
 	errno = 0;
-	size = f_img->read(pthdr, 1, sizeof(*pthdr));
-	if (size != sizeof(*pthdr)) {
+	lba_size = reader->read(pthdr, game_lba, BYTES_TO_LBA(sizeof(*pthdr)));
+	if (lba_size != BYTES_TO_LBA(sizeof(*pthdr))) {
 		// Read error.
 		ret = -errno;
 		if (ret == 0) {
@@ -303,27 +281,27 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 		goto end;
 	}
 
-	// Data offset.
-	data_offset = (int64_t)be32_to_cpu(pthdr->data_offset) << 2;
-	if (data_offset < (int64_t)sizeof(*pthdr)) {
+	// Data offset. (stored as bytes >> 2)
+	data_offset = be32_to_cpu(pthdr->data_offset);
+	if (data_offset < (sizeof(*pthdr) >> 2) ||
+	    (data_offset % (LBA_SIZE >> 2)) != 0)
+	{
 		// Invalid offset.
 		ret = bankType;
 		goto end;
 	}
 
 	// Read the first LBA of the partition.
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start + game_lba) + data_offset, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
+	// NOTE: Up to 3 LBAs are read from here.
+	data_lba = game_lba + (data_offset / (LBA_SIZE >> 2));
+	if (data_lba + 3 > reader->lba_len()) {
+		// Out of range.
+		ret = bankType;
 		goto end;
 	}
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
-	if (size != sizeof(sbuf.u8)) {
+	lba_size = reader->read(sbuf.u8, data_lba, 1);
+	if (lba_size != 1) {
 		// Read error.
 		ret = -errno;
 		if (ret == 0) {
@@ -385,8 +363,8 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	// Read the next LBA. This contains encrypted hashes,
 	// including the IV for the user data.
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
-	if (size != sizeof(sbuf.u8)) {
+	lba_size = reader->read(sbuf.u8, data_lba + 1, 1);
+	if (lba_size != 1) {
 		// Read error.
 		ret = -errno;
 		if (ret == 0) {
@@ -398,8 +376,8 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 
 	// Read the first LBA of user data.
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
-	if (size != sizeof(sbuf.u8)) {
+	lba_size = reader->read(sbuf.u8, data_lba + 2, 1);
+	if (lba_size != 1) {
 		// Read error.
 		ret = -errno;
 		if (ret == 0) {
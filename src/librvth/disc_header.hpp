@@ -25,7 +25,7 @@
 
 #include <stdint.h>
 
-class RefFile;
+class Reader;
 struct _GCN_DiscHeader;
 
 /**
@@ -53,13 +53,12 @@ int rvth_disc_header_identify(const struct _GCN_DiscHeader *discHeader);
  * NOTE: This function cannot currently distinguish between Wii SL
  * and Wii DL images.
  *
- * @param f_img		[in] Disc image file.
- * @param lba_start	[in] Starting LBA.
+ * @param reader	[in] Reader for the bank.
  * @param discHeader	[out] GCN disc header. (Not filled in if empty or unknown types.)
  * @param pIsDeleted	[out,opt] Set to true if the image appears to be "deleted".
  * @return Bank type, or negative POSIX error code. (See RvtH_BankType_e.)
  */
-int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
+int rvth_disc_header_get(Reader *reader,
 	struct _GCN_DiscHeader *discHeader, bool *pIsDeleted);
 
 #endif /* __RVTHTOOL_LIBRVTH_DISC_HEADER_H__ */
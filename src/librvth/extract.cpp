@@ -18,6 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
  ***************************************************************************/
 
+#include "config.librvth.h"
+
 #include "rvth.hpp"
 #include "ptbl.h"
 #include "rvth_error.h"
@@ -26,10 +28,25 @@
 #include "nhcd_structs.h"
 
 // Disc image reader.
+#include "ChunkStore.hpp"
 #include "reader/Reader.hpp"
+#include "reader/CachedReader.hpp"
+#include "ReadScheduler.hpp"
+#include "StreamHints.hpp"
+#include "CopyEngine.hpp"
+#include "GroupPipeline.hpp"
+#include "aligned_malloc.h"
+#include "reader/io_backend.h"
+
+#ifdef HAVE_ZSTD
+# include "reader/zstd_seekable.h"
+# include <zstd.h>
+#endif /* HAVE_ZSTD */
 
 // libwiicrypto
 #include "libwiicrypto/sig_tools.h"
+#include "libwiicrypto/sha1_multi.h"
+#include "libwiicrypto/zero_block.h"
 
 // C includes.
 #include <stdlib.h>
@@ -38,12 +55,21 @@
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <climits>
 #include <cstring>
 #include <ctime>
 
 // C++ includes.
+#include <algorithm>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+using std::lock_guard;
+using std::mutex;
 using std::string;
+using std::thread;
+using std::vector;
 using std::wstring;
 
 // for disk free space
@@ -53,6 +79,10 @@ using std::wstring;
 # include <sys/statvfs.h>
 #endif /* _WIN32 */
 
+// Number of chunk buffers for CopyEngine.
+// Reads can get this far ahead of writes.
+#define COPY_BUF_COUNT 4
+
 /**
  * Get the free disk space on the volume containing `filename`.
  * @param filename Filename.
@@ -134,6 +164,160 @@ static int64_t getDiskFreeSpace_lba(const TCHAR *filename)
 	return freeSpace_lba;
 }
 
+/**
+ * Restore the disc header if it was zeroed by the RVT-H's "Flush" function.
+ * @param buf	[in/out] First 4 KB of the disc image.
+ * @param hdr	[in] Disc header from the bank table entry.
+ * @return True if the disc header was restored; false if not.
+ */
+static bool restoreDiscHeader(uint8_t *buf, const GCN_DiscHeader *hdr)
+{
+	// TODO: Also check for NDDEMO?
+	const GCN_DiscHeader *const origHdr = (const GCN_DiscHeader*)buf;
+	if (origHdr->magic_wii != be32_to_cpu(WII_MAGIC) &&
+	    origHdr->magic_gcn != be32_to_cpu(GCN_MAGIC))
+	{
+		// Missing magic number. Need to restore the disc header.
+		memcpy(buf, hdr, sizeof(*hdr));
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Check if a range of LBAs in a source disc image is a hole.
+ * Holes are known to be zero, so they don't need to be read.
+ * @param reader	[in] Source reader.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param pDataStart	[in/out] Cached start of the current data region. (initialize to 0)
+ * @param pDataEnd	[in/out] Cached end of the current data region. (initialize to 0)
+ * @return True if the entire range is a hole; false if it may contain data.
+ */
+static bool isHole(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+	uint32_t *pDataStart, uint32_t *pDataEnd)
+{
+	if (lba_start >= *pDataEnd) {
+		// Past the current data region. Find the next one.
+		if (reader->findData(lba_start, pDataStart, pDataEnd) != 0) {
+			// No more data in the disc image.
+			*pDataStart = UINT32_MAX;
+			*pDataEnd = UINT32_MAX;
+		}
+	}
+	return (lba_start + lba_len <= *pDataStart);
+}
+
+/**
+ * Copy LBAs between two linear disc images using copy offloading.
+ *
+ * Only the data regions of the source image are copied, so holes
+ * stay sparse in the destination image. Each data region is copied
+ * using copy_file_range(), which doesn't need any particular alignment.
+ * If a range is aligned to the file system block size in both files,
+ * it's cloned (reflinked) instead, which doesn't read or write any data.
+ *
+ * RVT-H banks aren't aligned to 4 KB, so banks extracted from
+ * an RVT-H disk image are always copied, not cloned.
+ *
+ * @param reader_src	[in] Source reader. (must be linear)
+ * @param reader_dest	[in] Destination reader. (must be linear)
+ * @param lba_copy_len	[in] Number of LBAs to copy.
+ * @param pLbaCount	[out] Number of LBAs copied.
+ * @param pLbaNonSparse	[out] Last LBA copied that wasn't in a hole.
+ * @param state		[in/out] Progress state.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return 0 if all LBAs were copied; -ECANCELED if cancelled;
+ *         other negative POSIX error code if copy offloading failed.
+ */
+static int copyLinear_offload(Reader *reader_src, Reader *reader_dest,
+	uint32_t lba_copy_len, uint32_t *pLbaCount, uint32_t *pLbaNonSparse, RvtH_Progress_State *state,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	// Copy 32 MB at a time so progress can still be reported.
+	#define LBA_COUNT_OFFLOAD BYTES_TO_LBA(32U*1024U*1024U)
+	// Ranges are only cloned if they're aligned to this size.
+	#define CLONE_ALIGNMENT 4096
+	RefFile *const f_src = reader_src->file();
+	RefFile *const f_dest = reader_dest->file();
+	const int64_t off_src = LBA_TO_BYTES((int64_t)reader_src->lba_start());
+	const int64_t off_dest = LBA_TO_BYTES((int64_t)reader_dest->lba_start());
+
+	assert(reader_src->isLinear());
+	assert(reader_dest->isLinear());
+
+	bool doClone = true;
+	uint32_t lba_count = 0;
+	uint32_t lba_data_start = 0, lba_data_end = 0;
+	int ret = 0;
+	while (lba_count < lba_copy_len) {
+		if (callback) {
+			state->lba_processed = lba_count;
+			if (!callback(state, userdata)) {
+				// Stop processing.
+				ret = -ECANCELED;
+				break;
+			}
+		}
+
+		// Skip holes in the source image.
+		if (lba_count >= lba_data_end) {
+			if (reader_src->findData(lba_count, &lba_data_start, &lba_data_end) != 0) {
+				// No more data in the source image.
+				lba_count = lba_copy_len;
+				break;
+			}
+			if (lba_data_start > lba_count) {
+				lba_count = lba_data_start;
+				continue;
+			}
+		}
+
+		uint32_t lba_len = std::min(lba_data_end, lba_copy_len) - lba_count;
+		if (lba_len > LBA_COUNT_OFFLOAD) {
+			lba_len = LBA_COUNT_OFFLOAD;
+		}
+		int64_t pos_src = off_src + LBA_TO_BYTES((int64_t)lba_count);
+		int64_t pos_dest = off_dest + LBA_TO_BYTES((int64_t)lba_count);
+		int64_t size = LBA_TO_BYTES((int64_t)lba_len);
+
+		if (doClone && pos_src % CLONE_ALIGNMENT == 0 && pos_dest % CLONE_ALIGNMENT == 0) {
+			// Clone the aligned part of the range.
+			// The rest of the range, if any, is copied.
+			const int64_t clone_size = size & ~(int64_t)(CLONE_ALIGNMENT - 1);
+			ret = f_dest->cloneRangeFrom(f_src, pos_src, pos_dest, clone_size);
+			if (ret == 0) {
+				pos_src += clone_size;
+				pos_dest += clone_size;
+				size -= clone_size;
+			} else if (ret != -EINVAL) {
+				// Cloning isn't supported for these files.
+				doClone = false;
+			}
+		}
+
+		if (size > 0) {
+			const int64_t copied = f_dest->copyRangeFrom(f_src, pos_src, pos_dest, size);
+			if (copied != size) {
+				// Copy error. Partially-copied LBAs will be copied again.
+				ret = (errno != 0 ? -errno : -EIO);
+				break;
+			}
+		}
+		ret = 0;
+		lba_count += lba_len;
+		*pLbaNonSparse = lba_count - 1;
+	}
+
+	// The destination file was written directly,
+	// so the Reader's cached data may be stale.
+	reader_dest->discardCache();
+
+	*pLbaCount = lba_count;
+	return ret;
+}
+
 /**
  * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
  * @param rvth_dest	[out] Destination RvtH object.
@@ -146,9 +330,8 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 {
 	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
 	uint32_t lba_count;
-	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
 	uint32_t lba_nonsparse;	// Last LBA written that wasn't sparse.
-	unsigned int sprs;		// Sparse counter.
+	uint32_t lba_data_start = 0, lba_data_end = 0;	// Source data region. (for isHole())
 
 	// Callback state.
 	RvtH_Progress_State state;
@@ -173,6 +356,9 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 	}
 
 	// Check if the source bank can be extracted.
+	// NOTE: The ticket and TMD signature status are copied
+	// to the destination, so make sure they're initialized.
+	loadBankDetails(bank_src);
 	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
 	switch (entry_src->type) {
 		case RVTH_BankType_GCN:
@@ -199,10 +385,11 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 			return RVTH_ERROR_BANK_DL_2;
 	}
 
-	// Process 1 MB at a time.
+	// Copy 1 MB at a time using the copy engine.
+	// This buffer is only used for the disc header and the last LBA.
 	#define BUF_SIZE 1048576
 	#define LBA_COUNT_BUF BYTES_TO_LBA(BUF_SIZE)
-	uint8_t *const buf = (uint8_t*)malloc(BUF_SIZE);
+	uint8_t *const buf = (uint8_t*)malloc(4096);
 	if (!buf) {
 		// Error allocating memory.
 		err = errno;
@@ -217,17 +404,21 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 	// either truncate it or don't do sparse writes.
 
 	// Make this a sparse file.
+	// CISO and WBFS images skip empty blocks on their own
+	// and are written sequentially, so they aren't sparse.
 	entry_dest = &rvth_dest->m_entries[0];
-	ret = rvth_dest->m_file->makeSparse(LBA_TO_BYTES(entry_dest->lba_len));
-	if (ret != 0) {
-		// Error managing the sparse file.
-		// TODO: Delete the file?
-		err = rvth_dest->m_file->lastError();
-		if (err == 0) {
-			err = ENOMEM;
+	if (entry_dest->reader->isLinear()) {
+		ret = rvth_dest->m_file->makeSparse(LBA_TO_BYTES(entry_dest->lba_len));
+		if (ret != 0) {
+			// Error managing the sparse file.
+			// TODO: Delete the file?
+			err = rvth_dest->m_file->lastError();
+			if (err == 0) {
+				err = ENOMEM;
+			}
+			ret = -err;
+			goto end;
 		}
-		ret = -err;
-		goto end;
 	}
 
 	// Copy the bank table information.
@@ -263,75 +454,110 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 		state.lba_total = lba_copy_len;
 	}
 
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_buf_max = entry_dest->lba_len & ~(LBA_COUNT_BUF-1);
+	// If both images are stored linearly, try copy offloading first.
+	// This avoids copying the data through user space, and if the file
+	// system supports cloning, no data is read or written at all.
+	lba_count = 0;
 	lba_nonsparse = 0;
-	for (lba_count = 0; lba_count < lba_buf_max; lba_count += LBA_COUNT_BUF) {
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
+	if (entry_src->reader->isLinear() && entry_dest->reader->isLinear()) {
+		ret = copyLinear_offload(entry_src->reader, entry_dest->reader,
+			lba_copy_len, &lba_count, &lba_nonsparse, &state, callback, userdata);
+		if (ret == -ECANCELED) {
+			err = ECANCELED;
+			goto end;
 		}
+		ret = 0;
 
-		// TODO: Error handling.
-		entry_src->reader->read(buf, lba_count, LBA_COUNT_BUF);
-
-		if (lba_count == 0) {
-			// Make sure we copy the disc header in if the
-			// header was zeroed by the RVT-H's "Flush" function.
-			// TODO: Move this outside of the `for` loop.
-			// TODO: Also check for NDDEMO?
-			const GCN_DiscHeader *const origHdr = (const GCN_DiscHeader*)buf;
-			if (origHdr->magic_wii != be32_to_cpu(WII_MAGIC) &&
-			    origHdr->magic_gcn != be32_to_cpu(GCN_MAGIC))
-			{
-				// Missing magic number. Need to restore the disc header.
-				memcpy(buf, &entry_src->discHeader, sizeof(entry_src->discHeader));
-			}
+		if (lba_count < lba_copy_len) {
+			// Offloading stopped partway through.
+			// Continue with the buffered copy loop.
+			lba_count &= ~(LBA_COUNT_BUF-1);
 		}
-
-		// Check for empty 4 KB blocks.
-		for (sprs = 0; sprs < BUF_SIZE; sprs += 4096) {
-			if (!isBlockEmpty(&buf[sprs], 4096)) {
-				// 4 KB block is not empty.
-				lba_nonsparse = lba_count + (sprs / 512);
-				entry_dest->reader->write(&buf[sprs], lba_nonsparse, 8);
-				lba_nonsparse += 7;
+		if (lba_count > 0) {
+			// Make sure the disc header is present.
+			// (See the lba_count == 0 case below.)
+			if (entry_src->reader->read(buf, 0, BYTES_TO_LBA(4096)) == BYTES_TO_LBA(4096) &&
+			    restoreDiscHeader(buf, &entry_src->discHeader))
+			{
+				entry_dest->reader->write(buf, 0, BYTES_TO_LBA(4096));
 			}
 		}
 	}
 
-	// Process any remaining LBAs.
+	// Copy the rest of the bank using the copy engine.
+	// Holes in the source image are skipped without reading them,
+	// and empty 4 KB blocks aren't written, so the destination
+	// image stays sparse.
+	// NOTE: The last chunk uses 512-byte blocks if it isn't
+	// a multiple of 4 KB.
 	if (lba_count < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count;
-		const unsigned int sz_left = (unsigned int)BYTES_TO_LBA(lba_left);
-
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
+		CopyEngine engine(COPY_BUF_COUNT, LBA_COUNT_BUF);
+		if (!engine.isValid()) {
+			err = ENOMEM;
+			ret = -ENOMEM;
+			goto end;
 		}
-		entry_src->reader->read(buf, lba_count, lba_left);
 
-		// Check for empty 512-byte blocks.
-		for (sprs = 0; sprs < sz_left; sprs += 512) {
-			if (!isBlockEmpty(&buf[sprs], 512)) {
-				// 512-byte block is not empty.
-				lba_nonsparse = lba_count + (sprs / 512);
-				entry_dest->reader->write(&buf[sprs], lba_nonsparse, 1);
-			}
+		// Keep the bank from flooding the page cache.
+		StreamHints srcHints(entry_src->reader, StreamHints::MODE_READ, lba_copy_len);
+		StreamHints destHints(entry_dest->reader, StreamHints::MODE_WRITE, lba_copy_len);
+
+		ret = engine.run(lba_count, lba_copy_len,
+			[entry_src, &srcHints, &lba_data_start, &lba_data_end](uint32_t lba, uint32_t count, uint8_t *cbuf) -> int {
+				srcHints.advance(lba);
+
+				// NOTE: The first chunk is always read in case the
+				// disc header needs to be restored.
+				if (lba != 0 && isHole(entry_src->reader, lba, count, &lba_data_start, &lba_data_end)) {
+					return CopyEngine::READ_HOLE;
+				}
+
+				if (entry_src->reader->read(cbuf, lba, count) != count) {
+					// Read error.
+					return (errno != 0 ? -errno : -EIO);
+				}
+
+				if (lba == 0) {
+					// Make sure we copy the disc header in if the
+					// header was zeroed by the RVT-H's "Flush" function.
+					restoreDiscHeader(cbuf, &entry_src->discHeader);
+				}
+				return 0;
+			},
+			[entry_dest, &destHints, &lba_nonsparse](uint32_t lba, uint32_t count, const uint8_t *cbuf) -> int {
+				destHints.advance(lba);
+				if (!cbuf) {
+					// Hole. Nothing to write.
+					return 0;
+				}
+
+				// Write the non-empty blocks.
+				// Runs of empty blocks are skipped in a single call.
+				const unsigned int sz = (unsigned int)LBA_TO_BYTES(count);
+				const unsigned int blk = (sz % 4096 == 0 ? 4096 : 512);
+				for (unsigned int sprs = 0; sprs < sz; sprs += blk) {
+					sprs += (unsigned int)zero_block_find(&cbuf[sprs], sz - sprs, blk);
+					if (sprs >= sz)
+						break;
+
+					// Block is not empty.
+					if (entry_dest->reader->write(&cbuf[sprs], lba + (sprs / 512), blk / 512) != blk / 512) {
+						// Write error.
+						return (errno != 0 ? -errno : -EIO);
+					}
+					lba_nonsparse = lba + ((sprs + blk) / 512) - 1;
+				}
+				return 0;
+			},
+			[&state, callback, userdata](uint32_t lba) -> bool {
+				if (!callback)
+					return true;
+				state.lba_processed = lba;
+				return callback(&state, userdata);
+			});
+		if (ret != 0) {
+			err = -ret;
+			goto end;
 		}
 	}
 
@@ -358,7 +584,11 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 	}
 
 	// Finished extracting the disc image.
-	entry_dest->reader->flush();
+	// NOTE: CISO and WBFS headers are written here.
+	ret = entry_dest->reader->flush();
+	if (ret != 0) {
+		err = -ret;
+	}
 
 end:
 	free(buf);
@@ -368,6 +598,504 @@ end:
 	return ret;
 }
 
+/**
+ * Copy a bank from this RVT-H HDD or standalone disc image to a
+ * new disc image using the Zstandard seekable format.
+ *
+ * The disc image is split into independent frames, which are
+ * compressed by a pool of worker threads. The seek table is
+ * written at the end of the file, so ZstdReader can read
+ * the image without decompressing all of it.
+ *
+ * Compression level and frame size are set using rvth_zstd_set_params().
+ *
+ * @param bank_src	[in] Source bank number. (0-7)
+ * @param filename	[in] Destination filename.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::copyToZstd(unsigned int bank_src, const TCHAR *filename,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+#ifdef HAVE_ZSTD
+	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
+	uint32_t lba_frame;	// Number of LBAs per frame.
+	unsigned int frameCount;
+	uint32_t lba_data_start = 0, lba_data_end = 0;	// Source data region. (for isHole())
+	int level;
+	unsigned int frame_size;
+	size_t size;
+
+	// Callback state.
+	RvtH_Progress_State state;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	RefFile *f_dest = nullptr;
+	vector<ZSTD_CCtx*> cctxs;
+	vector<uint32_t> csizes;	// Compressed frame sizes.
+	uint64_t offset = 0;		// Current offset in the destination file.
+	StreamHints *srcHints = nullptr;	// Page cache hints for the source.
+
+	if (!filename || filename[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank_src >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Check if the source bank can be extracted.
+	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
+	switch (entry_src->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be extracted.
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	rvth_zstd_get_params(&level, &frame_size);
+	lba_copy_len = entry_src->lba_len;
+	lba_frame = static_cast<uint32_t>(BYTES_TO_LBA(frame_size));
+	frameCount = (lba_copy_len + lba_frame - 1) / lba_frame;
+	const size_t cbound = ZSTD_compressBound(frame_size);
+
+	GroupPipeline pipeline(0, frame_size, cbound);
+	if (!pipeline.isValid()) {
+		err = ENOMEM;
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	// Each worker needs its own compression context.
+	cctxs.resize(pipeline.workerCount());
+	for (ZSTD_CCtx *&cctx : cctxs) {
+		cctx = ZSTD_createCCtx();
+		if (!cctx) {
+			err = ENOMEM;
+			ret = -ENOMEM;
+			goto end;
+		}
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+	}
+	csizes.resize(frameCount);
+
+	// Create the destination file.
+	f_dest = new RefFile(filename, true);
+	if (!f_dest->isOpen()) {
+		err = f_dest->lastError();
+		if (err == 0) {
+			err = EIO;
+		}
+		ret = -err;
+		goto end;
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank_src;
+		state.bank_gcm = UINT_MAX;
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.lba_processed = 0;
+		state.lba_total = lba_copy_len;
+	}
+
+	// Frames are read and written in order.
+	// Holes in the source image are compressed as zero frames
+	// without reading them.
+	srcHints = new StreamHints(entry_src->reader, StreamHints::MODE_READ, lba_copy_len);
+	ret = pipeline.run(frameCount,
+		[entry_src, srcHints, lba_frame, lba_copy_len, &lba_data_start, &lba_data_end](unsigned int idx, uint8_t *inBuf) -> int {
+			const uint32_t lba = idx * lba_frame;
+			const uint32_t count = std::min<uint32_t>(lba_frame, lba_copy_len - lba);
+			srcHints->advance(lba);
+			// NOTE: The first frame is always read in case the
+			// disc header needs to be restored.
+			if (lba != 0 && isHole(entry_src->reader, lba, count, &lba_data_start, &lba_data_end)) {
+				memset(inBuf, 0, LBA_TO_BYTES(count));
+				return 0;
+			}
+
+			errno = 0;
+			if (entry_src->reader->read(inBuf, lba, count) != count) {
+				return (errno != 0 ? -errno : -EIO);
+			}
+			if (lba == 0) {
+				// Make sure we copy the disc header in if the
+				// header was zeroed by the RVT-H's "Flush" function.
+				restoreDiscHeader(inBuf, &entry_src->discHeader);
+			}
+			return 0;
+		},
+		[&cctxs, &csizes, lba_frame, lba_copy_len, cbound](unsigned int workerIdx, unsigned int idx, uint8_t *inBuf, uint8_t *outBuf) -> int {
+			const uint32_t lba = idx * lba_frame;
+			const uint32_t count = std::min<uint32_t>(lba_frame, lba_copy_len - lba);
+			const size_t csize = ZSTD_compress2(cctxs[workerIdx],
+				outBuf, cbound, inBuf, LBA_TO_BYTES(count));
+			if (ZSTD_isError(csize)) {
+				return -EIO;
+			}
+			csizes[idx] = static_cast<uint32_t>(csize);
+			return 0;
+		},
+		[f_dest, &csizes, &offset, lba_frame, lba_copy_len, &state, callback, userdata](unsigned int idx, const uint8_t*, const uint8_t *outBuf) -> int {
+			errno = 0;
+			if (f_dest->pwriteAt(offset, outBuf, csizes[idx]) != csizes[idx]) {
+				return (errno != 0 ? -errno : -EIO);
+			}
+			offset += csizes[idx];
+			if (callback) {
+				state.lba_processed = std::min<uint32_t>((idx + 1) * lba_frame, lba_copy_len);
+				if (!callback(&state, userdata)) {
+					return -ECANCELED;
+				}
+			}
+			return 0;
+		});
+	if (ret != 0) {
+		err = -ret;
+		goto end;
+	}
+
+	{
+		// Write the seek table.
+		vector<uint8_t> tbl(sizeof(zstd_skippable_header_t) +
+			(frameCount * sizeof(zstd_seek_entry_t)) + sizeof(zstd_seek_footer_t));
+		zstd_skippable_header_t *const skip = reinterpret_cast<zstd_skippable_header_t*>(tbl.data());
+		skip->magic = cpu_to_le32(ZSTD_SEEKABLE_SKIPPABLE_MAGIC);
+		skip->frame_size = cpu_to_le32(static_cast<uint32_t>(tbl.size() - sizeof(*skip)));
+
+		zstd_seek_entry_t *const entries = reinterpret_cast<zstd_seek_entry_t*>(skip + 1);
+		for (unsigned int i = 0; i < frameCount; i++) {
+			const uint32_t count = std::min<uint32_t>(lba_frame, lba_copy_len - (i * lba_frame));
+			entries[i].c_size = cpu_to_le32(csizes[i]);
+			entries[i].d_size = cpu_to_le32(static_cast<uint32_t>(LBA_TO_BYTES(count)));
+		}
+
+		zstd_seek_footer_t *const footer = reinterpret_cast<zstd_seek_footer_t*>(&entries[frameCount]);
+		footer->n_frames = cpu_to_le32(frameCount);
+		footer->descriptor = 0;
+		footer->magic = cpu_to_le32(ZSTD_SEEKABLE_FOOTER_MAGIC);
+
+		errno = 0;
+		size = f_dest->pwriteAt(offset, tbl.data(), tbl.size());
+		if (size != tbl.size()) {
+			err = (errno != 0 ? errno : EIO);
+			ret = -err;
+			goto end;
+		}
+	}
+
+	// Finished extracting the disc image.
+	ret = f_dest->flush();
+	if (ret != 0) {
+		err = -ret;
+	}
+
+end:
+	for (ZSTD_CCtx *cctx : cctxs) {
+		ZSTD_freeCCtx(cctx);
+	}
+	delete srcHints;
+	if (f_dest) {
+		// TODO: Delete the file on error?
+		f_dest->unref();
+	}
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+#else /* !HAVE_ZSTD */
+	// Zstandard support was not compiled in.
+	UNUSED(bank_src);
+	UNUSED(filename);
+	UNUSED(callback);
+	UNUSED(userdata);
+	errno = ENOTSUP;
+	return -ENOTSUP;
+#endif /* HAVE_ZSTD */
+}
+
+// Chunk store chunk sizes.
+// Wii chunks are one group, so changed groups don't affect other chunks.
+#define STORE_CHUNK_SIZE_GCN	(32U*1024U)
+#define STORE_CHUNK_SIZE_WII	(2U*1024U*1024U)
+// Chunks are hashed and stored in batches of this size.
+#define STORE_BATCH_SIZE	(2U*1024U*1024U)
+
+/**
+ * Get the length of the first chunk for a chunk store manifest.
+ * Wii disc images are aligned to the game partition's data,
+ * so each chunk is exactly one group.
+ * @param entry		[in] Bank entry.
+ * @param chunk_size	[in] Chunk size, in bytes.
+ * @return Length of the first chunk, in LBAs.
+ */
+static uint32_t getStoreFirstChunkLen(RvtH_BankEntry *entry, unsigned int chunk_size)
+{
+	const uint32_t chunk_lba_len = static_cast<uint32_t>(BYTES_TO_LBA(chunk_size));
+	if (entry->type != RVTH_BankType_Wii_SL && entry->type != RVTH_BankType_Wii_DL) {
+		// Not a Wii disc image.
+		return chunk_lba_len;
+	}
+
+	const pt_entry_t *const game_pte = rvth_ptbl_find_game(entry);
+	if (!game_pte) {
+		// No game partition.
+		return chunk_lba_len;
+	}
+
+	RVL_PartitionHeader pthdr;
+	if (entry->reader->read(&pthdr, game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr))) != BYTES_TO_LBA(sizeof(pthdr))) {
+		// Unable to read the partition header.
+		return chunk_lba_len;
+	}
+
+	// Data offset. (stored as bytes >> 2)
+	const uint32_t data_offset = be32_to_cpu(pthdr.data_offset);
+	if (data_offset % (LBA_SIZE >> 2) != 0) {
+		// Invalid offset.
+		return chunk_lba_len;
+	}
+
+	// NOTE: If the first chunk would be smaller than a Wii sector,
+	// the partition isn't aligned, so alignment won't help.
+	const uint32_t data_lba = game_pte->lba_start + (data_offset / (LBA_SIZE >> 2));
+	const uint32_t first_lba_len = data_lba % chunk_lba_len;
+	return (first_lba_len >= BYTES_TO_LBA(32768) ? first_lba_len : chunk_lba_len);
+}
+
+/**
+ * Copy a bank from this RVT-H HDD or standalone disc image into
+ * a chunk store. (See ChunkStore.)
+ *
+ * The store is the directory containing the manifest. Chunks are
+ * hashed and stored by a pool of worker threads, and chunks that
+ * are already in the store aren't written again.
+ *
+ * Wii disc images use 2 MB chunks aligned to the game partition's
+ * groups. GameCube disc images use 32 KB chunks.
+ *
+ * @param bank_src	[in] Source bank number. (0-7)
+ * @param filename	[in] Manifest filename.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::copyToStore(unsigned int bank_src, const TCHAR *filename,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
+	unsigned int chunk_size;
+	uint32_t chunksPerBatch;
+	unsigned int batchCount;
+	uint32_t lba_data_start = 0, lba_data_end = 0;	// Source data region. (for isHole())
+
+	// Callback state.
+	RvtH_Progress_State state;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	StoreManifest manifest;
+	StreamHints *srcHints = nullptr;	// Page cache hints for the source.
+
+	if (!filename || filename[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank_src >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Check if the source bank can be extracted.
+	RvtH_BankEntry *const entry_src = &m_entries[bank_src];
+	switch (entry_src->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be extracted.
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	lba_copy_len = entry_src->lba_len;
+	chunk_size = (entry_src->type == RVTH_BankType_GCN ? STORE_CHUNK_SIZE_GCN : STORE_CHUNK_SIZE_WII);
+	ret = manifest.init(lba_copy_len, chunk_size, getStoreFirstChunkLen(entry_src, chunk_size));
+	if (ret != 0) {
+		err = -ret;
+		goto end;
+	}
+	chunksPerBatch = STORE_BATCH_SIZE / chunk_size;
+	batchCount = (manifest.chunkCount() + chunksPerBatch - 1) / chunksPerBatch;
+
+	if (callback) {
+		// Initialize the callback state.
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank_src;
+		state.bank_gcm = UINT_MAX;
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.lba_processed = 0;
+		state.lba_total = lba_copy_len;
+	}
+
+	{
+		GroupPipeline pipeline(0, STORE_BATCH_SIZE, 0);
+		if (!pipeline.isValid()) {
+			err = ENOMEM;
+			ret = -ENOMEM;
+			goto end;
+		}
+		ChunkStore store(ChunkStore::dirForManifest(filename).c_str());
+
+		// Keep the store locked until the manifest is saved,
+		// so "store gc" doesn't delete the chunks that were
+		// stored for this disc image.
+		const ChunkStore::Lock lock(store, false, true);
+		if (lock.error() != 0) {
+			ret = lock.error();
+			err = -ret;
+			goto end;
+		}
+
+		// Get the LBA range of a batch of chunks.
+		auto batchRange = [&manifest, chunksPerBatch](unsigned int idx, uint32_t *pFirst, uint32_t *pEnd) -> uint32_t {
+			*pFirst = idx * chunksPerBatch;
+			*pEnd = std::min(*pFirst + chunksPerBatch, manifest.chunkCount());
+			const uint32_t last = *pEnd - 1;
+			return manifest.chunkStart(last) + manifest.chunkLen(last) - manifest.chunkStart(*pFirst);
+		};
+
+		// Batches are read in order, and chunks are hashed and stored
+		// by the workers. Holes in the source image are empty chunks,
+		// so they don't need to be read.
+		srcHints = new StreamHints(entry_src->reader, StreamHints::MODE_READ, lba_copy_len);
+		ret = pipeline.run(batchCount,
+			[entry_src, srcHints, &manifest, &batchRange, &lba_data_start, &lba_data_end](unsigned int idx, uint8_t *inBuf) -> int {
+				uint32_t first, end;
+				const uint32_t count = batchRange(idx, &first, &end);
+				const uint32_t lba = manifest.chunkStart(first);
+				srcHints->advance(lba);
+				// NOTE: The first batch is always read in case the
+				// disc header needs to be restored.
+				if (lba != 0 && isHole(entry_src->reader, lba, count, &lba_data_start, &lba_data_end)) {
+					memset(inBuf, 0, LBA_TO_BYTES(count));
+					return 0;
+				}
+
+				errno = 0;
+				if (entry_src->reader->read(inBuf, lba, count) != count) {
+					return (errno != 0 ? -errno : -EIO);
+				}
+				if (lba == 0) {
+					// Make sure we copy the disc header in if the
+					// header was zeroed by the RVT-H's "Flush" function.
+					restoreDiscHeader(inBuf, &entry_src->discHeader);
+				}
+				return 0;
+			},
+			[&manifest, &store, &batchRange](unsigned int, unsigned int idx, uint8_t *inBuf, uint8_t*) -> int {
+				uint32_t first, end;
+				batchRange(idx, &first, &end);
+				const uint8_t *p = inBuf;
+				for (uint32_t i = first; i < end; ) {
+					const size_t size = LBA_TO_BYTES(manifest.chunkLen(i));
+					if (isBlockEmpty(p, static_cast<unsigned int>(size))) {
+						// Empty chunks aren't stored.
+						// The digest was already zeroed by init().
+						p += size;
+						i++;
+						continue;
+					}
+
+					// Hash a run of non-empty chunks with the same size at once.
+					uint32_t j = i + 1;
+					while (j < end && LBA_TO_BYTES(manifest.chunkLen(j)) == size &&
+					       !isBlockEmpty(p + ((j - i) * size), static_cast<unsigned int>(size)))
+					{
+						j++;
+					}
+					sha1_multi(manifest.digest(i), p, size, j - i);
+
+					for (; i < j; i++, p += size) {
+						const int ret = store.put(manifest.digest(i), p, size);
+						if (ret != 0) {
+							return ret;
+						}
+					}
+				}
+				return 0;
+			},
+			[&batchRange, &state, callback, userdata](unsigned int idx, const uint8_t*, const uint8_t*) -> int {
+				if (callback) {
+					uint32_t first, end;
+					state.lba_processed += batchRange(idx, &first, &end);
+					if (!callback(&state, userdata)) {
+						return -ECANCELED;
+					}
+				}
+				return 0;
+			});
+		if (ret == 0) {
+			// Finished storing the chunks.
+			// Sync them and save the manifest last, so the disc image
+			// only appears in the store if all of its chunks are on disk.
+			ret = store.sync();
+		}
+		if (ret == 0) {
+			ret = manifest.save(filename);
+		}
+	}
+	if (ret != 0) {
+		err = -ret;
+	}
+
+end:
+	delete srcHints;
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
+
 /**
  * Extract a disc image from this RVT-H disk image.
  * Compatibility wrapper; this function creates a new RvtH
@@ -434,6 +1162,62 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 		gcm_lba_len = entry->lba_len;
 	}
 
+	// Output format.
+	RvtH_ImageFormat_e format;
+	switch (flags & (RVTH_EXTRACT_FORMAT_CISO | RVTH_EXTRACT_FORMAT_WBFS |
+			 RVTH_EXTRACT_FORMAT_ZSTD | RVTH_EXTRACT_FORMAT_STORE)) {
+		case 0:
+			format = RVTH_ImageFormat_GCM;
+			break;
+		case RVTH_EXTRACT_FORMAT_CISO:
+			format = RVTH_ImageFormat_CISO;
+			break;
+		case RVTH_EXTRACT_FORMAT_WBFS:
+			format = RVTH_ImageFormat_WBFS;
+			break;
+		case RVTH_EXTRACT_FORMAT_ZSTD:
+			format = RVTH_ImageFormat_ZSTD;
+			break;
+		case RVTH_EXTRACT_FORMAT_STORE:
+			format = RVTH_ImageFormat_STORE;
+			break;
+		default:
+			// Only one output format can be specified.
+			errno = EINVAL;
+			ret = -EINVAL;
+			goto end;
+	}
+	if (format != RVTH_ImageFormat_GCM && (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER)) {
+		// SDK headers are only supported for plain GCMs.
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto end;
+	}
+
+	if (format == RVTH_ImageFormat_ZSTD || format == RVTH_ImageFormat_STORE) {
+		// Zstandard images and chunk store manifests are written
+		// sequentially, so the disc image can't be encrypted or
+		// recrypted afterwards.
+		if (entry->type >= RVTH_BankType_Wii_SL &&
+		    recrypt_key > RVL_CryptoType_Unknown &&
+		    entry->crypto_type != recrypt_key)
+		{
+			errno = ENOTSUP;
+			ret = -ENOTSUP;
+			goto end;
+		}
+
+		// NOTE: Not checking for free disk space, since
+		// the compressed or deduplicated size isn't known
+		// in advance.
+		if (format == RVTH_ImageFormat_STORE) {
+			ret = copyToStore(bank, filename, callback, userdata);
+		} else {
+			ret = copyToZstd(bank, filename, callback, userdata);
+		}
+		goto end;
+	}
+
 	if (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) {
 		if (entry->type == RVTH_BankType_GCN) {
 			// FIXME: Not supported.
@@ -460,7 +1244,7 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 		goto end;
 	}
 
-	rvth_dest = new RvtH(filename, gcm_lba_len, &ret);
+	rvth_dest = new RvtH(filename, gcm_lba_len, &ret, format);
 	if (!rvth_dest->isOpen()) {
 		// Error creating the standalone disc image.
 		errno = EIO;
@@ -548,6 +1332,214 @@ end:
 	return ret;
 }
 
+// extractBanks() shared state.
+struct ExtractBanksState {
+	mutex mtx;			// Serializes progress callbacks.
+	const RvtH *rvth;		// Source RvtH.
+	RvtH_Progress_Callback callback;
+	void *userdata;
+	bool cancel;			// Set if any callback returned false.
+};
+
+// extractBanks() per-bank state.
+struct ExtractBanksBank {
+	ExtractBanksState *shared;
+	unsigned int bank;
+};
+
+/**
+ * Progress callback wrapper for extractBanks().
+ * @param state		[in] Current progress.
+ * @param userdata	[in] ExtractBanksBank*
+ * @return True to continue; false to abort.
+ */
+static bool extractBanks_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	ExtractBanksBank *const bb = static_cast<ExtractBanksBank*>(userdata);
+	ExtractBanksState *const shared = bb->shared;
+
+	lock_guard<mutex> lock(shared->mtx);
+	if (shared->cancel) {
+		// Another bank was cancelled.
+		return false;
+	} else if (!shared->callback) {
+		return true;
+	}
+
+	// Recryption reports progress on the destination image.
+	// Always report the source RvtH and bank so the caller
+	// can tell the banks apart.
+	RvtH_Progress_State bstate = *state;
+	if (state->rvth != shared->rvth) {
+		bstate.rvth_gcm = state->rvth;
+		bstate.bank_gcm = state->bank_rvth;
+		bstate.rvth = shared->rvth;
+	}
+	bstate.bank_rvth = bb->bank;
+
+	if (!shared->callback(&bstate, shared->userdata)) {
+		shared->cancel = true;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Extract multiple disc images from this RVT-H disk image concurrently.
+ *
+ * Each bank is extracted on its own thread. Reads from this image are
+ * scheduled so the source is read in large sequential windows instead
+ * of having every thread seek to its own bank.
+ *
+ * Progress callbacks are serialized. state->rvth is always this RvtH
+ * and state->bank_rvth is the bank being extracted, including while
+ * the extracted image is being recrypted. If the callback returns
+ * false, all extractions are cancelled.
+ *
+ * @param banks		[in] Bank numbers. (0-7)
+ * @param filenames	[in] Destination filenames. (one per bank)
+ * @param count		[in] Number of banks.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+ *			(Ignored for GameCube banks.)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param pErrs		[out,opt] Error code for each bank. (count elements)
+ * @return Error code of the first bank that failed. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::extractBanks(const unsigned int *banks, const TCHAR *const *filenames,
+	unsigned int count, int recrypt_key, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata, int *pErrs)
+{
+	if (!banks || !filenames || count == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Validate the banks and filenames.
+	int64_t total_lba_len = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (!filenames[i] || filenames[i][0] == 0) {
+			errno = EINVAL;
+			return -EINVAL;
+		} else if (banks[i] >= m_bankCount) {
+			// Bank number is out of range.
+			errno = ERANGE;
+			return -ERANGE;
+		}
+		for (unsigned int j = 0; j < i; j++) {
+			if (banks[j] == banks[i]) {
+				// Duplicate bank.
+				errno = EINVAL;
+				return -EINVAL;
+			}
+		}
+		total_lba_len += m_entries[banks[i]].lba_len;
+	}
+
+	// Check that we have enough free disk space for all of the banks.
+	// extract() checks each bank individually, but the other banks
+	// are being written at the same time.
+	// NOTE: This assumes all destination files are on the same volume.
+	// NOTE: Like extract(), not checking for Zstandard images and
+	// chunk stores, since their size isn't known in advance.
+	if (!(flags & (RVTH_EXTRACT_FORMAT_ZSTD | RVTH_EXTRACT_FORMAT_STORE))) {
+		const int64_t diskFreeSpace_lba = getDiskFreeSpace_lba(filenames[0]);
+		if (diskFreeSpace_lba < 0) {
+			// Error...
+			const int ret = static_cast<int>(diskFreeSpace_lba);
+			errno = -ret;
+			return ret;
+		} else if (diskFreeSpace_lba < total_lba_len) {
+			// Not enough free disk space.
+			errno = ENOSPC;
+			return -ENOSPC;
+		}
+	}
+
+	// Initialize the deferred bank entry fields before starting,
+	// since the bank readers will be in use by the extraction threads.
+	for (unsigned int i = 0; i < count; i++) {
+		loadBankDetails(banks[i]);
+	}
+
+	// Add the banks to the read scheduler in LBA order.
+	// Reads are done in 1 MB chunks, with up to 8 MB
+	// read from a bank before switching to the next one.
+	vector<unsigned int> order(count);
+	for (unsigned int i = 0; i < count; i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [this, banks](unsigned int a, unsigned int b) {
+		return m_entries[banks[a]].lba_start < m_entries[banks[b]].lba_start;
+	});
+
+	ReadScheduler sched(BYTES_TO_LBA(1024*1024), 8);
+	vector<Reader*> origReaders(count, nullptr);
+	for (unsigned int i : order) {
+		RvtH_BankEntry *const entry = &m_entries[banks[i]];
+		if (!entry->reader) {
+			// No reader. extract() will report the error.
+			continue;
+		}
+		Reader *const reader = sched.addStream(entry->reader);
+		if (!reader) {
+			// Use the original reader for this bank.
+			continue;
+		}
+		origReaders[i] = entry->reader;
+		entry->reader = reader;
+	}
+
+	// Extract the banks.
+	ExtractBanksState shared;
+	shared.rvth = this;
+	shared.callback = callback;
+	shared.userdata = userdata;
+	shared.cancel = false;
+
+	vector<ExtractBanksBank> bb(count);
+	vector<int> errs(count, 0);
+	vector<thread> threads;
+	threads.reserve(count);
+
+	sched.start();
+	for (unsigned int i = 0; i < count; i++) {
+		bb[i].shared = &shared;
+		bb[i].bank = banks[i];
+		// GameCube banks can't be recrypted.
+		const int bank_recrypt_key = (m_entries[banks[i]].type == RVTH_BankType_GCN ? -1 : recrypt_key);
+		threads.emplace_back([this, &bb, &errs, banks, filenames, bank_recrypt_key, flags, i]() {
+			errs[i] = extract(banks[i], filenames[i], bank_recrypt_key, flags,
+				extractBanks_callback, &bb[i]);
+		});
+	}
+	for (thread &t : threads) {
+		t.join();
+	}
+	sched.stop();
+
+	// Restore the original readers.
+	for (unsigned int i = 0; i < count; i++) {
+		if (origReaders[i]) {
+			RvtH_BankEntry *const entry = &m_entries[banks[i]];
+			delete entry->reader;
+			entry->reader = origReaders[i];
+		}
+	}
+
+	int ret = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (pErrs) {
+			pErrs[i] = errs[i];
+		}
+		if (ret == 0) {
+			ret = errs[i];
+		}
+	}
+	return ret;
+}
+
 /**
  * Copy a bank from this HDD or standalone disc image to an RVT-H system.
  * @param rvth_dest	[in] Destination RvtH object.
@@ -561,9 +1553,9 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata)
 {
 	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
-	uint32_t lba_count;
-	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
-	uint8_t *buf = NULL;
+	uint32_t lba_data_start = 0, lba_data_end = 0;	// Source data region. (for isHole())
+	uint8_t *zero_buf = NULL;	// Written for holes in the source image.
+	bool copied = false;	// True if the bank was copied by the decompression pipeline.
 
 	// Callback state.
 	RvtH_Progress_State state;
@@ -586,6 +1578,9 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	}
 
 	// Check if the source bank can be imported.
+	// NOTE: The ticket and TMD signature status are copied
+	// to the destination, so make sure they're initialized.
+	loadBankDetails(bank_src);
 	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
 	switch (entry_src->type) {
 		case RVTH_BankType_GCN:
@@ -720,8 +1715,8 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	}
 	// NOTE: Using the source LBA length, since we might be
 	// importing a dual-layer Wii image.
-	entry_dest->reader = Reader::open(rvth_dest->m_file,
-		entry_dest->lba_start, entry_src->lba_len);
+	entry_dest->reader = CachedReader::wrap(Reader::open(rvth_dest->m_file,
+		entry_dest->lba_start, entry_src->lba_len));
 	if (!entry_dest->reader) {
 		// Cannot create a reader...
 		err = errno;
@@ -743,17 +1738,19 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		entry_dest2->is_deleted = false;
 		free(entry_dest2->ptbl);
 		entry_dest2->ptbl = nullptr;
+		rvth_dest->setBankDetailsLoaded(bank_dest+1, true);
 
 		// NOTE: We don't need to write the second bank table entry for,
 		// DL images, since it should already be empty and/or deleted.
 		// It has to be updated in memory for qrvthtool, though.
 	}
 
-	// Process 1 MB at a time.
+	// Copy 1 MB at a time using the copy engine.
 	#define BUF_SIZE 1048576
 	#define LBA_COUNT_BUF BYTES_TO_LBA(BUF_SIZE)
-	buf = (uint8_t*)malloc(BUF_SIZE);
-	if (!buf) {
+	// NOTE: Aligned for unbuffered writes.
+	zero_buf = (uint8_t*)aligned_malloc(RVTH_IO_DIRECT_ALIGNMENT, BUF_SIZE);
+	if (!zero_buf) {
 		// Error allocating memory.
 		err = errno;
 		if (err == 0) {
@@ -762,6 +1759,7 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		ret = -err;
 		goto end;
 	}
+	memset(zero_buf, 0, BUF_SIZE);
 
 	// Copy the bank table information.
 	entry_dest->lba_len	= entry_src->lba_len;
@@ -772,6 +1770,9 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	entry_dest->ios_version	= entry_src->ios_version;
 	entry_dest->ticket	= entry_src->ticket;
 	entry_dest->tmd		= entry_src->tmd;
+	entry_dest->aplerr	= entry_src->aplerr;
+	memcpy(entry_dest->aplerr_val, entry_src->aplerr_val, sizeof(entry_dest->aplerr_val));
+	rvth_dest->setBankDetailsLoaded(bank_dest, true);
 
 	// Copy the disc header.
 	memcpy(&entry_dest->discHeader, &entry_src->discHeader, sizeof(entry_dest->discHeader));
@@ -798,36 +1799,116 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		state.lba_total = lba_copy_len;
 	}
 
-	// TODO: Special indicator.
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_buf_max = entry_dest->lba_len & ~(LBA_COUNT_BUF-1);
-	for (lba_count = 0; lba_count < lba_buf_max; lba_count += LBA_COUNT_BUF) {
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
+	// Compressed disc images, e.g. WIA and RVZ, are decompressed
+	// on multiple threads. Each worker needs its own Reader.
+	// NOTE: reopen() isn't supported by the other readers.
+	if (!entry_src->reader->isLinear()) {
+		vector<Reader*> readers;
+		Reader *reader = entry_src->reader->reopen();
+		if (reader) {
+			readers.push_back(reader);
+			GroupPipeline pipeline(0, BUF_SIZE, 0);
+			while (readers.size() < pipeline.workerCount()) {
+				reader = entry_src->reader->reopen();
+				if (!reader)
+					break;
+				readers.push_back(reader);
+			}
+
+			if (pipeline.isValid() && readers.size() == pipeline.workerCount()) {
+				StreamHints destHints(entry_dest->reader, StreamHints::MODE_WRITE, lba_copy_len);
+				const unsigned int groupCount = (lba_copy_len + LBA_COUNT_BUF - 1) / LBA_COUNT_BUF;
+				ret = pipeline.run(groupCount,
+					[](unsigned int, uint8_t*) -> int {
+						// Nothing to do here. The workers read the data.
+						return 0;
+					},
+					[&readers, lba_copy_len](unsigned int workerIdx, unsigned int idx, uint8_t *inBuf, uint8_t*) -> int {
+						const uint32_t lba = idx * LBA_COUNT_BUF;
+						const uint32_t count = std::min<uint32_t>(LBA_COUNT_BUF, lba_copy_len - lba);
+						errno = 0;
+						if (readers[workerIdx]->read(inBuf, lba, count) != count) {
+							return (errno != 0 ? -errno : -EIO);
+						}
+						return 0;
+					},
+					[entry_dest, &destHints, lba_copy_len, &state, callback, userdata](unsigned int idx, const uint8_t *inBuf, const uint8_t*) -> int {
+						const uint32_t lba = idx * LBA_COUNT_BUF;
+						const uint32_t count = std::min<uint32_t>(LBA_COUNT_BUF, lba_copy_len - lba);
+						destHints.advance(lba);
+						if (entry_dest->reader->write(inBuf, lba, count) != count) {
+							return (errno != 0 ? -errno : -EIO);
+						}
+						if (callback) {
+							state.lba_processed = lba + count;
+							if (!callback(&state, userdata)) {
+								return -ECANCELED;
+							}
+						}
+						return 0;
+					});
+				copied = true;
 			}
 		}
 
+		for (Reader *r : readers) {
+			delete r;
+		}
+		if (ret != 0) {
+			err = -ret;
+			goto end;
+		}
+	}
+
+	// TODO: Special indicator.
+	if (!copied) {
+		CopyEngine engine(COPY_BUF_COUNT, LBA_COUNT_BUF);
+		if (!engine.isValid()) {
+			err = ENOMEM;
+			ret = -ENOMEM;
+			goto end;
+		}
+
+		// Keep the source image from flooding the page cache.
+		StreamHints srcHints(entry_src->reader, StreamHints::MODE_READ, lba_copy_len);
+		StreamHints destHints(entry_dest->reader, StreamHints::MODE_WRITE, lba_copy_len);
+
 		// TODO: Restore the disc header here if necessary?
 		// GCMs being imported generally won't have the first
 		// 16 KB zeroed out...
-
-		// TODO: Error handling.
-		entry_src->reader->read(buf, lba_count, LBA_COUNT_BUF);
-		entry_dest->reader->write(buf, lba_count, LBA_COUNT_BUF);
-	}
-
-	// Process any remaining LBAs.
-	if (lba_count < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count;
-		entry_src->reader->read(buf, lba_count, lba_left);
-		entry_dest->reader->write(buf, lba_count, lba_left);
+		ret = engine.run(0, lba_copy_len,
+			[entry_src, &srcHints, &lba_data_start, &lba_data_end](uint32_t lba, uint32_t count, uint8_t *cbuf) -> int {
+				srcHints.advance(lba);
+				if (isHole(entry_src->reader, lba, count, &lba_data_start, &lba_data_end)) {
+					// Hole in the source image.
+					return CopyEngine::READ_HOLE;
+				}
+
+				if (entry_src->reader->read(cbuf, lba, count) != count) {
+					// Read error.
+					return (errno != 0 ? -errno : -EIO);
+				}
+				return 0;
+			},
+			[entry_dest, &destHints, zero_buf](uint32_t lba, uint32_t count, const uint8_t *cbuf) -> int {
+				// The bank may have old data, so holes
+				// in the source image still need to be zeroed.
+				destHints.advance(lba);
+				if (entry_dest->reader->write(cbuf ? cbuf : zero_buf, lba, count) != count) {
+					return (errno != 0 ? -errno : -EIO);
+				}
+				return 0;
+			},
+			[&state, callback, userdata](uint32_t lba) -> bool {
+				if (!callback)
+					return true;
+				state.lba_processed = lba;
+				return callback(&state, userdata);
+			});
+		if (ret != 0) {
+			err = -ret;
+			goto end;
+		}
 	}
 
 	if (callback) {
@@ -852,7 +1933,7 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	// Finished importing the disc image.
 
 end:
-	free(buf);
+	aligned_free(zero_buf);
 	if (err != 0) {
 		errno = err;
 	}
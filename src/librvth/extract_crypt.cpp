@@ -22,6 +22,7 @@
 #include "disc_header.hpp"
 #include "ptbl.h"
 #include "rvth_error.h"
+#include "wii_crypt.h"
 
 #include "byteswap.h"
 #include "nhcd_structs.h"
@@ -29,9 +30,8 @@
 // Reader class
 #include "reader/Reader.hpp"
 
-// libwiicrypto
-#include "libwiicrypto/cert_store.h"
-#include "libwiicrypto/sig_tools.h"
+// Multi-threaded group encryption
+#include "GroupPipeline.hpp"
 
 // C includes.
 #include <stdlib.h>
@@ -41,272 +41,14 @@
 #include <cerrno>
 #include <cstring>
 
+// C++ includes.
+#include <vector>
+using std::vector;
+
 // Encryption.
 #include "aesw.h"
 #include <nettle/sha1.h>
 
-// Sector: 32 KB [H0]
-// Subgroup: 8 sectors == 256 KB [H1]
-// Group: 8 subgroups == 2 MB [H2]
-
-#define SECTOR_SIZE_DEC		(31*1024)
-#define SECTOR_SIZE_ENC		(32*1024)
-#define SUBGROUP_SIZE_DEC	(8*SECTOR_SIZE_DEC)
-#define SUBGROUP_SIZE_ENC	(8*SECTOR_SIZE_ENC)
-#define GROUP_SIZE_DEC		(8*SUBGROUP_SIZE_DEC)
-#define GROUP_SIZE_ENC		(8*SUBGROUP_SIZE_ENC)
-
-// H3 table: SHA-1 hashes of each group's H2 tables.
-// Up to 4,915 groups can be hashed. (9,830 MB of encrypted data)
-// Unused hash entries are all zero.
-// The SHA-1 hash of the H3 table is stored in the TMD content table.
-typedef struct _Wii_Disc_H3_t {
-	uint8_t h3[4915][SHA1_DIGEST_SIZE];
-	uint8_t pad[4];
-} Wii_Disc_H3_t;
-ASSERT_STRUCT(Wii_Disc_H3_t, 0x18000);
-
-// Encrypted Wii disc sector: Hash data.
-// The hash data is encrypted using AES-128-CBC.
-// - Key: Decrypted title key.
-// - IV: All zero.
-typedef struct _Wii_Disc_Hashes_t {
-	// H0 hashes.
-	// One SHA-1 hash for each kilobyte of user data.
-	uint8_t H0[31][SHA1_DIGEST_SIZE];
-
-	// Padding. (0x00)
-	uint8_t pad_H0[20];
-
-	// H1 hashes.
-	// Each hash is over the H0 table for each sector
-	// in an 8-sector subgroup.
-	uint8_t H1[8][SHA1_DIGEST_SIZE];
-
-	// Padding. (0x00)
-	uint8_t pad_H1[32];
-
-	// H2 hashes.
-	// Each hash is over the H1 table for each subgroup
-	// in an 8-subgroup group.
-	// NOTE: The last 16 bytes of h2[7], when encrypted,
-	// is the user data CBC IV.
-	uint8_t H2[8][SHA1_DIGEST_SIZE];
-
-	// Padding. (0x00)
-	uint8_t pad_H2[32];
-} Wii_Disc_Hashes_t;
-ASSERT_STRUCT(Wii_Disc_Hashes_t, 1024);
-
-// Encrypted Wii disc sector.
-typedef struct _Wii_Disc_Sector_t {
-	// Hash table.
-	Wii_Disc_Hashes_t hashes;
-
-	// User data.
-	// This section is encrypted using AES-128-CBC:
-	// - Key: Decrypted title key.
-	// - IV: *Encrypted* bytes 0x3D0-0x3DF of the hash table,
-	//        aka the last 16 bytes of hashes.h2[7].
-	uint8_t data[31*1024];
-} Wii_Disc_Sector_t;
-ASSERT_STRUCT(Wii_Disc_Sector_t, 32*1024);
-
-// TODO: Static assertion that SHA1_DIGEST_SIZE == 20.
-
-/**
- * Encrypt a group of Wii sectors.
- * @param aesw AES context. (Key must be set to the decrypted title key.)
- * @param pInBuf	[in] Input buffer.
- * @param inSize	[in] Size of in_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
- * @param pOutBuf	[out] Output buffer.
- * @param outSize	[in] Size of out_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
- * @param pH3		[in] Output buffer for the H3 hash.
- * @param H3_size;	[in] Size of pH3. (Must be SHA1_DIGEST_SIZE bytes.)
- * @return 0 on success; negative POSIX error code on error.
- */
-static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
-	size_t inSize, uint8_t *pOutBuf, size_t outSize,
-	uint8_t *pH3, size_t H3_size)
-{
-	struct sha1_ctx sha1;
-	unsigned int i, j;
-	uint8_t iv[16];
-
-	// Disc sector pointers.
-	Wii_Disc_Sector_t *const sbuf = (Wii_Disc_Sector_t*)pOutBuf;
-	Wii_Disc_Sector_t *sbuf_tmp;
-
-	assert(aesw);
-	assert(pInBuf);
-	assert(inSize == GROUP_SIZE_DEC);
-	assert(pOutBuf);
-	assert(outSize == GROUP_SIZE_ENC);
-	assert(pH3);
-	assert(H3_size == SHA1_DIGEST_SIZE);
-
-	if (!aesw || !pInBuf || inSize != GROUP_SIZE_DEC ||
-	    !pOutBuf || outSize != GROUP_SIZE_ENC ||
-	    !pH3 || H3_size != SHA1_DIGEST_SIZE)
-	{
-		// Invalid parameters.
-		errno = EINVAL;
-		return -EINVAL;
-	}
-
-	// Initialize the SHA-1 context.
-	sha1_init(&sha1);
-
-	// Copy the user data and calculate the H0 hashes.
-	for (i = 0; i < 64; i++, pInBuf += SECTOR_SIZE_DEC) {
-		// Copy user data.
-		uint8_t *pH0 = sbuf[i].hashes.H0[0];
-		uint8_t *pData = sbuf[i].data;
-		memcpy(pData, pInBuf, SECTOR_SIZE_DEC);
-
-		// Calculate the H0 hashes.
-		for (j = 0; j < 31; j++, pData += 1024, pH0 += SHA1_DIGEST_SIZE) {
-			sha1_update(&sha1, 1024, pData);
-			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH0);
-		}
-
-		// Zero out the post-H0 padding.
-		memset(sbuf[i].hashes.pad_H0, 0, sizeof(sbuf[i].hashes.pad_H0));
-	}
-
-	// Calculate the H1 hashes for each subgroup of 8 sectors.
-	for (i = 0; i < 64; i += 8) {
-		// First sector in the subgroup.
-		Wii_Disc_Sector_t *const sbuf0 = &sbuf[i];
-		uint8_t *pH1 = sbuf0->hashes.H1[0];
-
-		// Hash the H0 tables and store the results
-		// in the first sector's H1 table.
-		for (j = i; j < i+8; j++, pH1 += SHA1_DIGEST_SIZE) {
-			sha1_update(&sha1, sizeof(sbuf[j].hashes.H0), sbuf[j].hashes.H0[0]);
-			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH1);
-		}
-		memset(sbuf0->hashes.pad_H1, 0, sizeof(sbuf0->hashes.pad_H1));
-
-		// Copy the H1 hashes to each sector in the subgroup.
-		for (j = i+1; j < i+8; j++) {
-			memcpy(sbuf[j].hashes.H1, sbuf0->hashes.H1, sizeof(sbuf[j].hashes.H1));
-			memset(sbuf[j].hashes.pad_H1, 0, sizeof(sbuf[j].hashes.pad_H1));
-		}
-	}
-
-	// Calculate the H2 hashes for the subgroups.
-	// NOTE: All sectors in this group have the same H2 hashes.
-	sbuf_tmp = sbuf;
-	for (i = 0; i < 8; i += 1, sbuf_tmp += 8) {
-		sha1_update(&sha1, sizeof(sbuf_tmp->hashes.H1), sbuf_tmp->hashes.H1[0]);
-		sha1_digest(&sha1, SHA1_DIGEST_SIZE, sbuf[0].hashes.H2[i]);
-	}
-	memset(sbuf[0].hashes.pad_H2, 0, sizeof(sbuf[0].hashes.pad_H2));
-
-	// Copy the H2 hashes to all sectors and encrypt the hashes.
-	sbuf_tmp = &sbuf[1];
-	memset(iv, 0, sizeof(iv));
-	for (i = 1; i < 64; i++, sbuf_tmp++) {
-		memcpy(sbuf_tmp->hashes.H2, sbuf[0].hashes.H2, sizeof(sbuf[0].hashes.H2));
-		memset(sbuf_tmp->hashes.pad_H2, 0, sizeof(sbuf_tmp->hashes.pad_H2));
-
-		// TODO: Error checking.
-		aesw_set_iv(aesw, iv, sizeof(iv));
-		aesw_encrypt(aesw, (uint8_t*)&sbuf_tmp->hashes, sizeof(sbuf_tmp->hashes));
-	}
-
-	// Calculate the H3 hash.
-	sha1_update(&sha1, sizeof(sbuf[0].hashes.H2), sbuf[0].hashes.H2[0]);
-	sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH3);
-
-	// Encrypt sector 0's hashes.
-	aesw_set_iv(aesw, iv, sizeof(iv));
-	aesw_encrypt(aesw, (uint8_t*)&sbuf[0].hashes, sizeof(sbuf[0].hashes));
-
-	// Encrypt the user data.
-	sbuf_tmp = sbuf;
-	for (i = 0; i < 64; i++, sbuf_tmp++) {
-		// User data IV is stored within the encrypted H2 table.
-		aesw_set_iv(aesw, &sbuf[i].hashes.H2[7][4], 16);
-		aesw_encrypt(aesw, sbuf_tmp->data, sizeof(sbuf_tmp->data));
-	}
-
-	// We're done here?
-	return 0;
-}
-
-/**
- * Decrypt the title key.
- * TODO: Pass in an aesw context for less overhead.
- *
- * @param ticket	[in] Ticket.
- * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
- * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
- * @return 0 on success; non-zero on error.
- */
-static int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
-{
-	const uint8_t *commonKey;
-	uint8_t iv[16];	// based on Title ID
-
-	// TODO: Error checking.
-	// TODO: Pass in an aesw context for less overhead.
-	AesCtx *aesw;
-
-	// Check the 'from' key.
-	if (!strncmp(ticket->issuer,
-	    RVL_Cert_Issuers[RVL_CERT_ISSUER_RETAIL_TICKET], sizeof(ticket->issuer)))
-	{
-		// Retail. Use RVL_KEY_RETAIL unless the Korean key is selected.
-		if (ticket->common_key_index != 1) {
-			commonKey = RVL_AES_Keys[RVL_KEY_RETAIL];
-			*crypto_type = RVL_CryptoType_Retail;
-		} else {
-			commonKey = RVL_AES_Keys[RVL_KEY_KOREAN];
-			*crypto_type = RVL_CryptoType_Korean;
-		}
-	}
-	else if (!strncmp(ticket->issuer,
-		 RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TICKET], sizeof(ticket->issuer)))
-	{
-		// Debug. Use RVL_KEY_DEBUG.
-		commonKey = RVL_AES_Keys[RVL_KEY_DEBUG];
-		*crypto_type = RVL_CryptoType_Debug;
-	}
-	else
-	{
-		// Unknown issuer.
-		errno = EIO;
-		return RVTH_ERROR_ISSUER_UNKNOWN;
-	}
-
-	// Initialize the AES context.
-	errno = 0;
-	aesw = aesw_new();
-	if (!aesw) {
-		int ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		return ret;
-	}
-
-	// IV is the 64-bit title ID, followed by zeroes.
-	memcpy(iv, &ticket->title_id, 8);
-	memset(&iv[8], 0, 8);
-
-	// Decrypt the key with the original common key.
-	memcpy(titleKey, ticket->enc_title_key, 16);
-	aesw_set_key(aesw, commonKey, 16);
-	aesw_set_iv(aesw, iv, sizeof(iv));
-	aesw_decrypt(aesw, titleKey, 16);
-
-	// We're done here
-	aesw_free(aesw);
-	return 0;
-}
-
 /**
  * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
  *
@@ -330,23 +72,17 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	// Buffers.
 	RVL_PartitionHeader pthdr;
 	uint8_t *buf_dec = NULL;
-	uint8_t *buf_enc = NULL;
 
 	// H3 table.
 	Wii_Disc_H3_t *H3_tbl = NULL;	// H3 hash table.
-	uint8_t *pH3;			// Current H3 hash.
 	RVL_Content_Entry *content;
 	struct sha1_ctx sha1;
 
-	// Current LBA counters.
-	// Relative to the game partition.
-	uint32_t data_offset;	// Partition data offset.
-	uint32_t lba_count_dec;	// Decrypted (source)
-	uint32_t lba_count_enc;	// Encrypted (destination)
+	// Partition data offset.
+	uint32_t data_offset;
 
-	// Highest LBA that can be read from the source without
-	// padding the buffer.
-	uint32_t lba_max_dec;
+	// Number of groups to encrypt.
+	unsigned int group_count;
 
 	// Callback state.
 	RvtH_Progress_State state;
@@ -357,8 +93,8 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	// Destination disc image.
 	RvtH_BankEntry *entry_dest;
 
-	// AES context.
-	AesCtx *aesw = NULL;
+	// AES contexts. (one per worker thread)
+	vector<AesCtx*> aesw;
 	uint8_t titleKey[16];
 
 	if (!rvth_dest) {
@@ -375,6 +111,9 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	}
 
 	// Check if the source bank can be extracted.
+	// NOTE: The ticket and TMD signature status are copied
+	// to the destination, so make sure they're initialized.
+	loadBankDetails(bank_src);
 	RvtH_BankEntry *const entry_src = &m_entries[bank_src];
 	switch (entry_src->type) {
 		case RVTH_BankType_Wii_SL:
@@ -426,10 +165,9 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	// TODO: Use unique_ptr<>?
 	#define LBA_COUNT_DEC BYTES_TO_LBA(GROUP_SIZE_DEC)
 	#define LBA_COUNT_ENC BYTES_TO_LBA(GROUP_SIZE_ENC)
-	buf_dec = static_cast<uint8_t*>(malloc(GROUP_SIZE_DEC));
-	buf_enc = static_cast<uint8_t*>(malloc(GROUP_SIZE_ENC));
+	buf_dec = static_cast<uint8_t*>(malloc(LBA_SIZE));
 	H3_tbl = static_cast<Wii_Disc_H3_t*>(calloc(1, sizeof(*H3_tbl)));	// zero initialized
-	if (!buf_dec || !buf_enc || !H3_tbl) {
+	if (!buf_dec || !H3_tbl) {
 		// Error allocating memory.
 		err = errno;
 		if (err == 0) {
@@ -439,18 +177,6 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		goto end;
 	}
 
-	// Initialize encryption.
-	aesw = aesw_new();
-	if (!aesw) {
-		// Error initializing encryption.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		ret = -err;
-		goto end;
-	}
-
 	// TODO: Set the expected file size.
 	// Since we're writing mostly encrypted data, we aren't
 	// going to make this a sparse file, but we should at least
@@ -540,70 +266,102 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	}
 
 	// Decrypt the title key.
-	ret = decrypt_title_key(&pthdr.ticket, titleKey, &entry_dest->crypto_type);
+	ret = rvth_decrypt_title_key(&pthdr.ticket, titleKey, &entry_dest->crypto_type);
 	if (ret != 0) {
 		// Error decrypting the title key.
 		err = EIO;
 		goto end;
 	}
-	aesw_set_key(aesw, titleKey, sizeof(titleKey));
-
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_max_dec = lba_copy_len - (lba_copy_len % LBA_COUNT_DEC);
-	pH3 = H3_tbl->h3[0];
-	for (lba_count_dec = 0, lba_count_enc = 0;
-	     lba_count_dec < lba_max_dec;
-	     lba_count_dec += LBA_COUNT_DEC, lba_count_enc += LBA_COUNT_ENC, pH3 += SHA1_DIGEST_SIZE)
-	{
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count_dec;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
-		}
-
-		// TODO: Error handling.
-
-		// Read 64 decrypted sectors.
-		entry_src->reader->read(buf_dec, data_lba_src + lba_count_dec, LBA_COUNT_DEC);
 
-		// Encrypt the sectors. (64*31k -> 64*32k)
-		rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC, buf_enc, GROUP_SIZE_ENC, pH3, SHA1_DIGEST_SIZE);
-
-		// Write 64 encrypted sectors.
-		entry_dest->reader->write(buf_enc, data_lba_dest + lba_count_enc, LBA_COUNT_ENC);
+	// The H3 table can only hold a limited number of groups.
+	group_count = (lba_copy_len + LBA_COUNT_DEC - 1) / LBA_COUNT_DEC;
+	if (group_count > ARRAY_SIZE(H3_tbl->h3)) {
+		// Partition is too big.
+		err = EIO;
+		ret = RVTH_ERROR_IMAGE_TOO_BIG;
+		goto end;
 	}
 
-	// If we have leftover, write a padded group.
-	if (lba_count_dec < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count_dec;
-
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count_dec;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
+	{
+		// Encrypt the groups using a multi-threaded pipeline.
+		// The output buffer has the H3 hash after the encrypted group.
+		GroupPipeline pipeline(0, GROUP_SIZE_DEC, GROUP_SIZE_ENC + SHA1_DIGEST_SIZE);
+		if (!pipeline.isValid()) {
+			// Error allocating memory.
+			err = ENOMEM;
+			ret = -err;
+			goto end;
+		}
+
+		// Initialize encryption for each worker.
+		aesw.resize(pipeline.workerCount(), nullptr);
+		for (AesCtx *&ctx : aesw) {
+			ctx = aesw_new();
+			if (!ctx) {
+				// Error initializing encryption.
+				err = errno;
+				if (err == 0) {
+					err = EIO;
+				}
+				ret = -err;
 				goto end;
 			}
+			aesw_set_key(ctx, titleKey, sizeof(titleKey));
 		}
 
-		// Read and pad the sectors.
-		entry_src->reader->read(buf_dec, data_lba_src + lba_count_dec, lba_left);
-		memset(&buf_dec[LBA_TO_BYTES(LBA_COUNT_DEC - lba_left)], 0, LBA_TO_BYTES(lba_left));
+		// Reader: Read 64 decrypted sectors.
+		// If this is the last group, pad it with zeroes.
+		auto readFn = [=](unsigned int idx, uint8_t *inBuf) -> int {
+			const uint32_t lba_count_dec = idx * LBA_COUNT_DEC;
+			uint32_t lba_left = lba_copy_len - lba_count_dec;
+			if (lba_left > LBA_COUNT_DEC) {
+				lba_left = LBA_COUNT_DEC;
+			} else if (lba_left < LBA_COUNT_DEC) {
+				memset(&inBuf[LBA_TO_BYTES(lba_left)], 0, LBA_TO_BYTES(LBA_COUNT_DEC - lba_left));
+			}
 
-		// Encrypt the sectors. (64*31k -> 64*32k)
-		rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC, buf_enc, GROUP_SIZE_ENC, pH3, SHA1_DIGEST_SIZE);
+			errno = 0;
+			uint32_t lba_size = entry_src->reader->read(inBuf, data_lba_src + lba_count_dec, lba_left);
+			if (lba_size != lba_left) {
+				// Read error.
+				return (errno != 0 ? -errno : -EIO);
+			}
+			return 0;
+		};
+
+		// Workers: Encrypt the sectors. (64*31k -> 64*32k)
+		auto workFn = [&aesw](unsigned int workerIdx, unsigned int idx, uint8_t *inBuf, uint8_t *outBuf) -> int {
+			UNUSED(idx);
+			return rvth_encrypt_group(aesw[workerIdx], inBuf, GROUP_SIZE_DEC,
+				outBuf, GROUP_SIZE_ENC, &outBuf[GROUP_SIZE_ENC], SHA1_DIGEST_SIZE);
+		};
+
+		// Writer: Write 64 encrypted sectors and save the H3 hash.
+		auto writeFn = [&](unsigned int idx, const uint8_t *inBuf, const uint8_t *outBuf) -> int {
+			UNUSED(inBuf);
+			if (callback) {
+				state.lba_processed = idx * LBA_COUNT_DEC;
+				if (!callback(&state, userdata)) {
+					// Stop processing.
+					return -ECANCELED;
+				}
+			}
+
+			errno = 0;
+			uint32_t lba_size = entry_dest->reader->write(outBuf, data_lba_dest + (idx * LBA_COUNT_ENC), LBA_COUNT_ENC);
+			if (lba_size != LBA_COUNT_ENC) {
+				// Write error.
+				return (errno != 0 ? -errno : -EIO);
+			}
+			memcpy(H3_tbl->h3[idx], &outBuf[GROUP_SIZE_ENC], SHA1_DIGEST_SIZE);
+			return 0;
+		};
 
-		// Write 64 encrypted sectors.
-		entry_dest->reader->write(buf_enc, data_lba_dest + lba_count_enc, LBA_COUNT_ENC);
+		ret = pipeline.run(group_count, readFn, workFn, writeFn);
+		if (ret != 0) {
+			err = -ret;
+			goto end;
+		}
 	}
 
 	/** Update the partition header. **/
@@ -650,13 +408,18 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	}
 
 	// Finished extracting the disc image.
-	entry_dest->reader->flush();
+	// NOTE: CISO and WBFS headers are written here.
+	ret = entry_dest->reader->flush();
+	if (ret != 0) {
+		err = -ret;
+	}
 
 end:
 	free(buf_dec);
-	free(buf_enc);
 	free(H3_tbl);
-	aesw_free(aesw);
+	for (AesCtx *ctx : aesw) {
+		aesw_free(ctx);
+	}
 	if (err != 0) {
 		errno = err;
 	}
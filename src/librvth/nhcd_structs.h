@@ -26,6 +26,7 @@ extern "C" {
 #pragma pack(1)
 
 #define NHCD_BANK_COUNT 8
+#define NHCD_BANK_COUNT_MAX 32	/* Extended bank tables */
 
 /**
  * RVT-H bank table header.
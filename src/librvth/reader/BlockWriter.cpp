@@ -0,0 +1,330 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BlockWriter.cpp: Block-mapped disc image writer.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BlockWriter.hpp"
+#include "aligned_malloc.h"
+#include "libwiicrypto/zero_block.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+using std::vector;
+
+const uint32_t BlockWriter::BLOCK_EMPTY;
+
+/**
+ * Create a block writer.
+ * Check isValid() afterwards.
+ * @param file			[in] RefFile*. (not ref()'d; must outlive the BlockWriter)
+ * @param data_lba		[in] File LBA of the first physical block.
+ * @param block_size_lba	[in] Block size, in LBAs.
+ * @param block_count		[in] Number of logical blocks.
+ */
+BlockWriter::BlockWriter(RefFile *file, uint32_t data_lba, uint32_t block_size_lba, uint32_t block_count)
+	: m_file(file)
+	, m_data_lba(data_lba)
+	, m_block_size_lba(block_size_lba)
+	, m_physBlockCount(0)
+	, m_blockMap(block_count, BLOCK_EMPTY)
+	, m_pendingBuf(nullptr)
+	, m_pendingIdx(BLOCK_EMPTY)
+{
+	assert(file != nullptr);
+	assert(block_size_lba != 0);
+
+	// Page-aligned in case the file is opened with O_DIRECT.
+	m_pendingBuf = static_cast<uint8_t*>(aligned_malloc(4096, LBA_TO_BYTES(block_size_lba)));
+	if (!m_pendingBuf) {
+		errno = ENOMEM;
+	}
+}
+
+BlockWriter::~BlockWriter()
+{
+	// NOTE: The pending block must be written by calling flush().
+	assert(m_pendingIdx == BLOCK_EMPTY);
+	aligned_free(m_pendingBuf);
+}
+
+/**
+ * Get the file offset of a physical block.
+ * @param physIdx	[in] Physical block index.
+ * @return File offset, in bytes.
+ */
+int64_t BlockWriter::physOffset(uint32_t physIdx) const
+{
+	return LBA_TO_BYTES(m_data_lba) + LBA_TO_BYTES(m_block_size_lba) * physIdx;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t BlockWriter::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	const uint64_t lba_end = static_cast<uint64_t>(lba_start) + lba_len;
+	assert(lba_end <= static_cast<uint64_t>(m_blockMap.size()) * m_block_size_lba);
+	if (lba_end > static_cast<uint64_t>(m_blockMap.size()) * m_block_size_lba) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	uint32_t lba = lba_start;
+	while (lba < lba_end) {
+		const uint32_t blockIdx = lba / m_block_size_lba;
+		const uint32_t offset = lba % m_block_size_lba;
+		uint32_t run_len = m_block_size_lba - offset;
+		if (run_len > lba_end - lba) {
+			run_len = static_cast<uint32_t>(lba_end - lba);
+		}
+		const size_t run_bytes = LBA_TO_BYTES(run_len);
+
+		const uint32_t physIdx = m_blockMap[blockIdx];
+		if (physIdx != BLOCK_EMPTY) {
+			// Allocated block.
+			size_t size = m_file->preadAt(physOffset(physIdx) + LBA_TO_BYTES(offset), ptr8, run_bytes);
+			if (size != run_bytes) {
+				// Read error.
+				if (errno == 0) {
+					errno = EIO;
+				}
+				return 0;
+			}
+		} else if (blockIdx == m_pendingIdx) {
+			// Pending block.
+			memcpy(ptr8, &m_pendingBuf[LBA_TO_BYTES(offset)], run_bytes);
+		} else {
+			// Empty block.
+			memset(ptr8, 0, run_bytes);
+		}
+
+		lba += run_len;
+		ptr8 += run_bytes;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Write data to the disc image.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t BlockWriter::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	const uint64_t lba_end = static_cast<uint64_t>(lba_start) + lba_len;
+	assert(lba_end <= static_cast<uint64_t>(m_blockMap.size()) * m_block_size_lba);
+	if (lba_end > static_cast<uint64_t>(m_blockMap.size()) * m_block_size_lba) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	uint32_t lba = lba_start;
+	while (lba < lba_end) {
+		const uint32_t blockIdx = lba / m_block_size_lba;
+		const uint32_t offset = lba % m_block_size_lba;
+		uint32_t run_len = m_block_size_lba - offset;
+		if (run_len > lba_end - lba) {
+			run_len = static_cast<uint32_t>(lba_end - lba);
+		}
+		const size_t run_bytes = LBA_TO_BYTES(run_len);
+
+		const uint32_t physIdx = m_blockMap[blockIdx];
+		if (physIdx != BLOCK_EMPTY) {
+			// Block is already allocated. Overwrite it in place.
+			size_t size = m_file->pwriteAt(physOffset(physIdx) + LBA_TO_BYTES(offset), ptr8, run_bytes);
+			if (size != run_bytes) {
+				// Write error.
+				if (errno == 0) {
+					errno = EIO;
+				}
+				return 0;
+			}
+		} else if (blockIdx != m_pendingIdx && run_len == m_block_size_lba) {
+			// Full block. Write it directly.
+			int ret = writeNewBlock(blockIdx, ptr8);
+			if (ret != 0) {
+				errno = -ret;
+				return 0;
+			}
+		} else {
+			if (blockIdx != m_pendingIdx) {
+				// Write the current pending block and
+				// start a new one for this block.
+				int ret = flush();
+				if (ret != 0) {
+					errno = -ret;
+					return 0;
+				}
+				memset(m_pendingBuf, 0, LBA_TO_BYTES(m_block_size_lba));
+				m_pendingIdx = blockIdx;
+			}
+			memcpy(&m_pendingBuf[LBA_TO_BYTES(offset)], ptr8, run_bytes);
+		}
+
+		lba += run_len;
+		ptr8 += run_bytes;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Write the pending block, if any.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int BlockWriter::flush(void)
+{
+	if (m_pendingIdx == BLOCK_EMPTY) {
+		// No pending block.
+		return 0;
+	}
+
+	const uint32_t blockIdx = m_pendingIdx;
+	m_pendingIdx = BLOCK_EMPTY;
+	return writeNewBlock(blockIdx, m_pendingBuf);
+}
+
+/**
+ * Rearrange the physical blocks so they're in logical block order.
+ * This is needed for formats that don't store the physical block
+ * index, e.g. CISO. The pending block must be flushed first.
+ *
+ * Blocks are normally written in logical block order, so this
+ * usually doesn't need to move anything.
+ *
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int BlockWriter::sortBlocks(void)
+{
+	assert(m_pendingIdx == BLOCK_EMPTY);
+	if (m_pendingIdx != BLOCK_EMPTY) {
+		return -EINVAL;
+	}
+
+	// Determine the new physical index of each physical block.
+	vector<uint32_t> newPhys(m_physBlockCount);
+	bool sorted = true;
+	uint32_t physIdx = 0;
+	for (uint32_t blockIdx = 0; blockIdx < m_blockMap.size(); blockIdx++) {
+		const uint32_t oldPhys = m_blockMap[blockIdx];
+		if (oldPhys == BLOCK_EMPTY)
+			continue;
+		newPhys[oldPhys] = physIdx;
+		if (oldPhys != physIdx) {
+			sorted = false;
+		}
+		physIdx++;
+	}
+	if (sorted) {
+		// Nothing to do.
+		return 0;
+	}
+
+	// Move the blocks one permutation cycle at a time.
+	// m_pendingBuf holds the block being moved; a second
+	// buffer holds the block that's being overwritten.
+	const size_t block_bytes = LBA_TO_BYTES(m_block_size_lba);
+	uint8_t *tmpBuf = static_cast<uint8_t*>(aligned_malloc(4096, block_bytes));
+	if (!tmpBuf) {
+		return -ENOMEM;
+	}
+
+	int ret = 0;
+	vector<bool> moved(m_physBlockCount, false);
+	for (uint32_t start = 0; start < m_physBlockCount && ret == 0; start++) {
+		if (moved[start] || newPhys[start] == start) {
+			continue;
+		}
+
+		errno = 0;
+		if (m_file->preadAt(physOffset(start), m_pendingBuf, block_bytes) != block_bytes) {
+			ret = (errno != 0 ? -errno : -EIO);
+			break;
+		}
+		uint32_t cur = start;
+		do {
+			const uint32_t dest = newPhys[cur];
+			if (dest != start) {
+				// Save the block that's about to be overwritten.
+				if (m_file->preadAt(physOffset(dest), tmpBuf, block_bytes) != block_bytes) {
+					ret = (errno != 0 ? -errno : -EIO);
+					break;
+				}
+			}
+			if (m_file->pwriteAt(physOffset(dest), m_pendingBuf, block_bytes) != block_bytes) {
+				ret = (errno != 0 ? -errno : -EIO);
+				break;
+			}
+			moved[cur] = true;
+			std::swap(m_pendingBuf, tmpBuf);
+			cur = dest;
+		} while (cur != start);
+	}
+	aligned_free(tmpBuf);
+	if (ret != 0) {
+		// The block map no longer matches the file.
+		return ret;
+	}
+
+	// Update the block map.
+	for (uint32_t &phys : m_blockMap) {
+		if (phys != BLOCK_EMPTY) {
+			phys = newPhys[phys];
+		}
+	}
+	return 0;
+}
+
+/**
+ * Allocate a physical block and write a full block of data to it.
+ * Blocks that only contain zeroes are not allocated.
+ * @param blockIdx	[in] Logical block index.
+ * @param data		[in] Block data.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int BlockWriter::writeNewBlock(uint32_t blockIdx, const uint8_t *data)
+{
+	assert(m_blockMap[blockIdx] == BLOCK_EMPTY);
+	const size_t block_bytes = LBA_TO_BYTES(m_block_size_lba);
+	if (zero_block_is_empty(data, block_bytes)) {
+		// Empty block. Don't allocate it.
+		return 0;
+	}
+
+	// Append the block to the end of the file.
+	const uint32_t physIdx = m_physBlockCount;
+	errno = 0;
+	size_t size = m_file->pwriteAt(physOffset(physIdx), data, block_bytes);
+	if (size != block_bytes) {
+		// Write error.
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	m_blockMap[blockIdx] = physIdx;
+	m_physBlockCount++;
+	return 0;
+}
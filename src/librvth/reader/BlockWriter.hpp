@@ -0,0 +1,159 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BlockWriter.hpp: Block-mapped disc image writer.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_BLOCKWRITER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_BLOCKWRITER_HPP__
+
+#include "libwiicrypto/common.h"
+#include "RefFile.hpp"
+
+// C++ includes.
+#include <vector>
+
+/**
+ * Writer for block-mapped disc image formats, e.g. CISO and WBFS.
+ *
+ * The disc image is divided into fixed-size logical blocks.
+ * Physical blocks are allocated in the order they're written,
+ * starting at data_lba, so the file is written sequentially
+ * and doesn't need to be sparse.
+ *
+ * Writes to a block that hasn't been allocated yet are collected
+ * in a pending block buffer. The pending block is written when a
+ * different unallocated block is written to, or when flush() is
+ * called. Blocks that only contain zeroes are never allocated.
+ *
+ * The block map is owned by the BlockWriter. The Reader subclass
+ * is responsible for writing it to the file in its own format.
+ */
+class BlockWriter
+{
+	public:
+		/**
+		 * Create a block writer.
+		 * Check isValid() afterwards.
+		 * @param file			[in] RefFile*. (not ref()'d; must outlive the BlockWriter)
+		 * @param data_lba		[in] File LBA of the first physical block.
+		 * @param block_size_lba	[in] Block size, in LBAs.
+		 * @param block_count		[in] Number of logical blocks.
+		 */
+		BlockWriter(RefFile *file, uint32_t data_lba, uint32_t block_size_lba, uint32_t block_count);
+		~BlockWriter();
+
+	private:
+		DISABLE_COPY(BlockWriter)
+
+	public:
+		// Block map value for an empty block.
+		static const uint32_t BLOCK_EMPTY = ~0U;
+
+		/**
+		 * Was the block writer initialized successfully?
+		 * @return True if valid; false if not.
+		 */
+		inline bool isValid(void) const
+		{
+			return (m_pendingBuf != nullptr);
+		}
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Write data to the disc image.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Write the pending block, if any.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int flush(void);
+
+		/**
+		 * Rearrange the physical blocks so they're in logical block order.
+		 * This is needed for formats that don't store the physical block
+		 * index, e.g. CISO. The pending block must be flushed first.
+		 *
+		 * Blocks are normally written in logical block order, so this
+		 * usually doesn't need to move anything.
+		 *
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int sortBlocks(void);
+
+		/**
+		 * Get the physical block index of a logical block.
+		 * @param blockIdx	[in] Logical block index.
+		 * @return Physical block index, or BLOCK_EMPTY if not allocated.
+		 */
+		inline uint32_t physBlock(uint32_t blockIdx) const
+		{
+			return m_blockMap[blockIdx];
+		}
+
+		/**
+		 * Get the number of logical blocks.
+		 * @return Number of logical blocks.
+		 */
+		inline uint32_t blockCount(void) const
+		{
+			return static_cast<uint32_t>(m_blockMap.size());
+		}
+
+		/**
+		 * Get the number of allocated physical blocks.
+		 * @return Number of allocated physical blocks.
+		 */
+		inline uint32_t physBlockCount(void) const
+		{
+			return m_physBlockCount;
+		}
+
+	private:
+		/**
+		 * Allocate a physical block and write a full block of data to it.
+		 * Blocks that only contain zeroes are not allocated.
+		 * @param blockIdx	[in] Logical block index.
+		 * @param data		[in] Block data.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int writeNewBlock(uint32_t blockIdx, const uint8_t *data);
+
+		/**
+		 * Get the file offset of a physical block.
+		 * @param physIdx	[in] Physical block index.
+		 * @return File offset, in bytes.
+		 */
+		int64_t physOffset(uint32_t physIdx) const;
+
+	private:
+		RefFile *m_file;
+		uint32_t m_data_lba;		// File LBA of the first physical block
+		uint32_t m_block_size_lba;	// Block size, in LBAs
+		uint32_t m_physBlockCount;	// Number of allocated physical blocks
+
+		// Block map. (logical -> physical; BLOCK_EMPTY == empty)
+		std::vector<uint32_t> m_blockMap;
+
+		// Pending block.
+		uint8_t *m_pendingBuf;
+		uint32_t m_pendingIdx;		// Logical block index (BLOCK_EMPTY == none)
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_BLOCKWRITER_HPP__ */
@@ -0,0 +1,240 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CachedReader.cpp: Block cache for small disc image reads.               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "CachedReader.hpp"
+#include "io_backend.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * Create a block cache for a Reader.
+ * The CachedReader takes ownership of the Reader.
+ * @param reader	[in] Underlying Reader.
+ * @param block_size	[in] Block size, in bytes. (multiple of LBA_SIZE)
+ * @param block_count	[in] Maximum number of cached blocks.
+ */
+CachedReader::CachedReader(Reader *reader, unsigned int block_size, unsigned int block_count)
+	: super(reader->file(), reader->lba_start(), reader->lba_len())
+	, m_reader(reader)
+	, m_blockLBAs(BYTES_TO_LBA(block_size))
+	, m_blockCount(block_count)
+	, m_hits(0)
+	, m_misses(0)
+{
+	assert(block_size >= LBA_SIZE);
+	assert(block_size % LBA_SIZE == 0);
+	assert(block_count > 0);
+	m_type = reader->type();
+}
+
+CachedReader::~CachedReader()
+{
+	delete m_reader;
+}
+
+/**
+ * Wrap a Reader in a CachedReader using the block cache settings.
+ * (See rvth_io_set_block_cache().)
+ *
+ * The Reader is returned as-is if the block cache is disabled,
+ * or if the Reader can be memory-mapped.
+ *
+ * @param reader	[in] Reader. (may be nullptr)
+ * @return Reader to use in place of the original Reader.
+ */
+Reader *CachedReader::wrap(Reader *reader)
+{
+	if (!reader) {
+		return nullptr;
+	}
+
+	unsigned int block_size, block_count;
+	rvth_io_get_block_cache(&block_size, &block_count);
+	if (block_count == 0) {
+		// Block cache is disabled.
+		return reader;
+	}
+
+	// Memory-mapped readers already use the page cache directly.
+	if (reader->lba_len() > 0 && reader->map(0, 1) != nullptr) {
+		return reader;
+	}
+
+	return new CachedReader(reader, block_size, block_count);
+}
+
+/**
+ * Get a block, reading it from the underlying Reader if necessary.
+ * The block is moved to the front of the LRU list.
+ * @param idx Block index.
+ * @return Block, or nullptr on error. (check errno)
+ */
+const CachedReader::Block *CachedReader::getBlock(uint32_t idx)
+{
+	auto iter = m_map.find(idx);
+	if (iter != m_map.end()) {
+		// Block is cached.
+		m_hits++;
+		m_lru.splice(m_lru.begin(), m_lru, iter->second);
+		return &m_lru.front();
+	}
+
+	// Block isn't cached. Read it from the underlying Reader.
+	m_misses++;
+	const uint32_t lba_start = idx * m_blockLBAs;
+	uint32_t lba_len = m_lba_len - lba_start;
+	if (lba_len > m_blockLBAs) {
+		lba_len = m_blockLBAs;
+	}
+
+	Block block;
+	if (m_lru.size() >= m_blockCount) {
+		// Reuse the least recently used block's buffer.
+		block.data.swap(m_lru.back().data);
+		m_map.erase(m_lru.back().idx);
+		m_lru.pop_back();
+	} else {
+		block.data.resize(LBA_TO_BYTES(m_blockLBAs));
+	}
+
+	errno = 0;
+	block.idx = idx;
+	block.lba_len = m_reader->read(block.data.data(), lba_start, lba_len);
+	if (block.lba_len == 0) {
+		// Read error. Don't cache anything.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return nullptr;
+	}
+
+	m_lru.push_front(std::move(block));
+	m_map.emplace(idx, m_lru.begin());
+	return &m_lru.front();
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t CachedReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	if (lba_len > m_blockLBAs) {
+		// Large reads bypass the cache.
+		return m_reader->read(ptr, lba_start, lba_len);
+	}
+
+	uint8_t *p = static_cast<uint8_t*>(ptr);
+	uint32_t lba_count = 0;
+	while (lba_count < lba_len) {
+		const uint32_t lba = lba_start + lba_count;
+		const Block *const block = getBlock(lba / m_blockLBAs);
+		if (!block) {
+			// Read error.
+			break;
+		}
+
+		// Copy the requested part of the block.
+		const uint32_t offset = lba % m_blockLBAs;
+		if (offset >= block->lba_len) {
+			// Short block. (end of file)
+			break;
+		}
+		uint32_t count = block->lba_len - offset;
+		if (count > lba_len - lba_count) {
+			count = lba_len - lba_count;
+		}
+		memcpy(p, &block->data[LBA_TO_BYTES(offset)], LBA_TO_BYTES(count));
+		p += LBA_TO_BYTES(count);
+		lba_count += count;
+
+		if (block->lba_len < m_blockLBAs) {
+			// Short block. Nothing after this.
+			break;
+		}
+	}
+
+	return lba_count;
+}
+
+/**
+ * Write data to the disc image.
+ * Cached blocks overlapping the written range are discarded.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t CachedReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	if (lba_len > 0) {
+		// The cache is small, so check every cached block
+		// instead of looking up each block in the range.
+		const uint32_t idx_first = lba_start / m_blockLBAs;
+		const uint32_t idx_last = (lba_start + lba_len - 1) / m_blockLBAs;
+		for (auto iter = m_lru.begin(); iter != m_lru.end(); ) {
+			if (iter->idx >= idx_first && iter->idx <= idx_last) {
+				m_map.erase(iter->idx);
+				iter = m_lru.erase(iter);
+			} else {
+				++iter;
+			}
+		}
+	}
+
+	return m_reader->write(ptr, lba_start, lba_len);
+}
+
+/**
+ * Discard all cached blocks.
+ */
+void CachedReader::discardCache(void)
+{
+	m_map.clear();
+	m_lru.clear();
+	m_reader->discardCache();
+}
+
+/** Other functions are passed through to the underlying Reader. **/
+
+int CachedReader::flush(void)
+{
+	return m_reader->flush();
+}
+
+int CachedReader::findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
+{
+	return m_reader->findData(lba, pLbaStart, pLbaEnd);
+}
+
+const uint8_t *CachedReader::map(uint32_t lba_start, uint32_t lba_len)
+{
+	return m_reader->map(lba_start, lba_len);
+}
+
+Reader *CachedReader::reopen(void) const
+{
+	return m_reader->reopen();
+}
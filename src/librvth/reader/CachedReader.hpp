@@ -0,0 +1,150 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CachedReader.hpp: Block cache for small disc image reads.               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_CACHEDREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_CACHEDREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes.
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Block cache for another Reader.
+ *
+ * Bank metadata (disc header, partition table, region setting,
+ * partition headers) is read using many small reads at nearby
+ * offsets. On an RVT-H Reader, each read is a USB round trip.
+ * CachedReader reads whole blocks instead, and keeps the most
+ * recently used blocks in memory.
+ *
+ * Reads larger than one block bypass the cache, so bulk copies
+ * aren't slowed down and don't evict the metadata blocks.
+ * Writes are passed through to the underlying Reader, and any
+ * cached blocks they overlap are discarded.
+ *
+ * Thread-safety: Same as Reader.
+ */
+class CachedReader : public Reader
+{
+	public:
+		/**
+		 * Create a block cache for a Reader.
+		 * The CachedReader takes ownership of the Reader.
+		 * @param reader	[in] Underlying Reader.
+		 * @param block_size	[in] Block size, in bytes. (multiple of LBA_SIZE)
+		 * @param block_count	[in] Maximum number of cached blocks.
+		 */
+		CachedReader(Reader *reader, unsigned int block_size, unsigned int block_count);
+		virtual ~CachedReader();
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(CachedReader)
+
+	public:
+		/**
+		 * Wrap a Reader in a CachedReader using the block cache settings.
+		 * (See rvth_io_set_block_cache().)
+		 *
+		 * The Reader is returned as-is if the block cache is disabled,
+		 * or if the Reader can be memory-mapped.
+		 *
+		 * @param reader	[in] Reader. (may be nullptr)
+		 * @return Reader to use in place of the original Reader.
+		 */
+		static Reader *wrap(Reader *reader);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Write data to the disc image.
+		 * Cached blocks overlapping the written range are discarded.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		int flush(void) final;
+		int findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd) final;
+		const uint8_t *map(uint32_t lba_start, uint32_t lba_len) final;
+		Reader *reopen(void) const final;
+
+		bool isLinear(void) const final
+		{
+			return m_reader->isLinear();
+		}
+
+		bool hasReadahead(void) const final
+		{
+			return m_reader->hasReadahead();
+		}
+
+		/**
+		 * Discard all cached blocks.
+		 */
+		void discardCache(void) final;
+
+	public:
+		/** Cache statistics **/
+
+		/**
+		 * Get the number of block lookups that were found in the cache.
+		 * @return Number of cache hits.
+		 */
+		inline uint64_t hits(void) const { return m_hits; }
+
+		/**
+		 * Get the number of block lookups that had to be read.
+		 * @return Number of cache misses.
+		 */
+		inline uint64_t misses(void) const { return m_misses; }
+
+	private:
+		struct Block {
+			uint32_t idx;		// Block index
+			uint32_t lba_len;	// Number of valid LBAs (may be short at EOF)
+			std::vector<uint8_t> data;
+		};
+
+		/**
+		 * Get a block, reading it from the underlying Reader if necessary.
+		 * The block is moved to the front of the LRU list.
+		 * @param idx Block index.
+		 * @return Block, or nullptr on error. (check errno)
+		 */
+		const Block *getBlock(uint32_t idx);
+
+	private:
+		Reader *const m_reader;		// Underlying Reader (owned)
+		const uint32_t m_blockLBAs;	// Block size, in LBAs
+		const unsigned int m_blockCount;	// Maximum number of cached blocks
+
+		// Cached blocks. Most recently used blocks are first.
+		std::list<Block> m_lru;
+		std::unordered_map<uint32_t, std::list<Block>::iterator> m_map;
+
+		uint64_t m_hits;
+		uint64_t m_misses;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_CACHEDREADER_HPP__ */
@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "CisoReader.hpp"
+#include "BlockWriter.hpp"
 #include "byteswap.h"
 
 // For LBA_TO_BYTES()
@@ -104,8 +105,9 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	: super(file, lba_start, lba_len)
 	, m_real_lba_len(0)
 	, m_block_size_lba(0)
+	, m_blockWriter(nullptr)
+	, m_headerDirty(false)
 {
-	int ret;
 	int err = 0;
 	size_t size;
 	unsigned int i;
@@ -142,16 +144,7 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	m_real_lba_len = lba_len;
 
 	// Read the CISO header.
-	ret = m_file->seeko(lba_start * LBA_SIZE, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		goto fail;
-	}
-	size = m_file->read(cisoHeader, 1, sizeof(*cisoHeader));
+	size = m_file->preadAt(LBA_TO_BYTES(lba_start), cisoHeader, sizeof(*cisoHeader));
 	if (size != sizeof(*cisoHeader)) {
 		// Short read.
 		err = errno;
@@ -206,6 +199,99 @@ fail:
 	errno = err;
 }
 
+/**
+ * Create a new, writable CISO image.
+ * @param file		RefFile*. (must be writable and empty)
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ */
+CisoReader::CisoReader(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_real_lba_len(0)
+	, m_block_size_lba(0)
+	, m_blockWriter(nullptr)
+	, m_headerDirty(true)
+{
+	int err = 0;
+	uint32_t block_size, block_count;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	} else if (lba_len == 0) {
+		// Disc image size must be specified.
+		err = EINVAL;
+		goto fail;
+	}
+
+	// Use the smallest block size that fits in the CISO block map.
+	// Smaller blocks allow more of the disc image to be skipped.
+	block_size = CISO_BLOCK_SIZE_MIN;
+	while (static_cast<int64_t>(block_size) * CISO_MAP_SIZE < LBA_TO_BYTES(lba_len)) {
+		block_size <<= 1;
+		if (block_size > CISO_BLOCK_SIZE_MAX) {
+			// Disc image is too big.
+			err = EFBIG;
+			goto fail;
+		}
+	}
+	m_block_size_lba = BYTES_TO_LBA(block_size);
+	block_count = (lba_len + m_block_size_lba - 1) / m_block_size_lba;
+
+	// Blocks are written after the CISO header.
+	m_lba_start = BYTES_TO_LBA(CISO_HEADER_SIZE);
+	m_lba_len = lba_len;
+	m_real_lba_len = BYTES_TO_LBA(CISO_HEADER_SIZE);
+	memset(m_blockMap, 0xFF, sizeof(m_blockMap));
+
+	m_blockWriter = new BlockWriter(m_file, m_lba_start, m_block_size_lba, block_count);
+	if (!m_blockWriter->isValid()) {
+		// Error allocating the block buffer.
+		err = ENOMEM;
+		goto fail;
+	}
+
+	// Reader initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	delete m_blockWriter;
+	m_blockWriter = nullptr;
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+CisoReader::~CisoReader()
+{
+	if (m_blockWriter) {
+		// Make sure the CISO header is written.
+		flush();
+		delete m_blockWriter;
+	}
+
+	// Superclass will unreference the file.
+}
+
+/**
+ * Create a new, writable CISO image.
+ *
+ * Non-empty blocks are written sequentially after the
+ * CISO header as they're written to the disc image.
+ * The CISO header is written by flush().
+ *
+ * Check isOpen() afterwards.
+ *
+ * @param file		RefFile*. (must be writable and empty)
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @return CisoReader*
+ */
+CisoReader *CisoReader::create(RefFile *file, uint32_t lba_len)
+{
+	return new CisoReader(file, lba_len);
+}
+
 /**
  * Read data from the disc image.
  * @param ptr		[out] Read buffer.
@@ -215,9 +301,6 @@ fail:
  */
 uint32_t CisoReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 {
-	// Return value.
-	uint32_t lbas_read = 0;
-
 	// LBA bounds checking.
 	// TODO: Check for overflow?
 	assert(lba_start + m_lba_start + lba_len <=
@@ -230,39 +313,142 @@ uint32_t CisoReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// TODO: Optimize reading multiple LBAs at once.
-	// For now, we're looking up a single LBA at a time.
+	if (m_blockWriter) {
+		// CISO image is being written.
+		return m_blockWriter->read(ptr, lba_start, lba_len);
+	}
+
+	// Walk the block map and split the request into runs.
+	// A run is either a sequence of empty blocks, which is
+	// zero-filled with a single memset(), or a sequence of
+	// used blocks that are contiguous in the CISO file,
+	// which is read with a single preadAt() call.
 	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
-	uint32_t lba_end = lba_start + lba_len;
-	for (uint32_t lba = lba_start; lba < lba_end; lba++, ptr8 += LBA_SIZE) {
-		unsigned int physBlockIdx = m_blockMap[lba / m_block_size_lba];
-		if (physBlockIdx == 0xFFFF) {
-			// Empty block.
-			memset(ptr8, 0, LBA_SIZE);
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba = lba_start;
+	while (lba < lba_end) {
+		unsigned int blockIdx = lba / m_block_size_lba;
+		const unsigned int physBlockIdx = m_blockMap[blockIdx];
+		const bool isEmpty = (physBlockIdx == 0xFFFF);
+
+		// Extend the run as far as possible.
+		uint32_t run_end = (blockIdx + 1) * m_block_size_lba;
+		unsigned int nextPhysBlockIdx = physBlockIdx + 1;
+		for (blockIdx++; run_end < lba_end; blockIdx++) {
+			const unsigned int curPhysBlockIdx = m_blockMap[blockIdx];
+			if (isEmpty) {
+				if (curPhysBlockIdx != 0xFFFF)
+					break;
+			} else {
+				if (curPhysBlockIdx == 0xFFFF || curPhysBlockIdx != nextPhysBlockIdx)
+					break;
+				nextPhysBlockIdx++;
+			}
+			run_end += m_block_size_lba;
+		}
+		if (run_end > lba_end) {
+			run_end = lba_end;
+		}
+		const uint32_t run_len = run_end - lba;
+
+		if (isEmpty) {
+			// Empty block(s).
+			memset(ptr8, 0, LBA_TO_BYTES(run_len));
 		} else {
 			// Determine the offset.
 			const unsigned int blockStart = physBlockIdx * m_block_size_lba;
 			const unsigned int offset = lba % m_block_size_lba;
 
-			int ret = m_file->seeko(LBA_TO_BYTES(blockStart + offset + m_lba_start), SEEK_SET);
-			if (ret != 0) {
-				// Seek error.
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
-			}
-			size_t size = m_file->read(ptr8, LBA_SIZE, 1);
-			if (size != 1) {
+			const size_t run_bytes = LBA_TO_BYTES(run_len);
+			size_t size = m_file->preadAt(LBA_TO_BYTES(blockStart + offset + m_lba_start), ptr8, run_bytes);
+			if (size != run_bytes) {
 				// Read error.
 				if (errno == 0) {
 					errno = EIO;
 				}
 				return 0;
 			}
-			lbas_read++;
 		}
+
+		lba = run_end;
+		ptr8 += LBA_TO_BYTES(run_len);
+	}
+
+	return lba_len;
+}
+
+/**
+ * Write data to the disc image.
+ * Only supported for CISO images created with create().
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t CisoReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	if (!m_blockWriter) {
+		// CISO images can only be written if they were created with create().
+		return super::write(ptr, lba_start, lba_len);
+	}
+
+	// LBA bounds checking.
+	assert(static_cast<uint64_t>(lba_start) + lba_len <= m_lba_len);
+	if (static_cast<uint64_t>(lba_start) + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	m_headerDirty = true;
+	return m_blockWriter->write(ptr, lba_start, lba_len);
+}
+
+/**
+ * Flush the file buffers.
+ * For CISO images created with create(), this writes
+ * the pending block and the CISO header.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int CisoReader::flush(void)
+{
+	if (!m_blockWriter || !m_headerDirty) {
+		return super::flush();
+	}
+
+	// Write the pending block.
+	int ret = m_blockWriter->flush();
+	if (ret != 0) {
+		return ret;
+	}
+
+	// CISO doesn't store physical block indexes, so the
+	// physical blocks must be in logical block order.
+	ret = m_blockWriter->sortBlocks();
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Build the CISO header.
+	CisoHeader *const cisoHeader = new CisoHeader;
+	memset(cisoHeader, 0, sizeof(*cisoHeader));
+	memcpy(cisoHeader->magic, CISO_MAGIC, sizeof(cisoHeader->magic));
+	cisoHeader->block_size = cpu_to_le32(static_cast<uint32_t>(LBA_TO_BYTES(m_block_size_lba)));
+	const uint32_t block_count = m_blockWriter->blockCount();
+	for (uint32_t i = 0; i < block_count; i++) {
+		cisoHeader->map[i] = (m_blockWriter->physBlock(i) != BlockWriter::BLOCK_EMPTY);
+	}
+
+	errno = 0;
+	size_t size = m_file->pwriteAt(0, cisoHeader, sizeof(*cisoHeader));
+	delete cisoHeader;
+	if (size != sizeof(*cisoHeader)) {
+		// Write error.
+		return (errno != 0 ? -errno : -EIO);
 	}
 
-	return lbas_read;
+	// CISO image is up to date.
+	m_real_lba_len = m_lba_start + (m_blockWriter->physBlockCount() * m_block_size_lba);
+	m_headerDirty = false;
+	return super::flush();
 }
@@ -23,6 +23,8 @@
 
 #include "Reader.hpp"
 
+class BlockWriter;
+
 class CisoReader : public Reader
 {
 	public:
@@ -38,10 +40,36 @@ class CisoReader : public Reader
 		 */
 		CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
 
+		virtual ~CisoReader();
+
+	private:
+		/**
+		 * Create a new, writable CISO image.
+		 * @param file		RefFile*. (must be writable and empty)
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 */
+		CisoReader(RefFile *file, uint32_t lba_len);
+
 	private:
 		typedef Reader super;
 		DISABLE_COPY(CisoReader)
 
+	public:
+		/**
+		 * Create a new, writable CISO image.
+		 *
+		 * Non-empty blocks are written sequentially after the
+		 * CISO header as they're written to the disc image.
+		 * The CISO header is written by flush().
+		 *
+		 * Check isOpen() afterwards.
+		 *
+		 * @param file		RefFile*. (must be writable and empty)
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 * @return CisoReader*
+		 */
+		static CisoReader *create(RefFile *file, uint32_t lba_len);
+
 	public:
 		/**
 		 * Is a given disc image supported by the CISO reader?
@@ -63,6 +91,24 @@ class CisoReader : public Reader
 		 */
 		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
 
+		/**
+		 * Write data to the disc image.
+		 * Only supported for CISO images created with create().
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Flush the file buffers.
+		 * For CISO images created with create(), this writes
+		 * the pending block and the CISO header.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int flush(void) final;
+
 	private:
 		#define CISO_HEADER_SIZE 0x8000
 		#define CISO_MAP_SIZE (CISO_HEADER_SIZE - sizeof(uint32_t) - (sizeof(char) * 4))
@@ -83,6 +129,11 @@ class CisoReader : public Reader
 		// 0x0000 == first block after CISO header.
 		// 0xFFFF == empty block.
 		uint16_t m_blockMap[CISO_MAP_SIZE];
+
+		// Block writer for CISO images created with create().
+		// If set, it's used instead of m_blockMap.
+		BlockWriter *m_blockWriter;
+		bool m_headerDirty;	// CISO header needs to be written
 };
 
 #endif /* __RVTHTOOL_LIBRVTH_READER_CISOREADER_HPP__ */
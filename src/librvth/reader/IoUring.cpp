@@ -0,0 +1,338 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoUring.cpp: Linux io_uring I/O backend.                                *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "IoUring.hpp"
+
+// C includes.
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// io_uring system calls.
+// glibc doesn't have wrappers for these.
+static inline int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned int to_submit,
+	unsigned int min_complete, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Ring indexes are shared with the kernel.
+#define load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * Create an io_uring instance.
+ * Check isValid() afterwards; io_uring may not be supported
+ * by the kernel, or may be blocked by a seccomp filter.
+ * @param queueDepth [in] Maximum number of requests in flight.
+ */
+IoUring::IoUring(unsigned int queueDepth)
+	: m_ringFd(-1)
+	, m_sqRing(MAP_FAILED)
+	, m_sqRingSize(0)
+	, m_sqHead(nullptr)
+	, m_sqTail(nullptr)
+	, m_sqMask(nullptr)
+	, m_sqArray(nullptr)
+	, m_sqEntries(0)
+	, m_sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+	, m_sqesSize(0)
+	, m_cqRing(MAP_FAILED)
+	, m_cqRingSize(0)
+	, m_cqHead(nullptr)
+	, m_cqTail(nullptr)
+	, m_cqMask(nullptr)
+	, m_cqes(nullptr)
+{
+	assert(queueDepth != 0);
+	if (queueDepth == 0) {
+		queueDepth = 1;
+	}
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	const int fd = sys_io_uring_setup(queueDepth, &params);
+	if (fd < 0) {
+		// io_uring isn't available.
+		return;
+	}
+
+	// Map the rings.
+	// Newer kernels allow the SQ and CQ rings to share a single mapping.
+	m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool singleMmap = !!(params.features & IORING_FEAT_SINGLE_MMAP);
+	if (singleMmap) {
+		if (m_cqRingSize > m_sqRingSize) {
+			m_sqRingSize = m_cqRingSize;
+		}
+		m_cqRingSize = m_sqRingSize;
+	}
+
+	m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (m_sqRing == MAP_FAILED) {
+		goto fail;
+	}
+	if (singleMmap) {
+		m_cqRing = m_sqRing;
+	} else {
+		m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED) {
+			goto fail;
+		}
+	}
+
+	m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+	if (m_sqes == MAP_FAILED) {
+		goto fail;
+	}
+
+	{
+		uint8_t *const sq = static_cast<uint8_t*>(m_sqRing);
+		m_sqHead  = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+		m_sqTail  = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+		m_sqMask  = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+		m_sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+		m_sqEntries = params.sq_entries;
+
+		uint8_t *const cq = static_cast<uint8_t*>(m_cqRing);
+		m_cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+		m_cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+		m_cqes   = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+	}
+
+	// io_uring initialized.
+	m_ringFd = fd;
+	return;
+
+fail:
+	if (m_sqes != MAP_FAILED) {
+		munmap(m_sqes, m_sqesSize);
+		m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	}
+	if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+		munmap(m_cqRing, m_cqRingSize);
+	}
+	m_cqRing = MAP_FAILED;
+	if (m_sqRing != MAP_FAILED) {
+		munmap(m_sqRing, m_sqRingSize);
+		m_sqRing = MAP_FAILED;
+	}
+	close(fd);
+}
+
+IoUring::~IoUring()
+{
+	if (m_sqes != MAP_FAILED) {
+		munmap(m_sqes, m_sqesSize);
+	}
+	if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+		munmap(m_cqRing, m_cqRingSize);
+	}
+	if (m_sqRing != MAP_FAILED) {
+		munmap(m_sqRing, m_sqRingSize);
+	}
+	if (m_ringFd >= 0) {
+		close(m_ringFd);
+	}
+}
+
+/**
+ * Get the number of queued requests that haven't been submitted yet.
+ * @return Number of unsubmitted requests.
+ */
+unsigned int IoUring::sqPending(void) const
+{
+	// NOTE: Only this thread writes the SQ tail.
+	return *m_sqTail - load_acquire(m_sqHead);
+}
+
+/**
+ * Queue a request for a segment.
+ * @param write	[in] True to write; false to read.
+ * @param fd	[in] File descriptor.
+ * @param idx	[in] Segment index.
+ */
+void IoUring::queueSegment(bool write, int fd, unsigned int idx)
+{
+	const Segment &seg = m_segs[idx];
+	const unsigned int tail = *m_sqTail;
+	const unsigned int sqIdx = tail & *m_sqMask;
+
+	struct io_uring_sqe *const sqe = &m_sqes[sqIdx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (write ? IORING_OP_WRITE : IORING_OP_READ);
+	sqe->fd = fd;
+	sqe->off = static_cast<uint64_t>(seg.offset);
+	sqe->addr = reinterpret_cast<uintptr_t>(seg.ptr);
+	sqe->len = static_cast<uint32_t>(seg.len);
+	sqe->user_data = idx;
+
+	m_sqArray[sqIdx] = sqIdx;
+	store_release(m_sqTail, tail + 1);
+}
+
+/**
+ * Submit queued requests and wait for completions.
+ * @param toSubmit	[in] Number of queued requests.
+ * @param minComplete	[in] Minimum number of completions to wait for.
+ * @return Number of requests submitted, or negative POSIX error code on error.
+ */
+int IoUring::enter(unsigned int toSubmit, unsigned int minComplete)
+{
+	int ret;
+	do {
+		ret = sys_io_uring_enter(m_ringFd, toSubmit, minComplete,
+			(minComplete != 0 ? IORING_ENTER_GETEVENTS : 0));
+	} while (ret < 0 && errno == EINTR && sqPending() == toSubmit);
+
+	if (ret < 0) {
+		if (errno == EINTR) {
+			// Interrupted after submitting.
+			return static_cast<int>(toSubmit - sqPending());
+		}
+		return (errno != 0 ? -errno : -EIO);
+	}
+	return ret;
+}
+
+/**
+ * Transfer data using multiple requests in flight.
+ * @param write		[in] True to write; false to read.
+ * @param fd		[in] File descriptor.
+ * @param offset	[in] File offset.
+ * @param ptr		[in,out] Buffer.
+ * @param size		[in] Number of bytes.
+ * @param segSize	[in] Size of each request.
+ * @return Number of bytes transferred, or negative POSIX error code on error.
+ */
+int64_t IoUring::transfer(bool write, int fd, int64_t offset, uint8_t *ptr, size_t size, size_t segSize)
+{
+	assert(isValid());
+	if (!isValid()) {
+		return -EBADF;
+	}
+	if (size == 0) {
+		return 0;
+	}
+	if (segSize == 0 || segSize > size) {
+		segSize = size;
+	}
+	// Requests are limited to 32-bit lengths.
+	if (segSize > 0x40000000U) {
+		segSize = 0x40000000U;
+	}
+
+	// Split the transfer into segments.
+	const unsigned int segCount = static_cast<unsigned int>((size + segSize - 1) / segSize);
+	m_segs.resize(segCount);
+	for (unsigned int i = 0; i < segCount; i++) {
+		Segment &seg = m_segs[i];
+		const size_t segOffset = static_cast<size_t>(i) * segSize;
+		seg.ptr = ptr + segOffset;
+		seg.offset = offset + static_cast<int64_t>(segOffset);
+		seg.len = (size - segOffset < segSize ? size - segOffset : segSize);
+		seg.done = 0;
+		seg.eof = false;
+	}
+
+	unsigned int next = 0;		// Next segment to queue.
+	unsigned int outstanding = 0;	// Queued or in flight.
+	int err = 0;
+	for (;;) {
+		// Keep the queue full.
+		while (err == 0 && next < segCount && outstanding < m_sqEntries) {
+			queueSegment(write, fd, next++);
+			outstanding++;
+		}
+		if (outstanding == 0)
+			break;
+
+		// Submit everything and wait for at least one completion.
+		const unsigned int pending = sqPending();
+		int ret = enter(pending, 1);
+		if (ret < 0) {
+			if (err == 0) {
+				err = ret;
+			}
+			if (outstanding == sqPending()) {
+				// Nothing is in flight, so the unsubmitted
+				// requests can be discarded.
+				store_release(m_sqTail, load_acquire(m_sqHead));
+				break;
+			}
+			// Requests are in flight. Keep reaping them.
+		}
+
+		// Reap completions.
+		unsigned int head = *m_cqHead;
+		const unsigned int tail = load_acquire(m_cqTail);
+		for (; head != tail; head++) {
+			const struct io_uring_cqe *const cqe = &m_cqes[head & *m_cqMask];
+			Segment &seg = m_segs[static_cast<unsigned int>(cqe->user_data)];
+			const int res = cqe->res;
+			outstanding--;
+
+			if (res < 0) {
+				if ((res == -EAGAIN || res == -EINTR) && err == 0) {
+					// Try again.
+					queueSegment(write, fd, static_cast<unsigned int>(cqe->user_data));
+					outstanding++;
+				} else if (err == 0) {
+					err = res;
+				}
+			} else if (res == 0) {
+				// EOF on read; no progress on write.
+				if (write && err == 0) {
+					err = -EIO;
+				}
+				seg.eof = true;
+			} else {
+				seg.done += res;
+				seg.ptr += res;
+				seg.offset += res;
+				seg.len -= res;
+				if (seg.len > 0 && err == 0) {
+					// Short transfer. Queue the rest.
+					queueSegment(write, fd, static_cast<unsigned int>(cqe->user_data));
+					outstanding++;
+				}
+			}
+		}
+		store_release(m_cqHead, head);
+	}
+
+	if (err != 0) {
+		return err;
+	}
+
+	// Count the bytes transferred up to the first short segment.
+	int64_t total = 0;
+	for (const Segment &seg : m_segs) {
+		total += seg.done;
+		if (seg.eof || seg.len != 0)
+			break;
+	}
+	return total;
+}
@@ -0,0 +1,172 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoUring.hpp: Linux io_uring I/O backend.                                *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_IOURING_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_IOURING_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes.
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * Minimal io_uring wrapper for large positional reads and writes.
+ *
+ * A single transfer is split into segments, and up to queueDepth
+ * segments are kept in flight, so the device sees a full queue
+ * even though the caller issued one synchronous request.
+ *
+ * This uses the io_uring system calls directly, so liburing
+ * isn't required.
+ *
+ * Thread-safety: An IoUring object must only be used by one
+ * thread at a time. Readers that use io_uring have their own
+ * IoUring object.
+ */
+class IoUring
+{
+	public:
+		/**
+		 * Create an io_uring instance.
+		 * Check isValid() afterwards; io_uring may not be supported
+		 * by the kernel, or may be blocked by a seccomp filter.
+		 * @param queueDepth [in] Maximum number of requests in flight.
+		 */
+		explicit IoUring(unsigned int queueDepth);
+		~IoUring();
+
+	private:
+		DISABLE_COPY(IoUring)
+
+	public:
+		/**
+		 * Was the io_uring instance created successfully?
+		 * @return True if valid; false if not.
+		 */
+		inline bool isValid(void) const
+		{
+			return (m_ringFd >= 0);
+		}
+
+		/**
+		 * Get the queue depth.
+		 * @return Queue depth.
+		 */
+		inline unsigned int queueDepth(void) const
+		{
+			return m_sqEntries;
+		}
+
+		/**
+		 * Read data from a file.
+		 * @param fd		[in] File descriptor.
+		 * @param offset	[in] File offset.
+		 * @param ptr		[out] Output buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @param segSize	[in] Size of each request.
+		 * @return Number of bytes read, or negative POSIX error code on error.
+		 */
+		int64_t readAt(int fd, int64_t offset, void *ptr, size_t size, size_t segSize)
+		{
+			return transfer(false, fd, offset, static_cast<uint8_t*>(ptr), size, segSize);
+		}
+
+		/**
+		 * Write data to a file.
+		 * @param fd		[in] File descriptor.
+		 * @param offset	[in] File offset.
+		 * @param ptr		[in] Input buffer.
+		 * @param size		[in] Number of bytes to write.
+		 * @param segSize	[in] Size of each request.
+		 * @return Number of bytes written, or negative POSIX error code on error.
+		 */
+		int64_t writeAt(int fd, int64_t offset, const void *ptr, size_t size, size_t segSize)
+		{
+			// NOTE: The buffer isn't modified for writes.
+			return transfer(true, fd, offset,
+				const_cast<uint8_t*>(static_cast<const uint8_t*>(ptr)), size, segSize);
+		}
+
+	private:
+		// Segment state.
+		struct Segment {
+			uint8_t *ptr;		// Remaining buffer
+			int64_t offset;		// Remaining file offset
+			size_t len;		// Remaining length
+			size_t done;		// Bytes transferred
+			bool eof;		// Short read at EOF
+		};
+
+		/**
+		 * Transfer data using multiple requests in flight.
+		 * @param write		[in] True to write; false to read.
+		 * @param fd		[in] File descriptor.
+		 * @param offset	[in] File offset.
+		 * @param ptr		[in,out] Buffer.
+		 * @param size		[in] Number of bytes.
+		 * @param segSize	[in] Size of each request.
+		 * @return Number of bytes transferred, or negative POSIX error code on error.
+		 */
+		int64_t transfer(bool write, int fd, int64_t offset, uint8_t *ptr, size_t size, size_t segSize);
+
+		/**
+		 * Queue a request for a segment.
+		 * @param write	[in] True to write; false to read.
+		 * @param fd	[in] File descriptor.
+		 * @param idx	[in] Segment index.
+		 */
+		void queueSegment(bool write, int fd, unsigned int idx);
+
+		/**
+		 * Submit queued requests and wait for completions.
+		 * @param toSubmit	[in] Number of queued requests.
+		 * @param minComplete	[in] Minimum number of completions to wait for.
+		 * @return Number of requests submitted, or negative POSIX error code on error.
+		 */
+		int enter(unsigned int toSubmit, unsigned int minComplete);
+
+		/**
+		 * Get the number of queued requests that haven't been submitted yet.
+		 * @return Number of unsubmitted requests.
+		 */
+		unsigned int sqPending(void) const;
+
+	private:
+		int m_ringFd;
+
+		// Submission queue.
+		void *m_sqRing;
+		size_t m_sqRingSize;
+		unsigned int *m_sqHead;
+		unsigned int *m_sqTail;
+		unsigned int *m_sqMask;
+		unsigned int *m_sqArray;
+		unsigned int m_sqEntries;
+		io_uring_sqe *m_sqes;
+		size_t m_sqesSize;
+
+		// Completion queue.
+		void *m_cqRing;
+		size_t m_cqRingSize;
+		unsigned int *m_cqHead;
+		unsigned int *m_cqTail;
+		unsigned int *m_cqMask;
+		io_uring_cqe *m_cqes;
+
+		// Current transfer.
+		std::vector<Segment> m_segs;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_IOURING_HPP__ */
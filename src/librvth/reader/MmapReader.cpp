@@ -0,0 +1,180 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MmapReader.cpp: Memory-mapped disc image reader class.                  *
+ * Used for plain binary disc images, e.g. .gcm and RVT-H images.          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "MmapReader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes.
+#include <sys/mman.h>
+#include <unistd.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * Create a memory-mapped reader for a disc image.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * Check isOpen() after constructing the object. If the
+ * window can't be mapped, e.g. because it extends past
+ * the end of the file, use PlainReader instead.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ */
+MmapReader::MmapReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+	: super(file, lba_start, lba_len)
+	, m_mapBase(nullptr)
+	, m_mapSize(0)
+	, m_data(nullptr)
+	, m_dataLba(0)
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// Get the file size.
+	errno = 0;
+	const int64_t filesize = m_file->size();
+	if (lba_start == 0 && lba_len == 0) {
+		// NOTE: If not a multiple of the LBA size,
+		// the partial LBA will be ignored.
+		lba_len = (uint32_t)(filesize / LBA_SIZE);
+	}
+	m_lba_start = lba_start;
+	m_lba_len = lba_len;
+
+	// The entire window must be present in the file.
+	// Otherwise, reading past EOF would raise SIGBUS.
+	const int64_t offset = LBA_TO_BYTES((int64_t)lba_start);
+	const int64_t size = LBA_TO_BYTES((int64_t)lba_len);
+	if (filesize <= 0 || lba_len == 0 || offset + size > filesize ||
+	    (uint64_t)size > (uint64_t)SIZE_MAX / 2)
+	{
+		m_file->unref();
+		m_file = nullptr;
+		errno = (filesize < 0 && errno != 0 ? errno : EINVAL);
+		return;
+	}
+
+	// mmap() offsets must be page-aligned.
+	const int64_t page_size = sysconf(_SC_PAGESIZE);
+	const int64_t map_offset = offset - (offset % page_size);
+	const size_t map_size = (size_t)(size + (offset - map_offset));
+	void *const p = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, m_file->fd(), (off_t)map_offset);
+	if (p == MAP_FAILED) {
+		// Could not map the file.
+		// This can happen for large windows on 32-bit systems.
+		const int err = (errno != 0 ? errno : ENOMEM);
+		m_file->unref();
+		m_file = nullptr;
+		errno = err;
+		return;
+	}
+
+	m_mapBase = static_cast<uint8_t*>(p);
+	m_mapSize = map_size;
+	m_data = m_mapBase + (offset - map_offset);
+	m_dataLba = lba_start;
+
+	// Set the reader type.
+	setLinearType(filesize);
+}
+
+MmapReader::~MmapReader()
+{
+	if (m_mapBase) {
+		munmap(m_mapBase, m_mapSize);
+	}
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t MmapReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint8_t *const src = map(lba_start, lba_len);
+	if (!src) {
+		return 0;
+	}
+
+	memcpy(ptr, src, LBA_TO_BYTES(lba_len));
+	return lba_len;
+}
+
+/**
+ * Write data to the disc image.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t MmapReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len || lba_start + lba_len < lba_start) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	// Write the data.
+	// NOTE: The mapping is read-only, but it's shared,
+	// so the new data will be visible through it.
+	size_t size = m_file->pwriteAt(LBA_TO_BYTES((int64_t)m_lba_start + lba_start),
+		ptr, LBA_TO_BYTES(lba_len));
+	return (uint32_t)(size / LBA_SIZE);
+}
+
+/**
+ * Map a range of the disc image into memory.
+ * The returned pointer is valid until the Reader is deleted.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr on error. (check errno)
+ */
+const uint8_t *MmapReader::map(uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len || lba_start + lba_len < lba_start) {
+		// Out of range.
+		errno = EIO;
+		return nullptr;
+	}
+
+	// NOTE: lba_adjust() may have moved the start of the disc image.
+	return m_data + LBA_TO_BYTES((size_t)(m_lba_start - m_dataLba) + lba_start);
+}
+
+/**
+ * Find the next region of the disc image that may contain data.
+ * Holes in sparse image files are detected using the file system.
+ * @param lba		[in] Starting LBA.
+ * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+ * @param pLbaEnd	[out] End of the data region. (exclusive)
+ * @return 0 on success; -ENXIO if there's no data at or after lba.
+ */
+int MmapReader::findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
+{
+	return findLinearData(lba, pLbaStart, pLbaEnd);
+}
@@ -0,0 +1,110 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MmapReader.hpp: Memory-mapped disc image reader class.                  *
+ * Used for plain binary disc images, e.g. .gcm and RVT-H images.          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__
+
+#include "Reader.hpp"
+
+/**
+ * Memory-mapped reader for plain disc images.
+ *
+ * The Reader's window of the file (e.g. one bank of an RVT-H
+ * Reader disk image) is mapped read-only when the Reader is
+ * created. read() copies from the mapping, and map() returns
+ * pointers into it, so the kernel page cache is used directly
+ * and is shared with any other processes reading the image.
+ *
+ * Writes use the RefFile's positional I/O functions. The mapping
+ * is shared, so written data is visible through it.
+ *
+ * NOTE: If the image file is truncated by another process while
+ * it's mapped, accessing the missing pages will raise SIGBUS.
+ */
+class MmapReader : public Reader
+{
+	public:
+		/**
+		 * Create a memory-mapped reader for a disc image.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * Check isOpen() after constructing the object. If the
+		 * window can't be mapped, e.g. because it extends past
+		 * the end of the file, use PlainReader instead.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		MmapReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		virtual ~MmapReader();
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(MmapReader)
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Write data to the disc image.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Map a range of the disc image into memory.
+		 * The returned pointer is valid until the Reader is deleted.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr on error. (check errno)
+		 */
+		const uint8_t *map(uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Find the next region of the disc image that may contain data.
+		 * Holes in sparse image files are detected using the file system.
+		 * @param lba		[in] Starting LBA.
+		 * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+		 * @param pLbaEnd	[out] End of the data region. (exclusive)
+		 * @return 0 on success; -ENXIO if there's no data at or after lba.
+		 */
+		int findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd) final;
+
+		/**
+		 * Is the disc image stored linearly in the file?
+		 * @return True, since plain disc images are never compressed.
+		 */
+		bool isLinear(void) const final
+		{
+			return true;
+		}
+
+	private:
+		uint8_t *m_mapBase;	// Start of the mapping (page-aligned)
+		size_t m_mapSize;	// Size of the mapping
+		const uint8_t *m_data;	// Start of the window within the mapping
+		uint32_t m_dataLba;	// File LBA corresponding to m_data
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__ */
@@ -20,10 +20,15 @@
  ***************************************************************************/
 
 #include "PlainReader.hpp"
+#include "io_backend.h"
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
 
+#ifdef HAVE_IO_URING
+# include "IoUring.hpp"
+#endif /* HAVE_IO_URING */
+
 // C includes.
 #include <stdlib.h>
 
@@ -44,6 +49,11 @@
  */
 PlainReader::PlainReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	: super(file, lba_start, lba_len)
+#ifdef HAVE_IO_URING
+	, m_uring(nullptr)
+	, m_uringDepth(0)
+	, m_useDirect(false)
+#endif /* HAVE_IO_URING */
 {
 	if (!isOpen()) {
 		// File wasn't opened.
@@ -75,27 +85,120 @@ PlainReader::PlainReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	m_lba_len = lba_len;
 
 	// Set the reader type.
-	if (m_file->isDevice()) {
-		// This is an RVT-H Reader.
-		m_type = RVTH_ImageType_HDD_Reader;
-	} else {
-		// If the file is larger than 10 GB, assume it's an RVT-H Reader disk image.
-		// Otherwise, it's a standalone disc image.
-		if (filesize > 10LL*1024LL*1024LL*1024LL) {
-			// RVT-H Reader disk image.
-			m_type = RVTH_ImageType_HDD_Image;
-		} else {
-			// If the starting LBA is 0, it's a standard GCM.
-			// Otherwise, it has an SDK header.
-			m_type = (lba_start == 0
-				? RVTH_ImageType_GCM
-				: RVTH_ImageType_GCM_SDK);
-		}
+	setLinearType(filesize);
+
+#ifdef HAVE_IO_URING
+	// Check if io_uring should be used.
+	// The io_uring instance is created on first use, since
+	// many Readers are only used to read the disc header.
+	// NOTE: Split files don't have a single file descriptor.
+	unsigned int queue_depth, flags;
+	if (rvth_io_get_backend(&queue_depth, &flags) == RVTH_IO_BACKEND_URING &&
+	    !m_file->isSplit())
+	{
+		m_uringDepth = queue_depth;
+		m_useDirect = !!(flags & RVTH_IO_FLAG_DIRECT);
 	}
+#endif /* HAVE_IO_URING */
 
 	// Reader initialized.
 }
 
+PlainReader::~PlainReader()
+{
+#ifdef HAVE_IO_URING
+	delete m_uring;
+#endif /* HAVE_IO_URING */
+}
+
+#ifdef HAVE_IO_URING
+// Minimum request size for io_uring.
+// Smaller requests use synchronous I/O.
+#define URING_MIN_SIZE (256U*1024U)
+// Minimum size of each io_uring request.
+#define URING_MIN_SEG_SIZE (64U*1024U)
+
+/**
+ * Transfer data using io_uring.
+ * The io_uring instance is created on first use.
+ * @param write		[in] True to write; false to read.
+ * @param ptr		[in,out] Buffer.
+ * @param lba_start	[in] Starting LBA. (absolute)
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of bytes transferred, or negative POSIX error code
+ *         if synchronous I/O should be used instead.
+ */
+int64_t PlainReader::uringTransfer(bool write, void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	const size_t size = (size_t)LBA_TO_BYTES(lba_len);
+	if (m_uringDepth == 0 || size < URING_MIN_SIZE) {
+		// Use synchronous I/O.
+		return -ENOTSUP;
+	}
+
+	if (!m_uring) {
+		m_uring = new IoUring(m_uringDepth);
+		if (!m_uring->isValid()) {
+			// io_uring isn't available. Don't try again.
+			delete m_uring;
+			m_uring = nullptr;
+			m_uringDepth = 0;
+			return -ENOTSUP;
+		}
+	}
+
+	// Split the request so the whole queue depth is used.
+	size_t segSize = size / m_uring->queueDepth();
+	segSize = (segSize + 4095) & ~(size_t)4095;
+	if (segSize < URING_MIN_SEG_SIZE) {
+		segSize = URING_MIN_SEG_SIZE;
+	}
+
+	const int64_t offset = LBA_TO_BYTES((int64_t)lba_start);
+	const bool unbuffered = (write && m_file->isUnbuffered());
+	int fd = m_file->fd();
+	bool direct = false;
+	if (m_useDirect || unbuffered) {
+		const int dfd = m_file->directFd();
+		if (dfd >= 0 && m_file->isDirectAligned(ptr, offset, size)) {
+			fd = dfd;
+			direct = true;
+		}
+	}
+	if (unbuffered && !direct) {
+		// RefFile handles unaligned unbuffered writes.
+		return -ENOTSUP;
+	}
+
+	int64_t ret = (write
+		? m_uring->writeAt(fd, offset, ptr, size, segSize)
+		: m_uring->readAt(fd, offset, ptr, size, segSize));
+	if (ret == -EINVAL && direct) {
+		// O_DIRECT alignment requirements weren't met.
+		m_useDirect = false;
+		if (unbuffered) {
+			// RefFile will write the data.
+			return ret;
+		}
+
+		// Try again without O_DIRECT.
+		fd = m_file->fd();
+		ret = (write
+			? m_uring->writeAt(fd, offset, ptr, size, segSize)
+			: m_uring->readAt(fd, offset, ptr, size, segSize));
+	}
+
+	if (ret == -EINVAL || ret == -EOPNOTSUPP || ret == -ENOSYS) {
+		// The kernel doesn't support the required io_uring operations.
+		// Don't try again.
+		delete m_uring;
+		m_uring = nullptr;
+		m_uringDepth = 0;
+	}
+	return ret;
+}
+#endif /* HAVE_IO_URING */
+
 /**
  * Read data from the disc image.
  * @param reader	[in] Reader*
@@ -116,18 +219,17 @@ uint32_t PlainReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// Seek to lba_start.
-	int ret = m_file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return 0;
+#ifdef HAVE_IO_URING
+	// Large reads use io_uring if it's enabled.
+	const int64_t uret = uringTransfer(false, ptr, lba_start, lba_len);
+	if (uret >= 0) {
+		return (uint32_t)(uret / LBA_SIZE);
 	}
+#endif /* HAVE_IO_URING */
 
 	// Read the data.
-	return (uint32_t)m_file->read(ptr, LBA_SIZE, lba_len);
+	size_t size = m_file->preadAt(LBA_TO_BYTES(lba_start), ptr, LBA_TO_BYTES(lba_len));
+	return (uint32_t)(size / LBA_SIZE);
 }
 
 /**
@@ -150,16 +252,28 @@ uint32_t PlainReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_le
 		return 0;
 	}
 
-	// Seek to lba_start.
-	int ret = m_file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return 0;
+#ifdef HAVE_IO_URING
+	// Large writes use io_uring if it's enabled.
+	const int64_t uret = uringTransfer(true, const_cast<void*>(ptr), lba_start, lba_len);
+	if (uret >= 0) {
+		return (uint32_t)(uret / LBA_SIZE);
 	}
+#endif /* HAVE_IO_URING */
 
 	// Write the data.
-	return (uint32_t)m_file->write(ptr, LBA_SIZE, lba_len);
+	size_t size = m_file->pwriteAt(LBA_TO_BYTES(lba_start), ptr, LBA_TO_BYTES(lba_len));
+	return (uint32_t)(size / LBA_SIZE);
+}
+
+/**
+ * Find the next region of the disc image that may contain data.
+ * Holes in sparse image files are detected using the file system.
+ * @param lba		[in] Starting LBA.
+ * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+ * @param pLbaEnd	[out] End of the data region. (exclusive)
+ * @return 0 on success; -ENXIO if there's no data at or after lba.
+ */
+int PlainReader::findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
+{
+	return findLinearData(lba, pLbaStart, pLbaEnd);
 }
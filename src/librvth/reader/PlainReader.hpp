@@ -22,8 +22,13 @@
 #ifndef __RVTHTOOL_LIBRVTH_READER_PLAINREADER_HPP__
 #define __RVTHTOOL_LIBRVTH_READER_PLAINREADER_HPP__
 
+#include "config.librvth.h"
 #include "Reader.hpp"
 
+#ifdef HAVE_IO_URING
+class IoUring;
+#endif /* HAVE_IO_URING */
+
 class PlainReader : public Reader
 {
 	public:
@@ -38,6 +43,7 @@ class PlainReader : public Reader
 		 * @param lba_len	[in] Length, in LBAs.
 		 */
 		PlainReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		virtual ~PlainReader();
 
 	private:
 		typedef Reader super;
@@ -63,6 +69,45 @@ class PlainReader : public Reader
 		 * @return Number of LBAs read, or 0 on error.
 		 */
 		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Find the next region of the disc image that may contain data.
+		 * Holes in sparse image files are detected using the file system.
+		 * @param lba		[in] Starting LBA.
+		 * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+		 * @param pLbaEnd	[out] End of the data region. (exclusive)
+		 * @return 0 on success; -ENXIO if there's no data at or after lba.
+		 */
+		int findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd) final;
+
+		/**
+		 * Is the disc image stored linearly in the file?
+		 * @return True, since plain disc images are never compressed.
+		 */
+		bool isLinear(void) const final
+		{
+			return true;
+		}
+
+#ifdef HAVE_IO_URING
+	private:
+		/**
+		 * Transfer data using io_uring.
+		 * The io_uring instance is created on first use.
+		 * @param write		[in] True to write; false to read.
+		 * @param ptr		[in,out] Buffer.
+		 * @param lba_start	[in] Starting LBA. (absolute)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of bytes transferred, or negative POSIX error code
+		 *         if synchronous I/O should be used instead.
+		 */
+		int64_t uringTransfer(bool write, void *ptr, uint32_t lba_start, uint32_t lba_len);
+
+	private:
+		IoUring *m_uring;		// io_uring instance (created on first use)
+		unsigned int m_uringDepth;	// io_uring queue depth (0 if disabled)
+		bool m_useDirect;		// Use O_DIRECT for aligned requests?
+#endif /* HAVE_IO_URING */
 };
 
 #ifdef __cplusplus
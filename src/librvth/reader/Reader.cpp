@@ -18,10 +18,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
  ***************************************************************************/
 
+#include "config.librvth.h"
 #include "Reader.hpp"
 #include "PlainReader.hpp"
 #include "CisoReader.hpp"
 #include "WbfsReader.hpp"
+#include "WiaReader.hpp"
+#include "StoreReader.hpp"
+#include "CachedReader.hpp"
+#include "io_backend.h"
+#ifdef HAVE_MMAP
+# include "MmapReader.hpp"
+#endif /* HAVE_MMAP */
+#ifdef HAVE_ZSTD
+# include "ZstdReader.hpp"
+#endif /* HAVE_ZSTD */
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
@@ -88,37 +99,42 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 
 	// Check for other disc image formats.
 	uint8_t sbuf[4096];
-	int ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return nullptr;
-	}
 	errno = 0;
-	size_t size = file->read(sbuf, 1, sizeof(sbuf));
+	size_t size = file->preadAt(LBA_TO_BYTES(lba_start), sbuf, sizeof(sbuf));
 	if (size != sizeof(sbuf)) {
 		// Short read. May be empty.
 		if (errno != 0) {
 			// Actual error.
 			return nullptr;
-		} else {
+		} else if (!StoreReader::isSupported(sbuf, size)) {
 			// Assume it's a new file.
 			// Use the plain disc image reader.
-			file->rewind();
 			return new PlainReader(file, lba_start, lba_len);
 		}
+		// Chunk store manifests may be smaller than sbuf.
 	}
-	file->rewind();
 
 	// Check the magic number.
-	if (CisoReader::isSupported(sbuf, sizeof(sbuf))) {
+	if (StoreReader::isSupported(sbuf, size)) {
+		// This is a chunk store manifest.
+		// Small reads, e.g. disc headers, are cached, since
+		// each read opens a chunk file.
+		Reader *const reader = new StoreReader(file, lba_start, lba_len);
+		return (reader->isOpen() ? CachedReader::wrap(reader) : reader);
+	} else if (CisoReader::isSupported(sbuf, sizeof(sbuf))) {
 		// This is a supported CISO image.
 		return new CisoReader(file, lba_start, lba_len);
 	} else if (WbfsReader::isSupported(sbuf, sizeof(sbuf))) {
 		// This is a supported WBFS image.
 		return new WbfsReader(file, lba_start, lba_len);
+	} else if (WiaReader::isSupported(sbuf, sizeof(sbuf))) {
+		// This is a WIA or RVZ image.
+		return new WiaReader(file, lba_start, lba_len);
+#ifdef HAVE_ZSTD
+	} else if (ZstdReader::isSupported(sbuf, sizeof(sbuf))) {
+		// This is a Zstandard seekable image.
+		return new ZstdReader(file, lba_start, lba_len);
+#endif /* HAVE_ZSTD */
 	}
 
 	// Check for SDK headers.
@@ -137,10 +153,78 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 		lba_len -= BYTES_TO_LBA(32768);
 	}
 
+#ifdef HAVE_MMAP
+	// Map read-only image files if possible.
+	// Writable files are usually being created, so they
+	// don't have any data to map yet.
+	// Split files can't be mapped as a single range.
+	// Devices aren't mapped, since a read error would
+	// raise SIGBUS instead of returning an error.
+	if (!file->isWritable() && !file->isSplit() && !file->isDevice() && rvth_io_get_mmap()) {
+		MmapReader *const reader = new MmapReader(file, lba_start, lba_len);
+		if (reader->isOpen()) {
+			return reader;
+		}
+		// Could not map the file.
+		delete reader;
+	}
+#endif /* HAVE_MMAP */
+
 	// Use the plain disc image reader.
 	return new PlainReader(file, lba_start, lba_len);
 }
 
+/**
+ * Create a Reader object for a new, writable disc image.
+ * The file should be empty.
+ *
+ * Plain disc images use the same reader as open().
+ * CISO and WBFS images are written sequentially, skipping
+ * empty blocks, and the header is written by flush().
+ *
+ * @param file		RefFile*.
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @param format	[in] Disc image format.
+ * @return Reader*, or NULL on error.
+ */
+Reader *Reader::create(RefFile *file, uint32_t lba_len, RvtH_ImageFormat_e format)
+{
+	assert(file != NULL);
+	assert(file->isWritable());
+
+	Reader *reader;
+	switch (format) {
+		case RVTH_ImageFormat_GCM:
+			return open(file, 0, lba_len);
+		case RVTH_ImageFormat_CISO:
+			reader = CisoReader::create(file, lba_len);
+			break;
+		case RVTH_ImageFormat_WBFS:
+			reader = WbfsReader::create(file, lba_len);
+			break;
+		case RVTH_ImageFormat_ZSTD:
+		case RVTH_ImageFormat_STORE:
+			// Zstandard images and chunk store manifests are written
+			// sequentially by RvtH::copyToZstd() and RvtH::copyToStore(),
+			// not by a Reader.
+			errno = ENOTSUP;
+			return nullptr;
+		default:
+			assert(!"Invalid disc image format.");
+			errno = EINVAL;
+			return nullptr;
+	}
+
+	if (!reader->isOpen()) {
+		// Error creating the disc image.
+		const int err = errno;
+		delete reader;
+		errno = (err != 0 ? err : EIO);
+		return nullptr;
+	}
+	return reader;
+}
+
 /**
  * Write data to a disc image.
  *
@@ -166,8 +250,168 @@ uint32_t Reader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
 
 /**
  * Flush the file buffers.
+ * Writable CISO and WBFS images write their headers here.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Reader::flush(void)
+{
+	return m_file->flush();
+}
+
+/**
+ * Find the next region of the disc image that may contain data.
+ * LBAs outside of the returned regions are known to be zero,
+ * so they don't need to be read.
+ *
+ * The default implementation reports the entire disc image as data.
+ *
+ * @param lba		[in] Starting LBA.
+ * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+ * @param pLbaEnd	[out] End of the data region. (exclusive)
+ * @return 0 on success; -ENXIO if there's no data at or after lba.
  */
-void Reader::flush(void)
+int Reader::findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
 {
-	m_file->flush();
+	if (lba >= m_lba_len) {
+		return -ENXIO;
+	}
+
+	*pLbaStart = lba;
+	*pLbaEnd = m_lba_len;
+	return 0;
+}
+
+/**
+ * Open another reader for the same disc image.
+ * Each Reader can only be used by one thread at a time, so
+ * this is used to read compressed disc images in parallel.
+ *
+ * The default implementation doesn't support reopening.
+ *
+ * @return New Reader, or nullptr on error. (check errno)
+ */
+Reader *Reader::reopen(void) const
+{
+	errno = ENOTSUP;
+	return nullptr;
+}
+
+/**
+ * Map a range of the disc image into memory.
+ *
+ * The returned pointer is borrowed from the Reader. It's valid
+ * until the Reader is deleted, and it must not be written to.
+ * Writes made with write() are visible through the mapping.
+ *
+ * The default implementation doesn't support mapping.
+ * Use read() or mapOrRead() if this function fails.
+ *
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr on error. (check errno)
+ */
+const uint8_t *Reader::map(uint32_t lba_start, uint32_t lba_len)
+{
+	// Base class can't be mapped.
+	UNUSED(lba_start);
+	UNUSED(lba_len);
+
+	errno = ENOTSUP;
+	return nullptr;
+}
+
+/**
+ * Map a range of the disc image into memory if possible.
+ * Otherwise, read it into the specified buffer.
+ * @param buf		[out] Fallback buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data (either mapped or buf), or nullptr on error.
+ */
+const void *Reader::mapOrRead(void *buf, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint8_t *const ptr = map(lba_start, lba_len);
+	if (ptr) {
+		return ptr;
+	}
+
+	errno = 0;
+	if (read(buf, lba_start, lba_len) != lba_len) {
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return nullptr;
+	}
+	return buf;
+}
+
+/**
+ * Set the image type for a disc image stored linearly in a file.
+ * m_lba_start must have been set first.
+ * @param filesize File size.
+ */
+void Reader::setLinearType(int64_t filesize)
+{
+	if (m_file->isDevice()) {
+		// This is an RVT-H Reader.
+		m_type = RVTH_ImageType_HDD_Reader;
+	} else {
+		// If the file is larger than 10 GB, assume it's an RVT-H Reader disk image.
+		// Otherwise, it's a standalone disc image.
+		if (filesize > 10LL*1024LL*1024LL*1024LL) {
+			// RVT-H Reader disk image.
+			m_type = RVTH_ImageType_HDD_Image;
+		} else {
+			// If the starting LBA is 0, it's a standard GCM.
+			// Otherwise, it has an SDK header.
+			m_type = (m_lba_start == 0
+				? RVTH_ImageType_GCM
+				: RVTH_ImageType_GCM_SDK);
+		}
+	}
+}
+
+/**
+ * Find the next data region for a disc image stored
+ * linearly in a file. Holes in sparse image files are
+ * detected using the file system.
+ * @param lba		[in] Starting LBA.
+ * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+ * @param pLbaEnd	[out] End of the data region. (exclusive)
+ * @return 0 on success; -ENXIO if there's no data at or after lba.
+ */
+int Reader::findLinearData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
+{
+	if (lba >= m_lba_len) {
+		return -ENXIO;
+	}
+
+	int64_t dataStart, dataEnd;
+	const int64_t offset = LBA_TO_BYTES((int64_t)m_lba_start + lba);
+	int ret = m_file->findDataRegion(offset, &dataStart, &dataEnd);
+	if (ret == 0) {
+		// Convert to LBAs relative to the disc image.
+		// Partial LBAs are considered to be data.
+		const int64_t lba_end = (int64_t)m_lba_start + m_lba_len;
+		int64_t lba_data_start = dataStart / LBA_SIZE;
+		int64_t lba_data_end = (dataEnd + LBA_SIZE - 1) / LBA_SIZE;
+		if (lba_data_start >= lba_end) {
+			// Next data region is past the end of the disc image.
+			return -ENXIO;
+		}
+		if (lba_data_end > lba_end) {
+			lba_data_end = lba_end;
+		}
+		*pLbaStart = (uint32_t)(lba_data_start - m_lba_start);
+		*pLbaEnd = (uint32_t)(lba_data_end - m_lba_start);
+		return 0;
+	} else if (ret == -ENXIO) {
+		// No more data in the file.
+		return -ENXIO;
+	}
+
+	// Holes can't be detected. Assume everything is data.
+	*pLbaStart = lba;
+	*pLbaEnd = m_lba_len;
+	return 0;
 }
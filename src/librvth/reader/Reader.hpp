@@ -29,6 +29,17 @@
 
 #ifdef __cplusplus
 
+/**
+ * Disc image reader base class.
+ *
+ * Thread-safety:
+ * - A Reader object must only be used by one thread at a time.
+ * - Different Reader objects may be used concurrently from different
+ *   threads, even if they share the same RefFile. Readers only use
+ *   RefFile's positional I/O functions, and each Reader holds its own
+ *   reference to the RefFile.
+ * - Readers may be created and destroyed concurrently.
+ */
 class Reader
 {
 	protected:
@@ -63,6 +74,21 @@ class Reader
 		 */
 		static Reader *open(RefFile *file, uint32_t lba_start, uint32_t lba_len);
 
+		/**
+		 * Create a Reader object for a new, writable disc image.
+		 * The file should be empty.
+		 *
+		 * Plain disc images use the same reader as open().
+		 * CISO and WBFS images are written sequentially, skipping
+		 * empty blocks, and the header is written by flush().
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 * @param format	[in] Disc image format.
+		 * @return Reader*, or NULL on error.
+		 */
+		static Reader *create(RefFile *file, uint32_t lba_len, RvtH_ImageFormat_e format);
+
 	public:
 		/**
 		 * Is the Reader object open?
@@ -76,9 +102,9 @@ class Reader
 	public:
 		/** I/O functions **/
 
-		// TODO: lba_start param, or separate seek()?
-		// Regardless, we have to seek on each read because another
-		// disc image may have altered the file pointer.
+		// NOTE: Readers use RefFile's positional I/O functions,
+		// so multiple Readers can share a single RefFile without
+		// interfering with each other's file position.
 
 		/**
 		 * Read data from the disc image.
@@ -100,8 +126,93 @@ class Reader
 
 		/**
 		 * Flush the file buffers.
+		 * Writable CISO and WBFS images write their headers here.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		virtual int flush(void);
+
+		/**
+		 * Find the next region of the disc image that may contain data.
+		 * LBAs outside of the returned regions are known to be zero,
+		 * so they don't need to be read.
+		 *
+		 * The default implementation reports the entire disc image as data.
+		 *
+		 * @param lba		[in] Starting LBA.
+		 * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+		 * @param pLbaEnd	[out] End of the data region. (exclusive)
+		 * @return 0 on success; -ENXIO if there's no data at or after lba.
+		 */
+		virtual int findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd);
+
+		/**
+		 * Map a range of the disc image into memory.
+		 *
+		 * The returned pointer is borrowed from the Reader. It's valid
+		 * until the Reader is deleted, and it must not be written to.
+		 * Writes made with write() are visible through the mapping.
+		 *
+		 * The default implementation doesn't support mapping.
+		 * Use read() or mapOrRead() if this function fails.
+		 *
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr on error. (check errno)
+		 */
+		virtual const uint8_t *map(uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Map a range of the disc image into memory if possible.
+		 * Otherwise, read it into the specified buffer.
+		 * @param buf		[out] Fallback buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data (either mapped or buf), or nullptr on error.
+		 */
+		const void *mapOrRead(void *buf, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Is the disc image stored linearly in the file?
+		 * If true, LBA x of the disc image is located at
+		 * LBA (lba_start() + x) of file(), so the file can
+		 * be accessed directly, e.g. for copy offloading.
+		 * @return True if the disc image is stored linearly.
+		 */
+		virtual bool isLinear(void) const
+		{
+			return false;
+		}
+
+		/**
+		 * Does the Reader read ahead on its own?
+		 * If true, StreamHints won't request readahead for it,
+		 * since that would compete with the Reader's own reads.
+		 * @return True if the Reader reads ahead on its own.
+		 */
+		virtual bool hasReadahead(void) const
+		{
+			return false;
+		}
+
+		/**
+		 * Open another reader for the same disc image.
+		 * Each Reader can only be used by one thread at a time, so
+		 * this is used to read compressed disc images in parallel.
+		 *
+		 * The default implementation doesn't support reopening.
+		 *
+		 * @return New Reader, or nullptr on error. (check errno)
 		 */
-		void flush(void);
+		virtual Reader *reopen(void) const;
+
+		/**
+		 * Discard any data cached by the Reader.
+		 * This must be called after writing to file() directly,
+		 * e.g. when using copy offloading.
+		 *
+		 * The default implementation doesn't cache anything.
+		 */
+		virtual void discardCache(void) { }
 
 	public:
 		/** Accessors **/
@@ -124,6 +235,12 @@ class Reader
 		 */
 		inline RvtH_ImageType_e type(void) const { return m_type; }
 
+		/**
+		 * Get the disc image file.
+		 * @return RefFile*. (not ref()'d)
+		 */
+		inline RefFile *file(void) const { return m_file; }
+
 	public:
 		/** Special functions **/
 
@@ -140,6 +257,25 @@ class Reader
 			m_lba_len -= lba_count;
 		}
 
+	protected:
+		/**
+		 * Set the image type for a disc image stored linearly in a file.
+		 * m_lba_start must have been set first.
+		 * @param filesize File size.
+		 */
+		void setLinearType(int64_t filesize);
+
+		/**
+		 * Find the next data region for a disc image stored
+		 * linearly in a file. Holes in sparse image files are
+		 * detected using the file system.
+		 * @param lba		[in] Starting LBA.
+		 * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+		 * @param pLbaEnd	[out] End of the data region. (exclusive)
+		 * @return 0 on success; -ENXIO if there's no data at or after lba.
+		 */
+		int findLinearData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd);
+
 	protected:
 		RefFile *m_file;		// Disc image file
 		uint32_t m_lba_start;		// Starting LBA
@@ -0,0 +1,176 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * StoreReader.cpp: Chunk store disc image reader class.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "StoreReader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+
+/**
+ * Create a chunk store reader for a disc image.
+ * @param file		RefFile*. (manifest)
+ * @param lba_start	[in] Starting LBA. (must be 0)
+ * @param lba_len	[in] Length, in LBAs. (ignored; the manifest has the length)
+ */
+StoreReader::StoreReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+	: super(file, lba_start, lba_len)
+	, m_store(file ? ChunkStore::dirForManifest(file->filename()).c_str() : _T("."))
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	int err = 0;
+	if (lba_start != 0) {
+		// Manifests are always standalone files.
+		err = EIO;
+		goto fail;
+	}
+
+	err = -m_manifest.load(m_file);
+	if (err != 0) {
+		goto fail;
+	}
+
+	// Disc image is ready.
+	m_lba_start = 0;
+	m_lba_len = m_manifest.lba_len();
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+/**
+ * Is a given disc image supported by the chunk store reader?
+ * NOTE: This only checks the manifest magic. The rest of
+ * the manifest is checked when the reader is created.
+ * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+ * @param size	[in] Size of sbuf.
+ * @return True if supported; false if not.
+ */
+bool StoreReader::isSupported(const uint8_t *sbuf, size_t size)
+{
+	return StoreManifest::isManifest(sbuf, size);
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t StoreReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len || lba_start + lba_len < lba_start) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	// NOTE: m_lba_start is only non-zero if lba_adjust() was used.
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	uint32_t lba = m_lba_start + lba_start;
+	uint32_t lba_count = 0;
+	while (lba_count < lba_len) {
+		const uint32_t idx = m_manifest.chunkAt(lba);
+		const uint32_t offset = lba - m_manifest.chunkStart(idx);
+		const uint32_t count = std::min(m_manifest.chunkLen(idx) - offset, lba_len - lba_count);
+
+		if (m_manifest.isEmpty(idx)) {
+			// Empty chunk.
+			memset(ptr8, 0, LBA_TO_BYTES(count));
+		} else {
+			const int ret = m_store.get(m_manifest.digest(idx),
+				LBA_TO_BYTES(offset), ptr8, LBA_TO_BYTES(count));
+			if (ret != 0) {
+				errno = -ret;
+				return 0;
+			}
+		}
+
+		ptr8 += LBA_TO_BYTES(count);
+		lba += count;
+		lba_count += count;
+	}
+
+	return lba_count;
+}
+
+/**
+ * Find the next region of the disc image that may contain data.
+ * Empty chunks are reported as holes.
+ * @param lba		[in] Starting LBA.
+ * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+ * @param pLbaEnd	[out] End of the data region. (exclusive)
+ * @return 0 on success; -ENXIO if there's no data at or after lba.
+ */
+int StoreReader::findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
+{
+	if (lba >= m_lba_len) {
+		return -ENXIO;
+	}
+
+	// Skip empty chunks.
+	const uint32_t chunkCount = m_manifest.chunkCount();
+	uint32_t idx = m_manifest.chunkAt(m_lba_start + lba);
+	while (idx < chunkCount && m_manifest.isEmpty(idx)) {
+		idx++;
+	}
+	if (idx >= chunkCount) {
+		return -ENXIO;
+	}
+	const uint32_t start = m_manifest.chunkStart(idx);
+
+	// Find the end of the data region.
+	while (idx < chunkCount && !m_manifest.isEmpty(idx)) {
+		idx++;
+	}
+	const uint32_t end = (idx < chunkCount ? m_manifest.chunkStart(idx) : m_manifest.lba_len());
+
+	*pLbaStart = std::max(start, m_lba_start + lba) - m_lba_start;
+	*pLbaEnd = end - m_lba_start;
+	return 0;
+}
+
+/**
+ * Open another reader for the same disc image.
+ * Chunks can then be read on multiple threads.
+ * @return New Reader, or nullptr on error. (check errno)
+ */
+Reader *StoreReader::reopen(void) const
+{
+	StoreReader *const reader = new StoreReader(m_file, 0, 0);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	if (m_lba_start != 0) {
+		// Keep the same LBA adjustment.
+		reader->lba_adjust(m_lba_start);
+	}
+	return reader;
+}
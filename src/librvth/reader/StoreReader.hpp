@@ -0,0 +1,89 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * StoreReader.hpp: Chunk store disc image reader class.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_STOREREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_STOREREADER_HPP__
+
+#include "Reader.hpp"
+#include "ChunkStore.hpp"
+
+/**
+ * Reader for disc images stored in a chunk store. (See ChunkStore.)
+ *
+ * The Reader is opened using the disc image's manifest. Chunks
+ * are read from the store that contains the manifest. Reads only
+ * read the requested part of each chunk, so large reads don't
+ * read more than they need to.
+ *
+ * Reader::open() wraps StoreReader in a CachedReader, which caches
+ * the chunk blocks used by small reads, e.g. disc headers.
+ *
+ * Empty chunks aren't stored, so they're reported as holes
+ * by findData().
+ */
+class StoreReader : public Reader
+{
+	public:
+		/**
+		 * Create a chunk store reader for a disc image.
+		 * @param file		RefFile*. (manifest)
+		 * @param lba_start	[in] Starting LBA. (must be 0)
+		 * @param lba_len	[in] Length, in LBAs. (ignored; the manifest has the length)
+		 */
+		StoreReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(StoreReader)
+
+	public:
+		/**
+		 * Is a given disc image supported by the chunk store reader?
+		 * NOTE: This only checks the manifest magic. The rest of
+		 * the manifest is checked when the reader is created.
+		 * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+		 * @param size	[in] Size of sbuf.
+		 * @return True if supported; false if not.
+		 */
+		static bool isSupported(const uint8_t *sbuf, size_t size);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Find the next region of the disc image that may contain data.
+		 * Empty chunks are reported as holes.
+		 * @param lba		[in] Starting LBA.
+		 * @param pLbaStart	[out] First LBA of the data region. (>= lba)
+		 * @param pLbaEnd	[out] End of the data region. (exclusive)
+		 * @return 0 on success; -ENXIO if there's no data at or after lba.
+		 */
+		int findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd) final;
+
+		/**
+		 * Open another reader for the same disc image.
+		 * Chunks can then be read on multiple threads.
+		 * @return New Reader, or nullptr on error. (check errno)
+		 */
+		Reader *reopen(void) const final;
+
+	private:
+		StoreManifest m_manifest;
+		ChunkStore m_store;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_STOREREADER_HPP__ */
@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "WbfsReader.hpp"
+#include "BlockWriter.hpp"
 #include "byteswap.h"
 
 // For LBA_TO_BYTES()
@@ -30,13 +31,28 @@
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <cstddef>
 #include <cstring>
 
+// C++ includes.
+#include <algorithm>
+
 #include "libwbfs.h"
 
 // WBFS magic.
 static const char WBFS_MAGIC[4] = {'W','B','F','S'};
 
+// Parameters for newly-created WBFS images.
+// 512-byte HDD sectors; 2 MB WBFS blocks.
+#define WBFS_NEW_HD_SEC_SZ_S	9
+#define WBFS_NEW_WBFS_SEC_SZ_S	21
+#define WBFS_NEW_WBFS_SEC_SZ	(1U << WBFS_NEW_WBFS_SEC_SZ_S)
+// Number of WBFS blocks per disc. (See readWbfsHeader().)
+#define WBFS_NEW_SEC_PER_DISC	((143432U*2U) >> (WBFS_NEW_WBFS_SEC_SZ_S - 15))
+// Disc info size, aligned to the HDD sector size.
+#define WBFS_NEW_DISC_INFO_SZ \
+	((sizeof(wbfs_disc_info_t) + (WBFS_NEW_SEC_PER_DISC * 2) + 511) & ~511U)
+
 /**
  * Is a given disc image supported by the WBFS reader?
  * @param sbuf	[in] Sector buffer. (first LBA of the disc)
@@ -108,12 +124,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 	}
 
 	// Read the WBFS header.
-	ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		goto end;
-	}
-	size = file->read(head, 1, hd_sec_sz);
+	size = file->preadAt(LBA_TO_BYTES(lba_start), head, hd_sec_sz);
 	if (size != hd_sec_sz) {
 		// Read error.
 		ret = -1;
@@ -152,12 +163,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 		}
 
 		// Re-read the WBFS header.
-		ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-		if (ret != 0) {
-			// Seek error.
-			goto end;
-		}
-		size = file->read(head, 1, hd_sec_sz);
+		size = file->preadAt(LBA_TO_BYTES(lba_start), head, hd_sec_sz);
 		if (size != hd_sec_sz) {
 			// Read error.
 			ret = -1;
@@ -191,6 +197,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 		p->max_disc = (uint16_t)(p->hd_sec_sz - sizeof(wbfs_head_t));
 
 	p->n_disc_open = 0;
+	ret = 0;
 
 end:
 	if (ret != 0) {
@@ -240,7 +247,6 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 		if (head->disc_table[i]) {
 			if (count++ == index) {
 				// Found the disc table index.
-				int ret;
 				size_t size;
 
 				wbfs_disc_t *disc = (wbfs_disc_t*)malloc(sizeof(wbfs_disc_t));
@@ -259,13 +265,8 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 					return NULL;
 				}
 
-				ret = file->seeko(LBA_TO_BYTES(lba_start) + p->hd_sec_sz + (i*p->disc_info_sz), SEEK_SET);
-				if (ret != 0) {
-					// Seek error.
-					free(disc);
-					return NULL;
-				}
-				size = file->read(disc->header, 1, p->disc_info_sz);
+				size = file->preadAt(LBA_TO_BYTES(lba_start) + p->hd_sec_sz + (i*p->disc_info_sz),
+					disc->header, p->disc_info_sz);
 				if (size != p->disc_info_sz) {
 					// Error reading the disc information.
 					free(disc->header);
@@ -273,10 +274,14 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 					return NULL;
 				}
 
-				// TODO: Byteswap wlba_table[] here?
-				// Removes unnecessary byteswaps when reading,
-				// but may not be necessary if we're not reading
-				// the entire disc.
+				// Byteswap wlba_table[] once here so the reader
+				// doesn't have to do it on every lookup.
+				// NOTE: wlba_table[] is host-endian after this point.
+				uint16_t *const wlba_table = reinterpret_cast<uint16_t*>(
+					reinterpret_cast<uint8_t*>(disc->header) + offsetof(wbfs_disc_info_t, wlba_table));
+				for (uint32_t j = 0; j < p->n_wbfs_sec_per_disc; j++) {
+					wlba_table[j] = be16_to_cpu(wlba_table[j]);
+				}
 
 				// Disc information read successfully.
 				p->n_disc_open++;
@@ -311,18 +316,18 @@ static void closeWbfsDisc(wbfs_disc_t *disc)
  * Get the non-sparse size of an open WBFS disc, in bytes.
  * This scans the block table to find the first block
  * from the end of wlba_table[] that has been allocated.
- * @param wlba_table	[in] Pointer to the wlba table
+ * @param wlba_table	[in] Pointer to the wlba table (host-endian)
  * @param disc		[in] wbfs_disc_t*
  * @return Non-sparse size, in bytes.
  */
-static int64_t getWbfsDiscSize(const be16_t *wlba_table, const wbfs_disc_t *disc)
+static int64_t getWbfsDiscSize(const uint16_t *wlba_table, const wbfs_disc_t *disc)
 {
 	// Find the last block that's used on the disc.
 	// NOTE: This is in WBFS blocks, not Wii blocks.
 	const wbfs_t *const p = disc->p;
 	int lastBlock = p->n_wbfs_sec_per_disc - 1;
 	for (; lastBlock >= 0; lastBlock--) {
-		if (wlba_table[lastBlock] != cpu_to_be16(0))
+		if (wlba_table[lastBlock] != 0)
 			break;
 	}
 
@@ -346,9 +351,11 @@ WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	, m_block_size_lba(0)
 	, m_wbfs(nullptr)
 	, m_wbfs_disc(nullptr)
-	, m_wlba_table(nullptr)
+	, m_blockWriter(nullptr)
+	, m_headerDirty(false)
 {
 	int err = 0;
+	const uint16_t *wlba_table;
 
 	if (!isOpen()) {
 		// File wasn't opened.
@@ -395,12 +402,16 @@ WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	}
 
 	// Save important values for later.
-	m_wlba_table = m_wbfs_disc->header->wlba_table;
 	// TODO: Convert to shift amount?
 	m_block_size_lba = BYTES_TO_LBA(m_wbfs->wbfs_sec_sz);
 
 	// Get the size of the WBFS disc.
-	m_lba_len = BYTES_TO_LBA(getWbfsDiscSize(m_wlba_table, m_wbfs_disc));
+	wlba_table = reinterpret_cast<const uint16_t*>(
+		reinterpret_cast<const uint8_t*>(m_wbfs_disc->header) + offsetof(wbfs_disc_info_t, wlba_table));
+	m_lba_len = BYTES_TO_LBA(getWbfsDiscSize(wlba_table, m_wbfs_disc));
+
+	// Build the extent list.
+	buildExtents(wlba_table);
 
 	// Reader initialized.
 	m_type = RVTH_ImageType_GCM;
@@ -422,8 +433,92 @@ fail:
 	return;
 }
 
+/**
+ * Create a new, writable WBFS image.
+ * @param file		RefFile*. (must be writable and empty)
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ */
+WbfsReader::WbfsReader(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_real_lba_len(0)
+	, m_block_size_lba(0)
+	, m_wbfs(nullptr)
+	, m_wbfs_disc(nullptr)
+	, m_blockWriter(nullptr)
+	, m_headerDirty(true)
+{
+	int err = 0;
+	uint32_t block_count;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	} else if (lba_len == 0) {
+		// Disc image size must be specified.
+		err = EINVAL;
+		goto fail;
+	}
+
+	m_block_size_lba = BYTES_TO_LBA(WBFS_NEW_WBFS_SEC_SZ);
+	block_count = (lba_len + m_block_size_lba - 1) / m_block_size_lba;
+	if (block_count > WBFS_NEW_SEC_PER_DISC) {
+		// Disc image is too big.
+		err = EFBIG;
+		goto fail;
+	}
+
+	m_lba_start = 0;
+	m_lba_len = lba_len;
+	m_real_lba_len = m_block_size_lba;
+
+	// WBFS block 0 is the header, so the disc blocks start at
+	// WBFS block 1. A block table entry of 0 means empty block.
+	m_blockWriter = new BlockWriter(m_file, m_block_size_lba, m_block_size_lba, block_count);
+	if (!m_blockWriter->isValid()) {
+		// Error allocating the block buffer.
+		err = ENOMEM;
+		goto fail;
+	}
+
+	// Reader initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	delete m_blockWriter;
+	m_blockWriter = nullptr;
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+/**
+ * Create a new, writable WBFS image containing a single disc.
+ *
+ * Non-empty blocks are written sequentially after the
+ * WBFS header block as they're written to the disc image.
+ * The WBFS header and block table are written by flush().
+ *
+ * Check isOpen() afterwards.
+ *
+ * @param file		RefFile*. (must be writable and empty)
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @return WbfsReader*
+ */
+WbfsReader *WbfsReader::create(RefFile *file, uint32_t lba_len)
+{
+	return new WbfsReader(file, lba_len);
+}
+
 WbfsReader::~WbfsReader()
 {
+	if (m_blockWriter) {
+		// Make sure the WBFS header is written.
+		flush();
+		delete m_blockWriter;
+	}
+
 	// Free the WBFS structs.
 	if (m_wbfs_disc) {
 		closeWbfsDisc(m_wbfs_disc);
@@ -435,6 +530,43 @@ WbfsReader::~WbfsReader()
 	// Superclass will unreference the file.
 }
 
+/**
+ * Build the extent list from the WBFS block table.
+ * Adjacent blocks are merged into a single extent if they're
+ * either all empty or physically contiguous in the WBFS image.
+ * @param wlba_table	[in] Pointer to the wlba table (host-endian)
+ */
+void WbfsReader::buildExtents(const uint16_t *wlba_table)
+{
+	m_extents.clear();
+
+	const uint32_t block_count = m_lba_len / m_block_size_lba;
+	for (uint32_t i = 0; i < block_count; i++) {
+		const uint32_t phys_lba = wlba_table[i] * m_block_size_lba;
+		if (!m_extents.empty()) {
+			Extent &last = m_extents.back();
+			if (phys_lba == 0 && last.phys_lba == 0) {
+				// Empty block following an empty extent.
+				last.lba_len += m_block_size_lba;
+				continue;
+			} else if (phys_lba != 0 && last.phys_lba != 0 &&
+				   phys_lba == last.phys_lba + last.lba_len)
+			{
+				// Physically contiguous block.
+				last.lba_len += m_block_size_lba;
+				continue;
+			}
+		}
+
+		// Start a new extent.
+		Extent extent;
+		extent.lba_start = i * m_block_size_lba;
+		extent.lba_len = m_block_size_lba;
+		extent.phys_lba = phys_lba;
+		m_extents.push_back(extent);
+	}
+}
+
 /**
  * Read data from a disc image.
  * @param ptr		[out] Read buffer.
@@ -444,9 +576,6 @@ WbfsReader::~WbfsReader()
  */
 uint32_t WbfsReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 {
-	// Return value.
-	uint32_t lbas_read = 0;
-
 	// LBA bounds checking.
 	// TODO: Check for overflow?
 	assert(lba_start + m_lba_start + lba_len <=
@@ -457,41 +586,166 @@ uint32_t WbfsReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		// Out of range.
 		errno = EIO;
 		return 0;
+	} else if (lba_len == 0) {
+		// Nothing to read.
+		return 0;
+	}
+
+	if (m_blockWriter) {
+		// WBFS image is being written.
+		return m_blockWriter->read(ptr, lba_start, lba_len);
 	}
 
-	// TODO: Optimize reading multiple LBAs at once.
-	// For now, we're looking up a single LBA at a time.
+	// Find the extent containing the first LBA.
+	// Extents are sorted by starting LBA and cover the entire disc.
+	auto iter = std::upper_bound(m_extents.cbegin(), m_extents.cend(), lba_start,
+		[](uint32_t lba, const Extent &extent) { return lba < extent.lba_start; });
+	assert(iter != m_extents.cbegin());
+	--iter;
+
+	// Read one extent at a time.
 	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
-	uint32_t lba_end = lba_start + lba_len;
-	for (uint32_t lba = lba_start; lba < lba_end; lba++, ptr8 += LBA_SIZE) {
-		unsigned int physBlockIdx = be16_to_cpu(m_wlba_table[lba / m_block_size_lba]);
-		if (physBlockIdx == 0) {
-			// Empty block.
-			memset(ptr8, 0, LBA_SIZE);
-		} else {
-			// Determine the offset.
-			const unsigned int blockStart = physBlockIdx * m_block_size_lba;
-			const unsigned int offset = lba % m_block_size_lba;
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba = lba_start;
+	for (; lba < lba_end; ++iter) {
+		assert(iter != m_extents.cend());
+		const uint32_t offset = lba - iter->lba_start;
+		uint32_t run_len = iter->lba_len - offset;
+		if (run_len > lba_end - lba) {
+			run_len = lba_end - lba;
+		}
 
-			int ret = m_file->seeko(LBA_TO_BYTES(blockStart + offset + m_lba_start), SEEK_SET);
-			if (ret != 0) {
-				// Seek error.
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
-			}
-			size_t size = m_file->read(ptr8, LBA_SIZE, 1);
-			if (size != 1) {
+		if (iter->phys_lba == 0) {
+			// Empty extent.
+			memset(ptr8, 0, LBA_TO_BYTES(run_len));
+		} else {
+			const size_t run_bytes = LBA_TO_BYTES(run_len);
+			size_t size = m_file->preadAt(LBA_TO_BYTES(iter->phys_lba + offset + m_lba_start), ptr8, run_bytes);
+			if (size != run_bytes) {
 				// Read error.
 				if (errno == 0) {
 					errno = EIO;
 				}
 				return 0;
 			}
-			lbas_read++;
 		}
+
+		lba += run_len;
+		ptr8 += LBA_TO_BYTES(run_len);
+	}
+
+	return lba_len;
+}
+
+/**
+ * Write data to the disc image.
+ * Only supported for WBFS images created with create().
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t WbfsReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	if (!m_blockWriter) {
+		// WBFS images can only be written if they were created with create().
+		return super::write(ptr, lba_start, lba_len);
+	}
+
+	// LBA bounds checking.
+	assert(static_cast<uint64_t>(lba_start) + lba_len <= m_lba_len);
+	if (static_cast<uint64_t>(lba_start) + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	m_headerDirty = true;
+	return m_blockWriter->write(ptr, lba_start, lba_len);
+}
+
+/**
+ * Flush the file buffers.
+ * For WBFS images created with create(), this writes
+ * the pending block, the WBFS header, and the block table.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WbfsReader::flush(void)
+{
+	if (!m_blockWriter || !m_headerDirty) {
+		return super::flush();
+	}
+
+	// Write the pending block.
+	int ret = m_blockWriter->flush();
+	if (ret != 0) {
+		return ret;
+	}
+
+	// The header is the entire first WBFS block.
+	// It's written in full so the image doesn't have any holes.
+	uint8_t *const hdr = static_cast<uint8_t*>(calloc(1, WBFS_NEW_WBFS_SEC_SZ));
+	if (!hdr) {
+		return -ENOMEM;
+	}
+
+	// Number of WBFS blocks, including the header block.
+	// readWbfsHeader() calculates the number of WBFS blocks
+	// in 16 MB units, so round it up to a multiple of 8.
+	const uint32_t physBlockCount = m_blockWriter->physBlockCount();
+	const uint32_t n_wbfs_sec = (physBlockCount + 1 + 7) & ~7U;
+
+	// WBFS header.
+	wbfs_head_t *const head = reinterpret_cast<wbfs_head_t*>(hdr);
+	memcpy(&head->magic, WBFS_MAGIC, sizeof(WBFS_MAGIC));
+	head->n_hd_sec = cpu_to_be32(n_wbfs_sec << (WBFS_NEW_WBFS_SEC_SZ_S - WBFS_NEW_HD_SEC_SZ_S));
+	head->hd_sec_sz_s = WBFS_NEW_HD_SEC_SZ_S;
+	head->wbfs_sec_sz_s = WBFS_NEW_WBFS_SEC_SZ_S;
+	head->disc_table[0] = 1;
+
+	// Disc information, starting at the second HDD sector.
+	wbfs_disc_info_t *const disc_info = reinterpret_cast<wbfs_disc_info_t*>(
+		&hdr[1U << WBFS_NEW_HD_SEC_SZ_S]);
+	uint8_t sbuf[LBA_SIZE];
+	if (m_blockWriter->read(sbuf, 0, 1) != 1) {
+		ret = (errno != 0 ? -errno : -EIO);
+		free(hdr);
+		return ret;
+	}
+	memcpy(disc_info->disc_header_copy, sbuf, sizeof(disc_info->disc_header_copy));
+	uint16_t *const wlba_table = reinterpret_cast<uint16_t*>(
+		reinterpret_cast<uint8_t*>(disc_info) + offsetof(wbfs_disc_info_t, wlba_table));
+	const uint32_t block_count = m_blockWriter->blockCount();
+	for (uint32_t i = 0; i < block_count; i++) {
+		const uint32_t physIdx = m_blockWriter->physBlock(i);
+		wlba_table[i] = (physIdx != BlockWriter::BLOCK_EMPTY
+			? cpu_to_be16(static_cast<uint16_t>(physIdx + 1))
+			: 0);
+	}
+
+	// Free blocks table, at the end of the header block.
+	// Bit (n-1) represents WBFS block n. 1 == free.
+	const uint32_t freeblks_offset =
+		((WBFS_NEW_WBFS_SEC_SZ - n_wbfs_sec/8) >> WBFS_NEW_HD_SEC_SZ_S) << WBFS_NEW_HD_SEC_SZ_S;
+	assert(freeblks_offset >= (1U << WBFS_NEW_HD_SEC_SZ_S) + WBFS_NEW_DISC_INFO_SZ);
+	uint32_t *const freeblks = reinterpret_cast<uint32_t*>(&hdr[freeblks_offset]);
+	for (uint32_t bit = physBlockCount; bit < n_wbfs_sec - 1; bit++) {
+		freeblks[bit / 32] |= (1U << (bit % 32));
+	}
+	for (uint32_t i = 0; i < n_wbfs_sec / 32; i++) {
+		freeblks[i] = cpu_to_be32(freeblks[i]);
+	}
+
+	errno = 0;
+	size_t size = m_file->pwriteAt(0, hdr, WBFS_NEW_WBFS_SEC_SZ);
+	free(hdr);
+	if (size != WBFS_NEW_WBFS_SEC_SZ) {
+		// Write error.
+		return (errno != 0 ? -errno : -EIO);
 	}
 
-	return lbas_read;
+	// WBFS image is up to date.
+	m_real_lba_len = (physBlockCount + 1) * m_block_size_lba;
+	m_headerDirty = false;
+	return super::flush();
 }
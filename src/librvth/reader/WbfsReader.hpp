@@ -23,11 +23,15 @@
 
 #include "Reader.hpp"
 
+// C++ includes.
+#include <vector>
+
 struct wbfs_s;
 typedef struct wbfs_s wbfs_t;
 struct wbfs_disc_s;
 typedef struct wbfs_disc_s wbfs_disc_t;
-typedef uint16_t be16_t;
+
+class BlockWriter;
 
 class WbfsReader : public Reader
 {
@@ -47,10 +51,34 @@ class WbfsReader : public Reader
 
 		virtual ~WbfsReader();
 
+	private:
+		/**
+		 * Create a new, writable WBFS image.
+		 * @param file		RefFile*. (must be writable and empty)
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 */
+		WbfsReader(RefFile *file, uint32_t lba_len);
+
 	private:
 		typedef Reader super;
 		DISABLE_COPY(WbfsReader);
 
+	public:
+		/**
+		 * Create a new, writable WBFS image containing a single disc.
+		 *
+		 * Non-empty blocks are written sequentially after the
+		 * WBFS header block as they're written to the disc image.
+		 * The WBFS header and block table are written by flush().
+		 *
+		 * Check isOpen() afterwards.
+		 *
+		 * @param file		RefFile*. (must be writable and empty)
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 * @return WbfsReader*
+		 */
+		static WbfsReader *create(RefFile *file, uint32_t lba_len);
+
 	public:
 		/**
 		 * Is a given disc image supported by the WBFS reader?
@@ -72,6 +100,33 @@ class WbfsReader : public Reader
 		 */
 		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
 
+		/**
+		 * Write data to the disc image.
+		 * Only supported for WBFS images created with create().
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Flush the file buffers.
+		 * For WBFS images created with create(), this writes
+		 * the pending block, the WBFS header, and the block table.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int flush(void) final;
+
+	private:
+		/**
+		 * Build the extent list from the WBFS block table.
+		 * Adjacent blocks are merged into a single extent if they're
+		 * either all empty or physically contiguous in the WBFS image.
+		 * @param wlba_table	[in] Pointer to the wlba table (host-endian)
+		 */
+		void buildExtents(const uint16_t *wlba_table);
+
 	private:
 		// NOTE: reader.lba_len is the virtual image size.
 		// real_lba_len is the actual image size.
@@ -84,7 +139,19 @@ class WbfsReader : public Reader
 		wbfs_t *m_wbfs;			// WBFS image.
 		wbfs_disc_t *m_wbfs_disc;	// Current disc.
 
-		const be16_t *m_wlba_table;	// Pointer to m_wbfs_disc->disc->header->wlba_table.
+		// Disc extents, sorted by starting LBA.
+		// These cover the entire disc, [0, m_lba_len).
+		struct Extent {
+			uint32_t lba_start;	// Starting LBA on the disc
+			uint32_t lba_len;	// Length, in LBAs
+			uint32_t phys_lba;	// Physical LBA in the WBFS image (0 == empty)
+		};
+		std::vector<Extent> m_extents;
+
+		// Block writer for WBFS images created with create().
+		// If set, it's used instead of m_extents.
+		BlockWriter *m_blockWriter;
+		bool m_headerDirty;	// WBFS header needs to be written
 };
 
 #endif /* __RVTHTOOL_LIBRVTH_READER_WBFSREADER_HPP__ */
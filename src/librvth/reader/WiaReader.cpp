@@ -0,0 +1,1246 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WiaReader.cpp: WIA and RVZ disc image reader class.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "WiaReader.hpp"
+#include "byteswap.h"
+#include "wii_crypt.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Encryption.
+#include "aesw.h"
+
+// Decompression libraries.
+#ifdef HAVE_BZIP2
+#  include <bzlib.h>
+#endif /* HAVE_BZIP2 */
+#ifdef HAVE_LZMA
+#  include <lzma.h>
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif /* HAVE_ZSTD */
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+// WIA and RVZ magic numbers.
+static const char WIA_MAGIC[4] = {'W','I','A','\x01'};
+static const char RVZ_MAGIC[4] = {'R','V','Z','\x01'};
+
+// Compression methods.
+enum WiaCompression {
+	WIA_COMPRESSION_NONE	= 0,
+	WIA_COMPRESSION_PURGE	= 1,
+	WIA_COMPRESSION_BZIP2	= 2,
+	WIA_COMPRESSION_LZMA	= 3,
+	WIA_COMPRESSION_LZMA2	= 4,
+	WIA_COMPRESSION_ZSTD	= 5,	// RVZ only
+};
+
+// Disc types.
+enum WiaDiscType {
+	WIA_DISC_TYPE_GCN	= 1,
+	WIA_DISC_TYPE_WII	= 2,
+};
+
+// File header. (All fields are big-endian.)
+typedef struct PACKED _wia_file_head_t {
+	char magic[4];			// "WIA\x01" or "RVZ\x01"
+	uint32_t version;
+	uint32_t version_compatible;
+	uint32_t disc_size;		// Size of wia_disc_t
+	uint8_t disc_hash[20];		// SHA-1 of wia_disc_t
+	uint64_t iso_file_size;		// Size of the original disc image
+	uint64_t wia_file_size;		// Size of this file
+	uint8_t file_head_hash[20];	// SHA-1 of this header
+} wia_file_head_t;
+ASSERT_STRUCT(wia_file_head_t, 0x48);
+
+// Disc information. (All fields are big-endian.)
+typedef struct PACKED _wia_disc_t {
+	uint32_t disc_type;		// See WiaDiscType.
+	uint32_t compression;		// See WiaCompression.
+	int32_t compr_level;
+	uint32_t chunk_size;		// Chunk size (bytes)
+	uint8_t dhead[0x80];		// First 0x80 bytes of the disc
+
+	uint32_t n_part;		// Number of wia_part_t entries
+	uint32_t part_t_size;		// Size of each wia_part_t entry
+	uint64_t part_off;		// Offset of the partition table
+	uint8_t part_hash[20];		// SHA-1 of the partition table
+
+	uint32_t n_raw_data;		// Number of wia_raw_data_t entries
+	uint64_t raw_data_off;		// Offset of the raw data table
+	uint32_t raw_data_size;		// Stored size of the raw data table
+
+	uint32_t n_groups;		// Number of group entries
+	uint64_t group_off;		// Offset of the group table
+	uint32_t group_size;		// Stored size of the group table
+
+	uint8_t compr_data_len;		// Length of compr_data
+	uint8_t compr_data[7];		// Compressor properties
+} wia_disc_t;
+ASSERT_STRUCT(wia_disc_t, 0xDC);
+
+// Partition data entry. (All fields are big-endian.)
+typedef struct PACKED _wia_part_data_t {
+	uint32_t first_sector;
+	uint32_t n_sectors;
+	uint32_t group_index;
+	uint32_t n_groups;
+} wia_part_data_t;
+ASSERT_STRUCT(wia_part_data_t, 16);
+
+// Partition table entry. (All fields are big-endian.)
+typedef struct PACKED _wia_part_t {
+	uint8_t part_key[16];		// Decrypted title key
+	wia_part_data_t pd[2];
+} wia_part_t;
+ASSERT_STRUCT(wia_part_t, 48);
+
+// Raw data table entry. (All fields are big-endian.)
+typedef struct PACKED _wia_raw_data_t {
+	uint64_t raw_data_off;
+	uint64_t raw_data_size;
+	uint32_t group_index;
+	uint32_t n_groups;
+} wia_raw_data_t;
+ASSERT_STRUCT(wia_raw_data_t, 24);
+
+// WIA group table entry. (All fields are big-endian.)
+typedef struct PACKED _wia_group_t {
+	uint32_t data_off;		// Offset in the file, rshifted by 2
+	uint32_t data_size;		// Stored size
+} wia_group_t;
+ASSERT_STRUCT(wia_group_t, 8);
+
+// RVZ group table entry. (All fields are big-endian.)
+typedef struct PACKED _rvz_group_t {
+	uint32_t data_off;		// Offset in the file, rshifted by 2
+	uint32_t data_size;		// Stored size; high bit set if compressed
+	uint32_t rvz_packed_size;	// Size of the packed data (0 == not packed)
+} rvz_group_t;
+ASSERT_STRUCT(rvz_group_t, 12);
+
+// Hash exception entry: u16 offset + SHA-1
+#define WIA_EXCEPTION_SIZE (2 + 20)
+// Maximum size of a hash exception list.
+// Each 1 KB hash block can have at most 52 differing 20-byte hashes.
+#define WIA_EXCEPTION_LIST_MAX_SIZE (2 + 64*52*WIA_EXCEPTION_SIZE)
+
+// Sectors per hash group.
+#define SECTORS_PER_GROUP (GROUP_SIZE_ENC / SECTOR_SIZE_ENC)
+
+// Number of rebuilt hash groups to cache.
+#define HASH_GROUP_CACHE_COUNT 2
+
+/**
+ * RVZ junk data generator.
+ * This is the lagged Fibonacci generator used for
+ * GameCube and Wii disc padding.
+ */
+class RvzJunkGenerator
+{
+	public:
+		#define LFG_K 521
+		#define LFG_J 32
+		#define LFG_SEED_SIZE 17
+
+		/**
+		 * Initialize the generator.
+		 * @param seed Seed. (LFG_SEED_SIZE big-endian 32-bit words)
+		 */
+		void setSeed(const uint8_t *seed)
+		{
+			unsigned int i;
+			for (i = 0; i < LFG_SEED_SIZE; i++, seed += 4) {
+				m_buf[i] = ((uint32_t)seed[0] << 24) | ((uint32_t)seed[1] << 16) |
+				           ((uint32_t)seed[2] << 8) | (uint32_t)seed[3];
+			}
+			for (; i < LFG_K; i++) {
+				m_buf[i] = (m_buf[i - 17] << 23) ^ (m_buf[i - 16] >> 9) ^ m_buf[i - 1];
+			}
+
+			// Output byte 1 is taken from bits 18-25 instead of 16-23.
+			// Adjust that here and store the words in output byte order.
+			for (i = 0; i < LFG_K; i++) {
+				const uint32_t x = (m_buf[i] & 0xFF00FFFF) | ((m_buf[i] >> 2) & 0x00FF0000);
+				m_buf[i] = cpu_to_be32(x);
+			}
+
+			m_pos = 0;
+			for (i = 0; i < 4; i++) {
+				forward();
+			}
+		}
+
+		/**
+		 * Skip bytes.
+		 * @param count Number of bytes to skip.
+		 */
+		void skip(size_t count)
+		{
+			m_pos += count;
+			while (m_pos >= sizeof(m_buf)) {
+				forward();
+				m_pos -= sizeof(m_buf);
+			}
+		}
+
+		/**
+		 * Generate junk data.
+		 * @param out	[out] Output buffer.
+		 * @param count	[in] Number of bytes.
+		 */
+		void getBytes(uint8_t *out, size_t count)
+		{
+			while (count > 0) {
+				const size_t len = std::min(count, sizeof(m_buf) - m_pos);
+				memcpy(out, reinterpret_cast<const uint8_t*>(m_buf) + m_pos, len);
+				m_pos += len;
+				out += len;
+				count -= len;
+				if (m_pos == sizeof(m_buf)) {
+					forward();
+					m_pos = 0;
+				}
+			}
+		}
+
+	private:
+		void forward(void)
+		{
+			// NOTE: XOR is independent of byte order.
+			unsigned int i;
+			for (i = 0; i < LFG_J; i++) {
+				m_buf[i] ^= m_buf[i + LFG_K - LFG_J];
+			}
+			for (; i < LFG_K; i++) {
+				m_buf[i] ^= m_buf[i - LFG_J];
+			}
+		}
+
+		uint32_t m_buf[LFG_K];
+		size_t m_pos;
+};
+
+/**
+ * Is a compression method supported?
+ * @param compression Compression method.
+ * @param isRvz True for RVZ; false for WIA.
+ * @return True if supported; false if not.
+ */
+static bool isCompressionSupported(uint32_t compression, bool isRvz)
+{
+	switch (compression) {
+		case WIA_COMPRESSION_NONE:
+			return true;
+		case WIA_COMPRESSION_PURGE:
+			// Not used by RVZ.
+			return !isRvz;
+#ifdef HAVE_BZIP2
+		case WIA_COMPRESSION_BZIP2:
+			return true;
+#endif /* HAVE_BZIP2 */
+#ifdef HAVE_LZMA
+		case WIA_COMPRESSION_LZMA:
+		case WIA_COMPRESSION_LZMA2:
+			return true;
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+		case WIA_COMPRESSION_ZSTD:
+			// Not used by WIA.
+			return isRvz;
+#endif /* HAVE_ZSTD */
+		default:
+			break;
+	}
+	return false;
+}
+
+/**
+ * Decompress a buffer.
+ * @param compression	[in] Compression method. (BZIP2, LZMA, LZMA2, or ZSTD)
+ * @param props		[in] Compressor properties.
+ * @param propsLen	[in] Length of props.
+ * @param in		[in] Compressed data.
+ * @param inSize	[in] Size of in.
+ * @param out		[out] Output buffer.
+ * @param outSize	[in] Size of out.
+ * @param pOutLen	[out] Number of bytes decompressed.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int decompress(uint32_t compression, const uint8_t *props, unsigned int propsLen,
+	const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize, size_t *pOutLen)
+{
+	switch (compression) {
+#ifdef HAVE_BZIP2
+		case WIA_COMPRESSION_BZIP2: {
+			bz_stream strm;
+			memset(&strm, 0, sizeof(strm));
+			if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
+				return -ENOMEM;
+			}
+
+			strm.next_in = const_cast<char*>(reinterpret_cast<const char*>(in));
+			strm.avail_in = static_cast<unsigned int>(inSize);
+			strm.next_out = reinterpret_cast<char*>(out);
+			strm.avail_out = static_cast<unsigned int>(outSize);
+			int bzret;
+			do {
+				bzret = BZ2_bzDecompress(&strm);
+			} while (bzret == BZ_OK && strm.avail_in > 0 && strm.avail_out > 0);
+			BZ2_bzDecompressEnd(&strm);
+			if (bzret != BZ_OK && bzret != BZ_STREAM_END) {
+				return -EIO;
+			}
+			*pOutLen = outSize - strm.avail_out;
+			return 0;
+		}
+#endif /* HAVE_BZIP2 */
+
+#ifdef HAVE_LZMA
+		case WIA_COMPRESSION_LZMA:
+		case WIA_COMPRESSION_LZMA2: {
+			// Raw LZMA stream. The filter properties are
+			// stored in the disc header.
+			lzma_filter filters[2];
+			filters[0].id = (compression == WIA_COMPRESSION_LZMA
+				? LZMA_FILTER_LZMA1 : LZMA_FILTER_LZMA2);
+			filters[0].options = nullptr;
+			filters[1].id = LZMA_VLI_UNKNOWN;
+			filters[1].options = nullptr;
+			if (lzma_properties_decode(&filters[0], nullptr, props, propsLen) != LZMA_OK) {
+				return -EIO;
+			}
+
+			lzma_stream strm = LZMA_STREAM_INIT;
+			lzma_ret lret = lzma_raw_decoder(&strm, filters);
+			free(filters[0].options);
+			if (lret != LZMA_OK) {
+				return -ENOMEM;
+			}
+
+			strm.next_in = in;
+			strm.avail_in = inSize;
+			strm.next_out = out;
+			strm.avail_out = outSize;
+			do {
+				lret = lzma_code(&strm, LZMA_FINISH);
+			} while (lret == LZMA_OK && strm.avail_in > 0 && strm.avail_out > 0);
+			lzma_end(&strm);
+
+			// NOTE: LZMA_BUF_ERROR is returned if the stream
+			// has no end marker and all input was consumed.
+			if (lret != LZMA_OK && lret != LZMA_STREAM_END && lret != LZMA_BUF_ERROR) {
+				return -EIO;
+			}
+			*pOutLen = outSize - strm.avail_out;
+			return 0;
+		}
+#endif /* HAVE_LZMA */
+
+#ifdef HAVE_ZSTD
+		case WIA_COMPRESSION_ZSTD: {
+			const size_t zret = ZSTD_decompress(out, outSize, in, inSize);
+			if (ZSTD_isError(zret)) {
+				return -EIO;
+			}
+			*pOutLen = zret;
+			return 0;
+		}
+#endif /* HAVE_ZSTD */
+
+		default:
+			break;
+	}
+
+	((void)props);
+	((void)propsLen);
+	((void)in);
+	((void)inSize);
+	((void)out);
+	((void)outSize);
+	((void)pOutLen);
+	return -ENOTSUP;
+}
+
+/**
+ * Expand purged data.
+ * Purged data is a list of {u32 offset, u32 size, data} segments,
+ * followed by a SHA-1 hash. Everything else is zero.
+ * @param in		[in] Purged data.
+ * @param inSize	[in] Size of in.
+ * @param out		[out] Output buffer.
+ * @param outSize	[in] Size of out.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int unpurge(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize)
+{
+	if (inSize < 20) {
+		return -EIO;
+	}
+	// TODO: Verify the SHA-1 hash?
+	inSize -= 20;
+
+	memset(out, 0, outSize);
+	size_t pos = 0;
+	while (pos + 8 <= inSize) {
+		const uint32_t offset = be32_to_cpu(*reinterpret_cast<const uint32_t*>(&in[pos]));
+		const uint32_t size = be32_to_cpu(*reinterpret_cast<const uint32_t*>(&in[pos+4]));
+		pos += 8;
+		if (size > inSize - pos || offset > outSize || size > outSize - offset) {
+			// Segment is out of range.
+			return -EIO;
+		}
+		memcpy(&out[offset], &in[pos], size);
+		pos += size;
+	}
+
+	return (pos == inSize ? 0 : -EIO);
+}
+
+/**
+ * Unpack RVZ-packed data.
+ * Packed data is a list of {u32 size, data} segments. If the high bit
+ * of size is set, the segment is junk data, and only the 68-byte junk
+ * generator seed is stored.
+ * @param in		[in] Packed data.
+ * @param inSize	[in] Size of in.
+ * @param out		[out] Output buffer.
+ * @param outSize	[in] Size of out.
+ * @param dataOffset	[in] Offset of the chunk within the disc or partition data.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvzUnpack(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize, uint64_t dataOffset)
+{
+	// NOTE: Allocated only if needed, since it's over 2 KB.
+	RvzJunkGenerator *lfg = nullptr;
+
+	size_t inPos = 0, outPos = 0;
+	int ret = 0;
+	while (outPos < outSize) {
+		if (inPos + 4 > inSize) {
+			ret = -EIO;
+			break;
+		}
+		uint32_t size = be32_to_cpu(*reinterpret_cast<const uint32_t*>(&in[inPos]));
+		inPos += 4;
+		const bool isJunk = !!(size & 0x80000000U);
+		size &= ~0x80000000U;
+		if (size > outSize - outPos) {
+			ret = -EIO;
+			break;
+		}
+
+		if (isJunk) {
+			// Junk data. Generate it from the seed.
+			if (inPos + LFG_SEED_SIZE*4 > inSize) {
+				ret = -EIO;
+				break;
+			}
+			if (!lfg) {
+				lfg = new RvzJunkGenerator;
+			}
+			lfg->setSeed(&in[inPos]);
+			lfg->skip((size_t)((dataOffset + outPos) % SECTOR_SIZE_ENC));
+			lfg->getBytes(&out[outPos], size);
+			inPos += LFG_SEED_SIZE*4;
+		} else {
+			// Literal data.
+			if (size > inSize - inPos) {
+				ret = -EIO;
+				break;
+			}
+			memcpy(&out[outPos], &in[inPos], size);
+			inPos += size;
+		}
+		outPos += size;
+	}
+
+	delete lfg;
+	return ret;
+}
+
+/**
+ * Is a given disc image supported by the WIA/RVZ reader?
+ * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+ * @param size	[in] Size of sbuf. (should be 512 or larger)
+ * @return True if supported; false if not.
+ */
+bool WiaReader::isSupported(const uint8_t *sbuf, size_t size)
+{
+	assert(sbuf != NULL);
+	assert(size >= LBA_SIZE);
+	if (!sbuf || size < LBA_SIZE) {
+		return false;
+	}
+
+	// Check for WIA or RVZ magic.
+	// NOTE: The compression method is checked by the constructor.
+	return (!memcmp(sbuf, WIA_MAGIC, sizeof(WIA_MAGIC)) ||
+	        !memcmp(sbuf, RVZ_MAGIC, sizeof(RVZ_MAGIC)));
+}
+
+/**
+ * Create a WIA/RVZ reader for a disc image.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ */
+WiaReader::WiaReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+	: super(file, lba_start, lba_len)
+	, m_fileOffset(LBA_TO_BYTES((uint64_t)lba_start))
+	, m_fileLbaLen(lba_len)
+	, m_isRvz(false)
+	, m_compression(WIA_COMPRESSION_NONE)
+	, m_comprPropsLen(0)
+	, m_chunkSize(0)
+	, m_useCounter(0)
+	, m_aesw(nullptr)
+	, m_aeswPart(-1)
+{
+	int err = 0;
+	size_t size;
+	wia_file_head_t fhead;
+	wia_disc_t disc;
+	uint64_t iso_file_size;
+	uint32_t disc_type, n_part, part_t_size, n_raw_data, n_groups;
+	uint32_t chunkSizeDec;
+	unsigned int i, j;
+	vector<uint8_t> tbl;
+
+	memset(m_comprProps, 0, sizeof(m_comprProps));
+	memset(m_dhead, 0, sizeof(m_dhead));
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// Read the file header and disc information.
+	size = m_file->preadAt(m_fileOffset, &fhead, sizeof(fhead));
+	if (size != sizeof(fhead)) {
+		// Short read.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+	if (memcmp(fhead.magic, WIA_MAGIC, sizeof(WIA_MAGIC)) != 0 &&
+	    memcmp(fhead.magic, RVZ_MAGIC, sizeof(RVZ_MAGIC)) != 0)
+	{
+		// Not a WIA or RVZ image.
+		err = EIO;
+		goto fail;
+	}
+	m_isRvz = !memcmp(fhead.magic, RVZ_MAGIC, sizeof(RVZ_MAGIC));
+	if (be32_to_cpu(fhead.disc_size) < sizeof(disc)) {
+		// Disc information is too small.
+		err = EIO;
+		goto fail;
+	}
+
+	size = m_file->preadAt(m_fileOffset + sizeof(fhead), &disc, sizeof(disc));
+	if (size != sizeof(disc)) {
+		// Short read.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+
+	// Check the compression method.
+	m_compression = be32_to_cpu(disc.compression);
+	if (!isCompressionSupported(m_compression, m_isRvz)) {
+		// Compression method isn't supported.
+		err = ENOTSUP;
+		goto fail;
+	}
+	m_comprPropsLen = std::min<uint8_t>(disc.compr_data_len, sizeof(m_comprProps));
+	memcpy(m_comprProps, disc.compr_data, m_comprPropsLen);
+	memcpy(m_dhead, disc.dhead, sizeof(m_dhead));
+
+	// Check the chunk size.
+	// - WIA: Multiple of 2 MB.
+	// - RVZ: Power of two, 32 KB or larger.
+	// Chunks smaller than 2 MB must evenly divide a 2 MB hash group.
+	m_chunkSize = be32_to_cpu(disc.chunk_size);
+	if (m_chunkSize < SECTOR_SIZE_ENC ||
+	    (m_chunkSize < GROUP_SIZE_ENC && (GROUP_SIZE_ENC % m_chunkSize) != 0) ||
+	    (m_chunkSize >= GROUP_SIZE_ENC && (m_chunkSize % GROUP_SIZE_ENC) != 0))
+	{
+		// Unsupported chunk size.
+		err = EIO;
+		goto fail;
+	}
+	chunkSizeDec = m_chunkSize / SECTOR_SIZE_ENC * SECTOR_SIZE_DEC;
+
+	// Disc image size.
+	iso_file_size = be64_to_cpu(fhead.iso_file_size);
+	if (iso_file_size < sizeof(m_dhead) || BYTES_TO_LBA(iso_file_size) > 0xFFFFFFFFULL) {
+		// Invalid disc image size.
+		err = EIO;
+		goto fail;
+	}
+	m_lba_start = 0;
+	m_lba_len = static_cast<uint32_t>(BYTES_TO_LBA(iso_file_size));
+
+	// Group table.
+	n_groups = be32_to_cpu(disc.n_groups);
+	if (n_groups > 0x1000000) {
+		// Too many groups.
+		err = EIO;
+		goto fail;
+	}
+	if (n_groups > 0) {
+		const size_t entrySize = (m_isRvz ? sizeof(rvz_group_t) : sizeof(wia_group_t));
+		tbl.resize(n_groups * entrySize);
+		int ret = readTable(be64_to_cpu(disc.group_off), be32_to_cpu(disc.group_size),
+			tbl.data(), tbl.size());
+		if (ret != 0) {
+			err = -ret;
+			goto fail;
+		}
+
+		m_groups.resize(n_groups);
+		for (i = 0; i < n_groups; i++) {
+			Group &group = m_groups[i];
+			if (m_isRvz) {
+				const rvz_group_t *const rg = reinterpret_cast<const rvz_group_t*>(&tbl[i * entrySize]);
+				const uint32_t data_size = be32_to_cpu(rg->data_size);
+				group.offset = (uint64_t)be32_to_cpu(rg->data_off) << 2;
+				group.size = data_size & ~0x80000000U;
+				group.packedSize = be32_to_cpu(rg->rvz_packed_size);
+				group.compressed = !!(data_size & 0x80000000U);
+			} else {
+				const wia_group_t *const wg = reinterpret_cast<const wia_group_t*>(&tbl[i * entrySize]);
+				group.offset = (uint64_t)be32_to_cpu(wg->data_off) << 2;
+				group.size = be32_to_cpu(wg->data_size);
+				group.packedSize = 0;
+				group.compressed = (m_compression != WIA_COMPRESSION_NONE);
+			}
+		}
+	}
+
+	// Partition table. (Wii only; not compressed)
+	disc_type = be32_to_cpu(disc.disc_type);
+	n_part = be32_to_cpu(disc.n_part);
+	part_t_size = be32_to_cpu(disc.part_t_size);
+	if (disc_type == WIA_DISC_TYPE_WII && n_part > 0) {
+		if (n_part > 256 || part_t_size < sizeof(wia_part_t) || part_t_size > 4096) {
+			// Invalid partition table.
+			err = EIO;
+			goto fail;
+		}
+
+		tbl.resize(n_part * part_t_size);
+		size = m_file->preadAt(m_fileOffset + be64_to_cpu(disc.part_off), tbl.data(), tbl.size());
+		if (size != tbl.size()) {
+			// Short read.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			goto fail;
+		}
+
+		m_partitions.resize(n_part);
+		for (i = 0; i < n_part; i++) {
+			const wia_part_t *const part = reinterpret_cast<const wia_part_t*>(&tbl[i * part_t_size]);
+			Partition &partition = m_partitions[i];
+			memcpy(partition.key, part->part_key, sizeof(partition.key));
+			partition.firstSector = be32_to_cpu(part->pd[0].first_sector);
+
+			for (j = 0; j < ARRAY_SIZE(part->pd); j++) {
+				const wia_part_data_t *const pd = &part->pd[j];
+				const uint32_t first_sector = be32_to_cpu(pd->first_sector);
+				const uint32_t n_sectors = be32_to_cpu(pd->n_sectors);
+				if (n_sectors == 0) {
+					continue;
+				} else if (first_sector < partition.firstSector) {
+					// Data entries must be in order.
+					err = EIO;
+					goto fail;
+				}
+
+				Region region;
+				region.start = (uint64_t)first_sector * SECTOR_SIZE_ENC;
+				region.end = region.start + ((uint64_t)n_sectors * SECTOR_SIZE_ENC);
+				region.dataStart = (uint64_t)(first_sector - partition.firstSector) * SECTOR_SIZE_DEC;
+				region.dataSize = (uint64_t)n_sectors * SECTOR_SIZE_DEC;
+				region.groupIndex = be32_to_cpu(pd->group_index);
+				region.groupCount = be32_to_cpu(pd->n_groups);
+				region.type = REGION_PARTITION;
+				region.part = i;
+				if ((uint64_t)region.groupIndex + region.groupCount > n_groups ||
+				    (uint64_t)region.groupCount * chunkSizeDec < region.dataSize)
+				{
+					// Group table is too small.
+					err = EIO;
+					goto fail;
+				}
+				m_regions.push_back(region);
+			}
+		}
+
+		// AES context for re-encrypting the partition data.
+		m_aesw = aesw_new();
+		if (!m_aesw) {
+			err = errno;
+			if (err == 0) {
+				err = ENOMEM;
+			}
+			goto fail;
+		}
+	}
+
+	// Raw data table.
+	n_raw_data = be32_to_cpu(disc.n_raw_data);
+	if (n_raw_data > 0x10000) {
+		// Too many raw data entries.
+		err = EIO;
+		goto fail;
+	}
+	if (n_raw_data > 0) {
+		tbl.resize(n_raw_data * sizeof(wia_raw_data_t));
+		int ret = readTable(be64_to_cpu(disc.raw_data_off), be32_to_cpu(disc.raw_data_size),
+			tbl.data(), tbl.size());
+		if (ret != 0) {
+			err = -ret;
+			goto fail;
+		}
+
+		for (i = 0; i < n_raw_data; i++) {
+			const wia_raw_data_t *const rd = reinterpret_cast<const wia_raw_data_t*>(&tbl[i * sizeof(wia_raw_data_t)]);
+			const uint64_t raw_data_off = be64_to_cpu(rd->raw_data_off);
+			const uint64_t raw_data_size = be64_to_cpu(rd->raw_data_size);
+			if (raw_data_size == 0) {
+				continue;
+			}
+
+			// Chunks start at the beginning of the sector.
+			Region region;
+			region.start = raw_data_off;
+			region.end = raw_data_off + raw_data_size;
+			region.dataStart = raw_data_off - (raw_data_off % SECTOR_SIZE_ENC);
+			region.dataSize = region.end - region.dataStart;
+			region.groupIndex = be32_to_cpu(rd->group_index);
+			region.groupCount = be32_to_cpu(rd->n_groups);
+			region.type = REGION_RAW;
+			region.part = 0;
+			if (region.end < region.start ||
+			    (uint64_t)region.groupIndex + region.groupCount > n_groups ||
+			    (uint64_t)region.groupCount * m_chunkSize < region.dataSize)
+			{
+				// Group table is too small.
+				err = EIO;
+				goto fail;
+			}
+			m_regions.push_back(region);
+		}
+	}
+
+	// Sort the regions for binary searching.
+	std::sort(m_regions.begin(), m_regions.end(), [](const Region &a, const Region &b) {
+		return a.start < b.start;
+	});
+
+	// Chunk cache.
+	// If chunks are smaller than a hash group, a full hash
+	// group's worth of chunks should fit in the cache.
+	m_chunkCache.resize(std::max<size_t>(4, (2 * GROUP_SIZE_DEC / chunkSizeDec) + 1));
+	for (Chunk &chunk : m_chunkCache) {
+		chunk.groupIdx = ~0U;
+		chunk.lastUse = 0;
+	}
+	if (!m_partitions.empty()) {
+		m_hashGroupCache.resize(HASH_GROUP_CACHE_COUNT);
+		for (HashGroup &hg : m_hashGroupCache) {
+			hg.sector = ~0ULL;
+			hg.lastUse = 0;
+			hg.data = nullptr;
+		}
+	}
+
+	// Reader initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+WiaReader::~WiaReader()
+{
+	for (HashGroup &hg : m_hashGroupCache) {
+		free(hg.data);
+	}
+	if (m_aesw) {
+		aesw_free(m_aesw);
+	}
+}
+
+/**
+ * Read a table that's compressed using the disc compression method.
+ * @param offset	[in] Offset in the file.
+ * @param storedSize	[in] Stored size.
+ * @param buf		[out] Decompressed table.
+ * @param size		[in] Decompressed size.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WiaReader::readTable(uint64_t offset, uint32_t storedSize, uint8_t *buf, size_t size)
+{
+	if (storedSize > 64*1024*1024) {
+		// Table is too big.
+		return -EIO;
+	}
+
+	vector<uint8_t> stored(storedSize);
+	errno = 0;
+	if (m_file->preadAt(m_fileOffset + offset, stored.data(), storedSize) != storedSize) {
+		// Short read.
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	switch (m_compression) {
+		case WIA_COMPRESSION_NONE:
+			if (storedSize < size) {
+				return -EIO;
+			}
+			memcpy(buf, stored.data(), size);
+			return 0;
+
+		case WIA_COMPRESSION_PURGE:
+			return unpurge(stored.data(), storedSize, buf, size);
+
+		default: {
+			size_t outLen = 0;
+			int ret = decompress(m_compression, m_comprProps, m_comprPropsLen,
+				stored.data(), storedSize, buf, size, &outLen);
+			if (ret != 0) {
+				return ret;
+			}
+			return (outLen == size ? 0 : -EIO);
+		}
+	}
+}
+
+/**
+ * Load a chunk from the file.
+ * @param chunk		[out] Chunk.
+ * @param group		[in] Group table entry.
+ * @param size		[in] Decompressed size of the chunk.
+ * @param dataOffset	[in] Offset of the chunk within the region's data. (for RVZ junk)
+ * @param listCount	[in] Number of hash exception lists. (0 for raw data)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WiaReader::loadChunk(Chunk *chunk, const Group &group, size_t size, uint64_t dataOffset, unsigned int listCount)
+{
+	chunk->data.resize(size);
+	chunk->exceptions.clear();
+	if (group.size == 0) {
+		// Chunk is all zeroes.
+		// NOTE: Hash exceptions aren't stored in this case.
+		memset(chunk->data.data(), 0, size);
+		return 0;
+	}
+
+	vector<uint8_t> stored(group.size);
+	errno = 0;
+	if (m_file->preadAt(m_fileOffset + group.offset, stored.data(), group.size) != group.size) {
+		// Short read.
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	// Purged chunks have uncompressed hash exceptions,
+	// so they're handled the same way as uncompressed chunks.
+	const bool isPurged = (group.compressed && m_compression == WIA_COMPRESSION_PURGE);
+	const bool isCompressed = (group.compressed && !isPurged);
+
+	const uint8_t *p;
+	size_t len;
+	vector<uint8_t> dec;
+	if (isCompressed) {
+		// Hash exceptions are compressed along with the data.
+		dec.resize((group.packedSize != 0 ? group.packedSize : size) +
+			(listCount * WIA_EXCEPTION_LIST_MAX_SIZE));
+		int ret = decompress(m_compression, m_comprProps, m_comprPropsLen,
+			stored.data(), stored.size(), dec.data(), dec.size(), &len);
+		if (ret != 0) {
+			return ret;
+		}
+		p = dec.data();
+	} else {
+		p = stored.data();
+		len = stored.size();
+	}
+
+	// Hash exception lists.
+	size_t pos = 0;
+	for (unsigned int list = 0; list < listCount; list++) {
+		if (pos + 2 > len) {
+			return -EIO;
+		}
+		const unsigned int count = be16_to_cpu(*reinterpret_cast<const uint16_t*>(&p[pos]));
+		pos += 2;
+		if (count * WIA_EXCEPTION_SIZE > len - pos) {
+			return -EIO;
+		}
+		for (unsigned int i = 0; i < count; i++, pos += WIA_EXCEPTION_SIZE) {
+			HashException exc;
+			exc.list = list;
+			exc.offset = be16_to_cpu(*reinterpret_cast<const uint16_t*>(&p[pos]));
+			memcpy(exc.hash, &p[pos + 2], sizeof(exc.hash));
+			chunk->exceptions.push_back(exc);
+		}
+	}
+	if (listCount > 0 && !isCompressed) {
+		// Uncompressed hash exceptions are padded to 4 bytes.
+		pos = (pos + 3) & ~(size_t)3;
+		if (pos > len) {
+			return -EIO;
+		}
+	}
+	p += pos;
+	len -= pos;
+
+	if (isPurged) {
+		return unpurge(p, len, chunk->data.data(), size);
+	} else if (group.packedSize != 0) {
+		return rvzUnpack(p, std::min<size_t>(len, group.packedSize),
+			chunk->data.data(), size, dataOffset);
+	}
+
+	if (len < size) {
+		// Not enough data.
+		return -EIO;
+	}
+	memcpy(chunk->data.data(), p, size);
+	return 0;
+}
+
+/**
+ * Get a decompressed chunk.
+ * @param groupIdx	[in] Group table index.
+ * @param size		[in] Decompressed size of the chunk.
+ * @param dataOffset	[in] Offset of the chunk within the region's data. (for RVZ junk)
+ * @param listCount	[in] Number of hash exception lists. (0 for raw data)
+ * @return Chunk, or nullptr on error. (check errno)
+ */
+const WiaReader::Chunk *WiaReader::getChunk(uint32_t groupIdx, size_t size, uint64_t dataOffset, unsigned int listCount)
+{
+	// Check the cache first.
+	Chunk *lru = &m_chunkCache[0];
+	for (Chunk &chunk : m_chunkCache) {
+		if (chunk.groupIdx == groupIdx) {
+			chunk.lastUse = ++m_useCounter;
+			return &chunk;
+		}
+		if (chunk.lastUse < lru->lastUse) {
+			lru = &chunk;
+		}
+	}
+
+	// Replace the least-recently used chunk.
+	assert(groupIdx < m_groups.size());
+	if (groupIdx >= m_groups.size()) {
+		errno = EIO;
+		return nullptr;
+	}
+	int ret = loadChunk(lru, m_groups[groupIdx], size, dataOffset, listCount);
+	if (ret != 0) {
+		lru->groupIdx = ~0U;
+		lru->lastUse = 0;
+		errno = -ret;
+		return nullptr;
+	}
+	lru->groupIdx = groupIdx;
+	lru->lastUse = ++m_useCounter;
+	return lru;
+}
+
+/**
+ * Get a rebuilt Wii hash group.
+ * @param part		[in] Partition index.
+ * @param sector	[in] First sector of the hash group.
+ * @return Encrypted hash group (GROUP_SIZE_ENC bytes), or nullptr on error. (check errno)
+ */
+const uint8_t *WiaReader::getHashGroup(unsigned int part, uint64_t sector)
+{
+	// Check the cache first.
+	HashGroup *lru = &m_hashGroupCache[0];
+	for (HashGroup &hg : m_hashGroupCache) {
+		if (hg.sector == sector) {
+			hg.lastUse = ++m_useCounter;
+			return hg.data;
+		}
+		if (hg.lastUse < lru->lastUse) {
+			lru = &hg;
+		}
+	}
+
+	if (!lru->data) {
+		lru->data = static_cast<uint8_t*>(malloc(GROUP_SIZE_ENC));
+		if (!lru->data) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+	}
+	lru->sector = ~0ULL;
+	if (m_groupBuf.empty()) {
+		m_groupBuf.resize(GROUP_SIZE_DEC);
+	}
+	memset(m_groupBuf.data(), 0, GROUP_SIZE_DEC);
+
+	const Partition &partition = m_partitions[part];
+	const uint32_t sectorsPerChunk = m_chunkSize / SECTOR_SIZE_ENC;
+	const uint32_t chunkSizeDec = sectorsPerChunk * SECTOR_SIZE_DEC;
+	const unsigned int listCount = std::max(1U, chunkSizeDec / GROUP_SIZE_DEC);
+	const uint64_t hashGroupIdx = (sector - partition.firstSector) / SECTORS_PER_GROUP;
+
+	// Gather the decrypted data and the hash exceptions for this hash group.
+	vector<HashException> exceptions;
+	uint32_t lastGroupIdx = ~0U;
+	auto iter = m_regions.begin();
+	for (unsigned int i = 0; i < SECTORS_PER_GROUP; i++) {
+		const uint64_t offset = (sector + i) * SECTOR_SIZE_ENC;
+		while (iter != m_regions.end() && iter->end <= offset) {
+			++iter;
+		}
+		if (iter == m_regions.end()) {
+			break;
+		} else if (iter->start > offset ||
+		           iter->type != REGION_PARTITION || iter->part != part)
+		{
+			// Not part of this partition's data.
+			continue;
+		}
+
+		const Region &region = *iter;
+		const uint64_t relSector = (offset - region.start) / SECTOR_SIZE_ENC;
+		const uint32_t chunkIdx = static_cast<uint32_t>(relSector / sectorsPerChunk);
+		const uint64_t chunkOffset = (uint64_t)chunkIdx * chunkSizeDec;
+		const size_t chunkLen = static_cast<size_t>(
+			std::min<uint64_t>(chunkSizeDec, region.dataSize - chunkOffset));
+		const Chunk *const chunk = getChunk(region.groupIndex + chunkIdx, chunkLen,
+			region.dataStart + chunkOffset, listCount);
+		if (!chunk) {
+			return nullptr;
+		}
+
+		const size_t secOffset = (relSector % sectorsPerChunk) * SECTOR_SIZE_DEC;
+		if (secOffset + SECTOR_SIZE_DEC > chunk->data.size()) {
+			errno = EIO;
+			return nullptr;
+		}
+		memcpy(&m_groupBuf[i * SECTOR_SIZE_DEC], &chunk->data[secOffset], SECTOR_SIZE_DEC);
+
+		if (region.groupIndex + chunkIdx != lastGroupIdx) {
+			// New chunk. Save the hash exceptions for this hash group.
+			// Each list covers one hash group, and its offsets are
+			// relative to the start of the hash group.
+			lastGroupIdx = region.groupIndex + chunkIdx;
+			const uint64_t chunkSector = (region.start / SECTOR_SIZE_ENC) - partition.firstSector +
+				((uint64_t)chunkIdx * sectorsPerChunk);
+			for (const HashException &exc : chunk->exceptions) {
+				const uint64_t listSector = chunkSector + ((uint64_t)exc.list * SECTORS_PER_GROUP);
+				if (listSector / SECTORS_PER_GROUP == hashGroupIdx) {
+					exceptions.push_back(exc);
+				}
+			}
+		}
+	}
+
+	// Rebuild the hashes.
+	int ret = rvth_hash_group(m_groupBuf.data(), GROUP_SIZE_DEC, lru->data, GROUP_SIZE_ENC, nullptr, 0);
+	if (ret != 0) {
+		errno = -ret;
+		return nullptr;
+	}
+
+	// Apply the hash exceptions.
+	// These are hashes that don't match the data, e.g. for
+	// sectors that aren't part of the original disc image.
+	for (const HashException &exc : exceptions) {
+		const unsigned int block = exc.offset / sizeof(Wii_Disc_Hashes_t);
+		const unsigned int blockOffset = exc.offset % sizeof(Wii_Disc_Hashes_t);
+		if (block >= SECTORS_PER_GROUP || blockOffset + sizeof(exc.hash) > sizeof(Wii_Disc_Hashes_t)) {
+			errno = EIO;
+			return nullptr;
+		}
+		memcpy(&lru->data[(block * SECTOR_SIZE_ENC) + blockOffset], exc.hash, sizeof(exc.hash));
+	}
+
+	// Encrypt the hash group.
+	if (m_aeswPart != static_cast<int>(part)) {
+		aesw_set_key(m_aesw, partition.key, sizeof(partition.key));
+		m_aeswPart = static_cast<int>(part);
+	}
+	ret = rvth_encrypt_hashed_group(m_aesw, lru->data, GROUP_SIZE_ENC);
+	if (ret != 0) {
+		errno = -ret;
+		return nullptr;
+	}
+
+	lru->sector = sector;
+	lru->lastUse = ++m_useCounter;
+	return lru->data;
+}
+
+/**
+ * Read data from a region.
+ * @param region	[in] Region.
+ * @param buf		[out] Output buffer.
+ * @param offset	[in] Disc offset. (must be within the region)
+ * @param size		[in] Maximum number of bytes to read.
+ * @return Number of bytes read, or 0 on error. (check errno)
+ */
+size_t WiaReader::readRegion(const Region &region, uint8_t *buf, uint64_t offset, size_t size)
+{
+	assert(offset >= region.start && offset < region.end);
+	size = static_cast<size_t>(std::min<uint64_t>(size, region.end - offset));
+
+	if (region.type == REGION_PARTITION) {
+		// Wii partition data.
+		const Partition &partition = m_partitions[region.part];
+		const uint64_t sector = offset / SECTOR_SIZE_ENC;
+		const uint64_t groupSector = partition.firstSector +
+			((sector - partition.firstSector) / SECTORS_PER_GROUP * SECTORS_PER_GROUP);
+		const uint8_t *const hg = getHashGroup(region.part, groupSector);
+		if (!hg) {
+			return 0;
+		}
+
+		const size_t groupOffset = static_cast<size_t>(offset - (groupSector * SECTOR_SIZE_ENC));
+		size = std::min<size_t>(size, GROUP_SIZE_ENC - groupOffset);
+		memcpy(buf, &hg[groupOffset], size);
+		return size;
+	}
+
+	// Raw data.
+	const uint64_t rel = offset - region.dataStart;
+	const uint32_t chunkIdx = static_cast<uint32_t>(rel / m_chunkSize);
+	const uint64_t chunkOffset = (uint64_t)chunkIdx * m_chunkSize;
+	const size_t chunkLen = static_cast<size_t>(
+		std::min<uint64_t>(m_chunkSize, region.dataSize - chunkOffset));
+	const Chunk *const chunk = getChunk(region.groupIndex + chunkIdx, chunkLen,
+		region.dataStart + chunkOffset, 0);
+	if (!chunk) {
+		return 0;
+	}
+
+	const size_t inChunk = static_cast<size_t>(rel - chunkOffset);
+	size = std::min<size_t>(size, chunkLen - inChunk);
+	memcpy(buf, &chunk->data[inChunk], size);
+	return size;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t WiaReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len || lba_start + lba_len < lba_start) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	uint64_t offset = LBA_TO_BYTES((uint64_t)m_lba_start + lba_start);
+	size_t size = LBA_TO_BYTES((size_t)lba_len);
+	while (size > 0) {
+		size_t len;
+		if (offset < sizeof(m_dhead)) {
+			// Disc header.
+			len = std::min<size_t>(size, sizeof(m_dhead) - (size_t)offset);
+			memcpy(ptr8, &m_dhead[offset], len);
+		} else {
+			// Find the region containing this offset.
+			auto iter = std::upper_bound(m_regions.begin(), m_regions.end(), offset,
+				[](uint64_t off, const Region &region) {
+					return off < region.start;
+				});
+			if (iter != m_regions.begin() && (iter - 1)->end > offset) {
+				len = readRegion(*(iter - 1), ptr8, offset, size);
+				if (len == 0) {
+					// Read error.
+					if (errno == 0) {
+						errno = EIO;
+					}
+					return 0;
+				}
+			} else {
+				// Not stored in the WIA file. Assume it's zero.
+				len = size;
+				if (iter != m_regions.end()) {
+					len = static_cast<size_t>(std::min<uint64_t>(len, iter->start - offset));
+				}
+				memset(ptr8, 0, len);
+			}
+		}
+
+		ptr8 += len;
+		offset += len;
+		size -= len;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Open another reader for the same disc image.
+ * Chunks can then be decompressed on multiple threads.
+ * @return New Reader, or nullptr on error. (check errno)
+ */
+Reader *WiaReader::reopen(void) const
+{
+	WiaReader *const reader = new WiaReader(m_file,
+		static_cast<uint32_t>(BYTES_TO_LBA(m_fileOffset)), m_fileLbaLen);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	if (m_lba_start != 0) {
+		// Keep the same LBA adjustment.
+		reader->lba_adjust(m_lba_start);
+	}
+	return reader;
+}
@@ -0,0 +1,209 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WiaReader.hpp: WIA and RVZ disc image reader class.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_WIAREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_WIAREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes.
+#include <vector>
+
+// AES context. (libwiicrypto/aesw.h)
+struct _AesCtx;
+
+/**
+ * Reader for WIA and RVZ compressed disc images.
+ *
+ * The disc image is stored as a sequence of compressed chunks
+ * ("groups"). Chunks are decompressed on demand, and a few of the
+ * most recently used chunks are cached.
+ *
+ * Wii partition data is stored decrypted and without the hash
+ * tables, so each 2 MB hash group is rebuilt and re-encrypted
+ * using the partition's title key when it's read. The most
+ * recently used hash groups are cached, too.
+ */
+class WiaReader : public Reader
+{
+	public:
+		/**
+		 * Create a WIA/RVZ reader for a disc image.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		WiaReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		virtual ~WiaReader();
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(WiaReader)
+
+	public:
+		/**
+		 * Is a given disc image supported by the WIA/RVZ reader?
+		 * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+		 * @param size	[in] Size of sbuf. (should be 512 or larger)
+		 * @return True if supported; false if not.
+		 */
+		static bool isSupported(const uint8_t *sbuf, size_t size);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Open another reader for the same disc image.
+		 * Chunks can then be decompressed on multiple threads.
+		 * @return New Reader, or nullptr on error. (check errno)
+		 */
+		Reader *reopen(void) const final;
+
+	private:
+		// Disc region types.
+		enum RegionType {
+			REGION_RAW,		// Raw data (stored as-is)
+			REGION_PARTITION,	// Wii partition data (stored decrypted)
+		};
+
+		// Region of the disc image.
+		struct Region {
+			uint64_t start;		// Start of the region (bytes)
+			uint64_t end;		// End of the region (bytes; exclusive)
+			uint64_t dataStart;	// Offset of the first chunk (bytes)
+			uint64_t dataSize;	// Size of the chunked data (bytes)
+			uint32_t groupIndex;	// First entry in the group table
+			uint32_t groupCount;	// Number of groups
+			int type;		// RegionType
+			unsigned int part;	// Partition index (REGION_PARTITION only)
+		};
+
+		// Group table entry.
+		struct Group {
+			uint64_t offset;	// Offset in the file (bytes)
+			uint32_t size;		// Stored size (0 == all zeroes)
+			uint32_t packedSize;	// RVZ: Packed size (0 == not packed)
+			bool compressed;	// True if compressed
+		};
+
+		// Wii partition.
+		struct Partition {
+			uint8_t key[16];	// Decrypted title key
+			uint32_t firstSector;	// First sector of the partition data
+		};
+
+		// Hash exception.
+		struct HashException {
+			uint16_t list;		// Exception list index
+			uint16_t offset;	// Offset in the hash data
+			uint8_t hash[20];	// SHA-1 hash
+		};
+
+		// Decompressed chunk.
+		struct Chunk {
+			uint32_t groupIdx;	// Group table index (~0U == unused)
+			uint64_t lastUse;
+			std::vector<uint8_t> data;
+			std::vector<HashException> exceptions;
+		};
+
+		// Rebuilt Wii hash group. (64 encrypted sectors)
+		struct HashGroup {
+			uint64_t sector;	// First sector (~0ULL == unused)
+			uint64_t lastUse;
+			uint8_t *data;		// GROUP_SIZE_ENC bytes
+		};
+
+		/**
+		 * Read a table that's compressed using the disc compression method.
+		 * @param offset	[in] Offset in the file.
+		 * @param storedSize	[in] Stored size.
+		 * @param buf		[out] Decompressed table.
+		 * @param size		[in] Decompressed size.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int readTable(uint64_t offset, uint32_t storedSize, uint8_t *buf, size_t size);
+
+		/**
+		 * Get a decompressed chunk.
+		 * @param groupIdx	[in] Group table index.
+		 * @param size		[in] Decompressed size of the chunk.
+		 * @param dataOffset	[in] Offset of the chunk within the region's data. (for RVZ junk)
+		 * @param listCount	[in] Number of hash exception lists. (0 for raw data)
+		 * @return Chunk, or nullptr on error. (check errno)
+		 */
+		const Chunk *getChunk(uint32_t groupIdx, size_t size, uint64_t dataOffset, unsigned int listCount);
+
+		/**
+		 * Load a chunk from the file.
+		 * @param chunk		[out] Chunk.
+		 * @param group		[in] Group table entry.
+		 * @param size		[in] Decompressed size of the chunk.
+		 * @param dataOffset	[in] Offset of the chunk within the region's data. (for RVZ junk)
+		 * @param listCount	[in] Number of hash exception lists. (0 for raw data)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int loadChunk(Chunk *chunk, const Group &group, size_t size, uint64_t dataOffset, unsigned int listCount);
+
+		/**
+		 * Get a rebuilt Wii hash group.
+		 * @param part		[in] Partition index.
+		 * @param sector	[in] First sector of the hash group.
+		 * @return Encrypted hash group (GROUP_SIZE_ENC bytes), or nullptr on error. (check errno)
+		 */
+		const uint8_t *getHashGroup(unsigned int part, uint64_t sector);
+
+		/**
+		 * Read data from a region.
+		 * @param region	[in] Region.
+		 * @param buf		[out] Output buffer.
+		 * @param offset	[in] Disc offset. (must be within the region)
+		 * @param size		[in] Maximum number of bytes to read.
+		 * @return Number of bytes read, or 0 on error. (check errno)
+		 */
+		size_t readRegion(const Region &region, uint8_t *buf, uint64_t offset, size_t size);
+
+	private:
+		uint64_t m_fileOffset;		// Offset of the WIA header in the file
+		uint32_t m_fileLbaLen;		// Length of the WIA file window, in LBAs
+		bool m_isRvz;			// True for RVZ; false for WIA
+
+		uint32_t m_compression;		// Compression method
+		uint8_t m_comprProps[7];	// Compressor properties
+		uint8_t m_comprPropsLen;
+		uint32_t m_chunkSize;		// Chunk size (bytes)
+		uint8_t m_dhead[0x80];		// Disc header
+
+		std::vector<Region> m_regions;	// Sorted by start offset
+		std::vector<Group> m_groups;
+		std::vector<Partition> m_partitions;
+
+		// Caches.
+		std::vector<Chunk> m_chunkCache;
+		std::vector<HashGroup> m_hashGroupCache;
+		std::vector<uint8_t> m_groupBuf;	// Decrypted data for getHashGroup()
+		uint64_t m_useCounter;
+
+		struct _AesCtx *m_aesw;		// AES context for Wii partitions
+		int m_aeswPart;			// Partition whose key is set (-1 for none)
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_WIAREADER_HPP__ */
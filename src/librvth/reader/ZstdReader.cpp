@@ -0,0 +1,319 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ZstdReader.cpp: Zstandard seekable disc image reader class.             *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ZstdReader.hpp"
+#include "zstd_seekable.h"
+#include "byteswap.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Zstandard
+#include <zstd.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+using std::vector;
+
+/**
+ * Create a Zstandard seekable reader for a disc image.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ */
+ZstdReader::ZstdReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+	: super(file, lba_start, lba_len)
+	, m_fileOffset(LBA_TO_BYTES((uint64_t)lba_start))
+	, m_fileLbaLen(lba_len)
+	, m_dctx(nullptr)
+	, m_cacheIdx(~0U)
+{
+	int err = 0;
+	size_t size;
+	int64_t fileSize;
+	uint64_t tblOffset, c_offset, d_offset;
+	uint32_t n_frames, entrySize, max_c_size, max_d_size;
+	zstd_seek_footer_t footer;
+	zstd_skippable_header_t skip;
+	vector<uint8_t> tbl;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// The seek table is at the end of the file.
+	fileSize = m_file->size();
+	if (fileSize < 0) {
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+	if ((uint64_t)fileSize < m_fileOffset + sizeof(skip) + sizeof(footer)) {
+		// File is too small.
+		err = EIO;
+		goto fail;
+	}
+
+	size = m_file->preadAt(fileSize - sizeof(footer), &footer, sizeof(footer));
+	if (size != sizeof(footer)) {
+		// Short read.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+	n_frames = le32_to_cpu(footer.n_frames);
+	if (le32_to_cpu(footer.magic) != ZSTD_SEEKABLE_FOOTER_MAGIC ||
+	    (footer.descriptor & ZSTD_SEEKABLE_DESC_RESERVED) != 0 ||
+	    n_frames == 0)
+	{
+		// Not a valid seek table.
+		err = EIO;
+		goto fail;
+	}
+
+	// Read the seek table.
+	entrySize = sizeof(zstd_seek_entry_t) +
+		((footer.descriptor & ZSTD_SEEKABLE_DESC_CHECKSUM) ? sizeof(uint32_t) : 0);
+	if ((uint64_t)n_frames * entrySize + sizeof(skip) + sizeof(footer) >
+	    (uint64_t)fileSize - m_fileOffset)
+	{
+		// Seek table is larger than the file.
+		err = EIO;
+		goto fail;
+	}
+	tblOffset = fileSize - sizeof(footer) - ((uint64_t)n_frames * entrySize) - sizeof(skip);
+	size = m_file->preadAt(tblOffset, &skip, sizeof(skip));
+	if (size != sizeof(skip)) {
+		// Short read.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+	if (le32_to_cpu(skip.magic) != ZSTD_SEEKABLE_SKIPPABLE_MAGIC ||
+	    le32_to_cpu(skip.frame_size) != (uint64_t)n_frames * entrySize + sizeof(footer))
+	{
+		// Not a valid seek table.
+		err = EIO;
+		goto fail;
+	}
+
+	tbl.resize((size_t)n_frames * entrySize);
+	size = m_file->preadAt(tblOffset + sizeof(skip), tbl.data(), tbl.size());
+	if (size != tbl.size()) {
+		// Short read.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+
+	// Convert the seek table to absolute offsets.
+	m_frames.resize(n_frames);
+	c_offset = m_fileOffset;
+	d_offset = 0;
+	max_c_size = 0;
+	max_d_size = 0;
+	for (uint32_t i = 0; i < n_frames; i++) {
+		const zstd_seek_entry_t *const entry =
+			reinterpret_cast<const zstd_seek_entry_t*>(&tbl[(size_t)i * entrySize]);
+		Frame &frame = m_frames[i];
+		frame.c_offset = c_offset;
+		frame.d_offset = d_offset;
+		frame.c_size = le32_to_cpu(entry->c_size);
+		frame.d_size = le32_to_cpu(entry->d_size);
+		if (frame.d_size > ZSTD_SEEKABLE_MAX_FRAME_SIZE) {
+			// Frame is too large.
+			err = EIO;
+			goto fail;
+		}
+		c_offset += frame.c_size;
+		d_offset += frame.d_size;
+		max_c_size = std::max(max_c_size, frame.c_size);
+		max_d_size = std::max(max_d_size, frame.d_size);
+	}
+	if (c_offset != tblOffset) {
+		// Compressed frames don't end at the seek table.
+		err = EIO;
+		goto fail;
+	}
+	if (d_offset < LBA_SIZE || BYTES_TO_LBA(d_offset) > 0xFFFFFFFFULL) {
+		// Decompressed size is out of range.
+		err = EIO;
+		goto fail;
+	}
+
+	m_dctx = ZSTD_createDCtx();
+	if (!m_dctx) {
+		err = ENOMEM;
+		goto fail;
+	}
+	m_cbuf.resize(max_c_size);
+	m_cache.resize(max_d_size);
+
+	// Disc image is ready.
+	m_lba_start = 0;
+	m_lba_len = static_cast<uint32_t>(BYTES_TO_LBA(d_offset));
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+ZstdReader::~ZstdReader()
+{
+	ZSTD_freeDCtx(m_dctx);
+}
+
+/**
+ * Is a given disc image supported by the Zstandard reader?
+ * NOTE: This only checks the frame magic. The seek table
+ * is checked when the reader is created.
+ * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+ * @param size	[in] Size of sbuf. (should be 512 or larger)
+ * @return True if supported; false if not.
+ */
+bool ZstdReader::isSupported(const uint8_t *sbuf, size_t size)
+{
+	assert(size >= sizeof(uint32_t));
+	if (size < sizeof(uint32_t)) {
+		return false;
+	}
+
+	uint32_t magic;
+	memcpy(&magic, sbuf, sizeof(magic));
+	return (le32_to_cpu(magic) == ZSTD_SEEKABLE_FRAME_MAGIC);
+}
+
+/**
+ * Decompress a frame.
+ * @param frameIdx	[in] Frame index.
+ * @param buf		[out] Output buffer. (must be at least the frame's decompressed size)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ZstdReader::loadFrame(uint32_t frameIdx, uint8_t *buf)
+{
+	const Frame &frame = m_frames[frameIdx];
+	size_t size = m_file->preadAt(frame.c_offset, m_cbuf.data(), frame.c_size);
+	if (size != frame.c_size) {
+		// Short read.
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	size = ZSTD_decompressDCtx(m_dctx, buf, frame.d_size, m_cbuf.data(), frame.c_size);
+	if (ZSTD_isError(size) || size != frame.d_size) {
+		// Decompression error.
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t ZstdReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len || lba_start + lba_len < lba_start) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	uint64_t offset = LBA_TO_BYTES((uint64_t)m_lba_start + lba_start);
+	size_t size = LBA_TO_BYTES((size_t)lba_len);
+	while (size > 0) {
+		// Find the frame containing this offset.
+		auto iter = std::upper_bound(m_frames.begin(), m_frames.end(), offset,
+			[](uint64_t off, const Frame &frame) {
+				return off < frame.d_offset;
+			});
+		assert(iter != m_frames.begin());
+		const uint32_t frameIdx = static_cast<uint32_t>(iter - m_frames.begin() - 1);
+		const Frame &frame = m_frames[frameIdx];
+		const size_t frameOffset = static_cast<size_t>(offset - frame.d_offset);
+		const size_t len = std::min<size_t>(size, frame.d_size - frameOffset);
+
+		if (frameIdx == m_cacheIdx) {
+			// Frame is cached.
+			memcpy(ptr8, &m_cache[frameOffset], len);
+		} else if (frameOffset == 0 && len == frame.d_size) {
+			// Entire frame requested.
+			// Decompress it directly into the caller's buffer.
+			int ret = loadFrame(frameIdx, ptr8);
+			if (ret != 0) {
+				errno = -ret;
+				return 0;
+			}
+		} else {
+			// Partial frame. Decompress it into the cache.
+			m_cacheIdx = ~0U;
+			int ret = loadFrame(frameIdx, m_cache.data());
+			if (ret != 0) {
+				errno = -ret;
+				return 0;
+			}
+			m_cacheIdx = frameIdx;
+			memcpy(ptr8, &m_cache[frameOffset], len);
+		}
+
+		ptr8 += len;
+		offset += len;
+		size -= len;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Open another reader for the same disc image.
+ * Frames can then be decompressed on multiple threads.
+ * @return New Reader, or nullptr on error. (check errno)
+ */
+Reader *ZstdReader::reopen(void) const
+{
+	ZstdReader *const reader = new ZstdReader(m_file,
+		static_cast<uint32_t>(BYTES_TO_LBA(m_fileOffset)), m_fileLbaLen);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	if (m_lba_start != 0) {
+		// Keep the same LBA adjustment.
+		reader->lba_adjust(m_lba_start);
+	}
+	return reader;
+}
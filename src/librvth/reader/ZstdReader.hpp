@@ -0,0 +1,110 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ZstdReader.hpp: Zstandard seekable disc image reader class.             *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_ZSTDREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_ZSTDREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes.
+#include <vector>
+
+struct ZSTD_DCtx_s;
+
+/**
+ * Reader for disc images compressed using the Zstandard seekable format.
+ *
+ * The disc image is stored as a sequence of independent frames.
+ * The seek table at the end of the file is used to find the
+ * frame containing a given LBA, so only that frame needs to be
+ * decompressed. The most recently used frame is cached.
+ *
+ * The seek table must be at the end of the file, so this reader
+ * only supports standalone disc image files.
+ */
+class ZstdReader : public Reader
+{
+	public:
+		/**
+		 * Create a Zstandard seekable reader for a disc image.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		ZstdReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		virtual ~ZstdReader();
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(ZstdReader)
+
+	public:
+		/**
+		 * Is a given disc image supported by the Zstandard reader?
+		 * NOTE: This only checks the frame magic. The seek table
+		 * is checked when the reader is created.
+		 * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+		 * @param size	[in] Size of sbuf. (should be 512 or larger)
+		 * @return True if supported; false if not.
+		 */
+		static bool isSupported(const uint8_t *sbuf, size_t size);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Open another reader for the same disc image.
+		 * Frames can then be decompressed on multiple threads.
+		 * @return New Reader, or nullptr on error. (check errno)
+		 */
+		Reader *reopen(void) const final;
+
+	private:
+		/**
+		 * Decompress a frame.
+		 * @param frameIdx	[in] Frame index.
+		 * @param buf		[out] Output buffer. (must be at least the frame's decompressed size)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int loadFrame(uint32_t frameIdx, uint8_t *buf);
+
+	private:
+		uint64_t m_fileOffset;		// Offset of the first frame in the file
+		uint32_t m_fileLbaLen;		// Length of the file window, in LBAs
+
+		// Seek table entry.
+		struct Frame {
+			uint64_t c_offset;	// Offset in the file
+			uint64_t d_offset;	// Offset in the disc image
+			uint32_t c_size;	// Compressed size
+			uint32_t d_size;	// Decompressed size
+		};
+		std::vector<Frame> m_frames;	// Sorted by d_offset
+
+		struct ZSTD_DCtx_s *m_dctx;	// Decompression context
+
+		// Buffers.
+		std::vector<uint8_t> m_cbuf;	// Compressed frame
+		std::vector<uint8_t> m_cache;	// Most recently used frame
+		uint32_t m_cacheIdx;		// Frame in m_cache (~0U == none)
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_ZSTDREADER_HPP__ */
@@ -0,0 +1,318 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * io_backend.cpp: Disc image I/O backend selection.                       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+#include "io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+
+// C++ includes.
+#include <atomic>
+
+// Selected I/O backend.
+// Readers read these when they're created, so they're
+// atomic in case a backend is selected while other
+// threads are opening disc images.
+#ifdef HAVE_IO_URING
+static std::atomic<int> io_backend(RVTH_IO_BACKEND_URING);
+#else /* !HAVE_IO_URING */
+static std::atomic<int> io_backend(RVTH_IO_BACKEND_SYNC);
+#endif /* HAVE_IO_URING */
+static std::atomic<unsigned int> io_queue_depth(RVTH_IO_DEFAULT_QUEUE_DEPTH);
+static std::atomic<unsigned int> io_flags(0);
+static std::atomic<int> io_unbuffered(RVTH_IO_UNBUFFERED_AUTO);
+#ifdef HAVE_MMAP
+static std::atomic<bool> io_mmap(true);
+#else /* !HAVE_MMAP */
+static std::atomic<bool> io_mmap(false);
+#endif /* HAVE_MMAP */
+static std::atomic<bool> io_bank_cache(true);
+static std::atomic<unsigned int> io_block_cache_size(RVTH_IO_DEFAULT_BLOCK_CACHE_SIZE);
+static std::atomic<unsigned int> io_block_cache_count(RVTH_IO_DEFAULT_BLOCK_CACHE_COUNT);
+static std::atomic<bool> io_stream_hints(true);
+static std::atomic<long long> io_split_size(0);
+static std::atomic<int> zstd_level(RVTH_ZSTD_DEFAULT_LEVEL);
+static std::atomic<unsigned int> zstd_frame_size(RVTH_ZSTD_DEFAULT_FRAME_SIZE);
+
+/**
+ * Is the specified I/O backend supported by this build?
+ * NOTE: The io_uring backend may still be unavailable at runtime,
+ * e.g. on older kernels. Synchronous I/O is used in that case.
+ * @param backend I/O backend.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int rvth_io_backend_is_supported(RvtH_IO_Backend_e backend)
+{
+	switch (backend) {
+		case RVTH_IO_BACKEND_SYNC:
+			return 1;
+#ifdef HAVE_IO_URING
+		case RVTH_IO_BACKEND_URING:
+			return 1;
+#endif /* HAVE_IO_URING */
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Select the I/O backend.
+ * This affects Readers created after this function is called.
+ * @param backend	[in] I/O backend.
+ * @param queue_depth	[in] Number of requests in flight. (0 for default)
+ * @param flags		[in] Flags. (See RvtH_IO_Flags_e.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_backend(RvtH_IO_Backend_e backend, unsigned int queue_depth, unsigned int flags)
+{
+	if (!rvth_io_backend_is_supported(backend)) {
+		return -ENOTSUP;
+	} else if (queue_depth > 4096) {
+		return -EINVAL;
+	}
+
+	if (queue_depth == 0) {
+		queue_depth = RVTH_IO_DEFAULT_QUEUE_DEPTH;
+	}
+	io_queue_depth.store(queue_depth, std::memory_order_relaxed);
+	io_flags.store(flags, std::memory_order_relaxed);
+	io_backend.store(backend, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Get the selected I/O backend.
+ * @param p_queue_depth	[out,opt] Number of requests in flight.
+ * @param p_flags	[out,opt] Flags. (See RvtH_IO_Flags_e.)
+ * @return I/O backend.
+ */
+RvtH_IO_Backend_e rvth_io_get_backend(unsigned int *p_queue_depth, unsigned int *p_flags)
+{
+	if (p_queue_depth) {
+		*p_queue_depth = io_queue_depth.load(std::memory_order_relaxed);
+	}
+	if (p_flags) {
+		*p_flags = io_flags.load(std::memory_order_relaxed);
+	}
+	return static_cast<RvtH_IO_Backend_e>(io_backend.load(std::memory_order_relaxed));
+}
+
+/**
+ * Set the unbuffered write policy.
+ * This affects files opened after this function is called.
+ * @param policy Unbuffered write policy.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_unbuffered(RvtH_IO_Unbuffered_e policy)
+{
+	if (policy < RVTH_IO_UNBUFFERED_AUTO || policy >= RVTH_IO_UNBUFFERED_MAX) {
+		return -EINVAL;
+	}
+	io_unbuffered.store(policy, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Get the unbuffered write policy.
+ * @return Unbuffered write policy.
+ */
+RvtH_IO_Unbuffered_e rvth_io_get_unbuffered(void)
+{
+	return static_cast<RvtH_IO_Unbuffered_e>(io_unbuffered.load(std::memory_order_relaxed));
+}
+
+/**
+ * Enable or disable memory-mapped Readers.
+ * If enabled, plain disc image files that are opened read-only
+ * are memory-mapped instead of being read using positional I/O.
+ * This affects Readers created after this function is called.
+ * @param enable True (non-zero) to enable; false (0) to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_mmap(int enable)
+{
+#ifdef HAVE_MMAP
+	io_mmap.store(!!enable, std::memory_order_relaxed);
+	return 0;
+#else /* !HAVE_MMAP */
+	return (enable ? -ENOTSUP : 0);
+#endif /* HAVE_MMAP */
+}
+
+/**
+ * Are memory-mapped Readers enabled?
+ * @return True (non-zero) if enabled; false (0) if not.
+ */
+int rvth_io_get_mmap(void)
+{
+	return io_mmap.load(std::memory_order_relaxed);
+}
+
+/**
+ * Enable or disable the bank metadata cache.
+ * If enabled, the bank entries of RVT-H Readers and HDD images
+ * are saved in the user's cache directory, so they don't need
+ * to be read from the disk the next time it's opened.
+ * This affects RvtH objects opened after this function is called.
+ * @param enable True (non-zero) to enable; false (0) to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_bank_cache(int enable)
+{
+	io_bank_cache.store(!!enable, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Is the bank metadata cache enabled?
+ * @return True (non-zero) if enabled; false (0) if not.
+ */
+int rvth_io_get_bank_cache(void)
+{
+	return io_bank_cache.load(std::memory_order_relaxed);
+}
+
+/**
+ * Set the block cache settings for RVT-H Reader banks.
+ * Small reads, e.g. for the disc header and partition tables,
+ * read a whole block, and the most recently used blocks are kept
+ * in memory. Reads larger than one block bypass the cache.
+ * This affects Readers created after this function is called.
+ * @param block_size	[in] Block size, in bytes. (Multiple of 4 KB; 4 KB to 1 MB)
+ * @param block_count	[in] Maximum number of cached blocks per bank. (0 to disable)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_block_cache(unsigned int block_size, unsigned int block_count)
+{
+	if (block_size < 4096 || block_size > 1024U*1024U ||
+	    (block_size % 4096) != 0 || block_count > 1024)
+	{
+		return -EINVAL;
+	}
+
+	io_block_cache_size.store(block_size, std::memory_order_relaxed);
+	io_block_cache_count.store(block_count, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Get the block cache settings for RVT-H Reader banks.
+ * @param p_block_size	[out,opt] Block size, in bytes.
+ * @param p_block_count	[out,opt] Maximum number of cached blocks per bank. (0 if disabled)
+ */
+void rvth_io_get_block_cache(unsigned int *p_block_size, unsigned int *p_block_count)
+{
+	if (p_block_size) {
+		*p_block_size = io_block_cache_size.load(std::memory_order_relaxed);
+	}
+	if (p_block_count) {
+		*p_block_count = io_block_cache_count.load(std::memory_order_relaxed);
+	}
+}
+
+/**
+ * Enable or disable page cache hints for bulk transfers.
+ * If enabled, extraction and import sources are read ahead and
+ * dropped from the page cache once they've been copied, and
+ * destinations are written back and dropped as they're written.
+ * This affects transfers started after this function is called.
+ * @param enable True (non-zero) to enable; false (0) to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_stream_hints(int enable)
+{
+	io_stream_hints.store(!!enable, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Are page cache hints for bulk transfers enabled?
+ * @return True (non-zero) if enabled; false (0) if not.
+ */
+int rvth_io_get_stream_hints(void)
+{
+	return io_stream_hints.load(std::memory_order_relaxed);
+}
+
+/**
+ * Set the part size for newly-created disc image files.
+ * If set, new files are split into BASENAME.part0, BASENAME.part1,
+ * etc., e.g. for file systems that don't support files over 4 GB.
+ * This affects files created after this function is called.
+ * @param split_size Part size, in bytes. (Multiple of 4 KB; 0 to disable)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_split_size(long long split_size)
+{
+	if (split_size < 0 || (split_size % RVTH_IO_DIRECT_ALIGNMENT) != 0) {
+		return -EINVAL;
+	}
+	io_split_size.store(split_size, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Get the part size for newly-created disc image files.
+ * @return Part size, in bytes. (0 if disabled)
+ */
+long long rvth_io_get_split_size(void)
+{
+	return io_split_size.load(std::memory_order_relaxed);
+}
+
+/**
+ * Is Zstandard compression supported by this build?
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int rvth_zstd_is_supported(void)
+{
+#ifdef HAVE_ZSTD
+	return 1;
+#else /* !HAVE_ZSTD */
+	return 0;
+#endif /* HAVE_ZSTD */
+}
+
+/**
+ * Set the Zstandard compression settings for extracted images.
+ * This affects extractions started after this function is called.
+ * @param level		[in] Compression level. (1-22)
+ * @param frame_size	[in] Decompressed size of each seekable frame, in bytes.
+ *			(Multiple of 32 KB; 32 KB to 64 MB)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_zstd_set_params(int level, unsigned int frame_size)
+{
+	if (level < 1 || level > 22 ||
+	    frame_size < 32768 || frame_size > 64U*1024U*1024U ||
+	    (frame_size % 32768) != 0)
+	{
+		return -EINVAL;
+	}
+
+	zstd_level.store(level, std::memory_order_relaxed);
+	zstd_frame_size.store(frame_size, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * Get the Zstandard compression settings for extracted images.
+ * @param p_level	[out,opt] Compression level.
+ * @param p_frame_size	[out,opt] Decompressed size of each seekable frame, in bytes.
+ */
+void rvth_zstd_get_params(int *p_level, unsigned int *p_frame_size)
+{
+	if (p_level) {
+		*p_level = zstd_level.load(std::memory_order_relaxed);
+	}
+	if (p_frame_size) {
+		*p_frame_size = zstd_frame_size.load(std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,223 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * io_backend.h: Disc image I/O backend selection.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_IO_BACKEND_H__
+#define __RVTHTOOL_LIBRVTH_READER_IO_BACKEND_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * I/O backends for plain disc images and RVT-H Readers.
+ * Small requests always use synchronous I/O.
+ */
+typedef enum {
+	RVTH_IO_BACKEND_SYNC	= 0,	// Synchronous positional I/O
+	RVTH_IO_BACKEND_URING	= 1,	// Linux io_uring
+
+	RVTH_IO_BACKEND_MAX
+} RvtH_IO_Backend_e;
+
+// I/O backend flags.
+typedef enum {
+	// Use O_DIRECT for requests with aligned buffers.
+	// Only supported by the io_uring backend.
+	RVTH_IO_FLAG_DIRECT	= (1U << 0),
+} RvtH_IO_Flags_e;
+
+/**
+ * Unbuffered write policy.
+ * Unbuffered writes bypass the page cache, so writing a large
+ * amount of data doesn't flood memory, and write progress
+ * reflects the data that was actually submitted to the device.
+ */
+typedef enum {
+	RVTH_IO_UNBUFFERED_AUTO		= 0,	// RVT-H Reader devices only (default)
+	RVTH_IO_UNBUFFERED_ALWAYS	= 1,	// Devices and disc image files
+	RVTH_IO_UNBUFFERED_NEVER	= 2,	// Always use buffered writes
+
+	RVTH_IO_UNBUFFERED_MAX
+} RvtH_IO_Unbuffered_e;
+
+// Default number of requests in flight for asynchronous backends.
+#define RVTH_IO_DEFAULT_QUEUE_DEPTH 8
+
+// Buffer alignment required for O_DIRECT I/O.
+// (RVTH_IO_FLAG_DIRECT and unbuffered writes)
+#define RVTH_IO_DIRECT_ALIGNMENT 4096
+
+/**
+ * Is the specified I/O backend supported by this build?
+ * NOTE: The io_uring backend may still be unavailable at runtime,
+ * e.g. on older kernels. Synchronous I/O is used in that case.
+ * @param backend I/O backend.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int rvth_io_backend_is_supported(RvtH_IO_Backend_e backend);
+
+/**
+ * Select the I/O backend.
+ * This affects Readers created after this function is called.
+ * @param backend	[in] I/O backend.
+ * @param queue_depth	[in] Number of requests in flight. (0 for default)
+ * @param flags		[in] Flags. (See RvtH_IO_Flags_e.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_backend(RvtH_IO_Backend_e backend, unsigned int queue_depth, unsigned int flags);
+
+/**
+ * Get the selected I/O backend.
+ * @param p_queue_depth	[out,opt] Number of requests in flight.
+ * @param p_flags	[out,opt] Flags. (See RvtH_IO_Flags_e.)
+ * @return I/O backend.
+ */
+RvtH_IO_Backend_e rvth_io_get_backend(unsigned int *p_queue_depth, unsigned int *p_flags);
+
+/**
+ * Set the unbuffered write policy.
+ * This affects files opened after this function is called.
+ * @param policy Unbuffered write policy.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_unbuffered(RvtH_IO_Unbuffered_e policy);
+
+/**
+ * Get the unbuffered write policy.
+ * @return Unbuffered write policy.
+ */
+RvtH_IO_Unbuffered_e rvth_io_get_unbuffered(void);
+
+/**
+ * Enable or disable memory-mapped Readers.
+ * If enabled, plain disc image files that are opened read-only
+ * are memory-mapped instead of being read using positional I/O.
+ * RVT-H Reader devices are never memory-mapped.
+ * This affects Readers created after this function is called.
+ * @param enable True (non-zero) to enable; false (0) to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_mmap(int enable);
+
+/**
+ * Are memory-mapped Readers enabled?
+ * @return True (non-zero) if enabled; false (0) if not.
+ */
+int rvth_io_get_mmap(void);
+
+/**
+ * Enable or disable the bank metadata cache.
+ * If enabled, the bank entries of RVT-H Readers and HDD images
+ * are saved in the user's cache directory, so they don't need
+ * to be read from the disk the next time it's opened.
+ * This affects RvtH objects opened after this function is called.
+ * @param enable True (non-zero) to enable; false (0) to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_bank_cache(int enable);
+
+/**
+ * Is the bank metadata cache enabled?
+ * @return True (non-zero) if enabled; false (0) if not.
+ */
+int rvth_io_get_bank_cache(void);
+
+// Default block cache settings for RVT-H Reader banks.
+// 16 blocks of 32 KB covers the disc header, partition table,
+// region setting, and game partition header of a typical bank.
+#define RVTH_IO_DEFAULT_BLOCK_CACHE_SIZE	(32U*1024U)
+#define RVTH_IO_DEFAULT_BLOCK_CACHE_COUNT	16
+
+/**
+ * Set the block cache settings for RVT-H Reader banks.
+ * Small reads, e.g. for the disc header and partition tables,
+ * read a whole block, and the most recently used blocks are kept
+ * in memory. Reads larger than one block bypass the cache.
+ * This affects Readers created after this function is called.
+ * @param block_size	[in] Block size, in bytes. (Multiple of 4 KB; 4 KB to 1 MB)
+ * @param block_count	[in] Maximum number of cached blocks per bank. (0 to disable)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_block_cache(unsigned int block_size, unsigned int block_count);
+
+/**
+ * Get the block cache settings for RVT-H Reader banks.
+ * @param p_block_size	[out,opt] Block size, in bytes.
+ * @param p_block_count	[out,opt] Maximum number of cached blocks per bank. (0 if disabled)
+ */
+void rvth_io_get_block_cache(unsigned int *p_block_size, unsigned int *p_block_count);
+
+/**
+ * Enable or disable page cache hints for bulk transfers.
+ * If enabled, extraction and import sources are read ahead and
+ * dropped from the page cache once they've been copied, and
+ * destinations are written back and dropped as they're written.
+ * This affects transfers started after this function is called.
+ * @param enable True (non-zero) to enable; false (0) to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_stream_hints(int enable);
+
+/**
+ * Are page cache hints for bulk transfers enabled?
+ * @return True (non-zero) if enabled; false (0) if not.
+ */
+int rvth_io_get_stream_hints(void);
+
+// Maximum part size for FAT32 file systems. (4 GB minus 1 MB)
+#define RVTH_IO_SPLIT_SIZE_FAT32	(4095LL*1024LL*1024LL)
+
+/**
+ * Set the part size for newly-created disc image files.
+ * If set, new files are split into BASENAME.part0, BASENAME.part1,
+ * etc., e.g. for file systems that don't support files over 4 GB.
+ * This affects files created after this function is called.
+ * @param split_size Part size, in bytes. (Multiple of 4 KB; 0 to disable)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_io_set_split_size(long long split_size);
+
+/**
+ * Get the part size for newly-created disc image files.
+ * @return Part size, in bytes. (0 if disabled)
+ */
+long long rvth_io_get_split_size(void);
+
+// Default Zstandard settings for extracted images.
+// Each 2 MB frame matches a Wii partition hash group.
+#define RVTH_ZSTD_DEFAULT_LEVEL		3
+#define RVTH_ZSTD_DEFAULT_FRAME_SIZE	(2U*1024U*1024U)
+
+/**
+ * Is Zstandard compression supported by this build?
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int rvth_zstd_is_supported(void);
+
+/**
+ * Set the Zstandard compression settings for extracted images.
+ * This affects extractions started after this function is called.
+ * @param level		[in] Compression level. (1-22)
+ * @param frame_size	[in] Decompressed size of each seekable frame, in bytes.
+ *			(Multiple of 32 KB; 32 KB to 64 MB)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_zstd_set_params(int level, unsigned int frame_size);
+
+/**
+ * Get the Zstandard compression settings for extracted images.
+ * @param p_level	[out,opt] Compression level.
+ * @param p_frame_size	[out,opt] Decompressed size of each seekable frame, in bytes.
+ */
+void rvth_zstd_get_params(int *p_level, unsigned int *p_frame_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_IO_BACKEND_H__ */
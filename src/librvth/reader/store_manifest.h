@@ -0,0 +1,69 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * store_manifest.h: Chunk store manifest structs.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_STORE_MANIFEST_H__
+#define __RVTHTOOL_LIBRVTH_READER_STORE_MANIFEST_H__
+
+#include <stdint.h>
+#include "libwiicrypto/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Chunk store manifest.
+ *
+ * A manifest describes one disc image stored in a chunk store.
+ * The disc image is split into fixed-size chunks, and each chunk
+ * is stored once in the store, named after its digest.
+ *
+ * The first chunk may be shorter than the others, so the rest
+ * of the chunks can be aligned to the game partition's groups.
+ * The last chunk may also be shorter than the others.
+ *
+ * The header is followed by one digest per chunk. Chunks that
+ * are all zeroes aren't stored; their digests are all zeroes.
+ *
+ * All fields are little-endian.
+ */
+
+// Manifest magic.
+#define STORE_MANIFEST_MAGIC		"RVTHSTM1"
+
+// Hash algorithms.
+#define STORE_HASH_SHA1			0	// SHA-1 (20 bytes)
+
+// Maximum chunk size.
+#define STORE_MAX_CHUNK_SIZE		(8U*1024U*1024U)
+
+#pragma pack(1)
+
+/**
+ * Manifest header.
+ */
+typedef struct PACKED _store_manifest_header_t {
+	char magic[8];		// STORE_MANIFEST_MAGIC
+	uint32_t header_size;	// sizeof(store_manifest_header_t)
+	uint32_t chunk_size;	// Chunk size, in bytes (multiple of LBA_SIZE)
+	uint32_t lba_len;	// Length of the disc image, in LBAs
+	uint32_t first_lba_len;	// Length of the first chunk, in LBAs
+	uint32_t chunk_count;	// Number of chunks
+	uint8_t hash_type;	// Hash algorithm (STORE_HASH_*)
+	uint8_t digest_size;	// Size of each digest, in bytes
+	uint8_t reserved[2];
+} store_manifest_header_t;
+ASSERT_STRUCT(store_manifest_header_t, 32);
+
+#pragma pack()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_STORE_MANIFEST_H__ */
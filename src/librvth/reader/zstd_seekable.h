@@ -0,0 +1,85 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zstd_seekable.h: Zstandard seekable format structs.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_ZSTD_SEEKABLE_H__
+#define __RVTHTOOL_LIBRVTH_READER_ZSTD_SEEKABLE_H__
+
+#include <stdint.h>
+#include "libwiicrypto/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Zstandard seekable format.
+ * Reference: zstd/contrib/seekable_format/zstd_seekable_compression_format.md
+ *
+ * The disc image is compressed as a sequence of independent
+ * Zstandard frames, followed by a skippable frame containing
+ * the seek table. The seek table is at the end of the file.
+ *
+ * All fields are little-endian.
+ */
+
+// Zstandard frame magic.
+#define ZSTD_SEEKABLE_FRAME_MAGIC	0xFD2FB528U
+
+// Skippable frame magic for the seek table.
+#define ZSTD_SEEKABLE_SKIPPABLE_MAGIC	0x184D2A5EU
+
+// Seek table footer magic.
+#define ZSTD_SEEKABLE_FOOTER_MAGIC	0x8F92EAB1U
+
+// Maximum decompressed size of a single frame.
+#define ZSTD_SEEKABLE_MAX_FRAME_SIZE	0x40000000U
+
+#pragma pack(1)
+
+/**
+ * Skippable frame header.
+ */
+typedef struct PACKED _zstd_skippable_header_t {
+	uint32_t magic;		// ZSTD_SEEKABLE_SKIPPABLE_MAGIC
+	uint32_t frame_size;	// Size of the frame contents
+} zstd_skippable_header_t;
+ASSERT_STRUCT(zstd_skippable_header_t, 8);
+
+/**
+ * Seek table entry.
+ * If the checksum flag is set, each entry is followed
+ * by a 32-bit checksum. (XXH64, lower 32 bits)
+ */
+typedef struct PACKED _zstd_seek_entry_t {
+	uint32_t c_size;	// Compressed size
+	uint32_t d_size;	// Decompressed size
+} zstd_seek_entry_t;
+ASSERT_STRUCT(zstd_seek_entry_t, 8);
+
+// Seek table descriptor bits.
+#define ZSTD_SEEKABLE_DESC_CHECKSUM	0x80	// Entries have checksums
+#define ZSTD_SEEKABLE_DESC_RESERVED	0x7C	// Must be 0
+
+/**
+ * Seek table footer.
+ * This is the last 9 bytes of the file.
+ */
+typedef struct PACKED _zstd_seek_footer_t {
+	uint32_t n_frames;	// Number of frames
+	uint8_t descriptor;	// Seek table descriptor
+	uint32_t magic;		// ZSTD_SEEKABLE_FOOTER_MAGIC
+} zstd_seek_footer_t;
+ASSERT_STRUCT(zstd_seek_footer_t, 9);
+
+#pragma pack()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_ZSTD_SEEKABLE_H__ */
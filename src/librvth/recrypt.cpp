@@ -370,6 +370,9 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 	}
 
 	// Check the bank type.
+	// NOTE: The signature status is updated below, so the
+	// deferred fields must be initialized before that.
+	loadBankDetails(bank);
 	RvtH_BankEntry *const entry = &m_entries[bank];
 	switch (entry->type) {
 		case RVTH_BankType_Wii_SL:
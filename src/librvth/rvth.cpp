@@ -26,6 +26,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+// C++ includes.
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+using std::atomic;
+using std::thread;
+using std::vector;
+
+// Maximum number of threads for initializing bank entries.
+// Bank initialization is limited by I/O latency, not CPU,
+// so this doesn't depend on the number of CPUs.
+static const unsigned int BANK_INIT_THREADS_MAX = 8;
+
 /**
  * Open a Wii or GameCube disc image.
  * @param f_img	[in] RefFile*
@@ -50,21 +64,8 @@ int RvtH::openGcm(RefFile *f_img)
 	// Get the file length.
 	// FIXME: This is obtained in rvth_open().
 	// Pass it as a parameter?
-	ret = f_img->seeko(0, SEEK_END);
-	if (ret != 0) {
-		// Seek error.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		ret = -err;
-		goto fail;
-	}
-	len = f_img->tello();
-
-	// Rewind back to the beginning of the file.
-	ret = f_img->seeko(0, SEEK_SET);
-	if (ret != 0) {
+	len = f_img->size();
+	if (len < 0) {
 		// Seek error.
 		err = errno;
 		if (err == 0) {
@@ -140,8 +141,9 @@ int RvtH::openGcm(RefFile *f_img)
 		rvth_init_BankEntry_region(entry);
 		// Initialize the encryption status.
 		rvth_init_BankEntry_crypto(entry);
-		// Initialize the AppLoader error status.
-		rvth_init_BankEntry_AppLoader(entry);
+
+		// NOTE: The signature status and AppLoader error status
+		// are initialized by loadBankDetails().
 	}
 
 	// Disc image loaded.
@@ -176,7 +178,7 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 	*pGPT = false;
 
 	// Read LBA 0.
-	size_t size = f_img->seekoAndRead(LBA_TO_BYTES(0), SEEK_SET, sector_buffer, 1, sizeof(sector_buffer));
+	size_t size = f_img->preadAt(LBA_TO_BYTES(0), sector_buffer, sizeof(sector_buffer));
 	if (size != sizeof(sector_buffer)) {
 		// Short read.
 		int err = errno;
@@ -207,7 +209,7 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 	// the drive's sector size. We'll check both.
 
 	// Check 512. (512-byte sectors)
-	size = f_img->seekoAndRead(512, SEEK_SET, sector_buffer, 1, sizeof(sector_buffer));
+	size = f_img->preadAt(512, sector_buffer, sizeof(sector_buffer));
 	if (size != sizeof(sector_buffer)) {
 		// Short read.
 		int err = errno;
@@ -224,7 +226,7 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 	}
 
 	// Check 4096. (4k sectors)
-	size = f_img->seekoAndRead(4096, SEEK_SET, sector_buffer, 1, sizeof(sector_buffer));
+	size = f_img->preadAt(4096, sector_buffer, sizeof(sector_buffer));
 	if (size != sizeof(sector_buffer)) {
 		// Short read.
 		int err = errno;
@@ -243,6 +245,162 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 	return 0;
 }
 
+/**
+ * Initialize the bank entries for an RVT-H disk image.
+ *
+ * Each bank requires several small reads from different parts
+ * of the disk, so the banks are initialized using multiple
+ * threads in order to reduce the total I/O latency.
+ *
+ * m_entries must have already been allocated.
+ *
+ * @param f_img		[in] RefFile*
+ * @param nhcd_entries	[in,opt] NHCD bank table entries. (m_bankCount entries)
+ *			If NULL, use the default bank table.
+ */
+void RvtH::initBankEntries(RefFile *f_img, const NHCD_BankEntry *nhcd_entries)
+{
+	// Bank entry parameters from the bank table.
+	struct BankParams {
+		uint32_t lba_start;
+		uint32_t lba_len;
+		uint8_t type;
+		bool serial;	// If true, initialize after the other banks.
+		const char *timestamp;
+	};
+	vector<BankParams> params(m_bankCount);
+
+	for (unsigned int i = 0; i < m_bankCount; i++) {
+		BankParams &bp = params[i];
+		bp.serial = false;
+
+		if (!nhcd_entries) {
+			// Default bank table.
+			// Use "Empty" so we can try to detect the actual bank type.
+			bp.type = RVTH_BankType_Empty;
+			bp.lba_start = NHCD_BANK_START_LBA(i, m_bankCount);
+			bp.lba_len = NHCD_BANK_SIZE_LBA;
+			bp.timestamp = nullptr;
+			continue;
+		}
+
+		const NHCD_BankEntry *const nhcd_entry = &nhcd_entries[i];
+		uint32_t lba_start = 0, lba_len = 0;
+		uint8_t type;
+
+		// Check the type.
+		switch (be32_to_cpu(nhcd_entry->type)) {
+			default:
+				// Unknown bank type...
+				type = RVTH_BankType_Unknown;
+				break;
+			case NHCD_BankType_Empty:
+				// "Empty" bank. May have a deleted image.
+				type = RVTH_BankType_Empty;
+				break;
+			case NHCD_BankType_GCN:
+				// GameCube
+				type = RVTH_BankType_GCN;
+				break;
+			case NHCD_BankType_Wii_SL:
+				// Wii (single-layer)
+				type = RVTH_BankType_Wii_SL;
+				break;
+			case NHCD_BankType_Wii_DL:
+				// Wii (dual-layer)
+				// TODO: Cannot start in Bank 8.
+				type = RVTH_BankType_Wii_DL;
+				break;
+		}
+
+		// For valid types, use the listed LBAs if they're non-zero.
+		if (type >= RVTH_BankType_GCN) {
+			lba_start = be32_to_cpu(nhcd_entry->lba_start);
+			lba_len = be32_to_cpu(nhcd_entry->lba_len);
+		}
+
+		if (lba_start == 0 || lba_len == 0) {
+			// Invalid LBAs. Use the default starting offset.
+			// Bank size will be determined by rvth_init_BankEntry().
+			lba_start = NHCD_BANK_START_LBA(i, m_bankCount);
+			lba_len = 0;
+		}
+
+		bp.type = type;
+		bp.lba_start = lba_start;
+		bp.lba_len = lba_len;
+		bp.timestamp = nhcd_entry->timestamp;
+
+		// If the previous bank is dual-layer, this bank is most
+		// likely the second half of it. That depends on the
+		// previous bank's final type, so wait for it.
+		bp.serial = (i > 0 && params[i-1].type == RVTH_BankType_Wii_DL);
+	}
+
+	// Initialize the banks using a pool of threads.
+	vector<unsigned int> banks;
+	banks.reserve(m_bankCount);
+	for (unsigned int i = 0; i < m_bankCount; i++) {
+		if (!params[i].serial) {
+			banks.push_back(i);
+		}
+	}
+
+	atomic<unsigned int> next(0);
+	auto initFn = [this, f_img, &params, &banks, &next]() {
+		unsigned int idx;
+		while ((idx = next.fetch_add(1)) < banks.size()) {
+			const unsigned int bank = banks[idx];
+			const BankParams &bp = params[bank];
+			rvth_init_BankEntry(&m_entries[bank], f_img, bp.type,
+				bp.lba_start, bp.lba_len, bp.timestamp);
+		}
+	};
+
+	const unsigned int threadCount = std::min(
+		static_cast<unsigned int>(banks.size()), BANK_INIT_THREADS_MAX);
+	vector<thread> threads;
+	threads.reserve(threadCount);
+	for (unsigned int i = 1; i < threadCount; i++) {
+		threads.emplace_back(initFn);
+	}
+	// Use this thread, too.
+	initFn();
+	for (thread &t : threads) {
+		t.join();
+	}
+
+	if (!nhcd_entries) {
+		// Default bank table. No dual-layer handling.
+		return;
+	}
+
+	// Handle dual-layer images.
+	RvtH_BankEntry *rvth_entry = m_entries;
+	for (unsigned int i = 0; i < m_bankCount; i++, rvth_entry++) {
+		if (i > 0 && (rvth_entry-1)->type == RVTH_BankType_Wii_DL) {
+			// Second bank for a dual-layer Wii image.
+			if (!params[i].serial) {
+				// Previous bank was detected as dual-layer,
+				// but the bank table says otherwise.
+				delete rvth_entry->reader;
+				free(rvth_entry->ptbl);
+			}
+			memset(rvth_entry, 0, sizeof(*rvth_entry));
+			rvth_entry->type = RVTH_BankType_Wii_DL_Bank2;
+			rvth_entry->timestamp = -1;
+			continue;
+		}
+
+		if (params[i].serial) {
+			// Previous bank is not dual-layer after all.
+			const BankParams &bp = params[i];
+			rvth_init_BankEntry(rvth_entry, f_img, bp.type,
+				bp.lba_start, bp.lba_len, bp.timestamp);
+		}
+	}
+}
+
 /**
  * Open an RVT-H disk image.
  * @param f_img	[in] RefFile*
@@ -250,19 +408,34 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
  */
 int RvtH::openHDD(RefFile *f_img)
 {
-	NHCD_BankTable_Header nhcd_header;
-	RvtH_BankEntry *rvth_entry;
+	// Bank table, including extended bank table entries.
+	// The entire bank table is read at once to avoid
+	// a separate read request for each bank.
+	struct NHCD_BankTable_Max {
+		NHCD_BankTable_Header header;
+		NHCD_BankEntry entries[NHCD_BANK_COUNT_MAX];
+	};
+	NHCD_BankTable_Max *nhcd_table;
 	int ret = 0;	// errno or RvtH_Errors
 	int err = 0;	// errno setting
 
-	unsigned int i;
-	int64_t addr;
 	size_t size;
 
-	// Check the bank table header.
-	size = f_img->seekoAndRead(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA), SEEK_SET,
-		&nhcd_header, 1, sizeof(nhcd_header));
-	if (size != sizeof(nhcd_header)) {
+	nhcd_table = static_cast<NHCD_BankTable_Max*>(malloc(sizeof(*nhcd_table)));
+	if (!nhcd_table) {
+		// Error allocating memory.
+		err = ENOMEM;
+		ret = -err;
+		goto fail;
+	}
+
+	// Read the bank table.
+	// NOTE: Only the entries for the actual bank count
+	// are required. This is checked below.
+	errno = 0;
+	size = f_img->preadAt(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA),
+		nhcd_table, sizeof(*nhcd_table));
+	if (size < sizeof(nhcd_table->header)) {
 		// Short read.
 		err = errno;
 		if (err == 0) {
@@ -278,14 +451,13 @@ int RvtH::openHDD(RefFile *f_img)
 		: RVTH_ImageType_HDD_Image);
 
 	// Check the magic number.
-	if (nhcd_header.magic == be32_to_cpu(NHCD_BANKTABLE_MAGIC)) {
+	if (nhcd_table->header.magic == be32_to_cpu(NHCD_BANKTABLE_MAGIC)) {
 		// Magic number is correct.
 		m_NHCD_status = NHCD_STATUS_OK;
 	} else {
 		// Incorrect magic number.
 		// We'll continue with a default bank table.
 		// HDD will be non-writable.
-		uint32_t lba_start;
 
 		// Check for MBR or GPT for better error reporting.
 		bool hasMBR = false, hasGPT = false;
@@ -317,22 +489,19 @@ int RvtH::openHDD(RefFile *f_img)
 		}
 
 		m_file = f_img->ref();
-		rvth_entry = m_entries;
-		lba_start = NHCD_BANK_START_LBA(0, 8);
-		for (i = 0; i < m_bankCount; i++, rvth_entry++, lba_start += NHCD_BANK_SIZE_LBA) {
-			// Use "Empty" so we can try to detect the actual bank type.
-			rvth_init_BankEntry(rvth_entry, f_img,
-				RVTH_BankType_Empty,
-				lba_start, NHCD_BANK_SIZE_LBA, 0);
+		if (loadBankCache(f_img, &nhcd_table->header, sizeof(nhcd_table->header)) != 0) {
+			// Not cached. Initialize the bank entries.
+			initBankEntries(f_img, nullptr);
 		}
 
 		// RVT-H image loaded.
+		free(nhcd_table);
 		return RVTH_ERROR_SUCCESS;
 	}
 
 	// Get the bank count.
-	m_bankCount = be32_to_cpu(nhcd_header.bank_count);
-	if (m_bankCount < 8 || m_bankCount > 32) {
+	m_bankCount = be32_to_cpu(nhcd_table->header.bank_count);
+	if (m_bankCount < 8 || m_bankCount > NHCD_BANK_COUNT_MAX) {
 		// Bank count is either too small or too large.
 		// RVT-H systems are set to 8 banks at the factory,
 		// but we're supporting up to 32 in case the user
@@ -344,6 +513,11 @@ int RvtH::openHDD(RefFile *f_img)
 		}
 		ret = -err;
 		goto fail;
+	} else if (size < sizeof(nhcd_table->header) + (m_bankCount * sizeof(NHCD_BankEntry))) {
+		// Short read. Some bank entries are missing.
+		err = EIO;
+		ret = -err;
+		goto fail;
 	}
 
 	// Allocate memory for the 8 RvtH_BankEntry objects.
@@ -359,89 +533,20 @@ int RvtH::openHDD(RefFile *f_img)
 	};
 
 	m_file = f_img->ref();
-	rvth_entry = m_entries;
-	addr = (uint32_t)(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA) + NHCD_BLOCK_SIZE);
-	for (i = 0; i < m_bankCount; i++, rvth_entry++, addr += 512) {
-		NHCD_BankEntry nhcd_entry;
-		uint32_t lba_start = 0, lba_len = 0;
-		uint8_t type = RVTH_BankType_Unknown;
-
-		if (i > 0 && (rvth_entry-1)->type == RVTH_BankType_Wii_DL) {
-			// Second bank for a dual-layer Wii image.
-			rvth_entry->type = RVTH_BankType_Wii_DL_Bank2;
-			rvth_entry->timestamp = -1;
-			continue;
-		}
-
-		ret = f_img->seeko(addr, SEEK_SET);
-		if (ret != 0) {
-			// Seek error.
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			ret = -err;
-			goto fail;
-		}
-		size = f_img->read(&nhcd_entry, 1, sizeof(nhcd_entry));
-		if (size != sizeof(nhcd_entry)) {
-			// Short read.
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			ret = -err;
-			goto fail;
-		}
-
-		// Check the type.
-		switch (be32_to_cpu(nhcd_entry.type)) {
-			default:
-				// Unknown bank type...
-				type = RVTH_BankType_Unknown;
-				break;
-			case NHCD_BankType_Empty:
-				// "Empty" bank. May have a deleted image.
-				type = RVTH_BankType_Empty;
-				break;
-			case NHCD_BankType_GCN:
-				// GameCube
-				type = RVTH_BankType_GCN;
-				break;
-			case NHCD_BankType_Wii_SL:
-				// Wii (single-layer)
-				type = RVTH_BankType_Wii_SL;
-				break;
-			case NHCD_BankType_Wii_DL:
-				// Wii (dual-layer)
-				// TODO: Cannot start in Bank 8.
-				type = RVTH_BankType_Wii_DL;
-				break;
-		}
-
-		// For valid types, use the listed LBAs if they're non-zero.
-		if (type >= RVTH_BankType_GCN) {
-			lba_start = be32_to_cpu(nhcd_entry.lba_start);
-			lba_len = be32_to_cpu(nhcd_entry.lba_len);
-		}
-
-		if (lba_start == 0 || lba_len == 0) {
-			// Invalid LBAs. Use the default starting offset.
-			// Bank size will be determined by rvth_init_BankEntry().
-			lba_start = NHCD_BANK_START_LBA(i, m_bankCount);
-			lba_len = 0;
-		}
-
-		// Initialize the bank entry.
-		rvth_init_BankEntry(rvth_entry, f_img, type,
-			lba_start, lba_len, nhcd_entry.timestamp);
+	if (loadBankCache(f_img, nhcd_table,
+		sizeof(nhcd_table->header) + (m_bankCount * sizeof(NHCD_BankEntry))) != 0)
+	{
+		// Not cached. Initialize the bank entries.
+		initBankEntries(f_img, nhcd_table->entries);
 	}
 
 	// RVT-H image loaded.
+	free(nhcd_table);
 	return RVTH_ERROR_SUCCESS;
 
 fail:
 	// Failed to open the HDD image.
+	free(nhcd_table);
 	if (m_file) {
 		m_file->unref();
 		m_file = nullptr;
@@ -463,6 +568,9 @@ RvtH::RvtH(const TCHAR *filename, int *pErr)
 	, m_imageType(RVTH_ImageType_Unknown)
 	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
 	, m_entries(nullptr)
+	, m_bankDetailsLoaded(0)
+	, m_bankCacheHit(false)
+	, m_bankCacheDetails(0)
 {
 	// Open the disk image.
 	RefFile *const f_img = new RefFile(filename);
@@ -511,6 +619,11 @@ RvtH::RvtH(const TCHAR *filename, int *pErr)
 
 RvtH::~RvtH()
 {
+	// Save the bank entries to the bank metadata cache.
+	if (m_file) {
+		saveBankCache();
+	}
+
 	// Close all bank entry files.
 	// RefFile has a reference count, so we have to clear the count.
 	for (unsigned int i = 0; i < m_bankCount; i++) {
@@ -564,5 +677,33 @@ const RvtH_BankEntry *RvtH::bankEntry(unsigned int bank, int *pErr) const
 		return nullptr;
 	}
 
+	if (!(m_bankDetailsLoaded.load() & (1U << bank))) {
+		// Initialize the deferred fields.
+		loadBankDetails(bank);
+	}
 	return &m_entries[bank];
 }
+
+/**
+ * Initialize the deferred fields of a bank entry
+ * if they haven't been initialized yet.
+ *
+ * The signature status and AppLoader error status aren't
+ * needed to identify the bank, so they're initialized when
+ * the bank entry is first requested.
+ *
+ * @param bank	[in] Bank number. (0-7)
+ */
+void RvtH::loadBankDetails(unsigned int bank) const
+{
+	assert(bank < m_bankCount);
+
+	std::lock_guard<std::mutex> lock(m_bankDetailsMutex);
+	if (m_bankDetailsLoaded.load() & (1U << bank)) {
+		// Another thread initialized the fields.
+		return;
+	}
+
+	rvth_init_BankEntry_details(&m_entries[bank]);
+	m_bankDetailsLoaded.fetch_or(1U << bank);
+}
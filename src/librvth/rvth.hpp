@@ -87,6 +87,23 @@ typedef struct _RvtH_BankEntry {
 	struct _pt_entry_t *ptbl;	// Partition table.
 } RvtH_BankEntry;
 
+// Wii partition verification result.
+typedef struct _RvtH_Verify_Result {
+	uint32_t type;		// Partition type.
+	uint8_t vg;		// Volume group number.
+	uint8_t pt;		// Partition number.
+	uint8_t status;		// Verification status. (See RvtH_Verify_Status_e.)
+	uint8_t bad_level;	// Hash level that failed for bad_sector. (See RvtH_Verify_Level_e.)
+	bool tmd_ok;		// True if the H3 table matches the TMD content hash.
+	int err;		// Error code if status == RVTH_VERIFY_STATUS_ERROR.
+
+	uint32_t sector_count;		// Number of 32 KB sectors verified.
+	uint32_t bad_sector_count;	// Number of sectors with invalid hashes.
+	uint32_t bad_group;		// First group with an invalid hash. (UINT32_MAX if none)
+	uint32_t bad_sector;		// First sector with an invalid hash, relative to
+					// the start of the partition data. (UINT32_MAX if none)
+} RvtH_Verify_Result;
+
 /** Progress callback for write functions **/
 
 // Progress callback type.
@@ -95,6 +112,7 @@ typedef enum {
 	RVTH_PROGRESS_EXTRACT,		// Extract image
 	RVTH_PROGRESS_IMPORT,		// Import image
 	RVTH_PROGRESS_RECRYPT,		// Recrypt image
+	RVTH_PROGRESS_VERIFY,		// Verify image
 } RvtH_Progress_Type;
 
 // Progress callback status.
@@ -133,6 +151,11 @@ typedef bool (*RvtH_Progress_Callback)(const RvtH_Progress_State *state, void *u
 
 #ifdef __cplusplus
 
+// C++ includes.
+#include <atomic>
+#include <mutex>
+#include <string>
+
 /** Main class **/
 
 class RvtH {
@@ -158,8 +181,10 @@ class RvtH {
 		 * @param filename	[in] Filename.
 		 * @param lba_len	[in] LBA length. (Will NOT be allocated initially.)
 		 * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @param format	[in,opt] Disc image format.
 		 */
-		RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr = nullptr);
+		RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr = nullptr,
+			RvtH_ImageFormat_e format = RVTH_ImageFormat_GCM);
 
 		~RvtH();
 
@@ -189,6 +214,48 @@ class RvtH {
 		 */
 		int openHDD(RefFile *f_img);
 
+		/**
+		 * Initialize the bank entries for an RVT-H disk image.
+		 *
+		 * Each bank requires several small reads from different parts
+		 * of the disk, so the banks are initialized using multiple
+		 * threads in order to reduce the total I/O latency.
+		 *
+		 * m_entries must have already been allocated.
+		 *
+		 * @param f_img		[in] RefFile*
+		 * @param nhcd_entries	[in,opt] NHCD bank table entries. (m_bankCount entries)
+		 *			If NULL, use the default bank table.
+		 */
+		void initBankEntries(RefFile *f_img, const NHCD_BankEntry *nhcd_entries);
+
+		/**
+		 * Initialize the deferred fields of a bank entry
+		 * if they haven't been initialized yet.
+		 *
+		 * The signature status and AppLoader error status aren't
+		 * needed to identify the bank, so they're initialized when
+		 * the bank entry is first requested.
+		 *
+		 * @param bank	[in] Bank number. (0-7)
+		 */
+		void loadBankDetails(unsigned int bank) const;
+
+		/**
+		 * Mark the deferred fields of a bank entry as initialized.
+		 * This is used if the fields were set directly.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @param loaded	[in] If false, the fields will be reinitialized when needed.
+		 */
+		inline void setBankDetailsLoaded(unsigned int bank, bool loaded)
+		{
+			if (loaded) {
+				m_bankDetailsLoaded.fetch_or(1U << bank);
+			} else {
+				m_bankDetailsLoaded.fetch_and(~(1U << bank));
+			}
+		}
+
 	public:
 		/** General utility functions. **/
 		// TODO: Move out of RvtH?
@@ -200,6 +267,39 @@ class RvtH {
 		 */
 		static bool isBlockEmpty(const uint8_t *block, unsigned int size);
 
+	private:
+		/** Bank metadata cache functions (bank_cache.cpp) **/
+
+		/**
+		 * Load the bank entries from the bank metadata cache.
+		 *
+		 * The cache file is selected using the RVT-H Reader's serial
+		 * number, or the HDD image's file ID. It's only used if the
+		 * raw bank table and the first LBA of each bank match the
+		 * values that were hashed when the cache file was saved.
+		 *
+		 * m_entries, m_bankCount, m_imageType, and m_NHCD_status
+		 * must have already been set.
+		 *
+		 * If the cache can be used but doesn't have a valid entry,
+		 * the bank entries will be saved by saveBankCache().
+		 *
+		 * @param f_img		[in] RefFile*
+		 * @param nhcd_table	[in] Raw bank table, as read from the disk.
+		 * @param nhcd_size	[in] Size of nhcd_table, in bytes.
+		 * @return 0 if the bank entries were loaded; negative POSIX error code if not.
+		 */
+		int loadBankCache(RefFile *f_img, const void *nhcd_table, size_t nhcd_size);
+
+		/**
+		 * Save the bank entries to the bank metadata cache.
+		 * This is called by the destructor.
+		 *
+		 * If the disk image was made writable, the cache file is
+		 * deleted instead, since the banks may have been changed.
+		 */
+		void saveBankCache(void);
+
 	private:
 		/** Private functions (rvth_p.cpp) **/
 
@@ -266,6 +366,11 @@ class RvtH {
 
 		/**
 		 * Get a bank table entry.
+		 *
+		 * NOTE: The first call for each bank initializes the
+		 * signature status and AppLoader error status, which
+		 * requires reading from the bank.
+		 *
 		 * @param bank	[in] Bank number. (0-7)
 		 * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 * @return Bank table entry.
@@ -321,6 +426,48 @@ class RvtH {
 			RvtH_Progress_Callback callback = nullptr,
 			void *userdata = nullptr);
 
+		/**
+		 * Copy a bank from this RVT-H HDD or standalone disc image to a
+		 * new disc image using the Zstandard seekable format.
+		 *
+		 * The disc image is split into independent frames, which are
+		 * compressed by a pool of worker threads. The seek table is
+		 * written at the end of the file, so ZstdReader can read
+		 * the image without decompressing all of it.
+		 *
+		 * Compression level and frame size are set using rvth_zstd_set_params().
+		 *
+		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param filename	[in] Destination filename.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int copyToZstd(unsigned int bank_src, const TCHAR *filename,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
+		/**
+		 * Copy a bank from this RVT-H HDD or standalone disc image into
+		 * a chunk store. (See ChunkStore.)
+		 *
+		 * The store is the directory containing the manifest. Chunks are
+		 * hashed and stored by a pool of worker threads, and chunks that
+		 * are already in the store aren't written again.
+		 *
+		 * Wii disc images use 2 MB chunks aligned to the game partition's
+		 * groups. GameCube disc images use 32 KB chunks.
+		 *
+		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param filename	[in] Manifest filename.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int copyToStore(unsigned int bank_src, const TCHAR *filename,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
 		/**
 		 * Extract a disc image from this RVT-H disk image.
 		 * Compatibility wrapper; this function creates a new RvtH
@@ -338,6 +485,34 @@ class RvtH {
 			RvtH_Progress_Callback callback = nullptr,
 			void *userdata = nullptr);
 
+		/**
+		 * Extract multiple disc images from this RVT-H disk image concurrently.
+		 *
+		 * Each bank is extracted on its own thread. Reads from this image are
+		 * scheduled so the source is read in large sequential windows instead
+		 * of having every thread seek to its own bank.
+		 *
+		 * Progress callbacks are serialized. state->rvth is always this RvtH
+		 * and state->bank_rvth is the bank being extracted, including while
+		 * the extracted image is being recrypted. If the callback returns
+		 * false, all extractions are cancelled.
+		 *
+		 * @param banks		[in] Bank numbers. (0-7)
+		 * @param filenames	[in] Destination filenames. (one per bank)
+		 * @param count		[in] Number of banks.
+		 * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+		 *			(Ignored for GameCube banks.)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param pErrs		[out,opt] Error code for each bank. (count elements)
+		 * @return Error code of the first bank that failed. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int extractBanks(const unsigned int *banks, const TCHAR *const *filenames,
+			unsigned int count, int recrypt_key, unsigned int flags,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr, int *pErrs = nullptr);
+
 		/**
 		 * Copy a bank from this HDD or standalone disc image to an RVT-H system.
 		 * @param rvth_dest	[in] Destination RvtH object.
@@ -368,6 +543,33 @@ class RvtH {
 			void *userdata = nullptr,
 			int ios_force = -1);
 
+	public:
+		/** Verification functions (verify.cpp) **/
+
+		/**
+		 * Verify the hashes of all encrypted partitions in a Wii disc image.
+		 *
+		 * Each sector's H0, H1, H2, and H3 hashes are checked, along with
+		 * the TMD content hash of each partition's H3 table. Groups are
+		 * verified in parallel on all available CPUs.
+		 *
+		 * NOTE: Bad hashes are not an error. Check the results to
+		 * determine if each partition is valid.
+		 *
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param results	[out] Array of verification results. (one per partition)
+		 * @param pCount	[in/out] On input, number of elements in results.
+		 *			On output, number of partitions in the disc image.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 *         If results is too small, -ENOSPC is returned.
+		 */
+		int verifyWiiPartitions(unsigned int bank,
+			RvtH_Verify_Result *results, unsigned int *pCount,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
 	public:
 		/** Recryption functions (recrypt.cpp) **/
 
@@ -416,6 +618,17 @@ class RvtH {
 
 		// BankEntry objects.
 		RvtH_BankEntry *m_entries;
+
+		// Banks whose deferred fields have been initialized. (bitfield)
+		// See loadBankDetails().
+		mutable std::atomic<uint32_t> m_bankDetailsLoaded;
+		mutable std::mutex m_bankDetailsMutex;
+
+		// Bank metadata cache. (See loadBankCache().)
+		std::tstring m_bankCacheFile;	// Cache filename. (empty if not cached)
+		uint8_t m_bankCacheHash[20];	// Validation hash.
+		bool m_bankCacheHit;		// True if the entries were loaded from the cache.
+		uint32_t m_bankCacheDetails;	// m_bankDetailsLoaded when loaded from the cache.
 };
 
 #endif /* __cplusplus */
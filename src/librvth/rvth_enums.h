@@ -60,8 +60,50 @@ typedef enum {
 	// Prepend a 32 KB SDK header.
 	// Required for rvtwriter, NDEV ODEM, etc.
 	RVTH_EXTRACT_PREPEND_SDK_HEADER		= (1 << 0),
+
+	// Output format. (Default is a plain GCM.)
+	// Can't be combined with RVTH_EXTRACT_PREPEND_SDK_HEADER.
+	RVTH_EXTRACT_FORMAT_CISO		= (1 << 1),
+	RVTH_EXTRACT_FORMAT_WBFS		= (1 << 2),
+	// Zstandard seekable format. Requires libzstd.
+	// Can't be combined with recryption.
+	RVTH_EXTRACT_FORMAT_ZSTD		= (1 << 3),
+	// Chunk store manifest. Chunks are stored in the
+	// directory containing the manifest.
+	// Can't be combined with recryption.
+	RVTH_EXTRACT_FORMAT_STORE		= (1 << 4),
 } RvtH_Extract_Flags;
 
+// Disc image file format for newly-created disc images.
+typedef enum {
+	RVTH_ImageFormat_GCM	= 0,	// Plain disc image (sparse)
+	RVTH_ImageFormat_CISO	= 1,	// CISO
+	RVTH_ImageFormat_WBFS	= 2,	// WBFS (single disc)
+	RVTH_ImageFormat_ZSTD	= 3,	// Zstandard seekable (sequential only)
+	RVTH_ImageFormat_STORE	= 4,	// Chunk store manifest (sequential only)
+} RvtH_ImageFormat_e;
+
+// Wii partition verification status.
+typedef enum {
+	RVTH_VERIFY_STATUS_OK		= 0,	// All hashes are valid.
+	RVTH_VERIFY_STATUS_BAD		= 1,	// One or more hashes are invalid.
+	RVTH_VERIFY_STATUS_UNENCRYPTED	= 2,	// Partition is unencrypted. (no hashes)
+	RVTH_VERIFY_STATUS_ERROR	= 3,	// Partition could not be verified. (See err.)
+
+	RVTH_VERIFY_STATUS_MAX
+} RvtH_Verify_Status_e;
+
+// Hash level that failed verification.
+typedef enum {
+	RVTH_VERIFY_LEVEL_NONE	= 0,
+	RVTH_VERIFY_LEVEL_H0	= 1,	// Sector data (1 KB blocks)
+	RVTH_VERIFY_LEVEL_H1	= 2,	// Sector H0 table
+	RVTH_VERIFY_LEVEL_H2	= 3,	// Subgroup H1 table
+	RVTH_VERIFY_LEVEL_H3	= 4,	// Group H2 table
+
+	RVTH_VERIFY_LEVEL_MAX
+} RvtH_Verify_Level_e;
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,8 @@
 #include "byteswap.h"
 #include "nhcd_structs.h"
 
+#include "libwiicrypto/zero_block.h"
+
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
@@ -59,27 +61,8 @@ int RvtH::makeWritable(void)
  */
 bool RvtH::isBlockEmpty(const uint8_t *block, unsigned int size)
 {
-	// Process the block using 64-bit pointers.
-	const uint64_t *block64 = (const uint64_t*)block;
-	unsigned int i;
-	assert(size % 64 == 0);
-	for (i = size/8/8; i > 0; i--, block64 += 8) {
-		uint64_t x = block64[0];
-		x |= block64[1];
-		x |= block64[2];
-		x |= block64[3];
-		x |= block64[4];
-		x |= block64[5];
-		x |= block64[6];
-		x |= block64[7];
-		if (x != 0) {
-			// Non-zero block.
-			return false;
-		}
-	}
-
-	// Block is all zeroes.
-	return true;
+	assert(size % ZERO_BLOCK_CHUNK_SIZE == 0);
+	return zero_block_is_empty(block, size);
 }
 
 /**
@@ -165,15 +148,8 @@ int RvtH::writeBankEntry(unsigned int bank, time_t *pTimestamp)
 	}
 
 	// Write the bank entry.
-	ret = m_file->seeko(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA + bank+1), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return -errno;
-	}
-	size_t size = m_file->write(&nhcd_entry, 1, sizeof(nhcd_entry));
+	size_t size = m_file->pwriteAt(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA + bank+1),
+		&nhcd_entry, sizeof(nhcd_entry));
 	if (size != sizeof(nhcd_entry)) {
 		// Write error.
 		if (errno == 0) {
@@ -0,0 +1,503 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * BankCacheTest.cpp: Bank metadata cache tests.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "rvth.hpp"
+#include "reader/io_backend.h"
+
+// C includes.
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+# include <sys/utime.h>
+#else /* !_WIN32 */
+# include <dirent.h>
+# include <unistd.h>
+# include <utime.h>
+#endif /* _WIN32 */
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+#ifdef _WIN32
+# define DIR_SEP_CHR _T('\\')
+// Environment variable for the cache directory's parent directory.
+# define CACHE_HOME_ENV _T("LOCALAPPDATA")
+#else /* !_WIN32 */
+# define DIR_SEP_CHR '/'
+// Environment variable for the cache directory's parent directory.
+# define CACHE_HOME_ENV "XDG_CACHE_HOME"
+#endif /* _WIN32 */
+
+namespace LibRvth { namespace Tests {
+
+/**
+ * Set an environment variable.
+ * @param name	[in] Name.
+ * @param value	[in,opt] Value. (If NULL, the variable is removed.)
+ * @return 0 on success; non-zero on error.
+ */
+static int setEnv(const TCHAR *name, const TCHAR *value)
+{
+#ifdef _WIN32
+	// An empty value removes the variable.
+	return _tputenv_s(name, (value ? value : _T("")));
+#else /* !_WIN32 */
+	return (value ? setenv(name, value, 1) : unsetenv(name));
+#endif /* _WIN32 */
+}
+
+/**
+ * Get a file's access and modification times.
+ * @param filename	[in] Filename.
+ * @param pAtime	[out] Access time.
+ * @param pMtime	[out] Modification time.
+ * @return 0 on success; non-zero on error.
+ */
+static int getFileTimes(const TCHAR *filename, time_t *pAtime, time_t *pMtime)
+{
+#ifdef _WIN32
+	struct _stati64 sb;
+	const int ret = _tstati64(filename, &sb);
+#else /* !_WIN32 */
+	struct stat sb;
+	const int ret = stat(filename, &sb);
+#endif /* _WIN32 */
+	if (ret == 0) {
+		*pAtime = sb.st_atime;
+		*pMtime = sb.st_mtime;
+	}
+	return ret;
+}
+
+/**
+ * Set a file's access and modification times.
+ * @param filename	[in] Filename.
+ * @param atime		[in] Access time.
+ * @param mtime		[in] Modification time.
+ * @return 0 on success; non-zero on error.
+ */
+static int setFileTimes(const TCHAR *filename, time_t atime, time_t mtime)
+{
+#ifdef _WIN32
+	struct _utimbuf ut;
+	ut.actime = atime;
+	ut.modtime = mtime;
+	return _tutime(filename, &ut);
+#else /* !_WIN32 */
+	struct utimbuf ut;
+	ut.actime = atime;
+	ut.modtime = mtime;
+	return utime(filename, &ut);
+#endif /* _WIN32 */
+}
+
+/**
+ * Test fixture with an empty bank metadata cache directory.
+ * The cache directory is created in the current directory
+ * instead of the user's cache directory.
+ */
+class BankCacheTest : public ::testing::Test
+{
+	protected:
+		BankCacheTest()
+			: m_oldCacheHome(nullptr) { }
+
+		void SetUp(void) override
+		{
+			TCHAR cwd[1024];
+#ifdef _WIN32
+			ASSERT_TRUE(_tgetcwd(cwd, ARRAY_SIZE(cwd)) != nullptr);
+#else /* !_WIN32 */
+			ASSERT_TRUE(getcwd(cwd, ARRAY_SIZE(cwd)) != nullptr);
+#endif /* _WIN32 */
+			m_cacheHome = cwd;
+			m_cacheHome += DIR_SEP_CHR;
+			m_cacheHome += _T("BankCacheTest.cache");
+			m_cacheDir = m_cacheHome + DIR_SEP_CHR + _T("rvthtool");
+
+			const TCHAR *const oldCacheHome = _tgetenv(CACHE_HOME_ENV);
+			if (oldCacheHome) {
+				m_oldCacheHome = _tcsdup(oldCacheHome);
+			}
+			ASSERT_EQ(0, setEnv(CACHE_HOME_ENV, m_cacheHome.c_str()));
+		}
+
+		void TearDown(void) override
+		{
+			for (const tstring &filename : cacheFiles()) {
+				_tremove(filename.c_str());
+			}
+#ifdef _WIN32
+			_trmdir(m_cacheDir.c_str());
+			_trmdir(m_cacheHome.c_str());
+#else /* !_WIN32 */
+			rmdir(m_cacheDir.c_str());
+			rmdir(m_cacheHome.c_str());
+#endif /* _WIN32 */
+
+			setEnv(CACHE_HOME_ENV, m_oldCacheHome);
+			free(m_oldCacheHome);
+			m_oldCacheHome = nullptr;
+		}
+
+		/**
+		 * Get the files in the cache directory.
+		 * @return Full pathnames of the files in the cache directory.
+		 */
+		vector<tstring> cacheFiles(void) const
+		{
+			vector<tstring> files;
+#ifdef _WIN32
+			WIN32_FIND_DATA findData;
+			const tstring pattern = m_cacheDir + _T("\\*");
+			HANDLE hFind = FindFirstFile(pattern.c_str(), &findData);
+			if (hFind == INVALID_HANDLE_VALUE) {
+				return files;
+			}
+			do {
+				if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+					files.push_back(m_cacheDir + DIR_SEP_CHR + findData.cFileName);
+				}
+			} while (FindNextFile(hFind, &findData));
+			FindClose(hFind);
+#else /* !_WIN32 */
+			DIR *const pDir = opendir(m_cacheDir.c_str());
+			if (!pDir) {
+				return files;
+			}
+			for (struct dirent *d = readdir(pDir); d != nullptr; d = readdir(pDir)) {
+				if (d->d_name[0] != '.') {
+					files.push_back(m_cacheDir + DIR_SEP_CHR + d->d_name);
+				}
+			}
+			closedir(pDir);
+#endif /* _WIN32 */
+			return files;
+		}
+
+	protected:
+		tstring m_cacheHome;	// Cache directory's parent directory.
+		tstring m_cacheDir;	// Cache directory.
+		TCHAR *m_oldCacheHome;	// Original value of CACHE_HOME_ENV.
+};
+
+/**
+ * Open an RVT-H HDD image twice using the bank metadata cache.
+ * The second open should use the cache until a bank is changed.
+ */
+TEST_F(BankCacheTest, cacheHits)
+{
+	static const TCHAR hdd_filename[] = _T("BankCacheTest.hdd");
+	static const uint32_t bank = 1;
+	const uint32_t bank_lba = NHCD_BANK_START_LBA(bank, NHCD_BANK_COUNT);
+
+	// HDD image with a GameCube image in bank 2.
+	// The disc image is empty except for the disc header.
+	vector<uint8_t> disc(LBA_TO_BYTES(0x800));
+	uint8_t *const hdr = &disc[0];
+	memcpy(&hdr[0x00], "RCACH1", 6);
+	memcpy(&hdr[0x1C], "\xC2\x33\x9F\x3D", 4);	// GCN magic
+	memcpy(&hdr[0x20], "Cache Test", 11);
+	ASSERT_TRUE(writeHddImage(hdd_filename, bank, NHCD_BankType_GCN, &disc[0], 0x800));
+
+	// First open: Not cached.
+	int err = 0;
+	RvtH *rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(static_cast<unsigned int>(NHCD_BANK_COUNT), rvth->bankCount());
+	const RvtH_BankEntry *entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(RVTH_BankType_GCN, entry->type);
+	EXPECT_EQ(0, memcmp(entry->discHeader.id6, "RCACH1", 6));
+	delete rvth;
+
+	// Exactly one cache file should have been written.
+	const vector<tstring> files = cacheFiles();
+	ASSERT_EQ(1U, files.size());
+	const tstring &cache_filename = files[0];
+
+	// Change the title in the cache file. If the cache is
+	// used, the changed title will be visible.
+	FILE *f_cache = _tfopen(cache_filename.c_str(), _T("r+b"));
+	ASSERT_TRUE(f_cache != nullptr);
+	vector<uint8_t> cache_data(64*1024);
+	cache_data.resize(fread(cache_data.data(), 1, cache_data.size(), f_cache));
+	auto it = std::search(cache_data.begin(), cache_data.end(), &hdr[0x20], &hdr[0x20+10]);
+	ASSERT_TRUE(it != cache_data.end());
+	fseek(f_cache, static_cast<long>(it - cache_data.begin()), SEEK_SET);
+	fwrite("CACHE", 1, 5, f_cache);
+	fclose(f_cache);
+
+	// Second open: Cached.
+	rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(RVTH_BankType_GCN, entry->type);
+	EXPECT_EQ(0, memcmp(entry->discHeader.game_title, "CACHE Test", 11));
+	EXPECT_TRUE(entry->reader != nullptr);
+	delete rvth;
+
+	// Cache disabled.
+	ASSERT_EQ(0, rvth_io_set_bank_cache(0));
+	rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, rvth_io_set_bank_cache(1));
+	ASSERT_EQ(0, err);
+	entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(0, memcmp(entry->discHeader.game_title, "Cache Test", 11));
+	delete rvth;
+
+	// Change the bank's disc header. The cache file is out of date.
+	RefFile *const f = new RefFile(hdd_filename);
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_EQ(0, f->makeWritable());
+	memcpy(&hdr[0x20], "Other Test", 11);
+	ASSERT_EQ(static_cast<size_t>(LBA_SIZE), f->pwriteAt(LBA_TO_BYTES((int64_t)bank_lba), hdr, LBA_SIZE));
+	f->unref();
+
+	rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(0, memcmp(entry->discHeader.game_title, "Other Test", 11));
+	delete rvth;
+
+	EXPECT_EQ(0, _tremove(hdd_filename));
+}
+
+/**
+ * Change the ticket of a Wii bank without changing the disc header.
+ * The cached crypto type is out of date, so the cache must not be used.
+ */
+TEST_F(BankCacheTest, ticketChanged)
+{
+	static const TCHAR hdd_filename[] = _T("BankCacheTest-ticket.hdd");
+	static const uint32_t bank = 2;
+	static const uint32_t lba_len = 0x800;
+	static const uint32_t part_addr = 0x50000;
+	const int64_t bank_addr = LBA_TO_BYTES((int64_t)NHCD_BANK_START_LBA(bank, NHCD_BANK_COUNT));
+
+	// HDD image with a Wii image in bank 3.
+	// The game partition has a retail ticket and TMD.
+	vector<uint8_t> disc(LBA_TO_BYTES(lba_len));
+	uint8_t *const hdr = &disc[0];
+	memcpy(&hdr[0x00], "RCACH2", 6);
+	put_be32(&hdr[0x18], 0x5D1C9EA3);	// Wii magic
+	memcpy(&hdr[0x20], "Ticket Test", 12);
+	uint8_t *const vgtbl = &disc[RVL_VolumeGroupTable_ADDRESS];
+	put_be32(&vgtbl[0x00], 1);
+	put_be32(&vgtbl[0x04], (RVL_VolumeGroupTable_ADDRESS + 0x20) >> 2);
+	put_be32(&vgtbl[0x20], part_addr >> 2);
+	put_be32(&vgtbl[0x24], 0);		// Game partition
+	uint8_t *const part = &disc[part_addr];
+	memcpy(&part[0x140], "Root-CA00000001-XS00000003", 27);
+	put_be32(&part[0x2A4], 0x208);		// TMD size
+	put_be32(&part[0x2A8], 0x2C0 >> 2);	// TMD offset
+	memcpy(&part[0x2C0 + 0x140], "Root-CA00000001-CP00000004", 27);
+	ASSERT_TRUE(writeHddImage(hdd_filename, bank, NHCD_BankType_Wii_SL, &disc[0], lba_len));
+
+	// First open: Not cached.
+	int err = 0;
+	RvtH *rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	const RvtH_BankEntry *entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(RVTH_BankType_Wii_SL, entry->type);
+	EXPECT_EQ(RVL_CryptoType_Retail, entry->crypto_type);
+	delete rvth;
+	EXPECT_EQ(1U, cacheFiles().size());
+
+	// Change the ticket's common key index.
+	// The modification time is restored, since an RVT-H Reader
+	// doesn't have one.
+	time_t atime = 0, mtime = 0;
+	ASSERT_EQ(0, getFileTimes(hdd_filename, &atime, &mtime));
+	RefFile *const f = new RefFile(hdd_filename);
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_EQ(0, f->makeWritable());
+	static const uint8_t korean = 1;
+	ASSERT_EQ(1U, f->pwriteAt(bank_addr + part_addr + 0x1F1, &korean, 1));
+	f->unref();
+	ASSERT_EQ(0, setFileTimes(hdd_filename, atime, mtime));
+
+	// Second open: The cache is out of date.
+	rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(RVL_CryptoType_Korean, entry->crypto_type);
+	delete rvth;
+
+	EXPECT_EQ(0, _tremove(hdd_filename));
+}
+
+/**
+ * Change the disc header of a bank that doesn't start at its
+ * default starting LBA. The bank's starting LBA from the bank
+ * table must be used to validate the cache.
+ */
+TEST_F(BankCacheTest, bankTableStart)
+{
+	static const TCHAR hdd_filename[] = _T("BankCacheTest-start.hdd");
+	static const uint32_t bank = 3;
+	static const uint32_t lba_len = 0x800;
+	const uint32_t lba_default = NHCD_BANK_START_LBA(bank, NHCD_BANK_COUNT);
+	const uint32_t lba_start = lba_default + BYTES_TO_LBA(1024*1024);
+
+	// HDD image with a GameCube image in bank 4.
+	vector<uint8_t> disc(LBA_TO_BYTES(lba_len));
+	uint8_t *const hdr = &disc[0];
+	memcpy(&hdr[0x00], "RCACH3", 6);
+	memcpy(&hdr[0x1C], "\xC2\x33\x9F\x3D", 4);	// GCN magic
+	memcpy(&hdr[0x20], "Start Test", 11);
+	ASSERT_TRUE(writeHddImage(hdd_filename, bank, NHCD_BankType_GCN, &disc[0], lba_len));
+
+	// Move the disc image 1 MB past its default starting LBA.
+	RefFile *f = new RefFile(hdd_filename);
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_EQ(0, f->makeWritable());
+	uint8_t lba_start_be[4];
+	put_be32(lba_start_be, lba_start);
+	const int64_t nhcd_entry_addr = LBA_TO_BYTES((int64_t)NHCD_BANKTABLE_ADDRESS_LBA) +
+		(NHCD_BLOCK_SIZE * (1 + bank));
+	ASSERT_EQ(sizeof(lba_start_be), f->pwriteAt(nhcd_entry_addr + 0x20, lba_start_be, sizeof(lba_start_be)));
+	ASSERT_EQ(static_cast<size_t>(LBA_SIZE), f->pwriteAt(LBA_TO_BYTES((int64_t)lba_start), hdr, LBA_SIZE));
+	f->unref();
+
+	// First open: Not cached.
+	int err = 0;
+	RvtH *rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	const RvtH_BankEntry *entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(lba_start, entry->lba_start);
+	EXPECT_EQ(0, memcmp(entry->discHeader.game_title, "Start Test", 11));
+	delete rvth;
+	EXPECT_EQ(1U, cacheFiles().size());
+
+	// Change the disc header at the bank's actual starting LBA.
+	// The modification time is restored, since an RVT-H Reader
+	// doesn't have one.
+	time_t atime = 0, mtime = 0;
+	ASSERT_EQ(0, getFileTimes(hdd_filename, &atime, &mtime));
+	f = new RefFile(hdd_filename);
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_EQ(0, f->makeWritable());
+	memcpy(&hdr[0x20], "Moved Test", 11);
+	ASSERT_EQ(static_cast<size_t>(LBA_SIZE), f->pwriteAt(LBA_TO_BYTES((int64_t)lba_start), hdr, LBA_SIZE));
+	f->unref();
+	ASSERT_EQ(0, setFileTimes(hdd_filename, atime, mtime));
+
+	// Second open: The cache is out of date.
+	rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	entry = rvth->bankEntry(bank);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(0, memcmp(entry->discHeader.game_title, "Moved Test", 11));
+	delete rvth;
+
+	EXPECT_EQ(0, _tremove(hdd_filename));
+}
+
+/**
+ * Save a cache file when there are already too many cache files.
+ * The oldest cache files should be deleted.
+ */
+TEST_F(BankCacheTest, pruneOldFiles)
+{
+	static const TCHAR hdd_filename[] = _T("BankCacheTest-prune.hdd");
+	// NOTE: Must match BANK_CACHE_MAX_FILES in bank_cache.cpp.
+	static const unsigned int max_files = 32;
+	static const unsigned int old_files = max_files + 4;
+
+	vector<uint8_t> disc(LBA_TO_BYTES(0x800));
+	uint8_t *const hdr = &disc[0];
+	memcpy(&hdr[0x00], "RCACH4", 6);
+	memcpy(&hdr[0x1C], "\xC2\x33\x9F\x3D", 4);	// GCN magic
+	memcpy(&hdr[0x20], "Prune Test", 11);
+	ASSERT_TRUE(writeHddImage(hdd_filename, 0, NHCD_BankType_GCN, &disc[0], 0x800));
+
+	// Open the HDD image once so the cache directory is created.
+	int err = 0;
+	RvtH *rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	delete rvth;
+	vector<tstring> files = cacheFiles();
+	ASSERT_EQ(1U, files.size());
+	const tstring cache_filename = files[0];
+	ASSERT_EQ(0, _tremove(cache_filename.c_str()));
+
+	// Cache files for HDD images that no longer exist.
+	// Each file is one minute older than the next one.
+	const time_t now = time(nullptr);
+	for (unsigned int i = 0; i < old_files; i++) {
+		TCHAR name[32];
+		_sntprintf(name, ARRAY_SIZE(name), _T("img-old%02u.cache"), i);
+		const tstring filename = m_cacheDir + DIR_SEP_CHR + name;
+		FILE *const f_old = _tfopen(filename.c_str(), _T("wb"));
+		ASSERT_TRUE(f_old != nullptr);
+		fclose(f_old);
+		const time_t mtime = now - ((old_files - i) * 60);
+		ASSERT_EQ(0, setFileTimes(filename.c_str(), mtime, mtime));
+	}
+
+	// Open the HDD image again. The new cache file is kept,
+	// and the oldest cache files are deleted.
+	rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	delete rvth;
+	files = cacheFiles();
+	EXPECT_EQ(max_files, files.size());
+	EXPECT_TRUE(std::find(files.begin(), files.end(), cache_filename) != files.end());
+	for (unsigned int i = 0; i < old_files; i++) {
+		TCHAR name[32];
+		_sntprintf(name, ARRAY_SIZE(name), _T("img-old%02u.cache"), i);
+		const tstring filename = m_cacheDir + DIR_SEP_CHR + name;
+		const bool found = (std::find(files.begin(), files.end(), filename) != files.end());
+		EXPECT_EQ(i >= old_files - (max_files - 1), found) << "i == " << i;
+	}
+
+	EXPECT_EQ(0, _tremove(hdd_filename));
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Bank metadata cache tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,246 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * BankInitTest.cpp: RVT-H bank entry initialization tests.                *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "rvth.hpp"
+#include "bank_init.h"
+#include "reader/io_backend.h"
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+namespace LibRvth { namespace Tests {
+
+#ifndef _WIN32
+// Test bank layout.
+struct TestBank {
+	uint32_t type;		// Bank type in the bank table. (See NHCD_BankType_e.)
+	const char *id6;	// Game ID of the disc image, or nullptr if none.
+	bool isWii;		// True for a Wii disc header.
+	bool tableLBAs;		// True to set the LBAs in the bank table.
+};
+
+static const TestBank testBanks[NHCD_BANK_COUNT] = {
+	{NHCD_BankType_GCN,	"RBINI0", false, true},
+	{NHCD_BankType_Wii_DL,	"RBINI1", true,  true},
+	{NHCD_BankType_Empty,	nullptr,  false, false},	// Second half of bank 1
+	{NHCD_BankType_Empty,	"RBINI3", false, false},	// Deleted
+	{NHCD_BankType_GCN,	"RBINI4", false, false},
+	{NHCD_BankType_Empty,	nullptr,  false, false},
+	{NHCD_BankType_Empty,	"RBINI6", true,  false},	// Deleted
+	{NHCD_BankType_Wii_SL,	"RBINI7", true,  true},
+};
+
+/**
+ * Create a sparse RVT-H HDD image using testBanks[].
+ * Each disc image only has a disc header.
+ * @param filename	[in] Filename.
+ * @return True on success; false on error.
+ */
+static bool writeTestHdd(const char *filename)
+{
+	RefFile *const f = new RefFile(filename, true);
+	if (!f->isOpen() ||
+	    f->makeSparse(LBA_TO_BYTES((int64_t)NHCD_BANK_START_LBA(NHCD_BANK_COUNT, NHCD_BANK_COUNT))) != 0)
+	{
+		f->unref();
+		return false;
+	}
+
+	uint8_t table[NHCD_BLOCK_SIZE * (1 + NHCD_BANK_COUNT)];
+	memset(table, 0, sizeof(table));
+	put_be32(&table[0x000], NHCD_BANKTABLE_MAGIC);
+	put_be32(&table[0x004], 1);
+	put_be32(&table[0x008], NHCD_BANK_COUNT);
+
+	bool ok = true;
+	for (unsigned int i = 0; ok && i < NHCD_BANK_COUNT; i++) {
+		const TestBank &tb = testBanks[i];
+		const uint32_t bank_lba = NHCD_BANK_START_LBA(i, NHCD_BANK_COUNT);
+		uint8_t *const nhcd_entry = &table[NHCD_BLOCK_SIZE * (1 + i)];
+		put_be32(&nhcd_entry[0x000], tb.type);
+		if (tb.type != NHCD_BankType_Empty) {
+			char timestamp[15];
+			snprintf(timestamp, sizeof(timestamp), "2020010%u120000", i + 1);
+			memcpy(&nhcd_entry[0x004], "00000000000000", 14);
+			memcpy(&nhcd_entry[0x012], timestamp, 14);
+		}
+		if (tb.tableLBAs) {
+			put_be32(&nhcd_entry[0x020], bank_lba);
+			put_be32(&nhcd_entry[0x024], TEST_IMAGE_LBA_COUNT);
+		}
+
+		if (!tb.id6) {
+			continue;
+		}
+		uint8_t hdr[LBA_SIZE];
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(&hdr[0x00], tb.id6, 6);
+		if (tb.isWii) {
+			memcpy(&hdr[0x18], "\x5D\x1C\x9E\xA3", 4);	// Wii magic
+		} else {
+			memcpy(&hdr[0x1C], "\xC2\x33\x9F\x3D", 4);	// GCN magic
+		}
+		memcpy(&hdr[0x20], "Bank Init Test", 15);
+		ok = (f->pwriteAt(LBA_TO_BYTES((int64_t)bank_lba), hdr, sizeof(hdr)) == sizeof(hdr));
+	}
+	if (ok) {
+		ok = (f->pwriteAt(LBA_TO_BYTES((int64_t)NHCD_BANKTABLE_ADDRESS_LBA), table, sizeof(table)) == sizeof(table));
+	}
+
+	f->unref();
+	return ok;
+}
+
+/**
+ * Initialize the bank entries one at a time, in order.
+ * This is how RvtH::openHDD() initialized the banks before
+ * they were initialized in parallel.
+ * @param entries	[out] Bank entries. (NHCD_BANK_COUNT entries)
+ * @param f_img		[in] RVT-H HDD image.
+ * @return True on success; false on error.
+ */
+static bool initBanksSerial(RvtH_BankEntry *entries, RefFile *f_img)
+{
+	memset(entries, 0, NHCD_BANK_COUNT * sizeof(*entries));
+	for (unsigned int i = 0; i < NHCD_BANK_COUNT; i++) {
+		RvtH_BankEntry *const entry = &entries[i];
+		if (i > 0 && (entry-1)->type == RVTH_BankType_Wii_DL) {
+			// Second bank for a dual-layer Wii image.
+			entry->type = RVTH_BankType_Wii_DL_Bank2;
+			entry->timestamp = -1;
+			continue;
+		}
+
+		NHCD_BankEntry nhcd_entry;
+		if (f_img->preadAt(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA) + (NHCD_BLOCK_SIZE * (1 + i)),
+			&nhcd_entry, sizeof(nhcd_entry)) != sizeof(nhcd_entry))
+		{
+			return false;
+		}
+
+		uint8_t type;
+		switch (be32_to_cpu(nhcd_entry.type)) {
+			default:			type = RVTH_BankType_Unknown;	break;
+			case NHCD_BankType_Empty:	type = RVTH_BankType_Empty;	break;
+			case NHCD_BankType_GCN:		type = RVTH_BankType_GCN;	break;
+			case NHCD_BankType_Wii_SL:	type = RVTH_BankType_Wii_SL;	break;
+			case NHCD_BankType_Wii_DL:	type = RVTH_BankType_Wii_DL;	break;
+		}
+
+		uint32_t lba_start = 0, lba_len = 0;
+		if (type >= RVTH_BankType_GCN) {
+			lba_start = be32_to_cpu(nhcd_entry.lba_start);
+			lba_len = be32_to_cpu(nhcd_entry.lba_len);
+		}
+		if (lba_start == 0 || lba_len == 0) {
+			lba_start = NHCD_BANK_START_LBA(i, NHCD_BANK_COUNT);
+			lba_len = 0;
+		}
+
+		rvth_init_BankEntry(entry, f_img, type, lba_start, lba_len, nhcd_entry.timestamp);
+		rvth_init_BankEntry_details(entry);
+	}
+	return true;
+}
+
+/**
+ * Initialize the bank entries of an RVT-H HDD image with a
+ * dual-layer bank and deleted banks. The bank entries must
+ * match the bank entries initialized one at a time.
+ */
+TEST(BankInitTest, parallelMatchesSerial)
+{
+	static const char hdd_filename[] = "BankInitTest.hdd";
+	ASSERT_TRUE(writeTestHdd(hdd_filename));
+
+	RvtH_BankEntry expected[NHCD_BANK_COUNT];
+	RefFile *const f = new RefFile(hdd_filename);
+	ASSERT_TRUE(f->isOpen());
+	const bool ok = initBanksSerial(expected, f);
+	f->unref();
+	ASSERT_TRUE(ok);
+
+	// Sanity check for the serial bank entries.
+	EXPECT_EQ(RVTH_BankType_GCN, expected[0].type);
+	EXPECT_EQ(RVTH_BankType_Wii_DL, expected[1].type);
+	EXPECT_EQ(RVTH_BankType_Wii_DL_Bank2, expected[2].type);
+	EXPECT_EQ(RVTH_BankType_GCN, expected[3].type);
+	EXPECT_TRUE(expected[3].is_deleted);
+	EXPECT_EQ(RVTH_BankType_Empty, expected[5].type);
+	EXPECT_EQ(RVTH_BankType_Wii_SL, expected[6].type);
+	EXPECT_TRUE(expected[6].is_deleted);
+
+	// Open the HDD image multiple times, since the
+	// order in which the banks are initialized varies.
+	for (unsigned int pass = 0; pass < 8; pass++) {
+		int err = 0;
+		RvtH *const rvth = new RvtH(hdd_filename, &err);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ((unsigned int)NHCD_BANK_COUNT, rvth->bankCount());
+
+		for (unsigned int i = 0; i < NHCD_BANK_COUNT; i++) {
+			const RvtH_BankEntry *const entry = rvth->bankEntry(i);
+			ASSERT_TRUE(entry != nullptr);
+			const RvtH_BankEntry *const exp = &expected[i];
+			EXPECT_EQ(exp->reader != nullptr, entry->reader != nullptr) << "bank " << i;
+			EXPECT_EQ(exp->lba_start, entry->lba_start) << "bank " << i;
+			EXPECT_EQ(exp->lba_len, entry->lba_len) << "bank " << i;
+			EXPECT_EQ(exp->timestamp, entry->timestamp) << "bank " << i;
+			EXPECT_EQ(exp->type, entry->type) << "bank " << i;
+			EXPECT_EQ(exp->region_code, entry->region_code) << "bank " << i;
+			EXPECT_EQ(exp->is_deleted, entry->is_deleted) << "bank " << i;
+			EXPECT_EQ(exp->aplerr, entry->aplerr) << "bank " << i;
+			EXPECT_EQ(0, memcmp(exp->aplerr_val, entry->aplerr_val, sizeof(exp->aplerr_val))) << "bank " << i;
+			EXPECT_EQ(0, memcmp(&exp->discHeader, &entry->discHeader, sizeof(exp->discHeader))) << "bank " << i;
+			EXPECT_EQ(exp->crypto_type, entry->crypto_type) << "bank " << i;
+			EXPECT_EQ(exp->ios_version, entry->ios_version) << "bank " << i;
+			EXPECT_EQ(0, memcmp(&exp->ticket, &entry->ticket, sizeof(exp->ticket))) << "bank " << i;
+			EXPECT_EQ(0, memcmp(&exp->tmd, &entry->tmd, sizeof(exp->tmd))) << "bank " << i;
+			EXPECT_EQ(exp->pt_count, entry->pt_count) << "bank " << i;
+		}
+		delete rvth;
+	}
+
+	for (RvtH_BankEntry &entry : expected) {
+		delete entry.reader;
+		free(entry.ptbl);
+	}
+	_tremove(hdd_filename);
+}
+#endif /* !_WIN32 */
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: RVT-H bank entry initialization tests.\n\n");
+	fflush(nullptr);
+
+	// Bank entries must be initialized from the HDD image,
+	// not loaded from the bank metadata cache.
+	rvth_io_set_bank_cache(0);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * BlockWriterTest.cpp: CISO and WBFS writer tests.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+/**
+ * Write CISO and WBFS images using Reader::create(), then read them back.
+ */
+TEST(BlockWriterTest, cisoAndWbfs)
+{
+	static const TCHAR out_filename[] = _T("BlockWriterTest.out");
+
+	// 32 MB disc image, written in 2 MB regions.
+	// Regions 0, 1, 3, and 5 have data; the rest are empty.
+	// Region 3 is written last to check block reordering.
+	static const uint32_t region_lba = BYTES_TO_LBA(2*1024*1024);
+	static const uint32_t lba_len = 16 * region_lba;
+	static const unsigned int data_regions[] = {0, 1, 5, 3};
+	vector<uint32_t> expected(lba_len * U32_PER_LBA, 0);
+	for (unsigned int region : data_regions) {
+		for (uint32_t lba = region * region_lba; lba < (region + 1) * region_lba; lba++) {
+			expected[lba * U32_PER_LBA] = lba + 1;
+		}
+	}
+
+	static const struct {
+		RvtH_ImageFormat_e format;
+		int64_t header_size;
+	} formats[] = {
+		{RVTH_ImageFormat_CISO, 0x8000},
+		{RVTH_ImageFormat_WBFS, 2*1024*1024},
+	};
+
+	for (const auto &fmt : formats) {
+		RefFile *f = new RefFile(out_filename, true);
+		ASSERT_TRUE(f->isOpen());
+		Reader *reader = Reader::create(f, lba_len, fmt.format);
+		f->unref();
+		ASSERT_TRUE(reader != nullptr);
+		EXPECT_FALSE(reader->isLinear());
+
+		// Write the data regions in 4 KB pieces.
+		for (unsigned int region : data_regions) {
+			for (uint32_t lba = region * region_lba; lba < (region + 1) * region_lba; lba += 8) {
+				ASSERT_EQ(8U, reader->write(&expected[lba * U32_PER_LBA], lba, 8));
+			}
+		}
+		// Zero write to an empty block, e.g. the last LBA in copyToGcm().
+		ASSERT_EQ(1U, reader->write(&expected[(lba_len - 1) * U32_PER_LBA], lba_len - 1, 1));
+
+		// Unflushed data can be read back.
+		uint32_t lbabuf[LBA_SIZE / sizeof(uint32_t)];
+		ASSERT_EQ(1U, reader->read(lbabuf, 3 * region_lba + 10, 1));
+		EXPECT_EQ(3 * region_lba + 11, lbabuf[0]);
+
+		ASSERT_EQ(0, reader->flush());
+		delete reader;
+
+		// Only the non-empty blocks are stored.
+		f = new RefFile(out_filename);
+		ASSERT_TRUE(f->isOpen());
+		EXPECT_EQ(fmt.header_size + LBA_TO_BYTES(4 * region_lba), f->size());
+
+		reader = Reader::open(f, 0, 0);
+		f->unref();
+		ASSERT_TRUE(reader != nullptr);
+		ASSERT_TRUE(reader->isOpen());
+		EXPECT_FALSE(reader->isLinear());
+		ASSERT_EQ(6 * region_lba, reader->lba_len()) << "format == " << fmt.format;
+
+		vector<uint32_t> buf(reader->lba_len() * U32_PER_LBA);
+		ASSERT_EQ(reader->lba_len(), reader->read(&buf[0], 0, reader->lba_len()));
+		EXPECT_EQ(0, memcmp(&buf[0], &expected[0], buf.size() * sizeof(uint32_t)))
+			<< "format == " << fmt.format;
+		delete reader;
+	}
+
+	_tremove(out_filename);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: CISO and WBFS writer tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
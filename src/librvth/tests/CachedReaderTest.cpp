@@ -0,0 +1,119 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * CachedReaderTest.cpp: CachedReader tests.                               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "reader/CachedReader.hpp"
+#include "reader/PlainReader.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+
+namespace LibRvth { namespace Tests {
+
+class CachedReaderTest : public LbaImageTest
+{
+	protected:
+		CachedReaderTest()
+			: LbaImageTest(_T("CachedReaderTest.img")) { }
+};
+
+/**
+ * Read and write through a block cache.
+ */
+TEST_F(CachedReaderTest, readWrite)
+{
+	ASSERT_EQ(0, m_file->makeWritable());
+
+	// 4 blocks of 8 LBAs.
+	// The last block extends past the end of the file.
+	static const uint32_t lba_start = 1004;
+	static const uint32_t lba_len = TEST_IMAGE_LBA_COUNT - lba_start + 4;
+	CachedReader *const reader = new CachedReader(
+		new PlainReader(m_file, lba_start, lba_len), LBA_TO_BYTES(8), 4);
+	ASSERT_TRUE(reader->isOpen());
+	EXPECT_EQ(lba_len, reader->lba_len());
+
+	uint32_t buf[16 * U32_PER_LBA];
+
+	// The first read of a block reads the whole block.
+	ASSERT_EQ(1U, reader->read(buf, 3, 1));
+	EXPECT_EQ(lba_start + 3, buf[0]);
+	ASSERT_EQ(2U, reader->read(buf, 6, 2));
+	EXPECT_EQ(lba_start + 6, buf[0]);
+	EXPECT_EQ(lba_start + 7, buf[U32_PER_LBA]);
+	EXPECT_EQ(1U, reader->hits());
+	EXPECT_EQ(1U, reader->misses());
+
+	// Read across a block boundary.
+	ASSERT_EQ(4U, reader->read(buf, 6, 4));
+	for (unsigned int i = 0; i < 4; i++) {
+		EXPECT_EQ(lba_start + 6 + i, buf[i * U32_PER_LBA]);
+	}
+	EXPECT_EQ(2U, reader->hits());
+	EXPECT_EQ(2U, reader->misses());
+
+	// Reads larger than a block bypass the cache.
+	ASSERT_EQ(16U, reader->read(buf, 32, 16));
+	EXPECT_EQ(lba_start + 32, buf[0]);
+	EXPECT_EQ(lba_start + 47, buf[15 * U32_PER_LBA]);
+	EXPECT_EQ(2U, reader->hits());
+	EXPECT_EQ(2U, reader->misses());
+
+	// Fill the cache. The least recently used block is evicted.
+	for (uint32_t idx = 2; idx <= 4; idx++) {
+		ASSERT_EQ(1U, reader->read(buf, idx * 8, 1));
+	}
+	EXPECT_EQ(5U, reader->misses());
+	ASSERT_EQ(1U, reader->read(buf, 8, 1));
+	EXPECT_EQ(3U, reader->hits());
+	ASSERT_EQ(1U, reader->read(buf, 0, 1));
+	EXPECT_EQ(lba_start, buf[0]);
+	EXPECT_EQ(6U, reader->misses());
+
+	// Writes discard the cached block.
+	uint32_t wbuf[U32_PER_LBA];
+	for (unsigned int i = 0; i < ARRAY_SIZE(wbuf); i++) {
+		wbuf[i] = 0xDEADBEEF;
+	}
+	ASSERT_EQ(1U, reader->write(wbuf, 1, 1));
+	ASSERT_EQ(1U, reader->read(buf, 1, 1));
+	EXPECT_EQ(0xDEADBEEF, buf[0]);
+	EXPECT_EQ(7U, reader->misses());
+
+	// Short block at the end of the file.
+	ASSERT_EQ(2U, reader->read(buf, lba_len - 8, 2));
+	EXPECT_EQ(lba_start + lba_len - 8, buf[0]);
+	ASSERT_EQ(1U, reader->read(buf, lba_len - 5, 2));
+	EXPECT_EQ(lba_start + lba_len - 5, buf[0]);
+
+	delete reader;
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: CachedReader tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,256 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * ChunkStoreTest.cpp: Chunk store tests.                                  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "rvth.hpp"
+#include "ChunkStore.hpp"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+# include <dirent.h>
+# include <unistd.h>
+#endif /* !_WIN32 */
+
+// C++ includes.
+#include <string>
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+#ifndef _WIN32
+/**
+ * Extract a disc image into a chunk store twice, then read it
+ * back and remove the unreferenced chunks.
+ * NOTE: Not on Windows, since the chunk directories are removed
+ * using POSIX functions.
+ */
+TEST(ChunkStoreTest, storeImage)
+{
+	static const TCHAR gcm_filename[] = _T("ChunkStoreTest.gcm");
+	static const char store_dir[] = "ChunkStoreTest.store";
+	static const char manifest_a[] = "ChunkStoreTest.store/a.rvts";
+	static const char manifest_b[] = "ChunkStoreTest.store/b.rvts";
+
+	// GameCube disc image: disc header, followed by the LBA numbers.
+	// Chunks 64-127 are empty, and the last chunk is a partial chunk.
+	static const uint32_t chunk_lba_len = BYTES_TO_LBA(32*1024);
+	static const uint32_t lba_len = TEST_IMAGE_LBA_COUNT + 3;
+	static const uint32_t hole_start = 64 * chunk_lba_len;
+	static const uint32_t hole_end = 128 * chunk_lba_len;
+	vector<uint32_t> expected;
+	makeGcnImage(expected, lba_len, "RSTOR1", "Store Test");
+	memset(&expected[hole_start * U32_PER_LBA], 0, LBA_TO_BYTES(hole_end - hole_start));
+	const size_t size = expected.size() * sizeof(uint32_t);
+	ASSERT_TRUE(writeTestFile(gcm_filename, &expected[0], size));
+
+	// Extract the disc image twice.
+	// The second image shouldn't add any chunks.
+	int err = 0;
+	RvtH *const rvth = new RvtH(gcm_filename, &err);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(0, rvth->extract(0, manifest_a, -1, RVTH_EXTRACT_FORMAT_STORE));
+	ASSERT_EQ(0, rvth->extract(0, manifest_b, -1, RVTH_EXTRACT_FORMAT_STORE));
+	delete rvth;
+	_tremove(gcm_filename);
+
+	const uint32_t chunk_count = (lba_len + chunk_lba_len - 1) / chunk_lba_len;
+	const uint32_t empty_count = (hole_end - hole_start) / chunk_lba_len;
+	ChunkStore store(store_dir);
+	ChunkStore::Stats stats;
+	ASSERT_EQ(0, store.scan(&stats, 0));
+	EXPECT_EQ(2U, stats.manifests);
+	EXPECT_EQ(2 * static_cast<uint64_t>(size), stats.image_bytes);
+	EXPECT_EQ(chunk_count - empty_count, stats.chunks);
+	EXPECT_EQ(size - LBA_TO_BYTES((uint64_t)(hole_end - hole_start)), stats.chunk_bytes);
+	EXPECT_EQ(0U, stats.missing);
+	EXPECT_EQ(0U, stats.unreferenced);
+
+	// Read the disc image back.
+	RefFile *const f = new RefFile(manifest_a);
+	ASSERT_TRUE(f->isOpen());
+	Reader *const reader = Reader::open(f, 0, 0);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	ASSERT_TRUE(reader->isOpen());
+	EXPECT_EQ(lba_len, reader->lba_len());
+	EXPECT_EQ(0U, reader->write(&expected[0], 0, 1));
+
+	vector<uint32_t> buf(expected.size());
+	ASSERT_EQ(lba_len, reader->read(&buf[0], 0, lba_len));
+	EXPECT_EQ(0, memcmp(&buf[0], &expected[0], size));
+
+	// Empty chunks are holes.
+	uint32_t data_start = 0, data_end = 0;
+	ASSERT_EQ(0, reader->findData(1, &data_start, &data_end));
+	EXPECT_EQ(1U, data_start);
+	EXPECT_EQ(hole_start, data_end);
+	ASSERT_EQ(0, reader->findData(hole_start + 1, &data_start, &data_end));
+	EXPECT_EQ(hole_end, data_start);
+	EXPECT_EQ(lba_len, data_end);
+
+	// Random reads, including reads that cross chunk boundaries,
+	// using the original reader and a reopened reader.
+	Reader *const reader2 = reader->reopen();
+	ASSERT_TRUE(reader2 != nullptr);
+	EXPECT_TRUE(checkRandomReads(reader, reader2, expected));
+	delete reader2;
+	delete reader;
+
+	// Removing one manifest doesn't make any chunks unreferenced.
+	EXPECT_EQ(0, _tremove(manifest_b));
+	ASSERT_EQ(0, store.scan(&stats, ChunkStore::SCAN_REMOVE_UNREFERENCED));
+	EXPECT_EQ(1U, stats.manifests);
+	EXPECT_EQ(0U, stats.unreferenced);
+
+	// Removing both manifests makes all chunks unreferenced.
+	EXPECT_EQ(0, _tremove(manifest_a));
+	ASSERT_EQ(0, store.scan(&stats, ChunkStore::SCAN_REMOVE_UNREFERENCED));
+	EXPECT_EQ(0U, stats.manifests);
+	EXPECT_EQ(chunk_count - empty_count, stats.unreferenced);
+	ASSERT_EQ(0, store.scan(&stats, 0));
+	EXPECT_EQ(0U, stats.chunks);
+
+	// Remove the chunk directories.
+	const std::string chunk_dir = std::string(store_dir) + "/chunks";
+	DIR *const dir = opendir(chunk_dir.c_str());
+	ASSERT_TRUE(dir != nullptr);
+	for (struct dirent *d = readdir(dir); d != nullptr; d = readdir(dir)) {
+		if (d->d_name[0] != '.') {
+			EXPECT_EQ(0, rmdir((chunk_dir + '/' + d->d_name).c_str())) << d->d_name;
+		}
+	}
+	closedir(dir);
+	EXPECT_EQ(0, rmdir(chunk_dir.c_str()));
+	EXPECT_EQ(0, _tremove((std::string(store_dir) + "/.lock").c_str()));
+	EXPECT_EQ(0, rmdir(store_dir));
+}
+
+/**
+ * Corrupt a stored chunk. Reading the entire chunk and verifying
+ * the store should detect it. Storing the chunk again only replaces
+ * it if its size is wrong, since stored chunks aren't hashed again.
+ */
+TEST(ChunkStoreTest, corruptChunk)
+{
+	static const char store_dir[] = "ChunkStoreTest-corrupt.store";
+
+	vector<uint8_t> data(32*1024);
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = static_cast<uint8_t>(i * 7);
+	}
+	uint8_t digest[StoreManifest::DIGEST_SIZE];
+	ChunkStore::hash(digest, data.data(), data.size());
+
+	ChunkStore store(store_dir);
+	bool added = false;
+	ASSERT_EQ(0, store.put(digest, data.data(), data.size(), &added));
+	EXPECT_TRUE(added);
+	ASSERT_EQ(0, store.put(digest, data.data(), data.size(), &added));
+	EXPECT_FALSE(added);
+	EXPECT_EQ(0, store.sync());
+
+	// Corrupt one byte of the chunk without changing its size.
+	const std::string chunk_filename = store.chunkFilename(digest);
+	FILE *f = fopen(chunk_filename.c_str(), "r+b");
+	ASSERT_TRUE(f != nullptr);
+	fseek(f, 1000, SEEK_SET);
+	fputc(~data[1000], f);
+	fclose(f);
+
+	vector<uint8_t> buf(data.size());
+	EXPECT_EQ(-EIO, store.get(digest, 0, buf.data(), buf.size()));
+	// Partial reads aren't verified.
+	EXPECT_EQ(0, store.get(digest, 0, buf.data(), 512));
+
+	ChunkStore::Stats stats;
+	ASSERT_EQ(0, store.scan(&stats, ChunkStore::SCAN_VERIFY));
+	EXPECT_EQ(1U, stats.chunks);
+	EXPECT_EQ(1U, stats.corrupt);
+	ASSERT_EQ(0, store.scan(&stats, 0));
+	EXPECT_EQ(0U, stats.corrupt);
+
+	// The corrupt chunk has the right size, so it isn't replaced.
+	ASSERT_EQ(0, store.put(digest, data.data(), data.size(), &added));
+	EXPECT_FALSE(added);
+
+	// A truncated chunk is replaced.
+	ASSERT_EQ(0, truncate(chunk_filename.c_str(), 4096));
+	ASSERT_EQ(0, store.put(digest, data.data(), data.size(), &added));
+	EXPECT_TRUE(added);
+	EXPECT_EQ(0, store.sync());
+	ASSERT_EQ(0, store.get(digest, 0, buf.data(), buf.size()));
+	EXPECT_TRUE(buf == data);
+	ASSERT_EQ(0, store.scan(&stats, ChunkStore::SCAN_VERIFY));
+	EXPECT_EQ(0U, stats.corrupt);
+
+	EXPECT_EQ(0, _tremove(chunk_filename.c_str()));
+	const std::string subdir = chunk_filename.substr(0, chunk_filename.rfind('/'));
+	EXPECT_EQ(0, rmdir(subdir.c_str()));
+	EXPECT_EQ(0, rmdir((std::string(store_dir) + "/chunks").c_str()));
+	EXPECT_EQ(0, rmdir(store_dir));
+}
+
+/**
+ * Unreferenced chunks can't be removed while a disc image
+ * is being added to the store.
+ */
+TEST(ChunkStoreTest, gcLock)
+{
+	static const char store_dir[] = "ChunkStoreTest-lock.store";
+	ChunkStore store(store_dir);
+	ChunkStore::Stats stats;
+
+	// Locking for removal doesn't create the store.
+	EXPECT_EQ(-ENOENT, store.scan(&stats, ChunkStore::SCAN_REMOVE_UNREFERENCED));
+
+	{
+		const ChunkStore::Lock lock(store, false, true);
+		ASSERT_EQ(0, lock.error());
+		EXPECT_EQ(-EBUSY, store.scan(&stats, ChunkStore::SCAN_REMOVE_UNREFERENCED));
+		EXPECT_EQ(0, store.scan(&stats, 0));
+
+		// Shared locks don't block each other.
+		const ChunkStore::Lock lock2(store, false, false);
+		EXPECT_EQ(0, lock2.error());
+	}
+
+	EXPECT_EQ(0, store.scan(&stats, ChunkStore::SCAN_REMOVE_UNREFERENCED));
+
+	EXPECT_EQ(0, _tremove((std::string(store_dir) + "/.lock").c_str()));
+	EXPECT_EQ(0, rmdir(store_dir));
+}
+#endif /* !_WIN32 */
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Chunk store tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,111 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * CisoReaderBenchmark.cpp: CisoReader read throughput benchmark.          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Benchmark
+#include <benchmark/benchmark.h>
+
+#include "RefFile.hpp"
+#include "nhcd_structs.h"
+#include "reader/CisoReader.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+// Test image parameters.
+// NOTE: Every fourth block is left empty to exercise the zero-fill path.
+#define BENCH_CISO_FILENAME	_T("CisoReaderBenchmark.ciso")
+#define BENCH_CISO_BLOCK_SIZE	(2U*1024U*1024U)
+#define BENCH_CISO_BLOCK_COUNT	64U
+#define BENCH_BUF_SIZE		(1024U*1024U)
+
+/**
+ * Create the test CISO image.
+ * @return 0 on success; non-zero on error.
+ */
+static int createCisoImage(void)
+{
+	RefFile *f = new RefFile(BENCH_CISO_FILENAME, true);
+	if (!f->isOpen()) {
+		f->unref();
+		return -1;
+	}
+
+	// CISO header: magic, LE32 block size, and the block map.
+	vector<uint8_t> header(0x8000);
+	memcpy(&header[0], "CISO", 4);
+	header[4] = (BENCH_CISO_BLOCK_SIZE      ) & 0xFF;
+	header[5] = (BENCH_CISO_BLOCK_SIZE >>  8) & 0xFF;
+	header[6] = (BENCH_CISO_BLOCK_SIZE >> 16) & 0xFF;
+	header[7] = (BENCH_CISO_BLOCK_SIZE >> 24) & 0xFF;
+	unsigned int physBlockCount = 0;
+	for (unsigned int i = 0; i < BENCH_CISO_BLOCK_COUNT; i++) {
+		if ((i & 3) != 3) {
+			header[8 + i] = 1;
+			physBlockCount++;
+		}
+	}
+	f->pwriteAt(0, &header[0], header.size());
+
+	// Block data.
+	vector<uint8_t> block(BENCH_CISO_BLOCK_SIZE);
+	for (unsigned int i = 0; i < physBlockCount; i++) {
+		memset(&block[0], 0x20 + i, block.size());
+		f->pwriteAt(header.size() + ((int64_t)i * block.size()), &block[0], block.size());
+	}
+
+	f->unref();
+	return 0;
+}
+
+/**
+ * Read the entire CISO image in 1 MB chunks,
+ * like RvtH::copyToGcm() does.
+ */
+static void BM_CisoReader_read(benchmark::State &state)
+{
+	if (createCisoImage() != 0) {
+		state.SkipWithError("Unable to create the test CISO image.");
+		return;
+	}
+
+	RefFile *f = new RefFile(BENCH_CISO_FILENAME);
+	CisoReader *reader = new CisoReader(f, 0, 0);
+	f->unref();
+	if (!reader->isOpen()) {
+		delete reader;
+		_tremove(BENCH_CISO_FILENAME);
+		state.SkipWithError("Unable to open the test CISO image.");
+		return;
+	}
+
+	vector<uint8_t> buf(BENCH_BUF_SIZE);
+	const uint32_t lba_len = reader->lba_len();
+	const uint32_t lba_count_buf = BYTES_TO_LBA(BENCH_BUF_SIZE);
+	for (auto _ : state) {
+		for (uint32_t lba = 0; lba < lba_len; lba += lba_count_buf) {
+			uint32_t lba_read = reader->read(&buf[0], lba, lba_count_buf);
+			benchmark::DoNotOptimize(lba_read);
+		}
+	}
+	state.SetBytesProcessed(state.iterations() * LBA_TO_BYTES(lba_len));
+
+	delete reader;
+	_tremove(BENCH_CISO_FILENAME);
+}
+BENCHMARK(BM_CisoReader_read)->Unit(benchmark::kMillisecond);
+
+} }
+
+BENCHMARK_MAIN();
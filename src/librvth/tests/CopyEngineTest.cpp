@@ -0,0 +1,198 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * CopyEngineTest.cpp: CopyEngine tests.                                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "CopyEngine.hpp"
+#include "rvth.hpp"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+# include <unistd.h>
+#endif /* !_WIN32 */
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+class CopyEngineTest : public LbaImageTest
+{
+	protected:
+		CopyEngineTest()
+			: LbaImageTest(_T("CopyEngineTest.img")) { }
+};
+
+/**
+ * Copy the test image through a CopyEngine with an odd chunk size,
+ * so the last chunk is partial. Every fifth chunk is reported as a hole.
+ */
+TEST_F(CopyEngineTest, copyWithHoles)
+{
+	static const uint32_t chunkLBAs = 100;
+	Reader *const src = Reader::open(m_file, 0, TEST_IMAGE_LBA_COUNT);
+	ASSERT_TRUE(src != nullptr);
+
+	vector<uint32_t> dest(TEST_IMAGE_LBA_COUNT * U32_PER_LBA, 0xFFFFFFFFU);
+	CopyEngine engine(3, chunkLBAs);
+	ASSERT_TRUE(engine.isValid());
+
+	uint32_t lba_next = 0;
+	int ret = engine.run(0, TEST_IMAGE_LBA_COUNT,
+		[src](uint32_t lba, uint32_t count, uint8_t *buf) -> int {
+			if ((lba / chunkLBAs) % 5 == 4) {
+				return CopyEngine::READ_HOLE;
+			}
+			return (src->read(buf, lba, count) == count ? 0 : -EIO);
+		},
+		[&dest, &lba_next](uint32_t lba, uint32_t count, const uint8_t *buf) -> int {
+			// Chunks must be written in order.
+			if (lba != lba_next)
+				return -EINVAL;
+			lba_next = lba + count;
+
+			uint8_t *const p = reinterpret_cast<uint8_t*>(&dest[lba * U32_PER_LBA]);
+			if (buf) {
+				memcpy(p, buf, LBA_TO_BYTES(count));
+			} else {
+				memset(p, 0, LBA_TO_BYTES(count));
+			}
+			return 0;
+		});
+	EXPECT_EQ(0, ret);
+	EXPECT_EQ(TEST_IMAGE_LBA_COUNT, lba_next);
+
+	for (uint32_t lba = 0; lba < TEST_IMAGE_LBA_COUNT; lba++) {
+		const uint32_t expected = ((lba / chunkLBAs) % 5 == 4 ? 0 : lba);
+		ASSERT_EQ(expected, dest[lba * U32_PER_LBA]) << "lba == " << lba;
+	}
+
+	// Cancel partway through.
+	unsigned int writes = 0;
+	ret = engine.run(0, TEST_IMAGE_LBA_COUNT,
+		[src](uint32_t lba, uint32_t count, uint8_t *buf) -> int {
+			return (src->read(buf, lba, count) == count ? 0 : -EIO);
+		},
+		[&writes](uint32_t, uint32_t, const uint8_t*) -> int {
+			writes++;
+			return 0;
+		},
+		[](uint32_t lba) -> bool {
+			return (lba < 10 * chunkLBAs);
+		});
+	EXPECT_EQ(-ECANCELED, ret);
+	EXPECT_EQ(10U, writes);
+
+	delete src;
+}
+
+/**
+ * Copy the test image through a CopyEngine with a read error
+ * partway through. The error must be returned by run(), and
+ * nothing after the failed chunk may be written.
+ */
+TEST_F(CopyEngineTest, readError)
+{
+	static const uint32_t chunkLBAs = 100;
+	static const uint32_t badLBA = 20 * chunkLBAs;
+	Reader *const src = Reader::open(m_file, 0, TEST_IMAGE_LBA_COUNT);
+	ASSERT_TRUE(src != nullptr);
+
+	CopyEngine engine(3, chunkLBAs);
+	ASSERT_TRUE(engine.isValid());
+
+	uint32_t lba_next = 0;
+	const int ret = engine.run(0, TEST_IMAGE_LBA_COUNT,
+		[src](uint32_t lba, uint32_t count, uint8_t *buf) -> int {
+			if (lba == badLBA) {
+				return -EIO;
+			}
+			return (src->read(buf, lba, count) == count ? 0 : -EIO);
+		},
+		[&lba_next](uint32_t lba, uint32_t count, const uint8_t*) -> int {
+			lba_next = lba + count;
+			return 0;
+		});
+	EXPECT_EQ(-EIO, ret);
+	EXPECT_LE(lba_next, badLBA);
+
+	delete src;
+}
+
+#ifndef _WIN32
+/**
+ * Extract a CISO image whose file was truncated after it was opened.
+ * The read error must be reported instead of writing a destination
+ * image with missing data.
+ * CISO images aren't linear, so the copy engine is used instead of
+ * copy offloading.
+ * NOTE: Not on Windows, since the file is truncated using truncate().
+ */
+TEST(CopyEngineExtractTest, readError)
+{
+	static const char ciso_filename[] = "CopyEngineTest.ciso";
+	static const char gcm_filename[] = "CopyEngineTest.gcm";
+	static const uint32_t ciso_header_size = 0x8000;
+	static const uint32_t ciso_block_size = 0x8000;
+
+	// CISO image with all blocks used.
+	vector<uint32_t> image;
+	makeGcnImage(image, TEST_IMAGE_LBA_COUNT, "RCOPY1", "Copy Engine Test");
+	const size_t image_size = image.size() * sizeof(uint32_t);
+	vector<uint8_t> ciso(ciso_header_size + image_size);
+	memcpy(&ciso[0], "CISO", 4);
+	ciso[4] = ciso_block_size & 0xFF;
+	ciso[5] = (ciso_block_size >> 8) & 0xFF;
+	ciso[6] = (ciso_block_size >> 16) & 0xFF;
+	ciso[7] = (ciso_block_size >> 24) & 0xFF;
+	memset(&ciso[8], 1, image_size / ciso_block_size);
+	memcpy(&ciso[ciso_header_size], &image[0], image_size);
+	ASSERT_TRUE(writeTestFile(ciso_filename, &ciso[0], ciso.size()));
+
+	int err = 0;
+	RvtH *const rvth = new RvtH(ciso_filename, &err);
+	ASSERT_EQ(0, err);
+
+	// Truncate the image in the middle of the disc image.
+	ASSERT_EQ(0, truncate(ciso_filename, ciso_header_size + (image_size / 2)));
+	err = rvth->extract(0, gcm_filename, -1, 0);
+	EXPECT_NE(0, err);
+	delete rvth;
+
+	_tremove(gcm_filename);
+	_tremove(ciso_filename);
+}
+#endif /* !_WIN32 */
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: CopyEngine tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
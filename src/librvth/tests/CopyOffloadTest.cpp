@@ -0,0 +1,129 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * CopyOffloadTest.cpp: Copy offloading tests.                             *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "rvth.hpp"
+#include "ReadScheduler.hpp"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+
+// C++ includes.
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+class CopyOffloadTest : public LbaImageTest
+{
+	protected:
+		CopyOffloadTest()
+			: LbaImageTest(_T("CopyOffloadTest.img")) { }
+};
+
+/**
+ * Scheduled streams must not be offloaded, since that would
+ * bypass the ReadScheduler, so they aren't linear.
+ */
+TEST_F(CopyOffloadTest, scheduledStreamsNotLinear)
+{
+	Reader *const src = Reader::open(m_file, 0, TEST_IMAGE_LBA_COUNT);
+	ASSERT_TRUE(src != nullptr);
+	EXPECT_TRUE(src->isLinear());
+
+	ReadScheduler sched(64, 2);
+	Reader *const reader = sched.addStream(src);
+	ASSERT_TRUE(reader != nullptr);
+	EXPECT_FALSE(reader->isLinear());
+
+	delete reader;
+	delete src;
+}
+
+#ifndef _WIN32
+/**
+ * Extract a GameCube disc image with a hole from an RVT-H HDD image.
+ * RVT-H banks aren't aligned to the file system block size, so the
+ * data regions can't be cloned and must be copied instead.
+ * NOTE: Not on Windows, since the HDD image is a large sparse file.
+ */
+TEST(CopyOffloadHddTest, misalignedBank)
+{
+	static const char hdd_filename[] = "CopyOffloadTest.hdd";
+	static const char gcm_filename[] = "CopyOffloadTest-bank2.gcm";
+	static const uint32_t bank = 1;
+	static const uint32_t lba_len = TEST_IMAGE_LBA_COUNT;
+	static const uint32_t hole_start = 1000;
+	static const uint32_t hole_end = 5000;
+
+	// The source offset is 512 bytes off a 4 KB boundary.
+	ASSERT_NE(0U, LBA_TO_BYTES(NHCD_BANK_START_LBA(bank, NHCD_BANK_COUNT)) % 4096U);
+
+	// GameCube disc image with a 2 MB hole in the middle.
+	vector<uint32_t> image;
+	makeGcnImage(image, lba_len, "ROFFL1", "Offload Test");
+	std::fill(image.begin() + hole_start * U32_PER_LBA,
+		  image.begin() + hole_end * U32_PER_LBA, 0);
+	ASSERT_TRUE(writeHddImage(hdd_filename, bank, NHCD_BankType_GCN, &image[0], lba_len));
+
+	int err = 0;
+	RvtH *const rvth = new RvtH(hdd_filename, &err);
+	ASSERT_EQ(0, err);
+	err = rvth->extract(bank, gcm_filename, -1, 0);
+	delete rvth;
+	EXPECT_EQ(0, err);
+
+	// Compare the extracted image.
+	RefFile *const f = new RefFile(gcm_filename);
+	ASSERT_TRUE(f->isOpen());
+	EXPECT_EQ(static_cast<int64_t>(LBA_TO_BYTES(lba_len)), f->size());
+	vector<uint32_t> buf(image.size());
+	const size_t size = image.size() * sizeof(uint32_t);
+	EXPECT_EQ(size, f->preadAt(0, &buf[0], size));
+	EXPECT_TRUE(buf == image);
+
+	// The hole should still be a hole, if holes can be detected.
+	int64_t data_start, data_end;
+	if (f->findDataRegion(LBA_TO_BYTES(hole_start + 256), &data_start, &data_end) == 0) {
+		EXPECT_GT(data_start, static_cast<int64_t>(LBA_TO_BYTES(hole_start + 256)));
+	}
+	f->unref();
+
+	_tremove(gcm_filename);
+	_tremove(hdd_filename);
+}
+#endif /* !_WIN32 */
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Copy offloading tests.\n\n");
+	fflush(nullptr);
+
+	// Don't write bank metadata cache files for the test HDD images.
+	rvth_io_set_bank_cache(0);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
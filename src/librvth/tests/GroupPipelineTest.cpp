@@ -0,0 +1,149 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * GroupPipelineTest.cpp: Group processing pipeline tests.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "GroupPipeline.hpp"
+#include "wii_crypt.h"
+#include "libwiicrypto/aesw.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+// Number of groups to encrypt.
+#define TEST_GROUP_COUNT 12U
+
+/**
+ * Encrypt groups using a GroupPipeline.
+ * This uses the same stages as RvtH::copyToGcm_doCrypt().
+ * @param workerCount	[in] Number of worker threads.
+ * @param key		[in] Title key.
+ * @param dec		[in] Decrypted groups. (TEST_GROUP_COUNT * GROUP_SIZE_DEC)
+ * @param enc		[out] Encrypted groups. (TEST_GROUP_COUNT * GROUP_SIZE_ENC)
+ * @param h3		[out] H3 hashes. (TEST_GROUP_COUNT * SHA1_DIGEST_SIZE)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int encryptGroups(unsigned int workerCount, const uint8_t *key,
+	const vector<uint8_t> &dec, vector<uint8_t> &enc, vector<uint8_t> &h3)
+{
+	enc.assign((size_t)TEST_GROUP_COUNT * GROUP_SIZE_ENC, 0);
+	h3.assign(TEST_GROUP_COUNT * SHA1_DIGEST_SIZE, 0);
+
+	GroupPipeline pipeline(workerCount, GROUP_SIZE_DEC, GROUP_SIZE_ENC + SHA1_DIGEST_SIZE);
+	if (!pipeline.isValid()) {
+		return -ENOMEM;
+	}
+	EXPECT_EQ(workerCount, pipeline.workerCount());
+
+	vector<AesCtx*> aesw(pipeline.workerCount(), nullptr);
+	for (AesCtx *&ctx : aesw) {
+		ctx = aesw_new();
+		if (!ctx) {
+			for (AesCtx *ctx2 : aesw) {
+				aesw_free(ctx2);
+			}
+			return -ENOMEM;
+		}
+		aesw_set_key(ctx, key, 16);
+	}
+
+	unsigned int nextIdx = 0;
+	const int ret = pipeline.run(TEST_GROUP_COUNT,
+		[&dec](unsigned int idx, uint8_t *inBuf) -> int {
+			memcpy(inBuf, &dec[(size_t)idx * GROUP_SIZE_DEC], GROUP_SIZE_DEC);
+			return 0;
+		},
+		[&aesw](unsigned int workerIdx, unsigned int, uint8_t *inBuf, uint8_t *outBuf) -> int {
+			return rvth_encrypt_group(aesw[workerIdx], inBuf, GROUP_SIZE_DEC,
+				outBuf, GROUP_SIZE_ENC, &outBuf[GROUP_SIZE_ENC], SHA1_DIGEST_SIZE);
+		},
+		[&enc, &h3, &nextIdx](unsigned int idx, const uint8_t*, const uint8_t *outBuf) -> int {
+			// Groups must be written in order.
+			EXPECT_EQ(nextIdx, idx);
+			nextIdx++;
+			memcpy(&enc[(size_t)idx * GROUP_SIZE_ENC], outBuf, GROUP_SIZE_ENC);
+			memcpy(&h3[idx * SHA1_DIGEST_SIZE], &outBuf[GROUP_SIZE_ENC], SHA1_DIGEST_SIZE);
+			return 0;
+		});
+	EXPECT_EQ(TEST_GROUP_COUNT, nextIdx);
+
+	for (AesCtx *ctx : aesw) {
+		aesw_free(ctx);
+	}
+	return ret;
+}
+
+/**
+ * Encrypt groups using one worker thread and using multiple
+ * worker threads. The encrypted groups and H3 hashes must be
+ * identical.
+ */
+TEST(GroupPipelineTest, encryptThreadCounts)
+{
+	static const uint8_t key[16] = {0x01,0x23,0x45,0x67,0x89,0xAB,0xCD,0xEF,0xFE,0xDC,0xBA,0x98,0x76,0x54,0x32,0x10};
+
+	// Each group has different contents.
+	vector<uint8_t> dec((size_t)TEST_GROUP_COUNT * GROUP_SIZE_DEC);
+	for (size_t i = 0; i < dec.size(); i++) {
+		dec[i] = static_cast<uint8_t>((i >> 10) ^ (i / GROUP_SIZE_DEC) ^ i);
+	}
+
+	// Single worker thread.
+	vector<uint8_t> enc1, h3_1;
+	ASSERT_EQ(0, encryptGroups(1, key, dec, enc1, h3_1));
+
+	// The first group must match a group encrypted without the pipeline.
+	vector<uint8_t> enc0(GROUP_SIZE_ENC);
+	uint8_t h3_0[SHA1_DIGEST_SIZE];
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+	aesw_set_key(aesw, key, sizeof(key));
+	ASSERT_EQ(0, rvth_encrypt_group(aesw, &dec[0], GROUP_SIZE_DEC,
+		&enc0[0], enc0.size(), h3_0, sizeof(h3_0)));
+	aesw_free(aesw);
+	EXPECT_EQ(0, memcmp(&enc1[0], &enc0[0], enc0.size()));
+	EXPECT_EQ(0, memcmp(&h3_1[0], h3_0, sizeof(h3_0)));
+
+	// Multiple worker threads.
+	for (unsigned int workerCount : {2U, 4U, 7U}) {
+		vector<uint8_t> encN, h3_N;
+		ASSERT_EQ(0, encryptGroups(workerCount, key, dec, encN, h3_N));
+		EXPECT_TRUE(encN == enc1) << "workerCount == " << workerCount;
+		EXPECT_TRUE(h3_N == h3_1) << "workerCount == " << workerCount;
+	}
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Group processing pipeline tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
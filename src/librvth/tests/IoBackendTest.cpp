@@ -0,0 +1,95 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * IoBackendTest.cpp: I/O backend tests.                                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "aligned_malloc.h"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+namespace LibRvth { namespace Tests {
+
+class IoBackendTest : public LbaImageTest
+{
+	protected:
+		IoBackendTest()
+			: LbaImageTest(_T("IoBackendTest.img")) { }
+};
+
+/**
+ * Read and write the whole image with each I/O backend.
+ */
+TEST_F(IoBackendTest, readWrite)
+{
+	static const struct {
+		RvtH_IO_Backend_e backend;
+		unsigned int flags;
+	} modes[] = {
+		{RVTH_IO_BACKEND_SYNC, 0},
+		{RVTH_IO_BACKEND_URING, 0},
+		{RVTH_IO_BACKEND_URING, RVTH_IO_FLAG_DIRECT},
+	};
+
+	unsigned int old_depth, old_flags;
+	const RvtH_IO_Backend_e old_backend = rvth_io_get_backend(&old_depth, &old_flags);
+	ASSERT_EQ(0, m_file->makeWritable());
+
+	const size_t size = LBA_TO_BYTES(TEST_IMAGE_LBA_COUNT);
+	uint32_t *const buf = static_cast<uint32_t*>(aligned_malloc(RVTH_IO_DIRECT_ALIGNMENT, size));
+	ASSERT_TRUE(buf != nullptr);
+
+	for (const auto &mode : modes) {
+		if (!rvth_io_backend_is_supported(mode.backend))
+			continue;
+		ASSERT_EQ(0, rvth_io_set_backend(mode.backend, 4, mode.flags));
+
+		Reader *const reader = Reader::open(m_file, 0, TEST_IMAGE_LBA_COUNT);
+		ASSERT_TRUE(reader != nullptr);
+		for (int pass = 0; pass < 2; pass++) {
+			memset(buf, 0xFF, size);
+			ASSERT_EQ(TEST_IMAGE_LBA_COUNT, reader->read(buf, 0, TEST_IMAGE_LBA_COUNT));
+			for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+				ASSERT_EQ(i / U32_PER_LBA, buf[i])
+					<< "backend == " << mode.backend << ", flags == " << mode.flags << ", i == " << i;
+			}
+
+			// Write the data back, then check it again.
+			ASSERT_EQ(TEST_IMAGE_LBA_COUNT, reader->write(buf, 0, TEST_IMAGE_LBA_COUNT));
+		}
+		delete reader;
+	}
+
+	aligned_free(buf);
+	rvth_io_set_backend(old_backend, old_depth, old_flags);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: I/O backend tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * MmapReaderTest.cpp: Memory-mapped Reader tests.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+class MmapReaderTest : public LbaImageTest
+{
+	protected:
+		MmapReaderTest()
+			: LbaImageTest(_T("MmapReaderTest.img")) { }
+};
+
+/**
+ * Borrow data from a Reader using map().
+ */
+TEST_F(MmapReaderTest, mapOrRead)
+{
+	static const uint32_t lba_start = 1000;
+	Reader *const reader = Reader::open(m_file, lba_start, TEST_IMAGE_LBA_COUNT - lba_start);
+	ASSERT_TRUE(reader != nullptr);
+
+	const uint8_t *const p = reader->map(10, 20);
+	if (!p) {
+		// Memory-mapped Readers aren't available.
+		EXPECT_EQ(ENOTSUP, errno);
+	} else {
+		for (uint32_t lba = 0; lba < 20; lba++) {
+			uint32_t val;
+			memcpy(&val, &p[LBA_TO_BYTES(lba)], sizeof(val));
+			EXPECT_EQ(lba_start + 10 + lba, val);
+		}
+	}
+
+	// mapOrRead() works either way.
+	vector<uint32_t> buf(U32_PER_LBA);
+	const uint32_t *const q = static_cast<const uint32_t*>(reader->mapOrRead(&buf[0], 5, 1));
+	ASSERT_TRUE(q != nullptr);
+	EXPECT_EQ(lba_start + 5, q[0]);
+
+	delete reader;
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Memory-mapped Reader tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
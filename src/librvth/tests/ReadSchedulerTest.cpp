@@ -0,0 +1,127 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * ReadSchedulerTest.cpp: ReadScheduler tests.                             *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "ReadScheduler.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+
+// C++ includes.
+#include <atomic>
+#include <thread>
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+class ReadSchedulerTest : public LbaImageTest
+{
+	protected:
+		ReadSchedulerTest()
+			: LbaImageTest(_T("ReadSchedulerTest.img")) { }
+};
+
+/**
+ * Read multiple streams through a ReadScheduler from many threads.
+ * Reads are mostly sequential, with some backwards and skipping reads.
+ */
+TEST_F(ReadSchedulerTest, scheduledStreams)
+{
+	static const unsigned int streamCount = 4;
+	static const uint32_t streamLen = TEST_IMAGE_LBA_COUNT / streamCount;
+
+	vector<Reader*> srcs;
+	vector<Reader*> readers;
+	ReadScheduler sched(64, 2);
+	for (unsigned int i = 0; i < streamCount; i++) {
+		Reader *const src = Reader::open(m_file, i * streamLen, streamLen);
+		ASSERT_TRUE(src != nullptr);
+		srcs.push_back(src);
+		Reader *const reader = sched.addStream(src);
+		ASSERT_TRUE(reader != nullptr);
+		readers.push_back(reader);
+	}
+	sched.start();
+
+	std::atomic<unsigned int> errors(0);
+	vector<std::thread> threads;
+	for (unsigned int i = 0; i < streamCount; i++) {
+		threads.push_back(std::thread([&readers, &errors, i]() {
+			Reader *const reader = readers[i];
+			vector<uint32_t> buf(100 * U32_PER_LBA);
+			unsigned int seed = i + 1;
+			uint32_t lba = 0;
+			while (lba < streamLen) {
+				seed = seed * 1103515245U + 12345U;
+				uint32_t len = 1 + ((seed >> 8) % 100);
+				if (len > streamLen - lba) {
+					len = streamLen - lba;
+				}
+				uint32_t lba_read = lba;
+				if ((seed >> 16) % 16 == 0 && lba >= 200) {
+					// Backwards read.
+					lba_read = lba - 200;
+				} else if ((seed >> 16) % 16 == 1 && lba + 300 + len <= streamLen) {
+					// Skip ahead.
+					lba_read = lba = lba + 300;
+				}
+
+				if (reader->read(buf.data(), lba_read, len) != len) {
+					errors++;
+					break;
+				}
+				for (uint32_t j = 0; j < len; j++) {
+					if (buf[j * U32_PER_LBA] != (i * streamLen) + lba_read + j) {
+						errors++;
+						break;
+					}
+				}
+				if (lba_read == lba) {
+					lba += len;
+				}
+			}
+		}));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	EXPECT_EQ(0U, errors.load());
+
+	for (Reader *reader : readers) {
+		delete reader;
+	}
+	sched.stop();
+	for (Reader *src : srcs) {
+		delete src;
+	}
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: ReadScheduler tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
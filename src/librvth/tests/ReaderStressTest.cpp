@@ -0,0 +1,174 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * ReaderStressTest.cpp: Multi-threaded Reader/RefFile stress test.        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "RefFile.hpp"
+#include "nhcd_structs.h"
+#include "reader/Reader.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <atomic>
+#include <thread>
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+// Test image parameters.
+#define STRESS_IMAGE_FILENAME	_T("ReaderStressTest.img")
+#define STRESS_IMAGE_LBA_COUNT	8192U
+#define STRESS_THREAD_COUNT	16U
+#define STRESS_ITERATIONS	500U
+#define STRESS_READ_LBA_COUNT	8U
+
+class ReaderStressTest : public ::testing::Test
+{
+	protected:
+		ReaderStressTest()
+			: m_file(nullptr) { }
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Worker thread function.
+		 * Creates readers, reads data, and destroys readers.
+		 * @param seed		[in] Random seed.
+		 * @param errors	[out] Error counter.
+		 */
+		void worker(unsigned int seed, std::atomic<unsigned int> *errors);
+
+	protected:
+		RefFile *m_file;
+};
+
+/**
+ * Create the test image.
+ * Each LBA is filled with its own LBA number.
+ */
+void ReaderStressTest::SetUp(void)
+{
+	RefFile *f = new RefFile(STRESS_IMAGE_FILENAME, true);
+	ASSERT_TRUE(f->isOpen());
+
+	vector<uint32_t> buf(STRESS_IMAGE_LBA_COUNT * (LBA_SIZE / sizeof(uint32_t)));
+	for (size_t i = 0; i < buf.size(); i++) {
+		buf[i] = static_cast<uint32_t>(i / (LBA_SIZE / sizeof(uint32_t)));
+	}
+	const size_t size = buf.size() * sizeof(uint32_t);
+	ASSERT_EQ(size, f->pwriteAt(0, &buf[0], size));
+	f->unref();
+
+	m_file = new RefFile(STRESS_IMAGE_FILENAME);
+	ASSERT_TRUE(m_file->isOpen());
+}
+
+void ReaderStressTest::TearDown(void)
+{
+	if (m_file) {
+		m_file->unref();
+		m_file = nullptr;
+	}
+	_tremove(STRESS_IMAGE_FILENAME);
+}
+
+/**
+ * Worker thread function.
+ * Creates readers, reads data, and destroys readers.
+ * @param seed		[in] Random seed.
+ * @param errors	[out] Error counter.
+ */
+void ReaderStressTest::worker(unsigned int seed, std::atomic<unsigned int> *errors)
+{
+	uint32_t buf[STRESS_READ_LBA_COUNT * (LBA_SIZE / sizeof(uint32_t))];
+
+	for (unsigned int i = 0; i < STRESS_ITERATIONS; i++) {
+		// Simple LCG for reproducible per-thread offsets.
+		seed = seed * 1103515245U + 12345U;
+		const uint32_t lba_start = (seed >> 8) % (STRESS_IMAGE_LBA_COUNT / 2);
+		const uint32_t lba_len = STRESS_IMAGE_LBA_COUNT - lba_start;
+
+		Reader *const reader = Reader::open(m_file, lba_start, lba_len);
+		if (!reader || !reader->isOpen()) {
+			delete reader;
+			(*errors)++;
+			continue;
+		}
+
+		// Take and release extra references while other threads do the same.
+		RefFile *const extra = m_file->ref();
+
+		const uint32_t lba_read = (seed >> 4) % (lba_len - STRESS_READ_LBA_COUNT);
+		if (reader->read(buf, lba_read, STRESS_READ_LBA_COUNT) != STRESS_READ_LBA_COUNT) {
+			(*errors)++;
+		} else {
+			for (unsigned int j = 0; j < ARRAY_SIZE(buf); j++) {
+				const uint32_t expected = lba_start + lba_read + (j / (LBA_SIZE / sizeof(uint32_t)));
+				if (buf[j] != expected) {
+					(*errors)++;
+					break;
+				}
+			}
+		}
+
+		extra->unref();
+		delete reader;
+	}
+}
+
+/**
+ * Create and destroy Readers sharing a single RefFile from many threads.
+ */
+TEST_F(ReaderStressTest, concurrentReaders)
+{
+	std::atomic<unsigned int> errors(0);
+
+	vector<std::thread> threads;
+	for (unsigned int i = 0; i < STRESS_THREAD_COUNT; i++) {
+		threads.push_back(std::thread(&ReaderStressTest::worker, this, i + 1, &errors));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	EXPECT_EQ(0U, errors.load());
+
+	// All references taken by the workers must have been released,
+	// and the original reference must still be valid.
+	uint32_t lba0[LBA_SIZE / sizeof(uint32_t)];
+	EXPECT_EQ(sizeof(lba0), m_file->preadAt(LBA_TO_BYTES(1), lba0, sizeof(lba0)));
+	EXPECT_EQ(1U, lba0[0]);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Reader stress tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
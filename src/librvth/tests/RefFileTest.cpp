@@ -0,0 +1,89 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * RefFileTest.cpp: RefFile tests.                                         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "aligned_malloc.h"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+class RefFileTest : public LbaImageTest
+{
+	protected:
+		RefFileTest()
+			: LbaImageTest(_T("RefFileTest.img")) { }
+};
+
+/**
+ * Write aligned and unaligned data with unbuffered writes enabled.
+ */
+TEST_F(RefFileTest, unbufferedWrites)
+{
+	ASSERT_EQ(0, m_file->makeWritable());
+	if (m_file->setUnbuffered(true) != 0) {
+		// O_DIRECT isn't supported here.
+		return;
+	}
+	ASSERT_TRUE(m_file->isUnbuffered());
+
+	static const size_t size = 65536;
+	uint8_t *const buf = static_cast<uint8_t*>(aligned_malloc(RVTH_IO_DIRECT_ALIGNMENT, size));
+	ASSERT_TRUE(buf != nullptr);
+	vector<uint8_t> verify(size);
+
+	// Aligned write. (O_DIRECT)
+	memset(buf, 0x5A, size);
+	EXPECT_EQ(size, m_file->pwriteAt(size, buf, size));
+	EXPECT_EQ(size, m_file->preadAt(size, &verify[0], size));
+	EXPECT_EQ(0, memcmp(buf, &verify[0], size));
+
+	// Unaligned write. (buffered, then synced)
+	memset(buf, 0xA5, LBA_SIZE);
+	EXPECT_EQ(static_cast<size_t>(LBA_SIZE), m_file->pwriteAt(size + LBA_SIZE, buf, LBA_SIZE));
+	EXPECT_EQ(static_cast<size_t>(LBA_SIZE), m_file->preadAt(size + LBA_SIZE, &verify[0], LBA_SIZE));
+	EXPECT_EQ(0, memcmp(buf, &verify[0], LBA_SIZE));
+
+	// The rest of the aligned write must not be affected.
+	EXPECT_EQ(static_cast<size_t>(LBA_SIZE), m_file->preadAt(size, &verify[0], LBA_SIZE));
+	EXPECT_EQ(0x5A, verify[0]);
+	EXPECT_EQ(0x5A, verify[LBA_SIZE - 1]);
+
+	aligned_free(buf);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: RefFile tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
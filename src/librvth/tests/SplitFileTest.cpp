@@ -0,0 +1,115 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * SplitFileTest.cpp: Split file tests.                                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+#include <string>
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+/**
+ * Write a split file, then read it back through a Reader.
+ */
+TEST(SplitFileTest, readWrite)
+{
+	static const TCHAR split_filename[] = _T("SplitFileTest.split");
+	static const uint32_t part_lba = BYTES_TO_LBA(64*1024);
+	static const uint32_t lba_len = 5 * part_lba + 7;
+
+	vector<uint32_t> expected(lba_len * U32_PER_LBA, 0);
+	for (uint32_t lba = 0; lba < lba_len; lba++) {
+		// Part 2 is left empty.
+		if (lba / part_lba != 2) {
+			expected[lba * U32_PER_LBA] = lba + 1;
+		}
+	}
+
+	// Create the split file. Writes cross part boundaries.
+	ASSERT_EQ(0, rvth_io_set_split_size(64*1024));
+	RefFile *f = new RefFile(split_filename, true);
+	ASSERT_EQ(0, rvth_io_set_split_size(0));
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_TRUE(f->isSplit());
+	EXPECT_EQ(-1, f->fd());
+	Reader *reader = Reader::open(f, 0, lba_len);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	for (uint32_t lba = 0; lba < lba_len; lba += 24) {
+		const uint32_t count = std::min<uint32_t>(24, lba_len - lba);
+		if ((lba + count - 1) / part_lba == 2 && lba / part_lba == 2)
+			continue;
+		ASSERT_EQ(count, reader->write(&expected[lba * U32_PER_LBA], lba, count));
+	}
+	delete reader;
+
+	// Open the split file using the first part.
+	const std::tstring part0 = std::tstring(split_filename) + _T(".part0");
+	f = new RefFile(part0.c_str());
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_TRUE(f->isSplit());
+	EXPECT_EQ(LBA_TO_BYTES((int64_t)lba_len), f->size());
+	reader = Reader::open(f, 0, 0);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	ASSERT_TRUE(reader->isOpen());
+	ASSERT_EQ(lba_len, reader->lba_len());
+
+	vector<uint32_t> buf(expected.size());
+	ASSERT_EQ(lba_len, reader->read(&buf[0], 0, lba_len));
+	EXPECT_EQ(0, memcmp(&buf[0], &expected[0], buf.size() * sizeof(uint32_t)));
+	ASSERT_EQ(2U, reader->read(&buf[0], part_lba - 1, 2));
+	EXPECT_EQ(part_lba, buf[0]);
+	EXPECT_EQ(part_lba + 1, buf[LBA_SIZE / sizeof(uint32_t)]);
+	delete reader;
+
+	// The base filename also opens the split file.
+	f = new RefFile(split_filename);
+	ASSERT_TRUE(f->isOpen());
+	EXPECT_TRUE(f->isSplit());
+	EXPECT_EQ(LBA_TO_BYTES((int64_t)lba_len), f->size());
+	f->unref();
+
+	for (unsigned int i = 0; i < 6; i++) {
+		TCHAR part[64];
+		_sntprintf(part, ARRAY_SIZE(part), _T("%s.part%u"), split_filename, i);
+		EXPECT_EQ(0, _tremove(part)) << "part " << i;
+	}
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Split file tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * StreamHintsTest.cpp: StreamHints tests.                                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "StreamHints.hpp"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+class StreamHintsTest : public LbaImageTest
+{
+	protected:
+		StreamHintsTest()
+			: LbaImageTest(_T("StreamHintsTest.img")) { }
+};
+
+/**
+ * Copy the image onto itself with page cache hints.
+ * Hints must not change the data that's read or written.
+ */
+TEST_F(StreamHintsTest, copyInPlace)
+{
+	ASSERT_EQ(0, m_file->makeWritable());
+	Reader *const reader = Reader::open(m_file, 0, TEST_IMAGE_LBA_COUNT);
+	ASSERT_TRUE(reader != nullptr);
+
+	// Hints can be disabled.
+	ASSERT_EQ(0, rvth_io_set_stream_hints(0));
+	{
+		StreamHints hints(reader, StreamHints::MODE_READ, TEST_IMAGE_LBA_COUNT);
+		EXPECT_FALSE(hints.isActive());
+	}
+	ASSERT_EQ(0, rvth_io_set_stream_hints(1));
+
+	static const uint32_t chunk_lbas = 64;
+	vector<uint32_t> buf(chunk_lbas * U32_PER_LBA);
+	{
+		StreamHints srcHints(reader, StreamHints::MODE_READ, TEST_IMAGE_LBA_COUNT);
+		StreamHints destHints(reader, StreamHints::MODE_WRITE, TEST_IMAGE_LBA_COUNT);
+		EXPECT_TRUE(srcHints.isActive());
+		EXPECT_TRUE(destHints.isActive());
+
+		for (uint32_t lba = 0; lba < TEST_IMAGE_LBA_COUNT; lba += chunk_lbas) {
+			srcHints.advance(lba);
+			ASSERT_EQ(chunk_lbas, reader->read(&buf[0], lba, chunk_lbas));
+			for (uint32_t i = 0; i < chunk_lbas; i++) {
+				ASSERT_EQ(lba + i, buf[i * U32_PER_LBA]);
+			}
+			ASSERT_EQ(chunk_lbas, reader->write(&buf[0], lba, chunk_lbas));
+			destHints.advance(lba + chunk_lbas);
+		}
+	}
+
+	// Verify the data after the hints have been released.
+	for (uint32_t lba = 0; lba < TEST_IMAGE_LBA_COUNT; lba += chunk_lbas) {
+		ASSERT_EQ(chunk_lbas, reader->read(&buf[0], lba, chunk_lbas));
+		EXPECT_EQ(lba, buf[0]);
+		EXPECT_EQ(lba + chunk_lbas - 1, buf[(chunk_lbas - 1) * U32_PER_LBA]);
+	}
+
+	delete reader;
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: StreamHints tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,233 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * TestImage.hpp: Test disc image helpers.                                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_TESTS_TESTIMAGE_HPP__
+#define __RVTHTOOL_LIBRVTH_TESTS_TESTIMAGE_HPP__
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "RefFile.hpp"
+#include "nhcd_structs.h"
+#include "reader/Reader.hpp"
+
+// C includes. (C++ namespace)
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+
+namespace LibRvth { namespace Tests {
+
+// Test image parameters.
+#define TEST_IMAGE_LBA_COUNT	8192U
+#define TEST_RANDOM_READS	500U
+
+// Number of uint32_t values per LBA.
+#define U32_PER_LBA		(LBA_SIZE / sizeof(uint32_t))
+
+/**
+ * Fill a buffer with LBA numbers.
+ * Each LBA is filled with its own LBA number.
+ * @param buf		[out] Buffer.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+static inline void fillLbaNumbers(std::vector<uint32_t> &buf, uint32_t lba_len)
+{
+	buf.resize(lba_len * U32_PER_LBA);
+	for (size_t i = 0; i < buf.size(); i++) {
+		buf[i] = static_cast<uint32_t>(i / U32_PER_LBA);
+	}
+}
+
+/**
+ * Create a GameCube disc image in memory.
+ * The disc header is followed by the LBA numbers. (See fillLbaNumbers().)
+ * @param buf		[out] Buffer.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param id6		[in] Game ID. (6 characters)
+ * @param title		[in] Game title.
+ */
+static inline void makeGcnImage(std::vector<uint32_t> &buf, uint32_t lba_len,
+	const char *id6, const char *title)
+{
+	fillLbaNumbers(buf, lba_len);
+	uint8_t *const hdr = reinterpret_cast<uint8_t*>(&buf[0]);
+	memcpy(&hdr[0x00], id6, 6);
+	memcpy(&hdr[0x1C], "\xC2\x33\x9F\x3D", 4);	// GCN magic
+	memcpy(&hdr[0x20], title, strlen(title) + 1);
+}
+
+/**
+ * Write a test file.
+ * @param filename	[in] Filename.
+ * @param data		[in] Data.
+ * @param size		[in] Size of data.
+ * @return True on success; false on error.
+ */
+static inline bool writeTestFile(const TCHAR *filename, const void *data, size_t size)
+{
+	RefFile *const f = new RefFile(filename, true);
+	const bool ok = (f->isOpen() && f->pwriteAt(0, data, size) == size);
+	f->unref();
+	return ok;
+}
+
+/**
+ * Store a big-endian 32-bit value.
+ * @param p	[out] Destination.
+ * @param val	[in] Value.
+ */
+static inline void put_be32(uint8_t *p, uint32_t val)
+{
+	p[0] = (val >> 24) & 0xFF;
+	p[1] = (val >> 16) & 0xFF;
+	p[2] = (val >> 8) & 0xFF;
+	p[3] = val & 0xFF;
+}
+
+/**
+ * Store a big-endian 64-bit value.
+ * @param p	[out] Destination.
+ * @param val	[in] Value.
+ */
+static inline void put_be64(uint8_t *p, uint64_t val)
+{
+	put_be32(p, static_cast<uint32_t>(val >> 32));
+	put_be32(p + 4, static_cast<uint32_t>(val));
+}
+
+/**
+ * Create a sparse RVT-H HDD image with a disc image in one bank.
+ * LBAs of the disc image that are all zeroes aren't written.
+ * @param filename	[in] Filename.
+ * @param bank		[in] Bank number. (0-7)
+ * @param type		[in] Bank type. (See NHCD_BankType_e.)
+ * @param disc		[in] Disc image.
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @return True on success; false on error.
+ */
+static inline bool writeHddImage(const TCHAR *filename, unsigned int bank,
+	uint32_t type, const void *disc, uint32_t lba_len)
+{
+	RefFile *const f = new RefFile(filename, true);
+	if (!f->isOpen() ||
+	    f->makeSparse(LBA_TO_BYTES((int64_t)NHCD_BANK_START_LBA(NHCD_BANK_COUNT, NHCD_BANK_COUNT))) != 0)
+	{
+		f->unref();
+		return false;
+	}
+
+	// Bank table.
+	const uint32_t bank_lba = NHCD_BANK_START_LBA(bank, NHCD_BANK_COUNT);
+	uint8_t table[NHCD_BLOCK_SIZE * (1 + NHCD_BANK_COUNT)];
+	memset(table, 0, sizeof(table));
+	put_be32(&table[0x000], NHCD_BANKTABLE_MAGIC);
+	put_be32(&table[0x004], 1);
+	put_be32(&table[0x008], NHCD_BANK_COUNT);
+	uint8_t *const nhcd_entry = &table[NHCD_BLOCK_SIZE * (1 + bank)];
+	put_be32(&nhcd_entry[0x000], type);
+	memcpy(&nhcd_entry[0x004], "0000000000000020200101120000", 28);
+	put_be32(&nhcd_entry[0x020], bank_lba);
+	put_be32(&nhcd_entry[0x024], lba_len);
+	bool ok = (f->pwriteAt(LBA_TO_BYTES((int64_t)NHCD_BANKTABLE_ADDRESS_LBA), table, sizeof(table)) == sizeof(table));
+
+	// Disc image. Runs of non-zero LBAs are written at once.
+	static const uint8_t zero_lba[LBA_SIZE] = {0};
+	const uint8_t *const disc8 = static_cast<const uint8_t*>(disc);
+	uint32_t lba = 0;
+	while (ok && lba < lba_len) {
+		if (!memcmp(&disc8[LBA_TO_BYTES(lba)], zero_lba, LBA_SIZE)) {
+			lba++;
+			continue;
+		}
+		uint32_t lba_end = lba + 1;
+		while (lba_end < lba_len && memcmp(&disc8[LBA_TO_BYTES(lba_end)], zero_lba, LBA_SIZE) != 0) {
+			lba_end++;
+		}
+		const size_t size = LBA_TO_BYTES(lba_end - lba);
+		ok = (f->pwriteAt(LBA_TO_BYTES((int64_t)bank_lba + lba), &disc8[LBA_TO_BYTES(lba)], size) == size);
+		lba = lba_end;
+	}
+
+	f->unref();
+	return ok;
+}
+
+/**
+ * Read random LBA ranges from two Readers for the same disc image,
+ * e.g. a Reader and a reopened Reader, and compare them to the
+ * expected data. Reads are up to 256 LBAs long.
+ * @param reader1	[in] First Reader.
+ * @param reader2	[in] Second Reader.
+ * @param expected	[in] Expected disc image contents.
+ * @return Assertion result.
+ */
+static inline ::testing::AssertionResult checkRandomReads(Reader *reader1, Reader *reader2,
+	const std::vector<uint32_t> &expected)
+{
+	const uint32_t lba_len = static_cast<uint32_t>(expected.size() / U32_PER_LBA);
+	std::vector<uint32_t> buf(256 * U32_PER_LBA);
+	uint32_t seed = 1;
+	for (unsigned int i = 0; i < TEST_RANDOM_READS; i++) {
+		seed = seed * 1103515245U + 12345U;
+		const uint32_t count = 1 + ((seed >> 4) % 256);
+		const uint32_t lba = (seed >> 12) % (lba_len - count + 1);
+		Reader *const r = (i & 1) ? reader2 : reader1;
+		if (r->read(&buf[0], lba, count) != count) {
+			return ::testing::AssertionFailure()
+				<< "read failed: lba == " << lba << ", count == " << count;
+		}
+		if (memcmp(&buf[0], &expected[lba * U32_PER_LBA], LBA_TO_BYTES(count)) != 0) {
+			return ::testing::AssertionFailure()
+				<< "data mismatch: lba == " << lba << ", count == " << count;
+		}
+	}
+	return ::testing::AssertionSuccess();
+}
+
+/**
+ * Test fixture with a plain disc image on disk.
+ * Each LBA is filled with its own LBA number.
+ * NOTE: Each test program must use a different filename,
+ * since test programs may be run in parallel.
+ */
+class LbaImageTest : public ::testing::Test
+{
+	protected:
+		explicit LbaImageTest(const TCHAR *filename)
+			: m_filename(filename)
+			, m_file(nullptr) { }
+
+		void SetUp(void) override
+		{
+			std::vector<uint32_t> buf;
+			fillLbaNumbers(buf, TEST_IMAGE_LBA_COUNT);
+			ASSERT_TRUE(writeTestFile(m_filename, &buf[0], buf.size() * sizeof(uint32_t)));
+
+			m_file = new RefFile(m_filename);
+			ASSERT_TRUE(m_file->isOpen());
+		}
+
+		void TearDown(void) override
+		{
+			if (m_file) {
+				m_file->unref();
+				m_file = nullptr;
+			}
+			_tremove(m_filename);
+		}
+
+	protected:
+		const TCHAR *const m_filename;
+		RefFile *m_file;
+};
+
+} }
+
+#endif /* __RVTHTOOL_LIBRVTH_TESTS_TESTIMAGE_HPP__ */
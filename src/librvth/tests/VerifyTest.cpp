@@ -0,0 +1,259 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * VerifyTest.cpp: Wii partition hash verification tests.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "rvth.hpp"
+#include "wii_crypt.h"
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/cert_store.h"
+#include "libwiicrypto/wii_structs.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+// SHA-1
+#include <nettle/sha1.h>
+
+namespace LibRvth { namespace Tests {
+
+class VerifyTest : public ::testing::Test
+{
+	protected:
+		VerifyTest()
+			: m_rvth(nullptr) { }
+
+		void SetUp(void) override;
+		void TearDown(void) override;
+
+		/**
+		 * Flip a byte in the test image and reopen it.
+		 * @param offset Offset of the byte in the disc image.
+		 */
+		void flipByte(uint64_t offset);
+
+	public:
+		// Test image layout.
+		static const TCHAR filename[];
+		static const uint32_t part_addr = 0x50000;	// Partition header
+		static const uint32_t h3_offset = 0x8000;	// H3 table, relative to the partition
+		static const uint32_t data_offset = 0x20000;	// Partition data, relative to the partition
+		static const unsigned int group_count = 3;
+
+	protected:
+		RvtH *m_rvth;
+};
+
+const TCHAR VerifyTest::filename[] = _T("VerifyTest.gcm");
+const uint32_t VerifyTest::part_addr;
+const uint32_t VerifyTest::h3_offset;
+const uint32_t VerifyTest::data_offset;
+const unsigned int VerifyTest::group_count;
+
+/**
+ * Create an encrypted Wii disc image with a single game partition.
+ * The partition is signed with the debug common key.
+ */
+void VerifyTest::SetUp(void)
+{
+	const size_t disc_size = part_addr + data_offset + ((size_t)group_count * GROUP_SIZE_ENC);
+	vector<uint8_t> disc(disc_size);
+
+	// Disc header and partition table.
+	uint8_t *const hdr = &disc[0];
+	memcpy(&hdr[0x00], "RVRFY1", 6);
+	put_be32(&hdr[0x18], 0x5D1C9EA3);	// Wii magic
+	memcpy(&hdr[0x20], "Verify Test", 12);
+	uint8_t *const vgtbl = &disc[RVL_VolumeGroupTable_ADDRESS];
+	put_be32(&vgtbl[0x00], 1);
+	put_be32(&vgtbl[0x04], (RVL_VolumeGroupTable_ADDRESS + 0x20) >> 2);
+	put_be32(&vgtbl[0x20], part_addr >> 2);
+	put_be32(&vgtbl[0x24], 0);		// Game partition
+
+	// Partition header.
+	RVL_PartitionHeader *const pthdr = reinterpret_cast<RVL_PartitionHeader*>(&disc[part_addr]);
+	memcpy(pthdr->ticket.issuer, RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TICKET],
+		strlen(RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TICKET]));
+	memset(pthdr->ticket.enc_title_key, 0x5A, sizeof(pthdr->ticket.enc_title_key));
+	memcpy(&pthdr->ticket.title_id, "\x00\x01\x00\x00RVRF", 8);
+	const uint32_t tmd_offset = offsetof(RVL_PartitionHeader, data);
+	pthdr->tmd_size = cpu_to_be32(sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry));
+	pthdr->tmd_offset = cpu_to_be32(tmd_offset >> 2);
+	pthdr->h3_table_offset = cpu_to_be32(h3_offset >> 2);
+	pthdr->data_offset = cpu_to_be32(data_offset >> 2);
+	pthdr->data_size = cpu_to_be32(((uint32_t)group_count * GROUP_SIZE_ENC) >> 2);
+	memcpy(&pthdr->u8[tmd_offset + 0x140], RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TMD],
+		strlen(RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TMD]));
+
+	// Encrypt the partition data.
+	uint8_t titleKey[16];
+	uint8_t crypto_type;
+	ASSERT_EQ(0, rvth_decrypt_title_key(&pthdr->ticket, titleKey, &crypto_type));
+	ASSERT_EQ(RVL_CryptoType_Debug, crypto_type);
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+	aesw_set_key(aesw, titleKey, sizeof(titleKey));
+	vector<uint8_t> dec(GROUP_SIZE_DEC);
+	Wii_Disc_H3_t *const h3_tbl = reinterpret_cast<Wii_Disc_H3_t*>(&disc[part_addr + h3_offset]);
+	for (unsigned int g = 0; g < group_count; g++) {
+		for (size_t i = 0; i < dec.size(); i++) {
+			dec[i] = static_cast<uint8_t>((i >> 10) ^ (g * 3) ^ i);
+		}
+		uint8_t *const enc = &disc[part_addr + data_offset + ((size_t)g * GROUP_SIZE_ENC)];
+		ASSERT_EQ(0, rvth_encrypt_group(aesw, &dec[0], dec.size(),
+			enc, GROUP_SIZE_ENC, h3_tbl->h3[g], SHA1_DIGEST_SIZE));
+	}
+	aesw_free(aesw);
+
+	// TMD content hash: SHA-1 of the H3 table.
+	RVL_Content_Entry *const content = reinterpret_cast<RVL_Content_Entry*>(
+		&pthdr->u8[tmd_offset + sizeof(RVL_TMD_Header)]);
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, sizeof(*h3_tbl), reinterpret_cast<const uint8_t*>(h3_tbl));
+	sha1_digest(&sha1, sizeof(content->sha1_hash), content->sha1_hash);
+
+	ASSERT_TRUE(writeTestFile(filename, &disc[0], disc.size()));
+
+	int err = 0;
+	m_rvth = new RvtH(filename, &err);
+	ASSERT_EQ(0, err);
+}
+
+void VerifyTest::TearDown(void)
+{
+	delete m_rvth;
+	_tremove(filename);
+}
+
+/**
+ * Flip a byte in the test image and reopen it.
+ * @param offset Offset of the byte in the disc image.
+ */
+void VerifyTest::flipByte(uint64_t offset)
+{
+	delete m_rvth;
+	m_rvth = nullptr;
+
+	RefFile *const f = new RefFile(filename);
+	ASSERT_TRUE(f->isOpen());
+	ASSERT_EQ(0, f->makeWritable());
+	uint8_t b = 0;
+	ASSERT_EQ(1U, f->preadAt(offset, &b, 1));
+	b ^= 0xFF;
+	ASSERT_EQ(1U, f->pwriteAt(offset, &b, 1));
+	f->unref();
+
+	int err = 0;
+	m_rvth = new RvtH(filename, &err);
+	ASSERT_EQ(0, err);
+}
+
+/**
+ * Verify a valid encrypted Wii partition.
+ */
+TEST_F(VerifyTest, validImage)
+{
+	const RvtH_BankEntry *const entry = m_rvth->bankEntry(0);
+	ASSERT_TRUE(entry != nullptr);
+	EXPECT_EQ(RVTH_BankType_Wii_SL, entry->type);
+	EXPECT_EQ(RVL_CryptoType_Debug, entry->crypto_type);
+
+	RvtH_Verify_Result results[4];
+	unsigned int count = ARRAY_SIZE(results);
+	ASSERT_EQ(0, m_rvth->verifyWiiPartitions(0, results, &count));
+	ASSERT_EQ(1U, count);
+	const RvtH_Verify_Result *const result = &results[0];
+	EXPECT_EQ(RVTH_VERIFY_STATUS_OK, result->status);
+	EXPECT_TRUE(result->tmd_ok);
+	EXPECT_EQ(group_count * 64, result->sector_count);
+	EXPECT_EQ(0U, result->bad_sector_count);
+	EXPECT_EQ(UINT32_MAX, result->bad_group);
+	EXPECT_EQ(UINT32_MAX, result->bad_sector);
+	EXPECT_EQ(RVTH_VERIFY_LEVEL_NONE, result->bad_level);
+
+	// Bank number is out of range.
+	count = ARRAY_SIZE(results);
+	EXPECT_EQ(-ERANGE, m_rvth->verifyWiiPartitions(m_rvth->bankCount(), results, &count));
+}
+
+/**
+ * Flip a byte in the user data of group 1, sector 5.
+ * Only that sector's H0 hash should fail.
+ */
+TEST_F(VerifyTest, badUserData)
+{
+	static const unsigned int bad_group = 1;
+	static const unsigned int bad_sector = 5;
+	ASSERT_NO_FATAL_FAILURE(flipByte(part_addr + data_offset +
+		((uint64_t)bad_group * GROUP_SIZE_ENC) + (bad_sector * SECTOR_SIZE_ENC) + 0x400 + 1234));
+
+	RvtH_Verify_Result results[4];
+	unsigned int count = ARRAY_SIZE(results);
+	ASSERT_EQ(0, m_rvth->verifyWiiPartitions(0, results, &count));
+	ASSERT_EQ(1U, count);
+	const RvtH_Verify_Result *const result = &results[0];
+	EXPECT_EQ(RVTH_VERIFY_STATUS_BAD, result->status);
+	EXPECT_TRUE(result->tmd_ok);
+	EXPECT_EQ(group_count * 64, result->sector_count);
+	EXPECT_EQ(1U, result->bad_sector_count);
+	EXPECT_EQ(bad_group, result->bad_group);
+	EXPECT_EQ((bad_group * 64) + bad_sector, result->bad_sector);
+	EXPECT_EQ(RVTH_VERIFY_LEVEL_H0, result->bad_level);
+}
+
+/**
+ * Flip a byte in the H3 table.
+ * The TMD content hash and the group's H3 hash should fail.
+ */
+TEST_F(VerifyTest, badH3Table)
+{
+	static const unsigned int bad_group = 2;
+	ASSERT_NO_FATAL_FAILURE(flipByte(part_addr + h3_offset + (bad_group * SHA1_DIGEST_SIZE)));
+
+	RvtH_Verify_Result results[4];
+	unsigned int count = ARRAY_SIZE(results);
+	ASSERT_EQ(0, m_rvth->verifyWiiPartitions(0, results, &count));
+	ASSERT_EQ(1U, count);
+	const RvtH_Verify_Result *const result = &results[0];
+	EXPECT_EQ(RVTH_VERIFY_STATUS_BAD, result->status);
+	EXPECT_FALSE(result->tmd_ok);
+	EXPECT_EQ(64U, result->bad_sector_count);
+	EXPECT_EQ(bad_group, result->bad_group);
+	EXPECT_EQ(bad_group * 64, result->bad_sector);
+	EXPECT_EQ(RVTH_VERIFY_LEVEL_H3, result->bad_level);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Wii partition hash verification tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,461 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * WiaReaderTest.cpp: WIA disc image reader tests.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "config.librvth.h"
+#include "wii_crypt.h"
+#include "libwiicrypto/aesw.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_BZIP2
+# include <bzlib.h>
+#endif /* HAVE_BZIP2 */
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+/**
+ * Read an uncompressed WIA image with a Wii partition.
+ * The partition must be rebuilt with the stored hash exception.
+ */
+TEST(WiaReaderTest, uncompressedWii)
+{
+	static const TCHAR wia_filename[] = _T("WiaReaderTest.wia");
+	static const uint32_t raw_size = 0x50000;	// Raw data before the partition
+	static const uint64_t iso_size = raw_size + GROUP_SIZE_ENC;
+	static const uint8_t key[16] = {0x01,0x23,0x45,0x67,0x89,0xAB,0xCD,0xEF,0xFE,0xDC,0xBA,0x98,0x76,0x54,0x32,0x10};
+
+	// Disc contents.
+	vector<uint8_t> raw(raw_size);
+	for (size_t i = 0; i < raw.size(); i++) {
+		raw[i] = static_cast<uint8_t>(i * 7);
+	}
+	vector<uint8_t> dec(GROUP_SIZE_DEC);
+	for (size_t i = 0; i < dec.size(); i++) {
+		dec[i] = static_cast<uint8_t>((i >> 10) ^ i);
+	}
+
+	// WIA file layout:
+	// - 0x0000: Headers
+	// - 0x0200: Partition table
+	// - 0x0300: Raw data table
+	// - 0x0400: Group table
+	// - 0x1000: Group 0: raw data
+	// - 0x1000+raw_size: Group 1: hash exceptions and partition data
+	const uint32_t group1_off = 0x1000 + raw_size;
+	const uint32_t group1_size = 24 + GROUP_SIZE_DEC;
+	vector<uint8_t> wia(group1_off + group1_size);
+	uint8_t *const p = &wia[0];
+	memcpy(p, "WIA\x01", 4);
+	put_be32(p + 0x04, 0x01000000);
+	put_be32(p + 0x08, 0x00080000);
+	put_be32(p + 0x0C, 0xDC);			// disc_size
+	put_be64(p + 0x24, iso_size);
+	put_be64(p + 0x2C, wia.size());
+	uint8_t *const disc = p + 0x48;
+	put_be32(disc + 0x00, 2);			// Wii
+	put_be32(disc + 0x04, 0);			// No compression
+	put_be32(disc + 0x0C, GROUP_SIZE_ENC);		// chunk_size
+	memcpy(disc + 0x10, &raw[0], 0x80);		// dhead
+	put_be32(disc + 0x90, 1);			// n_part
+	put_be32(disc + 0x94, 48);			// part_t_size
+	put_be64(disc + 0x98, 0x200);			// part_off
+	put_be32(disc + 0xB4, 1);			// n_raw_data
+	put_be64(disc + 0xB8, 0x300);			// raw_data_off
+	put_be32(disc + 0xC0, 24);			// raw_data_size
+	put_be32(disc + 0xC4, 2);			// n_groups
+	put_be64(disc + 0xC8, 0x400);			// group_off
+	put_be32(disc + 0xD0, 16);			// group_size
+
+	memcpy(p + 0x200, key, sizeof(key));
+	put_be32(p + 0x210, raw_size / SECTOR_SIZE_ENC);	// first_sector
+	put_be32(p + 0x214, GROUP_SIZE_ENC / SECTOR_SIZE_ENC);	// n_sectors
+	put_be32(p + 0x218, 1);				// group_index
+	put_be32(p + 0x21C, 1);				// n_groups
+
+	put_be64(p + 0x300, 0x80);
+	put_be64(p + 0x308, raw_size - 0x80);
+	put_be32(p + 0x310, 0);				// group_index
+	put_be32(p + 0x314, 1);				// n_groups
+
+	put_be32(p + 0x400, 0x1000 >> 2);
+	put_be32(p + 0x404, raw_size);
+	put_be32(p + 0x408, group1_off >> 2);
+	put_be32(p + 0x40C, group1_size);
+
+	memcpy(p + 0x1000, &raw[0], raw_size);
+	uint8_t *const g1 = p + group1_off;
+	g1[1] = 1;					// One hash exception:
+	g1[2] = 0x14; g1[3] = 0x00;			// H0[0] of sector 5
+	memset(g1 + 4, 0xAB, 20);
+	memcpy(g1 + 24, &dec[0], dec.size());
+
+	ASSERT_TRUE(writeTestFile(wia_filename, &wia[0], wia.size()));
+
+	// Expected partition data.
+	vector<uint8_t> enc(GROUP_SIZE_ENC);
+	ASSERT_EQ(0, rvth_hash_group(&dec[0], dec.size(), &enc[0], enc.size(), nullptr, 0));
+	memset(&enc[5 * SECTOR_SIZE_ENC], 0xAB, 20);
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+	aesw_set_key(aesw, key, sizeof(key));
+	ASSERT_EQ(0, rvth_encrypt_hashed_group(aesw, &enc[0], enc.size()));
+	aesw_free(aesw);
+
+	RefFile *const f = new RefFile(wia_filename);
+	ASSERT_TRUE(f->isOpen());
+	Reader *const reader = Reader::open(f, 0, 0);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	ASSERT_TRUE(reader->isOpen());
+	EXPECT_EQ(BYTES_TO_LBA(iso_size), reader->lba_len());
+	EXPECT_FALSE(reader->isLinear());
+
+	// Read the disc image with the original reader and a reopened reader.
+	Reader *const reader2 = reader->reopen();
+	ASSERT_TRUE(reader2 != nullptr);
+	vector<uint8_t> buf(iso_size);
+	for (Reader *r : {reader, reader2}) {
+		memset(&buf[0], 0, buf.size());
+		ASSERT_EQ(reader->lba_len(), r->read(&buf[0], 0, reader->lba_len()));
+		EXPECT_EQ(0, memcmp(&buf[0], &raw[0], raw_size));
+		EXPECT_EQ(0, memcmp(&buf[raw_size], &enc[0], enc.size()));
+	}
+
+	delete reader2;
+	delete reader;
+	_tremove(wia_filename);
+}
+
+/**
+ * Reference junk data generator.
+ * This generates the lagged Fibonacci generator's output
+ * one byte at a time, without any byteswapping.
+ * @param out	[out] Output buffer.
+ * @param size	[in] Number of bytes.
+ * @param seed	[in] Seed. (17 words)
+ * @param skip	[in] Number of bytes to skip first.
+ */
+static void makeJunk(uint8_t *out, size_t size, const uint32_t *seed, size_t skip)
+{
+	static const unsigned int k = 521, j = 32;
+	vector<uint32_t> lfg(k);
+	for (unsigned int i = 0; i < k; i++) {
+		lfg[i] = (i < 17) ? seed[i]
+			: (lfg[i - 17] << 23) ^ (lfg[i - 16] >> 9) ^ lfg[i - 1];
+	}
+	for (uint32_t &x : lfg) {
+		x = (x & 0xFF00FFFF) | ((x >> 2) & 0x00FF0000);
+	}
+
+	auto forward = [&lfg]() {
+		for (unsigned int i = 0; i < k; i++) {
+			lfg[i] ^= lfg[(i + k - j) % k];
+		}
+	};
+	for (unsigned int i = 0; i < 4; i++) {
+		forward();
+	}
+
+	size_t pos = 0;
+	for (size_t n = 0; n < skip + size; n++) {
+		if (n >= skip) {
+			out[n - skip] = static_cast<uint8_t>(lfg[pos / 4] >> (24 - ((pos % 4) * 8)));
+		}
+		if (++pos == k * 4) {
+			forward();
+			pos = 0;
+		}
+	}
+}
+
+/**
+ * Read an RVZ image with packed GameCube data.
+ * Junk data segments must be regenerated from their seeds,
+ * including segments that don't start on a sector boundary.
+ */
+TEST(WiaReaderTest, rvzPackedJunk)
+{
+	static const TCHAR rvz_filename[] = _T("WiaReaderTest.rvz");
+	static const uint32_t chunk_size = 0x20000;
+	static const uint64_t iso_size = 2 * chunk_size;
+
+	// Packed segments: literal data or junk data.
+	struct Segment {
+		uint32_t start;
+		uint32_t end;
+		bool isJunk;
+	};
+	static const Segment segments[2][3] = {
+		{{0x00000, 0x01000, false}, {0x01000, 0x20000, true}, {0x20000, 0x20000, false}},
+		{{0x20000, 0x20123, false}, {0x20123, 0x38000, true}, {0x38000, 0x40000, false}},
+	};
+
+	// Expected disc image.
+	vector<uint8_t> expected(iso_size);
+	for (size_t i = 0; i < expected.size(); i++) {
+		expected[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	// RVZ file layout:
+	// - 0x0000: Headers
+	// - 0x0300: Raw data table
+	// - 0x0400: Group table
+	// - 0x1000: Groups 0 and 1: packed data
+	vector<uint8_t> rvz(0x1000);
+	vector<uint32_t> seed(17);
+	for (unsigned int g = 0; g < 2; g++) {
+		const size_t group_off = rvz.size();
+		for (const Segment &seg : segments[g]) {
+			const uint32_t size = seg.end - seg.start;
+			if (size == 0) {
+				continue;
+			}
+			size_t pos = rvz.size();
+			if (seg.isJunk) {
+				for (unsigned int i = 0; i < 17; i++) {
+					seed[i] = (0x9E3779B9U * (i + 1)) ^ (g << 16);
+				}
+				makeJunk(&expected[seg.start], size, &seed[0], seg.start % SECTOR_SIZE_ENC);
+				rvz.resize(pos + 4 + (17 * 4));
+				put_be32(&rvz[pos], 0x80000000U | size);
+				for (unsigned int i = 0; i < 17; i++) {
+					put_be32(&rvz[pos + 4 + (i * 4)], seed[i]);
+				}
+			} else {
+				rvz.resize(pos + 4 + size);
+				put_be32(&rvz[pos], size);
+				memcpy(&rvz[pos + 4], &expected[seg.start], size);
+			}
+		}
+
+		const uint32_t packed_size = static_cast<uint32_t>(rvz.size() - group_off);
+		put_be32(&rvz[0x400 + (g * 12)], static_cast<uint32_t>(group_off >> 2));
+		put_be32(&rvz[0x404 + (g * 12)], packed_size);
+		put_be32(&rvz[0x408 + (g * 12)], packed_size);	// rvz_packed_size
+		rvz.resize((rvz.size() + 3) & ~(size_t)3);
+	}
+
+	uint8_t *const p = &rvz[0];
+	memcpy(p, "RVZ\x01", 4);
+	put_be32(p + 0x04, 0x01000000);
+	put_be32(p + 0x08, 0x00030000);
+	put_be32(p + 0x0C, 0xDC);			// disc_size
+	put_be64(p + 0x24, iso_size);
+	put_be64(p + 0x2C, rvz.size());
+	uint8_t *const disc = p + 0x48;
+	put_be32(disc + 0x00, 1);			// GameCube
+	put_be32(disc + 0x04, 0);			// No compression
+	put_be32(disc + 0x0C, chunk_size);
+	memcpy(disc + 0x10, &expected[0], 0x80);	// dhead
+	put_be32(disc + 0xB4, 1);			// n_raw_data
+	put_be64(disc + 0xB8, 0x300);			// raw_data_off
+	put_be32(disc + 0xC0, 24);			// raw_data_size
+	put_be32(disc + 0xC4, 2);			// n_groups
+	put_be64(disc + 0xC8, 0x400);			// group_off
+	put_be32(disc + 0xD0, 24);			// group_size
+
+	put_be64(p + 0x300, 0x80);
+	put_be64(p + 0x308, iso_size - 0x80);
+	put_be32(p + 0x310, 0);				// group_index
+	put_be32(p + 0x314, 2);				// n_groups
+
+	ASSERT_TRUE(writeTestFile(rvz_filename, &rvz[0], rvz.size()));
+
+	RefFile *const f = new RefFile(rvz_filename);
+	ASSERT_TRUE(f->isOpen());
+	Reader *const reader = Reader::open(f, 0, 0);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	ASSERT_TRUE(reader->isOpen());
+	EXPECT_EQ(BYTES_TO_LBA(iso_size), reader->lba_len());
+
+	vector<uint8_t> buf(iso_size);
+	ASSERT_EQ(reader->lba_len(), reader->read(&buf[0], 0, reader->lba_len()));
+	EXPECT_TRUE(buf == expected);
+
+	// Read the second group's junk data by itself.
+	static const uint32_t junk_lba = BYTES_TO_LBA(0x30000);
+	memset(&buf[0], 0, LBA_SIZE);
+	ASSERT_EQ(1U, reader->read(&buf[0], junk_lba, 1));
+	EXPECT_EQ(0, memcmp(&buf[0], &expected[LBA_TO_BYTES(junk_lba)], LBA_SIZE));
+
+	delete reader;
+	_tremove(rvz_filename);
+}
+
+#ifdef HAVE_BZIP2
+/**
+ * Compress a buffer using bzip2.
+ * @param in Uncompressed data.
+ * @return Compressed data.
+ */
+static vector<uint8_t> bzip2Compress(const vector<uint8_t> &in)
+{
+	unsigned int len = static_cast<unsigned int>(in.size() + (in.size() / 100) + 600);
+	vector<uint8_t> out(len);
+	EXPECT_EQ(BZ_OK, BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(&out[0]), &len,
+		const_cast<char*>(reinterpret_cast<const char*>(&in[0])),
+		static_cast<unsigned int>(in.size()), 9, 0, 0));
+	out.resize(len);
+	return out;
+}
+
+/**
+ * Read a bzip2-compressed WIA image with a Wii partition.
+ * The hash exceptions are compressed along with the partition
+ * data, so they aren't padded to 4 bytes.
+ */
+TEST(WiaReaderTest, bzip2Wii)
+{
+	static const TCHAR wia_filename[] = _T("WiaReaderTest-bzip2.wia");
+	static const uint32_t raw_size = 0x50000;	// Raw data before the partition
+	static const uint64_t iso_size = raw_size + GROUP_SIZE_ENC;
+	static const uint8_t key[16] = {0x01,0x23,0x45,0x67,0x89,0xAB,0xCD,0xEF,0xFE,0xDC,0xBA,0x98,0x76,0x54,0x32,0x10};
+
+	// Disc contents.
+	vector<uint8_t> raw(raw_size);
+	for (size_t i = 0; i < raw.size(); i++) {
+		raw[i] = static_cast<uint8_t>(i * 7);
+	}
+	vector<uint8_t> dec(GROUP_SIZE_DEC);
+	for (size_t i = 0; i < dec.size(); i++) {
+		dec[i] = static_cast<uint8_t>((i >> 10) ^ i);
+	}
+
+	// Group 1: Two hash exceptions, followed by the partition data.
+	// - H0[0] of sector 5
+	// - H1[2] of sector 63
+	vector<uint8_t> g1(2 + (2 * 22) + GROUP_SIZE_DEC);
+	g1[1] = 2;
+	g1[2] = 0x14; g1[3] = 0x00;
+	memset(&g1[4], 0xAB, 20);
+	g1[24] = 0xFE; g1[25] = 0xA8;
+	memset(&g1[26], 0xCD, 20);
+	memcpy(&g1[46], &dec[0], dec.size());
+
+	// Compressed tables and groups.
+	vector<uint8_t> raw_tbl(24);
+	put_be64(&raw_tbl[0], 0x80);
+	put_be64(&raw_tbl[8], raw_size - 0x80);
+	put_be32(&raw_tbl[16], 0);			// group_index
+	put_be32(&raw_tbl[20], 1);			// n_groups
+	const vector<uint8_t> raw_tbl_z = bzip2Compress(raw_tbl);
+	const vector<uint8_t> g0_z = bzip2Compress(raw);
+	const vector<uint8_t> g1_z = bzip2Compress(g1);
+	const uint32_t group1_off = (0x1000 + static_cast<uint32_t>(g0_z.size()) + 3) & ~3U;
+	vector<uint8_t> group_tbl(16);
+	put_be32(&group_tbl[0x0], 0x1000 >> 2);
+	put_be32(&group_tbl[0x4], static_cast<uint32_t>(g0_z.size()));
+	put_be32(&group_tbl[0x8], group1_off >> 2);
+	put_be32(&group_tbl[0xC], static_cast<uint32_t>(g1_z.size()));
+	const vector<uint8_t> group_tbl_z = bzip2Compress(group_tbl);
+	ASSERT_LE(raw_tbl_z.size(), 0x100U);
+	ASSERT_LE(group_tbl_z.size(), 0xC00U);
+
+	// WIA file layout:
+	// - 0x0000: Headers
+	// - 0x0200: Partition table
+	// - 0x0300: Raw data table
+	// - 0x0400: Group table
+	// - 0x1000: Group 0: raw data
+	// - group1_off: Group 1: hash exceptions and partition data
+	vector<uint8_t> wia(group1_off + g1_z.size());
+	uint8_t *const p = &wia[0];
+	memcpy(p, "WIA\x01", 4);
+	put_be32(p + 0x04, 0x01000000);
+	put_be32(p + 0x08, 0x00080000);
+	put_be32(p + 0x0C, 0xDC);			// disc_size
+	put_be64(p + 0x24, iso_size);
+	put_be64(p + 0x2C, wia.size());
+	uint8_t *const disc = p + 0x48;
+	put_be32(disc + 0x00, 2);			// Wii
+	put_be32(disc + 0x04, 2);			// bzip2
+	put_be32(disc + 0x0C, GROUP_SIZE_ENC);		// chunk_size
+	memcpy(disc + 0x10, &raw[0], 0x80);		// dhead
+	put_be32(disc + 0x90, 1);			// n_part
+	put_be32(disc + 0x94, 48);			// part_t_size
+	put_be64(disc + 0x98, 0x200);			// part_off
+	put_be32(disc + 0xB4, 1);			// n_raw_data
+	put_be64(disc + 0xB8, 0x300);			// raw_data_off
+	put_be32(disc + 0xC0, static_cast<uint32_t>(raw_tbl_z.size()));
+	put_be32(disc + 0xC4, 2);			// n_groups
+	put_be64(disc + 0xC8, 0x400);			// group_off
+	put_be32(disc + 0xD0, static_cast<uint32_t>(group_tbl_z.size()));
+
+	memcpy(p + 0x200, key, sizeof(key));
+	put_be32(p + 0x210, raw_size / SECTOR_SIZE_ENC);	// first_sector
+	put_be32(p + 0x214, GROUP_SIZE_ENC / SECTOR_SIZE_ENC);	// n_sectors
+	put_be32(p + 0x218, 1);				// group_index
+	put_be32(p + 0x21C, 1);				// n_groups
+
+	memcpy(p + 0x300, &raw_tbl_z[0], raw_tbl_z.size());
+	memcpy(p + 0x400, &group_tbl_z[0], group_tbl_z.size());
+	memcpy(p + 0x1000, &g0_z[0], g0_z.size());
+	memcpy(p + group1_off, &g1_z[0], g1_z.size());
+
+	ASSERT_TRUE(writeTestFile(wia_filename, &wia[0], wia.size()));
+
+	// Expected partition data.
+	vector<uint8_t> enc(GROUP_SIZE_ENC);
+	ASSERT_EQ(0, rvth_hash_group(&dec[0], dec.size(), &enc[0], enc.size(), nullptr, 0));
+	memset(&enc[5 * SECTOR_SIZE_ENC], 0xAB, 20);
+	memset(&enc[(63 * SECTOR_SIZE_ENC) + 0x280 + (2 * 20)], 0xCD, 20);
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+	aesw_set_key(aesw, key, sizeof(key));
+	ASSERT_EQ(0, rvth_encrypt_hashed_group(aesw, &enc[0], enc.size()));
+	aesw_free(aesw);
+
+	RefFile *const f = new RefFile(wia_filename);
+	ASSERT_TRUE(f->isOpen());
+	Reader *const reader = Reader::open(f, 0, 0);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	ASSERT_TRUE(reader->isOpen());
+	EXPECT_EQ(BYTES_TO_LBA(iso_size), reader->lba_len());
+
+	vector<uint8_t> buf(iso_size);
+	ASSERT_EQ(reader->lba_len(), reader->read(&buf[0], 0, reader->lba_len()));
+	EXPECT_EQ(0, memcmp(&buf[0], &raw[0], raw_size));
+	EXPECT_EQ(0, memcmp(&buf[raw_size], &enc[0], enc.size()));
+
+	delete reader;
+	_tremove(wia_filename);
+}
+#endif /* HAVE_BZIP2 */
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: WIA disc image reader tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,101 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * ZstdReaderTest.cpp: Zstandard seekable format tests.                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+#include "TestImage.hpp"
+
+#include "rvth.hpp"
+#include "reader/io_backend.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvth { namespace Tests {
+
+/**
+ * Extract a disc image using the Zstandard seekable format,
+ * then read it back using random LBA reads.
+ */
+TEST(ZstdReaderTest, seekable)
+{
+	static const TCHAR gcm_filename[] = _T("ZstdReaderTest.gcm");
+	static const TCHAR zst_filename[] = _T("ZstdReaderTest.gcm.zst");
+
+	// GameCube disc image: disc header, followed by the LBA numbers.
+	// The last frame is a partial frame.
+	static const uint32_t lba_len = TEST_IMAGE_LBA_COUNT + 3;
+	vector<uint32_t> expected;
+	makeGcnImage(expected, lba_len, "RZSTD1", "Zstandard Test");
+	const size_t size = expected.size() * sizeof(uint32_t);
+	ASSERT_TRUE(writeTestFile(gcm_filename, &expected[0], size));
+
+	// 64 KB frames.
+	ASSERT_EQ(0, rvth_zstd_set_params(1, 65536));
+	int err = 0;
+	RvtH *const rvth = new RvtH(gcm_filename, &err);
+	ASSERT_EQ(0, err);
+	err = rvth->extract(0, zst_filename, -1, RVTH_EXTRACT_FORMAT_ZSTD);
+	delete rvth;
+	_tremove(gcm_filename);
+	rvth_zstd_set_params(RVTH_ZSTD_DEFAULT_LEVEL, RVTH_ZSTD_DEFAULT_FRAME_SIZE);
+	if (!rvth_zstd_is_supported()) {
+		// Zstandard support was not compiled in.
+		EXPECT_EQ(-ENOTSUP, err);
+		return;
+	}
+	ASSERT_EQ(0, err);
+
+	RefFile *const f = new RefFile(zst_filename);
+	ASSERT_TRUE(f->isOpen());
+	EXPECT_LT(f->size(), static_cast<int64_t>(size));
+	Reader *const reader = Reader::open(f, 0, 0);
+	f->unref();
+	ASSERT_TRUE(reader != nullptr);
+	ASSERT_TRUE(reader->isOpen());
+	EXPECT_EQ(lba_len, reader->lba_len());
+	EXPECT_FALSE(reader->isLinear());
+	EXPECT_EQ(0U, reader->write(&expected[0], 0, 1));
+
+	// Random reads, including reads that cross frame boundaries,
+	// using the original reader and a reopened reader.
+	Reader *const reader2 = reader->reopen();
+	ASSERT_TRUE(reader2 != nullptr);
+	EXPECT_TRUE(checkRandomReads(reader, reader2, expected));
+
+	delete reader2;
+	delete reader;
+	_tremove(zst_filename);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Zstandard seekable format tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,474 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * verify.cpp: Verify the hashes of encrypted Wii partitions.              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "wii_crypt.h"
+
+#include "byteswap.h"
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// Multi-threaded group verification
+#include "GroupPipeline.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/sha1_multi.h"
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+// Encryption.
+#include "aesw.h"
+#include <nettle/sha1.h>
+
+#define LBA_COUNT_ENC BYTES_TO_LBA(GROUP_SIZE_ENC)
+#define SECTORS_PER_GROUP (GROUP_SIZE_ENC / SECTOR_SIZE_ENC)
+
+// Per-group verification result. (worker -> writer)
+typedef struct _verify_group_t {
+	uint32_t bad_count;	// Number of sectors with invalid hashes.
+	uint8_t bad_sector;	// First sector with an invalid hash.
+	uint8_t bad_level;	// Hash level that failed for bad_sector. (See RvtH_Verify_Level_e.)
+} verify_group_t;
+
+/**
+ * Check the SHA-1 hash of a block of data.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData.
+ * @param pHash		[in] Expected SHA-1 hash.
+ * @return True if the hash matches; false if not.
+ */
+static bool sha1_check(const uint8_t *pData, size_t size, const uint8_t *pHash)
+{
+	struct sha1_ctx sha1;
+	uint8_t digest[SHA1_DIGEST_SIZE];
+
+	sha1_init(&sha1);
+	sha1_update(&sha1, size, pData);
+	sha1_digest(&sha1, sizeof(digest), digest);
+	return !memcmp(digest, pHash, sizeof(digest));
+}
+
+/**
+ * Decrypt and verify an encrypted Wii sector.
+ *
+ * Each sector contains the full H1 and H2 tables for its subgroup
+ * and group, so a sector can be verified up to H3 by itself.
+ *
+ * @param aesw		[in] AES context. (Key must be set to the decrypted title key.)
+ * @param sector	[in,out] Sector. (Decrypted in place.)
+ * @param sector_idx	[in] Sector index within the group. (0-63)
+ * @param pH3		[in] Expected H3 hash for the group.
+ * @return First hash level that failed, or RVTH_VERIFY_LEVEL_NONE if the sector is valid.
+ */
+static RvtH_Verify_Level_e verify_sector(AesCtx *aesw, Wii_Disc_Sector_t *sector,
+	unsigned int sector_idx, const uint8_t *pH3)
+{
+	static const uint8_t iv_zero[16] = {0};
+	uint8_t iv_data[16];
+	uint8_t H0[31][SHA1_DIGEST_SIZE];
+
+	// User data IV is stored within the *encrypted* H2 table.
+	memcpy(iv_data, &sector->hashes.H2[7][4], sizeof(iv_data));
+
+	// Decrypt the hashes and the user data.
+	aesw_set_iv(aesw, iv_zero, sizeof(iv_zero));
+	aesw_decrypt(aesw, (uint8_t*)&sector->hashes, sizeof(sector->hashes));
+	aesw_set_iv(aesw, iv_data, sizeof(iv_data));
+	aesw_decrypt(aesw, sector->data, sizeof(sector->data));
+
+	// H0: SHA-1 of each 1 KB block of user data.
+	sha1_multi(H0[0], sector->data, 1024, 31);
+	if (memcmp(H0, sector->hashes.H0, sizeof(H0)) != 0) {
+		return RVTH_VERIFY_LEVEL_H0;
+	}
+
+	// H1: SHA-1 of this sector's H0 table.
+	if (!sha1_check(sector->hashes.H0[0], sizeof(sector->hashes.H0),
+	     sector->hashes.H1[sector_idx % 8]))
+	{
+		return RVTH_VERIFY_LEVEL_H1;
+	}
+
+	// H2: SHA-1 of this subgroup's H1 table.
+	if (!sha1_check(sector->hashes.H1[0], sizeof(sector->hashes.H1),
+	     sector->hashes.H2[sector_idx / 8]))
+	{
+		return RVTH_VERIFY_LEVEL_H2;
+	}
+
+	// H3: SHA-1 of this group's H2 table.
+	if (!sha1_check(sector->hashes.H2[0], sizeof(sector->hashes.H2), pH3)) {
+		return RVTH_VERIFY_LEVEL_H3;
+	}
+
+	return RVTH_VERIFY_LEVEL_NONE;
+}
+
+/**
+ * Verify the hashes of all encrypted partitions in a Wii disc image.
+ *
+ * Each sector's H0, H1, H2, and H3 hashes are checked, along with
+ * the TMD content hash of each partition's H3 table. Groups are
+ * verified in parallel on all available CPUs.
+ *
+ * NOTE: Bad hashes are not an error. Check the results to
+ * determine if each partition is valid.
+ *
+ * @param bank		[in] Bank number. (0-7)
+ * @param results	[out] Array of verification results. (one per partition)
+ * @param pCount	[in/out] On input, number of elements in results.
+ *			On output, number of partitions in the disc image.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ *         If results is too small, -ENOSPC is returned.
+ */
+int RvtH::verifyWiiPartitions(unsigned int bank,
+	RvtH_Verify_Result *results, unsigned int *pCount,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	// Buffers.
+	RVL_PartitionHeader *pthdr = NULL;
+	Wii_Disc_H3_t *H3_tbl = NULL;
+
+	// Callback state.
+	RvtH_Progress_State state;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	// AES contexts. (one per worker thread)
+	vector<AesCtx*> aesw;
+
+	if (!results || !pCount) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Check if the bank can be verified.
+	RvtH_BankEntry *const entry = &m_entries[bank];
+	switch (entry->type) {
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be verified.
+			break;
+
+		case RVTH_BankType_GCN:
+			// No hashes for GameCube.
+			errno = EIO;
+			return RVTH_ERROR_NOT_WII_IMAGE;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	if (entry->crypto_type == RVL_CryptoType_None) {
+		// Unencrypted images don't have any hashes.
+		errno = EIO;
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+
+	// Load the partition table.
+	ret = rvth_ptbl_load(entry);
+	if (ret != 0 || entry->pt_count == 0 || !entry->ptbl) {
+		// Unable to load the partition table.
+		if (ret == 0) {
+			ret = RVTH_ERROR_PARTITION_TABLE_CORRUPTED;
+		}
+		errno = EIO;
+		return ret;
+	}
+	if (*pCount < entry->pt_count) {
+		// Not enough space for the results.
+		*pCount = entry->pt_count;
+		errno = ENOSPC;
+		return -ENOSPC;
+	}
+	*pCount = entry->pt_count;
+
+	pthdr = static_cast<RVL_PartitionHeader*>(malloc(sizeof(*pthdr)));
+	H3_tbl = static_cast<Wii_Disc_H3_t*>(malloc(sizeof(*H3_tbl)));
+	if (!pthdr || !H3_tbl) {
+		// Error allocating memory.
+		err = ENOMEM;
+		ret = -err;
+		goto end;
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		// NOTE: lba_total is the total size of all partitions,
+		// since the data sizes aren't known until the partition
+		// headers are loaded.
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank;
+		state.bank_gcm = UINT_MAX;
+		state.type = RVTH_PROGRESS_VERIFY;
+		state.lba_processed = 0;
+		state.lba_total = 0;
+		for (unsigned int i = 0; i < entry->pt_count; i++) {
+			state.lba_total += entry->ptbl[i].lba_len;
+		}
+	}
+
+	{
+		// Verify groups using a multi-threaded pipeline.
+		// The output buffer has the verification result for the group.
+		GroupPipeline pipeline(0, GROUP_SIZE_ENC, sizeof(verify_group_t));
+		if (!pipeline.isValid()) {
+			// Error allocating memory.
+			err = ENOMEM;
+			ret = -err;
+			goto end;
+		}
+
+		// Initialize decryption for each worker.
+		aesw.resize(pipeline.workerCount(), nullptr);
+		for (AesCtx *&ctx : aesw) {
+			ctx = aesw_new();
+			if (!ctx) {
+				// Error initializing decryption.
+				err = errno;
+				if (err == 0) {
+					err = EIO;
+				}
+				ret = -err;
+				goto end;
+			}
+		}
+
+		uint32_t lba_next = 0;	// Progress at the start of the next partition.
+		const pt_entry_t *pte = entry->ptbl;
+		for (unsigned int i = 0; i < entry->pt_count; i++, pte++) {
+			RvtH_Verify_Result *const result = &results[i];
+			const uint32_t lba_base = lba_next;
+			lba_next += pte->lba_len;
+
+			memset(result, 0, sizeof(*result));
+			result->type = pte->type;
+			result->vg = pte->vg;
+			result->pt = pte->pt;
+			result->status = RVTH_VERIFY_STATUS_OK;
+			result->bad_level = RVTH_VERIFY_LEVEL_NONE;
+			result->bad_group = UINT32_MAX;
+			result->bad_sector = UINT32_MAX;
+
+			// Read the partition header.
+			errno = 0;
+			uint32_t lba_size = entry->reader->read(pthdr, pte->lba_start, BYTES_TO_LBA(sizeof(*pthdr)));
+			if (lba_size != BYTES_TO_LBA(sizeof(*pthdr))) {
+				// Read error.
+				result->status = RVTH_VERIFY_STATUS_ERROR;
+				result->err = (errno != 0 ? -errno : -EIO);
+				continue;
+			}
+
+			const uint32_t h3_offset = be32_to_cpu(pthdr->h3_table_offset) << 2;
+			const uint32_t data_offset = be32_to_cpu(pthdr->data_offset) << 2;
+			const uint64_t data_size = (uint64_t)be32_to_cpu(pthdr->data_size) << 2;
+			if (h3_offset == 0 || data_offset <= sizeof(*pthdr)) {
+				// No H3 table. This partition is unencrypted.
+				result->status = RVTH_VERIFY_STATUS_UNENCRYPTED;
+				continue;
+			}
+
+			// Sanity checks.
+			// NOTE: Only whole sectors can be verified.
+			const uint32_t data_lba = pte->lba_start + BYTES_TO_LBA(data_offset);
+			const uint32_t sector_count = (uint32_t)(data_size / SECTOR_SIZE_ENC);
+			const uint32_t data_lba_len = sector_count * BYTES_TO_LBA(SECTOR_SIZE_ENC);
+			const unsigned int group_count = (sector_count + SECTORS_PER_GROUP - 1) / SECTORS_PER_GROUP;
+			const uint32_t tmd_offset = be32_to_cpu(pthdr->tmd_offset) << 2;
+			if ((h3_offset % LBA_SIZE) != 0 || (data_offset % LBA_SIZE) != 0 ||
+			    h3_offset + sizeof(*H3_tbl) > data_offset ||
+			    BYTES_TO_LBA(data_offset) + (uint64_t)data_lba_len > pte->lba_len ||
+			    group_count > ARRAY_SIZE(H3_tbl->h3) ||
+			    tmd_offset < offsetof(RVL_PartitionHeader, data) ||
+			    tmd_offset + sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry) > sizeof(*pthdr))
+			{
+				// Partition header is corrupted.
+				result->status = RVTH_VERIFY_STATUS_ERROR;
+				result->err = RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+				continue;
+			}
+
+			// Decrypt the title key.
+			uint8_t titleKey[16];
+			uint8_t crypto_type;
+			ret = rvth_decrypt_title_key(&pthdr->ticket, titleKey, &crypto_type);
+			if (ret != 0) {
+				// Error decrypting the title key.
+				result->status = RVTH_VERIFY_STATUS_ERROR;
+				result->err = ret;
+				ret = 0;
+				continue;
+			}
+
+			// Read the H3 table and check it against the TMD.
+			// NOTE: If the Reader is memory-mapped, the table is
+			// borrowed from the mapping instead of being copied.
+			const Wii_Disc_H3_t *const h3_tbl = static_cast<const Wii_Disc_H3_t*>(
+				entry->reader->mapOrRead(H3_tbl, pte->lba_start + BYTES_TO_LBA(h3_offset), BYTES_TO_LBA(sizeof(*H3_tbl))));
+			if (!h3_tbl) {
+				// Read error.
+				result->status = RVTH_VERIFY_STATUS_ERROR;
+				result->err = -errno;
+				continue;
+			}
+			const RVL_Content_Entry *const content = reinterpret_cast<const RVL_Content_Entry*>(
+				&pthdr->u8[tmd_offset + sizeof(RVL_TMD_Header)]);
+			result->tmd_ok = sha1_check(reinterpret_cast<const uint8_t*>(h3_tbl),
+				sizeof(*h3_tbl), content->sha1_hash);
+			if (!result->tmd_ok) {
+				result->status = RVTH_VERIFY_STATUS_BAD;
+			}
+
+			for (AesCtx *ctx : aesw) {
+				aesw_set_key(ctx, titleKey, sizeof(titleKey));
+			}
+
+			// Reader: Read 64 encrypted sectors.
+			// The last group may be partial.
+			auto readFn = [=](unsigned int idx, uint8_t *inBuf) -> int {
+				const uint32_t lba_offset = idx * LBA_COUNT_ENC;
+				uint32_t lba_left = data_lba_len - lba_offset;
+				if (lba_left > LBA_COUNT_ENC) {
+					lba_left = LBA_COUNT_ENC;
+				}
+
+				errno = 0;
+				uint32_t lba_size = entry->reader->read(inBuf, data_lba + lba_offset, lba_left);
+				if (lba_size != lba_left) {
+					// Read error.
+					return (errno != 0 ? -errno : -EIO);
+				}
+				return 0;
+			};
+
+			// Workers: Decrypt and verify the sectors.
+			auto workFn = [&aesw, h3_tbl, sector_count](unsigned int workerIdx, unsigned int idx, uint8_t *inBuf, uint8_t *outBuf) -> int {
+				verify_group_t *const vg = reinterpret_cast<verify_group_t*>(outBuf);
+				Wii_Disc_Sector_t *const sbuf = reinterpret_cast<Wii_Disc_Sector_t*>(inBuf);
+				unsigned int sectors = sector_count - (idx * SECTORS_PER_GROUP);
+				if (sectors > SECTORS_PER_GROUP) {
+					sectors = SECTORS_PER_GROUP;
+				}
+
+				vg->bad_count = 0;
+				vg->bad_sector = 0;
+				vg->bad_level = RVTH_VERIFY_LEVEL_NONE;
+				for (unsigned int j = 0; j < sectors; j++) {
+					RvtH_Verify_Level_e level = verify_sector(aesw[workerIdx], &sbuf[j], j, h3_tbl->h3[idx]);
+					if (level != RVTH_VERIFY_LEVEL_NONE) {
+						if (vg->bad_count == 0) {
+							vg->bad_sector = (uint8_t)j;
+							vg->bad_level = (uint8_t)level;
+						}
+						vg->bad_count++;
+					}
+				}
+				return 0;
+			};
+
+			// Writer: Collect the results in order.
+			auto writeFn = [&](unsigned int idx, const uint8_t *inBuf, const uint8_t *outBuf) -> int {
+				UNUSED(inBuf);
+				const verify_group_t *const vg = reinterpret_cast<const verify_group_t*>(outBuf);
+				if (vg->bad_count != 0) {
+					if (result->bad_sector_count == 0) {
+						result->bad_group = idx;
+						result->bad_sector = (idx * SECTORS_PER_GROUP) + vg->bad_sector;
+						result->bad_level = vg->bad_level;
+					}
+					result->bad_sector_count += vg->bad_count;
+					result->status = RVTH_VERIFY_STATUS_BAD;
+				}
+
+				if (callback) {
+					state.lba_processed = lba_base + BYTES_TO_LBA(data_offset) + (idx * LBA_COUNT_ENC);
+					if (!callback(&state, userdata)) {
+						// Stop processing.
+						return -ECANCELED;
+					}
+				}
+				return 0;
+			};
+
+			ret = pipeline.run(group_count, readFn, workFn, writeFn);
+			if (ret == -ECANCELED) {
+				// Verification was cancelled.
+				err = ECANCELED;
+				goto end;
+			} else if (ret != 0) {
+				// Read error.
+				result->status = RVTH_VERIFY_STATUS_ERROR;
+				result->err = ret;
+				ret = 0;
+				continue;
+			}
+			result->sector_count = sector_count;
+		}
+	}
+
+	if (callback) {
+		bool bRet;
+		state.lba_processed = state.lba_total;
+		bRet = callback(&state, userdata);
+		if (!bRet) {
+			// Stop processing.
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
+		}
+	}
+
+end:
+	free(pthdr);
+	free(H3_tbl);
+	for (AesCtx *ctx : aesw) {
+		aesw_free(ctx);
+	}
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
@@ -0,0 +1,265 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * wii_crypt.cpp: Wii partition encryption structures and helpers.         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "wii_crypt.h"
+#include "rvth_error.h"
+
+// libwiicrypto
+#include "libwiicrypto/cert_store.h"
+#include "libwiicrypto/sig_tools.h"
+#include "libwiicrypto/sha1_multi.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// Encryption.
+#include "aesw.h"
+
+/**
+ * Decrypt the title key.
+ * TODO: Pass in an aesw context for less overhead.
+ *
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @return 0 on success; non-zero on error.
+ */
+int rvth_decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
+{
+	const uint8_t *commonKey;
+	uint8_t iv[16];	// based on Title ID
+
+	// TODO: Error checking.
+	// TODO: Pass in an aesw context for less overhead.
+	AesCtx *aesw;
+
+	// Check the 'from' key.
+	if (!strncmp(ticket->issuer,
+	    RVL_Cert_Issuers[RVL_CERT_ISSUER_RETAIL_TICKET], sizeof(ticket->issuer)))
+	{
+		// Retail. Use RVL_KEY_RETAIL unless the Korean key is selected.
+		if (ticket->common_key_index != 1) {
+			commonKey = RVL_AES_Keys[RVL_KEY_RETAIL];
+			*crypto_type = RVL_CryptoType_Retail;
+		} else {
+			commonKey = RVL_AES_Keys[RVL_KEY_KOREAN];
+			*crypto_type = RVL_CryptoType_Korean;
+		}
+	}
+	else if (!strncmp(ticket->issuer,
+		 RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TICKET], sizeof(ticket->issuer)))
+	{
+		// Debug. Use RVL_KEY_DEBUG.
+		commonKey = RVL_AES_Keys[RVL_KEY_DEBUG];
+		*crypto_type = RVL_CryptoType_Debug;
+	}
+	else
+	{
+		// Unknown issuer.
+		errno = EIO;
+		return RVTH_ERROR_ISSUER_UNKNOWN;
+	}
+
+	// Initialize the AES context.
+	errno = 0;
+	aesw = aesw_new();
+	if (!aesw) {
+		int ret = -errno;
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		return ret;
+	}
+
+	// IV is the 64-bit title ID, followed by zeroes.
+	memcpy(iv, &ticket->title_id, 8);
+	memset(&iv[8], 0, 8);
+
+	// Decrypt the key with the original common key.
+	memcpy(titleKey, ticket->enc_title_key, 16);
+	aesw_set_key(aesw, commonKey, 16);
+	aesw_set_iv(aesw, iv, sizeof(iv));
+	aesw_decrypt(aesw, titleKey, 16);
+
+	// We're done here
+	aesw_free(aesw);
+	return 0;
+}
+
+/**
+ * Calculate the hashes for a group of Wii sectors.
+ * The user data is copied to the output buffer, and the H0, H1,
+ * and H2 tables are calculated. Nothing is encrypted.
+ * @param pInBuf	[in] Input buffer.
+ * @param inSize	[in] Size of in_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
+ * @param pOutBuf	[out] Output buffer.
+ * @param outSize	[in] Size of out_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @param pH3		[out,opt] Output buffer for the H3 hash.
+ * @param H3_size	[in] Size of pH3. (Must be SHA1_DIGEST_SIZE bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_hash_group(const uint8_t *pInBuf, size_t inSize,
+	uint8_t *pOutBuf, size_t outSize,
+	uint8_t *pH3, size_t H3_size)
+{
+	struct sha1_ctx sha1;
+	unsigned int i, j;
+
+	// Disc sector pointers.
+	Wii_Disc_Sector_t *const sbuf = (Wii_Disc_Sector_t*)pOutBuf;
+	Wii_Disc_Sector_t *sbuf_tmp;
+
+	assert(pInBuf);
+	assert(inSize == GROUP_SIZE_DEC);
+	assert(pOutBuf);
+	assert(outSize == GROUP_SIZE_ENC);
+	assert(!pH3 || H3_size == SHA1_DIGEST_SIZE);
+
+	if (!pInBuf || inSize != GROUP_SIZE_DEC ||
+	    !pOutBuf || outSize != GROUP_SIZE_ENC ||
+	    (pH3 && H3_size != SHA1_DIGEST_SIZE))
+	{
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Initialize the SHA-1 context.
+	sha1_init(&sha1);
+
+	// Copy the user data and calculate the H0 hashes.
+	for (i = 0; i < 64; i++, pInBuf += SECTOR_SIZE_DEC) {
+		// Copy user data.
+		memcpy(sbuf[i].data, pInBuf, SECTOR_SIZE_DEC);
+
+		// Calculate the H0 hashes.
+		// Each 1 KB block is hashed independently, so this
+		// uses the multi-buffer SHA-1 implementation.
+		sha1_multi(sbuf[i].hashes.H0[0], sbuf[i].data, 1024, 31);
+
+		// Zero out the post-H0 padding.
+		memset(sbuf[i].hashes.pad_H0, 0, sizeof(sbuf[i].hashes.pad_H0));
+	}
+
+	// Calculate the H1 hashes for each subgroup of 8 sectors.
+	for (i = 0; i < 64; i += 8) {
+		// First sector in the subgroup.
+		Wii_Disc_Sector_t *const sbuf0 = &sbuf[i];
+		uint8_t *pH1 = sbuf0->hashes.H1[0];
+
+		// Hash the H0 tables and store the results
+		// in the first sector's H1 table.
+		for (j = i; j < i+8; j++, pH1 += SHA1_DIGEST_SIZE) {
+			sha1_update(&sha1, sizeof(sbuf[j].hashes.H0), sbuf[j].hashes.H0[0]);
+			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH1);
+		}
+		memset(sbuf0->hashes.pad_H1, 0, sizeof(sbuf0->hashes.pad_H1));
+
+		// Copy the H1 hashes to each sector in the subgroup.
+		for (j = i+1; j < i+8; j++) {
+			memcpy(sbuf[j].hashes.H1, sbuf0->hashes.H1, sizeof(sbuf[j].hashes.H1));
+			memset(sbuf[j].hashes.pad_H1, 0, sizeof(sbuf[j].hashes.pad_H1));
+		}
+	}
+
+	// Calculate the H2 hashes for the subgroups.
+	// NOTE: All sectors in this group have the same H2 hashes.
+	sbuf_tmp = sbuf;
+	for (i = 0; i < 8; i += 1, sbuf_tmp += 8) {
+		sha1_update(&sha1, sizeof(sbuf_tmp->hashes.H1), sbuf_tmp->hashes.H1[0]);
+		sha1_digest(&sha1, SHA1_DIGEST_SIZE, sbuf[0].hashes.H2[i]);
+	}
+	memset(sbuf[0].hashes.pad_H2, 0, sizeof(sbuf[0].hashes.pad_H2));
+
+	// Copy the H2 hashes to all sectors.
+	for (i = 1; i < 64; i++) {
+		memcpy(sbuf[i].hashes.H2, sbuf[0].hashes.H2, sizeof(sbuf[0].hashes.H2));
+		memset(sbuf[i].hashes.pad_H2, 0, sizeof(sbuf[i].hashes.pad_H2));
+	}
+
+	if (pH3) {
+		// Calculate the H3 hash.
+		sha1_update(&sha1, sizeof(sbuf[0].hashes.H2), sbuf[0].hashes.H2[0]);
+		sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH3);
+	}
+
+	return 0;
+}
+
+/**
+ * Encrypt a group of Wii sectors that has already been hashed.
+ * @param aesw AES context. (Key must be set to the decrypted title key.)
+ * @param pBuf		[in/out] Group buffer.
+ * @param size		[in] Size of pBuf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_encrypt_hashed_group(AesCtx *aesw, uint8_t *pBuf, size_t size)
+{
+	unsigned int i;
+	uint8_t iv[16];
+
+	// Disc sector pointers.
+	Wii_Disc_Sector_t *const sbuf = (Wii_Disc_Sector_t*)pBuf;
+
+	assert(aesw);
+	assert(pBuf);
+	assert(size == GROUP_SIZE_ENC);
+	if (!aesw || !pBuf || size != GROUP_SIZE_ENC) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Encrypt the hashes.
+	// TODO: Error checking.
+	memset(iv, 0, sizeof(iv));
+	for (i = 0; i < 64; i++) {
+		aesw_set_iv(aesw, iv, sizeof(iv));
+		aesw_encrypt(aesw, (uint8_t*)&sbuf[i].hashes, sizeof(sbuf[i].hashes));
+	}
+
+	// Encrypt the user data.
+	for (i = 0; i < 64; i++) {
+		// User data IV is stored within the encrypted H2 table.
+		aesw_set_iv(aesw, &sbuf[i].hashes.H2[7][4], 16);
+		aesw_encrypt(aesw, sbuf[i].data, sizeof(sbuf[i].data));
+	}
+
+	return 0;
+}
+
+/**
+ * Encrypt a group of Wii sectors.
+ * @param aesw AES context. (Key must be set to the decrypted title key.)
+ * @param pInBuf	[in] Input buffer.
+ * @param inSize	[in] Size of in_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
+ * @param pOutBuf	[out] Output buffer.
+ * @param outSize	[in] Size of out_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @param pH3		[in] Output buffer for the H3 hash.
+ * @param H3_size;	[in] Size of pH3. (Must be SHA1_DIGEST_SIZE bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
+	size_t inSize, uint8_t *pOutBuf, size_t outSize,
+	uint8_t *pH3, size_t H3_size)
+{
+	assert(pH3);
+	if (!pH3) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	int ret = rvth_hash_group(pInBuf, inSize, pOutBuf, outSize, pH3, H3_size);
+	if (ret != 0) {
+		return ret;
+	}
+	return rvth_encrypt_hashed_group(aesw, pOutBuf, outSize);
+}
@@ -0,0 +1,145 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * wii_crypt.h: Wii partition encryption structures and helpers.           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_WII_CRYPT_H__
+#define __RVTHTOOL_LIBRVTH_WII_CRYPT_H__
+
+#include "libwiicrypto/common.h"
+#include "libwiicrypto/wii_structs.h"
+#include "libwiicrypto/aesw.h"
+
+#include <stdint.h>
+#include <nettle/sha1.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sector: 32 KB [H0]
+// Subgroup: 8 sectors == 256 KB [H1]
+// Group: 8 subgroups == 2 MB [H2]
+
+#define SECTOR_SIZE_DEC		(31*1024)
+#define SECTOR_SIZE_ENC		(32*1024)
+#define SUBGROUP_SIZE_DEC	(8*SECTOR_SIZE_DEC)
+#define SUBGROUP_SIZE_ENC	(8*SECTOR_SIZE_ENC)
+#define GROUP_SIZE_DEC		(8*SUBGROUP_SIZE_DEC)
+#define GROUP_SIZE_ENC		(8*SUBGROUP_SIZE_ENC)
+
+// H3 table: SHA-1 hashes of each group's H2 tables.
+// Up to 4,915 groups can be hashed. (9,830 MB of encrypted data)
+// Unused hash entries are all zero.
+// The SHA-1 hash of the H3 table is stored in the TMD content table.
+typedef struct _Wii_Disc_H3_t {
+	uint8_t h3[4915][SHA1_DIGEST_SIZE];
+	uint8_t pad[4];
+} Wii_Disc_H3_t;
+ASSERT_STRUCT(Wii_Disc_H3_t, 0x18000);
+
+// Encrypted Wii disc sector: Hash data.
+// The hash data is encrypted using AES-128-CBC.
+// - Key: Decrypted title key.
+// - IV: All zero.
+typedef struct _Wii_Disc_Hashes_t {
+	// H0 hashes.
+	// One SHA-1 hash for each kilobyte of user data.
+	uint8_t H0[31][SHA1_DIGEST_SIZE];
+
+	// Padding. (0x00)
+	uint8_t pad_H0[20];
+
+	// H1 hashes.
+	// Each hash is over the H0 table for each sector
+	// in an 8-sector subgroup.
+	uint8_t H1[8][SHA1_DIGEST_SIZE];
+
+	// Padding. (0x00)
+	uint8_t pad_H1[32];
+
+	// H2 hashes.
+	// Each hash is over the H1 table for each subgroup
+	// in an 8-subgroup group.
+	// NOTE: The last 16 bytes of h2[7], when encrypted,
+	// is the user data CBC IV.
+	uint8_t H2[8][SHA1_DIGEST_SIZE];
+
+	// Padding. (0x00)
+	uint8_t pad_H2[32];
+} Wii_Disc_Hashes_t;
+ASSERT_STRUCT(Wii_Disc_Hashes_t, 1024);
+
+// Encrypted Wii disc sector.
+typedef struct _Wii_Disc_Sector_t {
+	// Hash table.
+	Wii_Disc_Hashes_t hashes;
+
+	// User data.
+	// This section is encrypted using AES-128-CBC:
+	// - Key: Decrypted title key.
+	// - IV: *Encrypted* bytes 0x3D0-0x3DF of the hash table,
+	//        aka the last 16 bytes of hashes.h2[7].
+	uint8_t data[31*1024];
+} Wii_Disc_Sector_t;
+ASSERT_STRUCT(Wii_Disc_Sector_t, 32*1024);
+
+/**
+ * Decrypt the title key.
+ * TODO: Pass in an aesw context for less overhead.
+ *
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @return 0 on success; non-zero on error.
+ */
+int rvth_decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type);
+
+/**
+ * Calculate the hashes for a group of Wii sectors.
+ * The user data is copied to the output buffer, and the H0, H1,
+ * and H2 tables are calculated. Nothing is encrypted.
+ * @param pInBuf	[in] Input buffer.
+ * @param inSize	[in] Size of in_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
+ * @param pOutBuf	[out] Output buffer.
+ * @param outSize	[in] Size of out_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @param pH3		[out,opt] Output buffer for the H3 hash.
+ * @param H3_size	[in] Size of pH3. (Must be SHA1_DIGEST_SIZE bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_hash_group(const uint8_t *pInBuf, size_t inSize,
+	uint8_t *pOutBuf, size_t outSize,
+	uint8_t *pH3, size_t H3_size);
+
+/**
+ * Encrypt a group of Wii sectors that has already been hashed.
+ * @param aesw AES context. (Key must be set to the decrypted title key.)
+ * @param pBuf		[in/out] Group buffer.
+ * @param size		[in] Size of pBuf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_encrypt_hashed_group(AesCtx *aesw, uint8_t *pBuf, size_t size);
+
+/**
+ * Encrypt a group of Wii sectors.
+ * @param aesw AES context. (Key must be set to the decrypted title key.)
+ * @param pInBuf	[in] Input buffer.
+ * @param inSize	[in] Size of in_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
+ * @param pOutBuf	[out] Output buffer.
+ * @param outSize	[in] Size of out_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @param pH3		[in] Output buffer for the H3 hash.
+ * @param H3_size;	[in] Size of pH3. (Must be SHA1_DIGEST_SIZE bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
+	size_t inSize, uint8_t *pOutBuf, size_t outSize,
+	uint8_t *pH3, size_t H3_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_WII_CRYPT_H__ */
@@ -33,13 +33,17 @@
  * @param filename	[in] Filename.
  * @param lba_len	[in] LBA length. (Will NOT be allocated initially.)
  * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @param format	[in,opt] Disc image format.
  */
-RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
+RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr, RvtH_ImageFormat_e format)
 	: m_file(nullptr)
 	, m_bankCount(0)
 	, m_imageType(RVTH_ImageType_Unknown)
 	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
 	, m_entries(nullptr)
+	, m_bankDetailsLoaded(0)
+	, m_bankCacheHit(false)
+	, m_bankCacheDetails(0)
 {
 	RvtH_BankEntry *entry;
 
@@ -85,13 +89,15 @@ RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
 	entry->lba_len = lba_len;
 	entry->type = RVTH_BankType_Empty;
 	entry->is_deleted = false;
+	// The remaining fields are copied from the source bank.
+	setBankDetailsLoaded(0, true);
 
 	// Timestamp.
 	// TODO: Update on write.
 	entry->timestamp = time(nullptr);
 
 	// Initialize the disc image reader.
-	entry->reader = Reader::open(m_file, entry->lba_start, entry->lba_len);
+	entry->reader = Reader::create(m_file, entry->lba_len, format);
 	if (!entry->reader) {
 		// Error creating the disc image reader.
 		err = errno;
@@ -33,6 +33,32 @@ extern "C" {
 struct _AesCtx;
 typedef struct _AesCtx AesCtx;
 
+/**
+ * AES implementations.
+ * aesw_new() selects the fastest one supported by the CPU.
+ */
+typedef enum {
+	AESW_IMPL_NETTLE	= 0,	// GNU Nettle (portable)
+	AESW_IMPL_AESNI		= 1,	// x86 AES-NI
+	AESW_IMPL_ARMV8_CE	= 2,	// ARMv8 Crypto Extensions
+
+	AESW_IMPL_MAX
+} AesImpl_e;
+
+/**
+ * Is the specified AES implementation supported on this system?
+ * @param impl AES implementation.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int aesw_impl_is_supported(AesImpl_e impl);
+
+/**
+ * Get the name of an AES implementation.
+ * @param impl AES implementation.
+ * @return Name, or NULL if impl is invalid.
+ */
+const char *aesw_impl_name(AesImpl_e impl);
+
 /**
  * Create an AES context.
  * @return AES context, or NULL on error.
@@ -45,6 +71,23 @@ AesCtx *aesw_new(void);
  */
 void aesw_free(AesCtx *aesw);
 
+/**
+ * Get the AES implementation used by an AES context.
+ * @param aesw	[in] AES context.
+ * @return AES implementation.
+ */
+AesImpl_e aesw_get_impl(const AesCtx *aesw);
+
+/**
+ * Set the AES implementation used by an AES context.
+ * This is mostly useful for testing and benchmarking;
+ * aesw_new() automatically selects the fastest one.
+ * @param aesw	[in] AES context.
+ * @param impl	[in] AES implementation.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int aesw_set_impl(AesCtx *aesw, AesImpl_e impl);
+
 /**
  * Set the AES key.
  * @param aesw	[in] AES context.
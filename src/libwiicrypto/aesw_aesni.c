@@ -0,0 +1,199 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_aesni.c: AES wrapper functions. (x86 AES-NI version)               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with AES-NI enabled.
+// (-maes on gcc/clang)
+
+#include "aesw_hw.h"
+
+// AES-NI intrinsics.
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+/**
+ * AES-128 key expansion step.
+ * @param key		[in] Previous round key.
+ * @param keygened	[in] Result of _mm_aeskeygenassist_si128().
+ * @return Next round key.
+ */
+static inline __m128i aes128_key_exp(__m128i key, __m128i keygened)
+{
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3,3,3,3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+// _mm_aeskeygenassist_si128() requires an immediate value for rcon.
+#define AES128_KEY_EXP(key, rcon) \
+	aes128_key_exp((key), _mm_aeskeygenassist_si128((key), (rcon)))
+
+/**
+ * Expand an AES-128 key using AES-NI.
+ * @param rk_enc	[out] Encryption round keys.
+ * @param rk_dec	[out] Decryption round keys. (Equivalent Inverse Cipher)
+ * @param key		[in] AES-128 key.
+ */
+void aesw_aesni_set_key(uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t rk_dec[AESW_HW_RK_SIZE], const uint8_t key[16])
+{
+	__m128i ek[AESW_HW_ROUND_KEYS];
+	int i;
+
+	ek[0]  = _mm_loadu_si128((const __m128i*)key);
+	ek[1]  = AES128_KEY_EXP(ek[0], 0x01);
+	ek[2]  = AES128_KEY_EXP(ek[1], 0x02);
+	ek[3]  = AES128_KEY_EXP(ek[2], 0x04);
+	ek[4]  = AES128_KEY_EXP(ek[3], 0x08);
+	ek[5]  = AES128_KEY_EXP(ek[4], 0x10);
+	ek[6]  = AES128_KEY_EXP(ek[5], 0x20);
+	ek[7]  = AES128_KEY_EXP(ek[6], 0x40);
+	ek[8]  = AES128_KEY_EXP(ek[7], 0x80);
+	ek[9]  = AES128_KEY_EXP(ek[8], 0x1B);
+	ek[10] = AES128_KEY_EXP(ek[9], 0x36);
+
+	// Decryption keys are in reverse order, with
+	// InvMixColumns applied to the middle rounds.
+	for (i = 0; i < AESW_HW_ROUND_KEYS; i++) {
+		_mm_storeu_si128((__m128i*)&rk_enc[i * 16], ek[i]);
+	}
+	_mm_storeu_si128((__m128i*)&rk_dec[0], ek[10]);
+	for (i = 1; i < AESW_HW_ROUND_KEYS - 1; i++) {
+		_mm_storeu_si128((__m128i*)&rk_dec[i * 16], _mm_aesimc_si128(ek[10 - i]));
+	}
+	_mm_storeu_si128((__m128i*)&rk_dec[10 * 16], ek[0]);
+}
+
+/**
+ * Encrypt data in place using AES-128-CBC with AES-NI.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt(const uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size)
+{
+	__m128i rk[AESW_HW_ROUND_KEYS];
+	__m128i state;
+	int i;
+
+	for (i = 0; i < AESW_HW_ROUND_KEYS; i++) {
+		rk[i] = _mm_loadu_si128((const __m128i*)&rk_enc[i * 16]);
+	}
+
+	// CBC encryption is inherently serial, since each block
+	// depends on the previous block's ciphertext.
+	state = _mm_loadu_si128((const __m128i*)iv);
+	for (; size >= 16; size -= 16, pData += 16) {
+		state = _mm_xor_si128(state, _mm_loadu_si128((const __m128i*)pData));
+		state = _mm_xor_si128(state, rk[0]);
+		state = _mm_aesenc_si128(state, rk[1]);
+		state = _mm_aesenc_si128(state, rk[2]);
+		state = _mm_aesenc_si128(state, rk[3]);
+		state = _mm_aesenc_si128(state, rk[4]);
+		state = _mm_aesenc_si128(state, rk[5]);
+		state = _mm_aesenc_si128(state, rk[6]);
+		state = _mm_aesenc_si128(state, rk[7]);
+		state = _mm_aesenc_si128(state, rk[8]);
+		state = _mm_aesenc_si128(state, rk[9]);
+		state = _mm_aesenclast_si128(state, rk[10]);
+		_mm_storeu_si128((__m128i*)pData, state);
+	}
+	_mm_storeu_si128((__m128i*)iv, state);
+}
+
+/**
+ * Decrypt data in place using AES-128-CBC with AES-NI.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt(const uint8_t rk_dec[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size)
+{
+	__m128i rk[AESW_HW_ROUND_KEYS];
+	__m128i prev;
+	int i;
+
+	for (i = 0; i < AESW_HW_ROUND_KEYS; i++) {
+		rk[i] = _mm_loadu_si128((const __m128i*)&rk_dec[i * 16]);
+	}
+	prev = _mm_loadu_si128((const __m128i*)iv);
+
+	// CBC decryption can be parallelized, so process
+	// 8 blocks at a time to hide the AESDEC latency.
+	// NOTE: Blocks are kept in individual variables so the
+	// compiler doesn't spill the state arrays to the stack.
+#define AESDEC8(k) do { \
+	s0 = _mm_aesdec_si128(s0, (k)); s1 = _mm_aesdec_si128(s1, (k)); \
+	s2 = _mm_aesdec_si128(s2, (k)); s3 = _mm_aesdec_si128(s3, (k)); \
+	s4 = _mm_aesdec_si128(s4, (k)); s5 = _mm_aesdec_si128(s5, (k)); \
+	s6 = _mm_aesdec_si128(s6, (k)); s7 = _mm_aesdec_si128(s7, (k)); \
+} while (0)
+	for (; size >= 8*16; size -= 8*16, pData += 8*16) {
+		const __m128i c0 = _mm_loadu_si128((const __m128i*)&pData[0*16]);
+		const __m128i c1 = _mm_loadu_si128((const __m128i*)&pData[1*16]);
+		const __m128i c2 = _mm_loadu_si128((const __m128i*)&pData[2*16]);
+		const __m128i c3 = _mm_loadu_si128((const __m128i*)&pData[3*16]);
+		const __m128i c4 = _mm_loadu_si128((const __m128i*)&pData[4*16]);
+		const __m128i c5 = _mm_loadu_si128((const __m128i*)&pData[5*16]);
+		const __m128i c6 = _mm_loadu_si128((const __m128i*)&pData[6*16]);
+		const __m128i c7 = _mm_loadu_si128((const __m128i*)&pData[7*16]);
+		__m128i s0 = _mm_xor_si128(c0, rk[0]);
+		__m128i s1 = _mm_xor_si128(c1, rk[0]);
+		__m128i s2 = _mm_xor_si128(c2, rk[0]);
+		__m128i s3 = _mm_xor_si128(c3, rk[0]);
+		__m128i s4 = _mm_xor_si128(c4, rk[0]);
+		__m128i s5 = _mm_xor_si128(c5, rk[0]);
+		__m128i s6 = _mm_xor_si128(c6, rk[0]);
+		__m128i s7 = _mm_xor_si128(c7, rk[0]);
+
+		AESDEC8(rk[1]);
+		AESDEC8(rk[2]);
+		AESDEC8(rk[3]);
+		AESDEC8(rk[4]);
+		AESDEC8(rk[5]);
+		AESDEC8(rk[6]);
+		AESDEC8(rk[7]);
+		AESDEC8(rk[8]);
+		AESDEC8(rk[9]);
+
+		_mm_storeu_si128((__m128i*)&pData[0*16], _mm_xor_si128(_mm_aesdeclast_si128(s0, rk[10]), prev));
+		_mm_storeu_si128((__m128i*)&pData[1*16], _mm_xor_si128(_mm_aesdeclast_si128(s1, rk[10]), c0));
+		_mm_storeu_si128((__m128i*)&pData[2*16], _mm_xor_si128(_mm_aesdeclast_si128(s2, rk[10]), c1));
+		_mm_storeu_si128((__m128i*)&pData[3*16], _mm_xor_si128(_mm_aesdeclast_si128(s3, rk[10]), c2));
+		_mm_storeu_si128((__m128i*)&pData[4*16], _mm_xor_si128(_mm_aesdeclast_si128(s4, rk[10]), c3));
+		_mm_storeu_si128((__m128i*)&pData[5*16], _mm_xor_si128(_mm_aesdeclast_si128(s5, rk[10]), c4));
+		_mm_storeu_si128((__m128i*)&pData[6*16], _mm_xor_si128(_mm_aesdeclast_si128(s6, rk[10]), c5));
+		_mm_storeu_si128((__m128i*)&pData[7*16], _mm_xor_si128(_mm_aesdeclast_si128(s7, rk[10]), c6));
+		prev = c7;
+	}
+#undef AESDEC8
+
+	// Remaining blocks.
+	for (; size >= 16; size -= 16, pData += 16) {
+		const __m128i c = _mm_loadu_si128((const __m128i*)pData);
+		__m128i s = _mm_xor_si128(c, rk[0]);
+		s = _mm_aesdec_si128(s, rk[1]);
+		s = _mm_aesdec_si128(s, rk[2]);
+		s = _mm_aesdec_si128(s, rk[3]);
+		s = _mm_aesdec_si128(s, rk[4]);
+		s = _mm_aesdec_si128(s, rk[5]);
+		s = _mm_aesdec_si128(s, rk[6]);
+		s = _mm_aesdec_si128(s, rk[7]);
+		s = _mm_aesdec_si128(s, rk[8]);
+		s = _mm_aesdec_si128(s, rk[9]);
+		s = _mm_aesdeclast_si128(s, rk[10]);
+		_mm_storeu_si128((__m128i*)pData, _mm_xor_si128(s, prev));
+		prev = c;
+	}
+	_mm_storeu_si128((__m128i*)iv, prev);
+}
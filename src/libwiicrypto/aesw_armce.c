@@ -0,0 +1,172 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_armce.c: AES wrapper functions. (ARMv8 Crypto Extensions version)  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with the Crypto Extensions enabled.
+// (-march=armv8-a+crypto on gcc/clang)
+
+#include "aesw_hw.h"
+
+#include <string.h>
+
+// ARMv8 Crypto Extensions intrinsics.
+#ifdef _MSC_VER
+# include <arm64_neon.h>
+#else
+# include <arm_neon.h>
+#endif
+
+/**
+ * Apply the AES S-box to each byte of a 32-bit word.
+ * @param w Word.
+ * @return SubWord(w)
+ */
+static inline uint32_t aes_sub_word(uint32_t w)
+{
+	// If all four columns are identical, ShiftRows is a no-op,
+	// so AESE with a zero round key is just SubBytes.
+	const uint8x16_t s = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(w)), vdupq_n_u8(0));
+	return vgetq_lane_u32(vreinterpretq_u32_u8(s), 0);
+}
+
+/**
+ * Expand an AES-128 key using the ARMv8 Crypto Extensions.
+ * @param rk_enc	[out] Encryption round keys.
+ * @param rk_dec	[out] Decryption round keys. (Equivalent Inverse Cipher)
+ * @param key		[in] AES-128 key.
+ */
+void aesw_armce_set_key(uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t rk_dec[AESW_HW_RK_SIZE], const uint8_t key[16])
+{
+	static const uint8_t rcon[10] = {
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36
+	};
+	uint32_t w[AESW_HW_ROUND_KEYS * 4];
+	int i;
+
+	// NOTE: Words are handled in little-endian byte order,
+	// which matches the in-register layout used by AESE.
+	memcpy(w, key, 16);
+	for (i = 4; i < AESW_HW_ROUND_KEYS * 4; i++) {
+		uint32_t tmp = w[i - 1];
+		if ((i % 4) == 0) {
+			// RotWord(), SubWord(), Rcon.
+			tmp = aes_sub_word((tmp >> 8) | (tmp << 24)) ^ rcon[(i / 4) - 1];
+		}
+		w[i] = w[i - 4] ^ tmp;
+	}
+	memcpy(rk_enc, w, AESW_HW_RK_SIZE);
+
+	// Decryption keys are in reverse order, with
+	// InvMixColumns applied to the middle rounds.
+	vst1q_u8(&rk_dec[0], vld1q_u8(&rk_enc[10 * 16]));
+	for (i = 1; i < AESW_HW_ROUND_KEYS - 1; i++) {
+		vst1q_u8(&rk_dec[i * 16], vaesimcq_u8(vld1q_u8(&rk_enc[(10 - i) * 16])));
+	}
+	vst1q_u8(&rk_dec[10 * 16], vld1q_u8(&rk_enc[0]));
+}
+
+/**
+ * Encrypt data in place using AES-128-CBC with the ARMv8 Crypto Extensions.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armce_cbc_encrypt(const uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size)
+{
+	uint8x16_t rk[AESW_HW_ROUND_KEYS];
+	uint8x16_t state;
+	int i;
+
+	for (i = 0; i < AESW_HW_ROUND_KEYS; i++) {
+		rk[i] = vld1q_u8(&rk_enc[i * 16]);
+	}
+
+	// CBC encryption is inherently serial, since each block
+	// depends on the previous block's ciphertext.
+	// NOTE: AESE includes AddRoundKey, so the last round key
+	// is applied with a separate XOR.
+	state = vld1q_u8(iv);
+	for (; size >= 16; size -= 16, pData += 16) {
+		state = veorq_u8(state, vld1q_u8(pData));
+		for (i = 0; i < AESW_HW_ROUND_KEYS - 2; i++) {
+			state = vaesmcq_u8(vaeseq_u8(state, rk[i]));
+		}
+		state = vaeseq_u8(state, rk[9]);
+		state = veorq_u8(state, rk[10]);
+		vst1q_u8(pData, state);
+	}
+	vst1q_u8(iv, state);
+}
+
+/**
+ * Decrypt data in place using AES-128-CBC with the ARMv8 Crypto Extensions.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armce_cbc_decrypt(const uint8_t rk_dec[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size)
+{
+	uint8x16_t rk[AESW_HW_ROUND_KEYS];
+	uint8x16_t prev;
+	int i;
+
+	for (i = 0; i < AESW_HW_ROUND_KEYS; i++) {
+		rk[i] = vld1q_u8(&rk_dec[i * 16]);
+	}
+	prev = vld1q_u8(iv);
+
+	// CBC decryption can be parallelized, so process
+	// 4 blocks at a time to hide the AESD latency.
+	// NOTE: Blocks are kept in individual variables so the
+	// compiler doesn't spill the state arrays to the stack.
+#define AESD4(k) do { \
+	s0 = vaesimcq_u8(vaesdq_u8(s0, (k))); s1 = vaesimcq_u8(vaesdq_u8(s1, (k))); \
+	s2 = vaesimcq_u8(vaesdq_u8(s2, (k))); s3 = vaesimcq_u8(vaesdq_u8(s3, (k))); \
+} while (0)
+	for (; size >= 4*16; size -= 4*16, pData += 4*16) {
+		const uint8x16_t c0 = vld1q_u8(&pData[0*16]);
+		const uint8x16_t c1 = vld1q_u8(&pData[1*16]);
+		const uint8x16_t c2 = vld1q_u8(&pData[2*16]);
+		const uint8x16_t c3 = vld1q_u8(&pData[3*16]);
+		uint8x16_t s0 = c0, s1 = c1, s2 = c2, s3 = c3;
+
+		AESD4(rk[0]);
+		AESD4(rk[1]);
+		AESD4(rk[2]);
+		AESD4(rk[3]);
+		AESD4(rk[4]);
+		AESD4(rk[5]);
+		AESD4(rk[6]);
+		AESD4(rk[7]);
+		AESD4(rk[8]);
+
+		vst1q_u8(&pData[0*16], veorq_u8(veorq_u8(vaesdq_u8(s0, rk[9]), rk[10]), prev));
+		vst1q_u8(&pData[1*16], veorq_u8(veorq_u8(vaesdq_u8(s1, rk[9]), rk[10]), c0));
+		vst1q_u8(&pData[2*16], veorq_u8(veorq_u8(vaesdq_u8(s2, rk[9]), rk[10]), c1));
+		vst1q_u8(&pData[3*16], veorq_u8(veorq_u8(vaesdq_u8(s3, rk[9]), rk[10]), c2));
+		prev = c3;
+	}
+#undef AESD4
+
+	// Remaining blocks.
+	for (; size >= 16; size -= 16, pData += 16) {
+		const uint8x16_t c = vld1q_u8(pData);
+		uint8x16_t s = c;
+		for (i = 0; i < AESW_HW_ROUND_KEYS - 2; i++) {
+			s = vaesimcq_u8(vaesdq_u8(s, rk[i]));
+		}
+		s = veorq_u8(vaesdq_u8(s, rk[9]), rk[10]);
+		vst1q_u8(pData, veorq_u8(s, prev));
+		prev = c;
+	}
+	vst1q_u8(iv, prev);
+}
@@ -0,0 +1,94 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_hw.h: AES wrapper functions. (hardware-accelerated backends)       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This is an internal header used by aesw_nettle.c.
+// Only AES-128-CBC is supported.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_AESW_HW_H__
+#define __RVTHTOOL_LIBWIICRYPTO_AESW_HW_H__
+
+#include "config.libwiicrypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// AES-128 uses 11 round keys.
+#define AESW_HW_ROUND_KEYS 11
+#define AESW_HW_RK_SIZE (AESW_HW_ROUND_KEYS * 16)
+
+#ifdef HAVE_AESW_AESNI
+/**
+ * Expand an AES-128 key using AES-NI.
+ * @param rk_enc	[out] Encryption round keys.
+ * @param rk_dec	[out] Decryption round keys. (Equivalent Inverse Cipher)
+ * @param key		[in] AES-128 key.
+ */
+void aesw_aesni_set_key(uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t rk_dec[AESW_HW_RK_SIZE], const uint8_t key[16]);
+
+/**
+ * Encrypt data in place using AES-128-CBC with AES-NI.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt(const uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size);
+
+/**
+ * Decrypt data in place using AES-128-CBC with AES-NI.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt(const uint8_t rk_dec[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size);
+#endif /* HAVE_AESW_AESNI */
+
+#ifdef HAVE_AESW_ARMV8_CE
+/**
+ * Expand an AES-128 key using the ARMv8 Crypto Extensions.
+ * @param rk_enc	[out] Encryption round keys.
+ * @param rk_dec	[out] Decryption round keys. (Equivalent Inverse Cipher)
+ * @param key		[in] AES-128 key.
+ */
+void aesw_armce_set_key(uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t rk_dec[AESW_HW_RK_SIZE], const uint8_t key[16]);
+
+/**
+ * Encrypt data in place using AES-128-CBC with the ARMv8 Crypto Extensions.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armce_cbc_encrypt(const uint8_t rk_enc[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size);
+
+/**
+ * Decrypt data in place using AES-128-CBC with the ARMv8 Crypto Extensions.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. Updated for chaining.
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armce_cbc_decrypt(const uint8_t rk_dec[AESW_HW_RK_SIZE],
+	uint8_t iv[16], uint8_t *pData, size_t size);
+#endif /* HAVE_AESW_ARMV8_CE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_AESW_HW_H__ */
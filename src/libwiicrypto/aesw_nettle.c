@@ -19,8 +19,11 @@
  ***************************************************************************/
 
 #include "config.nettle.h"
+#include "config.libwiicrypto.h"
 
 #include "aesw.h"
+#include "aesw_hw.h"
+#include "cpuflags.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -32,25 +35,123 @@
 #include <nettle/cbc.h>
 
 // AES context. (GNU Nettle version.)
+// Hardware-accelerated implementations are used if available.
 struct _AesCtx {
+	// Expanded keys are cached, since the same key is
+	// typically used for many encrypt/decrypt calls.
+	union {
+		struct {
 #ifdef HAVE_NETTLE_3
-	struct aes128_ctx ctx;
+			struct aes128_ctx enc;
+			struct aes128_ctx dec;
 #else /* !HAVE_NETTLE_3 */
-	struct aes_ctx ctx;
+			struct aes_ctx enc;
+			struct aes_ctx dec;
 #endif /* HAVE_NETTLE_3 */
+		} nettle;
+		struct {
+			uint8_t enc[AESW_HW_RK_SIZE];
+			uint8_t dec[AESW_HW_RK_SIZE];
+		} hw;
+	} rk;
 
 	// Encryption key.
 	uint8_t key[16];
 	// Initialization vector.
 	uint8_t iv[16];
+
+	// AES implementation.
+	AesImpl_e impl;
+	// Set if the key has been expanded for the current implementation.
+	uint8_t key_set;
 };
 
+/**
+ * Is the specified AES implementation supported on this system?
+ * @param impl AES implementation.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int aesw_impl_is_supported(AesImpl_e impl)
+{
+	switch (impl) {
+		case AESW_IMPL_NETTLE:
+			return 1;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			return !!(wiicrypto_cpu_flags() & WIICRYPTO_CPUFLAG_X86_AESNI);
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8_CE
+		case AESW_IMPL_ARMV8_CE:
+			return !!(wiicrypto_cpu_flags() & WIICRYPTO_CPUFLAG_ARM_AES);
+#endif /* HAVE_AESW_ARMV8_CE */
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Get the name of an AES implementation.
+ * @param impl AES implementation.
+ * @return Name, or NULL if impl is invalid.
+ */
+const char *aesw_impl_name(AesImpl_e impl)
+{
+	static const char *const impl_names[AESW_IMPL_MAX] = {
+		"nettle",
+		"AES-NI",
+		"ARMv8-CE",
+	};
+
+	assert(impl >= 0 && impl < AESW_IMPL_MAX);
+	if (impl < 0 || impl >= AESW_IMPL_MAX) {
+		return NULL;
+	}
+	return impl_names[impl];
+}
+
+/**
+ * Expand the key for the current AES implementation.
+ * @param aesw AES context.
+ */
+static void aesw_expand_key(AesCtx *aesw)
+{
+	switch (aesw->impl) {
+		default:
+			assert(!"Invalid AES implementation.");
+			// fall-through
+		case AESW_IMPL_NETTLE:
+#ifdef HAVE_NETTLE_3
+			aes128_set_encrypt_key(&aesw->rk.nettle.enc, aesw->key);
+			aes128_set_decrypt_key(&aesw->rk.nettle.dec, aesw->key);
+#else /* !HAVE_NETTLE_3 */
+			aes_set_encrypt_key(&aesw->rk.nettle.enc, sizeof(aesw->key), aesw->key);
+			aes_set_decrypt_key(&aesw->rk.nettle.dec, sizeof(aesw->key), aesw->key);
+#endif /* HAVE_NETTLE_3 */
+			break;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_set_key(aesw->rk.hw.enc, aesw->rk.hw.dec, aesw->key);
+			break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8_CE
+		case AESW_IMPL_ARMV8_CE:
+			aesw_armce_set_key(aesw->rk.hw.enc, aesw->rk.hw.dec, aesw->key);
+			break;
+#endif /* HAVE_AESW_ARMV8_CE */
+	}
+	aesw->key_set = 1;
+}
+
 /**
  * Create an AES context.
+ * The fastest AES implementation supported by the CPU is selected.
  * @return AES context, or NULL on error.
  */
 AesCtx *aesw_new(void)
 {
+	int impl;
+
 	// Allocate an AES context.
 	AesCtx *aesw = calloc(1, sizeof(*aesw));
 	if (!aesw) {
@@ -59,6 +160,15 @@ AesCtx *aesw_new(void)
 		return NULL;
 	}
 
+	// Select the best available implementation.
+	aesw->impl = AESW_IMPL_NETTLE;
+	for (impl = AESW_IMPL_MAX - 1; impl > AESW_IMPL_NETTLE; impl--) {
+		if (aesw_impl_is_supported((AesImpl_e)impl)) {
+			aesw->impl = (AesImpl_e)impl;
+			break;
+		}
+	}
+
 	// AES context has been initialized.
 	return aesw;
 }
@@ -72,6 +182,43 @@ void aesw_free(AesCtx *aesw)
 	free(aesw);
 }
 
+/**
+ * Get the AES implementation used by an AES context.
+ * @param aesw	[in] AES context.
+ * @return AES implementation.
+ */
+AesImpl_e aesw_get_impl(const AesCtx *aesw)
+{
+	assert(aesw != NULL);
+	return aesw->impl;
+}
+
+/**
+ * Set the AES implementation used by an AES context.
+ * This is mostly useful for testing and benchmarking;
+ * aesw_new() automatically selects the fastest one.
+ * @param aesw	[in] AES context.
+ * @param impl	[in] AES implementation.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int aesw_set_impl(AesCtx *aesw, AesImpl_e impl)
+{
+	if (!aesw || impl < 0 || impl >= AESW_IMPL_MAX) {
+		return -EINVAL;
+	} else if (!aesw_impl_is_supported(impl)) {
+		return -ENOTSUP;
+	}
+
+	if (aesw->impl != impl) {
+		// Re-expand the key for the new implementation.
+		aesw->impl = impl;
+		if (aesw->key_set) {
+			aesw_expand_key(aesw);
+		}
+	}
+	return 0;
+}
+
 /**
  * Set the AES key.
  * @param aesw	[in] AES context.
@@ -86,6 +233,7 @@ int aesw_set_key(AesCtx *aesw, const uint8_t *pKey, size_t size)
 	}
 
 	memcpy(aesw->key, pKey, size);
+	aesw_expand_key(aesw);
 	return 0;
 }
 
@@ -121,16 +269,33 @@ size_t aesw_encrypt(AesCtx *aesw, uint8_t *pData, size_t size)
 		return 0;
 	}
 
-	// TODO: Only set encrypt key if switching modes?
+	if (!aesw->key_set) {
+		// Key hasn't been set. Use the zeroed key.
+		aesw_expand_key(aesw);
+	}
+
+	switch (aesw->impl) {
+		default:
+		case AESW_IMPL_NETTLE:
 #ifdef HAVE_NETTLE_3
-	aes128_set_encrypt_key(&aesw->ctx, aesw->key);
-	cbc_encrypt(&aesw->ctx, (nettle_cipher_func*)aes128_encrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_encrypt(&aesw->rk.nettle.enc, (nettle_cipher_func*)aes128_encrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #else /* !HAVE_NETTLE_3 */
-	aes_set_encrypt_key(&aesw->ctx, sizeof(aesw->key), aesw->key);
-	cbc_encrypt(&aesw->ctx, (nettle_crypt_func*)aes_encrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_encrypt(&aesw->rk.nettle.enc, (nettle_crypt_func*)aes_encrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #endif /* HAVE_NETTLE_3 */
+			break;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_cbc_encrypt(aesw->rk.hw.enc, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8_CE
+		case AESW_IMPL_ARMV8_CE:
+			aesw_armce_cbc_encrypt(aesw->rk.hw.enc, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_ARMV8_CE */
+	}
 
 	return size;
 }
@@ -150,16 +315,33 @@ size_t aesw_decrypt(AesCtx *aesw, uint8_t *pData, size_t size)
 		return 0;
 	}
 
-	// TODO: Only set decrypt key if switching modes?
+	if (!aesw->key_set) {
+		// Key hasn't been set. Use the zeroed key.
+		aesw_expand_key(aesw);
+	}
+
+	switch (aesw->impl) {
+		default:
+		case AESW_IMPL_NETTLE:
 #ifdef HAVE_NETTLE_3
-	aes128_set_decrypt_key(&aesw->ctx, aesw->key);
-	cbc_decrypt(&aesw->ctx, (nettle_cipher_func*)aes128_decrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_decrypt(&aesw->rk.nettle.dec, (nettle_cipher_func*)aes128_decrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #else /* !HAVE_NETTLE_3 */
-	aes_set_decrypt_key(&aesw->ctx, sizeof(aesw->key), aesw->key);
-	cbc_decrypt(&aesw->ctx, (nettle_crypt_func*)aes_decrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_decrypt(&aesw->rk.nettle.dec, (nettle_crypt_func*)aes_decrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #endif /* HAVE_NETTLE_3 */
+			break;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_cbc_decrypt(aesw->rk.hw.dec, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8_CE
+		case AESW_IMPL_ARMV8_CE:
+			aesw_armce_cbc_decrypt(aesw->rk.hw.dec, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_ARMV8_CE */
+	}
 
 	return size;
 }
@@ -0,0 +1,152 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * cpuflags.c: CPU feature detection for runtime dispatch.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.libwiicrypto.h"
+#include "cpuflags.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+# define CPUFLAGS_X86 1
+# ifdef _MSC_VER
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+# define CPUFLAGS_ARM64 1
+# if defined(_WIN32)
+#  include "win32/Win32_sdk.h"
+# elif defined(HAVE_GETAUXVAL)
+#  include <sys/auxv.h>
+#  ifndef HWCAP_AES
+#   define HWCAP_AES (1 << 3)
+#  endif
+# endif
+#endif
+
+// Bit 31 indicates that the flags have been initialized.
+#define WIICRYPTO_CPUFLAG_INIT (1U << 31)
+static uint32_t cpu_flags = 0;
+
+#ifdef CPUFLAGS_X86
+/**
+ * Run the CPUID instruction.
+ * @param leaf	[in] CPUID leaf.
+ * @param regs	[out] EAX, EBX, ECX, EDX
+ * @return True if the leaf is supported; false if not.
+ */
+static int do_cpuid(unsigned int leaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	int iregs[4];
+	__cpuid(iregs, 0);
+	if ((unsigned int)iregs[0] < leaf)
+		return 0;
+	__cpuidex(iregs, (int)leaf, 0);
+	regs[0] = (unsigned int)iregs[0];
+	regs[1] = (unsigned int)iregs[1];
+	regs[2] = (unsigned int)iregs[2];
+	regs[3] = (unsigned int)iregs[3];
+	return 1;
+#else /* !_MSC_VER */
+	if (__get_cpuid_max(0, 0) < leaf)
+		return 0;
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+	return 1;
+#endif /* _MSC_VER */
+}
+
+/**
+ * Check if the OS saves the AVX (YMM) register state.
+ * @return True if it does; false if not.
+ */
+static int os_supports_avx(void)
+{
+#ifdef _MSC_VER
+	return (_xgetbv(0) & 6) == 6;
+#else /* !_MSC_VER */
+	unsigned int eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return (eax & 6) == 6;
+#endif /* _MSC_VER */
+}
+#endif /* CPUFLAGS_X86 */
+
+/**
+ * Detect the host CPU's feature flags.
+ * @return WIICRYPTO_CPUFLAG_* bitfield.
+ */
+static uint32_t detect_cpu_flags(void)
+{
+	uint32_t flags = 0;
+
+#if defined(CPUFLAGS_X86)
+	unsigned int regs[4];
+	if (do_cpuid(1, regs)) {
+		if (regs[3] & (1U << 26))
+			flags |= WIICRYPTO_CPUFLAG_X86_SSE2;
+		if (regs[2] & (1U << 9))
+			flags |= WIICRYPTO_CPUFLAG_X86_SSSE3;
+		if (regs[2] & (1U << 19))
+			flags |= WIICRYPTO_CPUFLAG_X86_SSE41;
+		if (regs[2] & (1U << 25))
+			flags |= WIICRYPTO_CPUFLAG_X86_AESNI;
+
+		// AVX2 requires OS support for saving the YMM registers.
+		// (OSXSAVE and AVX must both be set.)
+		const int has_avx = ((regs[2] & (1U << 27)) && (regs[2] & (1U << 28)) &&
+			os_supports_avx());
+		if (do_cpuid(7, regs)) {
+			if (has_avx && (regs[1] & (1U << 5)))
+				flags |= WIICRYPTO_CPUFLAG_X86_AVX2;
+			if (regs[1] & (1U << 29))
+				flags |= WIICRYPTO_CPUFLAG_X86_SHA;
+		}
+	}
+#elif defined(CPUFLAGS_ARM64)
+# if defined(__APPLE__)
+	// All Apple ARM64 CPUs support the Crypto Extensions.
+	flags |= WIICRYPTO_CPUFLAG_ARM_AES;
+# elif defined(_WIN32)
+	if (IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE))
+		flags |= WIICRYPTO_CPUFLAG_ARM_AES;
+# elif defined(HAVE_GETAUXVAL)
+	const unsigned long hwcap = getauxval(AT_HWCAP);
+	if (hwcap & HWCAP_AES)
+		flags |= WIICRYPTO_CPUFLAG_ARM_AES;
+# endif
+#endif
+
+	return flags;
+}
+
+/**
+ * Get the host CPU's feature flags.
+ * The flags are detected on the first call and cached.
+ * @return WIICRYPTO_CPUFLAG_* bitfield.
+ */
+uint32_t wiicrypto_cpu_flags(void)
+{
+	// NOTE: Detection is idempotent, so if multiple threads
+	// call this at the same time, they'll store the same value.
+#ifdef __GNUC__
+	uint32_t flags = __atomic_load_n(&cpu_flags, __ATOMIC_RELAXED);
+#else
+	uint32_t flags = *(volatile uint32_t*)&cpu_flags;
+#endif
+	if (flags & WIICRYPTO_CPUFLAG_INIT) {
+		return (flags & ~WIICRYPTO_CPUFLAG_INIT);
+	}
+
+	flags = detect_cpu_flags();
+#ifdef __GNUC__
+	__atomic_store_n(&cpu_flags, flags | WIICRYPTO_CPUFLAG_INIT, __ATOMIC_RELAXED);
+#else
+	*(volatile uint32_t*)&cpu_flags = flags | WIICRYPTO_CPUFLAG_INIT;
+#endif
+	return flags;
+}
@@ -0,0 +1,40 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * cpuflags.h: CPU feature detection for runtime dispatch.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_CPUFLAGS_H__
+#define __RVTHTOOL_LIBWIICRYPTO_CPUFLAGS_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// x86 CPU flags.
+#define WIICRYPTO_CPUFLAG_X86_SSE2	(1U << 0)
+#define WIICRYPTO_CPUFLAG_X86_SSSE3	(1U << 1)
+#define WIICRYPTO_CPUFLAG_X86_AESNI	(1U << 2)
+#define WIICRYPTO_CPUFLAG_X86_SSE41	(1U << 3)
+#define WIICRYPTO_CPUFLAG_X86_AVX2	(1U << 4)
+#define WIICRYPTO_CPUFLAG_X86_SHA	(1U << 5)
+
+// ARM CPU flags.
+#define WIICRYPTO_CPUFLAG_ARM_AES	(1U << 16)
+
+/**
+ * Get the host CPU's feature flags.
+ * The flags are detected on the first call and cached.
+ * @return WIICRYPTO_CPUFLAG_* bitfield.
+ */
+uint32_t wiicrypto_cpu_flags(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_CPUFLAGS_H__ */
@@ -0,0 +1,86 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1_multi.h: Multi-buffer SHA-1.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Hashes many equal-sized, independent blocks at once.
+// This is used for the Wii H0 hashes: 31 SHA-1 digests
+// of 1 KB blocks per sector.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_SHA1_MULTI_H__
+#define __RVTHTOOL_LIBWIICRYPTO_SHA1_MULTI_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SHA-1 digest size.
+#define SHA1_MULTI_DIGEST_SIZE 20
+
+/**
+ * Multi-buffer SHA-1 implementations.
+ * sha1_multi() uses the fastest one supported by the CPU.
+ */
+typedef enum {
+	SHA1_MULTI_IMPL_NETTLE	= 0,	// GNU Nettle (one block at a time)
+	SHA1_MULTI_IMPL_SSE2	= 1,	// x86 SSE2 (4 lanes)
+	SHA1_MULTI_IMPL_AVX2	= 2,	// x86 AVX2 (8 lanes)
+	SHA1_MULTI_IMPL_SHANI	= 3,	// x86 SHA extensions
+
+	SHA1_MULTI_IMPL_MAX
+} Sha1MultiImpl_e;
+
+/**
+ * Is the specified SHA-1 implementation supported on this system?
+ * @param impl SHA-1 implementation.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int sha1_multi_impl_is_supported(Sha1MultiImpl_e impl);
+
+/**
+ * Get the name of a SHA-1 implementation.
+ * @param impl SHA-1 implementation.
+ * @return Name, or NULL if impl is invalid.
+ */
+const char *sha1_multi_impl_name(Sha1MultiImpl_e impl);
+
+/**
+ * Get the SHA-1 implementation used by sha1_multi().
+ * @return SHA-1 implementation.
+ */
+Sha1MultiImpl_e sha1_multi_get_impl(void);
+
+/**
+ * Calculate the SHA-1 digests of multiple equal-sized blocks.
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ */
+void sha1_multi(uint8_t *pDigests, const uint8_t *pData, size_t block_size, size_t count);
+
+/**
+ * Calculate the SHA-1 digests of multiple equal-sized blocks
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] SHA-1 implementation.
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int sha1_multi_impl(Sha1MultiImpl_e impl, uint8_t *pDigests,
+	const uint8_t *pData, size_t block_size, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_SHA1_MULTI_H__ */
@@ -0,0 +1,86 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1_multi_avx2.c: Multi-buffer SHA-1. (AVX2 version, 8 lanes)          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with AVX2 enabled.
+// (-mavx2 on gcc/clang)
+
+#include "sha1_multi_hw.h"
+
+// AVX2 intrinsics.
+#include <immintrin.h>
+
+#define SHA1_MULTI_FN	sha1_multi_avx2
+#define SHA1_LANES	8
+typedef __m256i vec_t;
+
+#define V_ADD(a, b)	_mm256_add_epi32((a), (b))
+#define V_XOR(a, b)	_mm256_xor_si256((a), (b))
+#define V_AND(a, b)	_mm256_and_si256((a), (b))
+#define V_OR(a, b)	_mm256_or_si256((a), (b))
+#define V_SLLI(a, n)	_mm256_slli_epi32((a), (n))
+#define V_SRLI(a, n)	_mm256_srli_epi32((a), (n))
+#define V_SET1(x)	_mm256_set1_epi32((int)(x))
+#define V_STOREU(p, a)	_mm256_storeu_si256((__m256i*)(p), (a))
+
+/**
+ * Load 16 message words from each lane.
+ * The words are transposed so w[t] has word t from every lane.
+ * @param w	[out] Message words.
+ * @param p	[in] Data pointer for each lane.
+ */
+static inline void sha1_load_words(__m256i w[16], const uint8_t *const p[SHA1_LANES])
+{
+	const __m256i bswap_mask = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	unsigned int k;
+
+	for (k = 0; k < 2; k++) {
+		const __m256i a0 = _mm256_loadu_si256((const __m256i*)&p[0][k * 32]);
+		const __m256i a1 = _mm256_loadu_si256((const __m256i*)&p[1][k * 32]);
+		const __m256i a2 = _mm256_loadu_si256((const __m256i*)&p[2][k * 32]);
+		const __m256i a3 = _mm256_loadu_si256((const __m256i*)&p[3][k * 32]);
+		const __m256i a4 = _mm256_loadu_si256((const __m256i*)&p[4][k * 32]);
+		const __m256i a5 = _mm256_loadu_si256((const __m256i*)&p[5][k * 32]);
+		const __m256i a6 = _mm256_loadu_si256((const __m256i*)&p[6][k * 32]);
+		const __m256i a7 = _mm256_loadu_si256((const __m256i*)&p[7][k * 32]);
+
+		// 8x8 transpose.
+		// Unpacks operate within 128-bit halves, so words 0-3 end up
+		// in the low halves and words 4-7 in the high halves.
+		const __m256i t0 = _mm256_unpacklo_epi32(a0, a1);
+		const __m256i t1 = _mm256_unpackhi_epi32(a0, a1);
+		const __m256i t2 = _mm256_unpacklo_epi32(a2, a3);
+		const __m256i t3 = _mm256_unpackhi_epi32(a2, a3);
+		const __m256i t4 = _mm256_unpacklo_epi32(a4, a5);
+		const __m256i t5 = _mm256_unpackhi_epi32(a4, a5);
+		const __m256i t6 = _mm256_unpacklo_epi32(a6, a7);
+		const __m256i t7 = _mm256_unpackhi_epi32(a6, a7);
+
+		const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+		const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+		const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+		const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+		const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+		const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+		const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+		const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+		__m256i *const wk = &w[k * 8];
+		wk[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x20), bswap_mask);
+		wk[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x20), bswap_mask);
+		wk[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x20), bswap_mask);
+		wk[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x20), bswap_mask);
+		wk[4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x31), bswap_mask);
+		wk[5] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x31), bswap_mask);
+		wk[6] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x31), bswap_mask);
+		wk[7] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x31), bswap_mask);
+	}
+}
+
+#include "sha1_multi_simd.inc.h"
@@ -0,0 +1,110 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1_multi_hw.h: Multi-buffer SHA-1. (SIMD backends)                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This is an internal header used by the sha1_multi_*.c files.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_SHA1_MULTI_HW_H__
+#define __RVTHTOOL_LIBWIICRYPTO_SHA1_MULTI_HW_H__
+
+#include "config.libwiicrypto.h"
+#include "sha1_multi.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SHA-1 chunk size.
+#define SHA1_CHUNK_SIZE 64
+
+// Initial SHA-1 state.
+#define SHA1_H0 0x67452301U
+#define SHA1_H1 0xEFCDAB89U
+#define SHA1_H2 0x98BADCFEU
+#define SHA1_H3 0x10325476U
+#define SHA1_H4 0xC3D2E1F0U
+
+/**
+ * Build the final padded chunk(s) of a message.
+ * @param tail		[out] Tail buffer. (2 chunks)
+ * @param pBlock	[in] Message.
+ * @param block_size	[in] Message size, in bytes.
+ * @return Number of chunks in the tail buffer. (1 or 2)
+ */
+static inline unsigned int sha1_multi_make_tail(uint8_t tail[SHA1_CHUNK_SIZE * 2],
+	const uint8_t *pBlock, size_t block_size)
+{
+	const size_t rem = block_size % SHA1_CHUNK_SIZE;
+	const unsigned int chunks = (rem + 1 + 8 <= SHA1_CHUNK_SIZE ? 1 : 2);
+	const uint64_t bits = (uint64_t)block_size * 8;
+	uint8_t *const pLen = &tail[(chunks * SHA1_CHUNK_SIZE) - 8];
+	int i;
+
+	memcpy(tail, &pBlock[block_size - rem], rem);
+	tail[rem] = 0x80;
+	memset(&tail[rem + 1], 0, (chunks * SHA1_CHUNK_SIZE) - rem - 1);
+	for (i = 0; i < 8; i++) {
+		pLen[i] = (uint8_t)(bits >> (56 - (i * 8)));
+	}
+	return chunks;
+}
+
+/**
+ * Store a 32-bit word in big-endian byte order.
+ * @param p	[out] Destination.
+ * @param v	[in] Value.
+ */
+static inline void sha1_multi_store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+#ifdef HAVE_SHA1_MULTI_SSE2
+/**
+ * Calculate SHA-1 digests using SSE2. (4 lanes)
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ */
+void sha1_multi_sse2(uint8_t *pDigests, const uint8_t *pData, size_t block_size, size_t count);
+#endif /* HAVE_SHA1_MULTI_SSE2 */
+
+#ifdef HAVE_SHA1_MULTI_AVX2
+/**
+ * Calculate SHA-1 digests using AVX2. (8 lanes)
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ */
+void sha1_multi_avx2(uint8_t *pDigests, const uint8_t *pData, size_t block_size, size_t count);
+#endif /* HAVE_SHA1_MULTI_AVX2 */
+
+#ifdef HAVE_SHA1_MULTI_SHANI
+/**
+ * Calculate SHA-1 digests using the x86 SHA extensions.
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ */
+void sha1_multi_shani(uint8_t *pDigests, const uint8_t *pData, size_t block_size, size_t count);
+#endif /* HAVE_SHA1_MULTI_SHANI */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_SHA1_MULTI_HW_H__ */
@@ -0,0 +1,201 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1_multi_shani.c: Multi-buffer SHA-1. (x86 SHA extensions version)    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with SSE4.1 and SHA enabled.
+// (-msse4.1 -msha on gcc/clang)
+//
+// The SHA extensions process one message at a time, so this hashes
+// two blocks at a time with interleaved rounds. Based on the round
+// structure from Intel's "New Instructions Supporting the Secure Hash
+// Algorithm" white paper.
+
+#include "sha1_multi_hw.h"
+
+// SHA intrinsics.
+#include <immintrin.h>
+
+/**
+ * Process a 64-byte chunk of a single message.
+ * @param abcd		[in/out] SHA-1 state A-D. (in SHA-NI order)
+ * @param e0		[in/out] SHA-1 state E. (in SHA-NI order)
+ * @param data		[in] Data.
+ */
+static inline void sha1_shani_chunk(__m128i *abcd, __m128i *e0, const uint8_t *data)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+	__m128i ABCD = *abcd, E0 = *e0, E1;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+
+	const __m128i ABCD_SAVE = ABCD;
+	const __m128i E0_SAVE = E0;
+
+	// Rounds 0-3
+	MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&data[0]), mask);
+	E0 = _mm_add_epi32(E0, MSG0);
+	E1 = ABCD;
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+	// Rounds 4-7
+	MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&data[16]), mask);
+	E1 = _mm_sha1nexte_epu32(E1, MSG1);
+	E0 = ABCD;
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+	MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+	// Rounds 8-11
+	MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&data[32]), mask);
+	E0 = _mm_sha1nexte_epu32(E0, MSG2);
+	E1 = ABCD;
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+	MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+	MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+	// Rounds 12-15
+	MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&data[48]), mask);
+	E1 = _mm_sha1nexte_epu32(E1, MSG3);
+	E0 = ABCD;
+	MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+	MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+	MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+	// Rounds 16-63 follow the same pattern, rotating through
+	// MSG0-MSG3 and alternating between E0 and E1.
+#define SHA1_SHANI_4R(Enext, Eprev, Mcur, Mnext, Mnext2, Mprev, func) do { \
+	Enext = _mm_sha1nexte_epu32(Enext, Mcur); \
+	Eprev = ABCD; \
+	Mnext = _mm_sha1msg2_epu32(Mnext, Mcur); \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, Enext, (func)); \
+	Mprev = _mm_sha1msg1_epu32(Mprev, Mcur); \
+	Mnext2 = _mm_xor_si128(Mnext2, Mcur); \
+} while (0)
+	SHA1_SHANI_4R(E0, E1, MSG0, MSG1, MSG2, MSG3, 0);	// 16-19
+	SHA1_SHANI_4R(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);	// 20-23
+	SHA1_SHANI_4R(E0, E1, MSG2, MSG3, MSG0, MSG1, 1);	// 24-27
+	SHA1_SHANI_4R(E1, E0, MSG3, MSG0, MSG1, MSG2, 1);	// 28-31
+	SHA1_SHANI_4R(E0, E1, MSG0, MSG1, MSG2, MSG3, 1);	// 32-35
+	SHA1_SHANI_4R(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);	// 36-39
+	SHA1_SHANI_4R(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);	// 40-43
+	SHA1_SHANI_4R(E1, E0, MSG3, MSG0, MSG1, MSG2, 2);	// 44-47
+	SHA1_SHANI_4R(E0, E1, MSG0, MSG1, MSG2, MSG3, 2);	// 48-51
+	SHA1_SHANI_4R(E1, E0, MSG1, MSG2, MSG3, MSG0, 2);	// 52-55
+	SHA1_SHANI_4R(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);	// 56-59
+	SHA1_SHANI_4R(E1, E0, MSG3, MSG0, MSG1, MSG2, 3);	// 60-63
+#undef SHA1_SHANI_4R
+
+	// Rounds 64-67
+	E0 = _mm_sha1nexte_epu32(E0, MSG0);
+	E1 = ABCD;
+	MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+	MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+	MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+	// Rounds 68-71
+	E1 = _mm_sha1nexte_epu32(E1, MSG1);
+	E0 = ABCD;
+	MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+	MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+	// Rounds 72-75
+	E0 = _mm_sha1nexte_epu32(E0, MSG2);
+	E1 = ABCD;
+	MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+	// Rounds 76-79
+	E1 = _mm_sha1nexte_epu32(E1, MSG3);
+	E0 = ABCD;
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+	// Add this chunk's hash to the result so far.
+	E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+	ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+
+	*abcd = ABCD;
+	*e0 = E0;
+}
+
+/**
+ * Store a SHA-1 digest.
+ * @param pDigest	[out] Digest.
+ * @param ABCD		[in] SHA-1 state A-D. (in SHA-NI order)
+ * @param E0		[in] SHA-1 state E. (in SHA-NI order)
+ */
+static inline void sha1_shani_store_digest(uint8_t *pDigest, __m128i ABCD, __m128i E0)
+{
+	uint32_t abcd_out[4];
+	_mm_storeu_si128((__m128i*)abcd_out, ABCD);
+	sha1_multi_store_be32(&pDigest[0], abcd_out[3]);
+	sha1_multi_store_be32(&pDigest[4], abcd_out[2]);
+	sha1_multi_store_be32(&pDigest[8], abcd_out[1]);
+	sha1_multi_store_be32(&pDigest[12], abcd_out[0]);
+	sha1_multi_store_be32(&pDigest[16], (uint32_t)_mm_extract_epi32(E0, 3));
+}
+
+/**
+ * Calculate SHA-1 digests using the x86 SHA extensions.
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ */
+void sha1_multi_shani(uint8_t *pDigests, const uint8_t *pData, size_t block_size, size_t count)
+{
+	const size_t full_chunks = block_size / SHA1_CHUNK_SIZE;
+	uint8_t tail[2][SHA1_CHUNK_SIZE * 2];
+
+	// SHA-NI keeps A in the most significant lane.
+	const __m128i ABCD_INIT = _mm_set_epi32((int)SHA1_H0, (int)SHA1_H1, (int)SHA1_H2, (int)SHA1_H3);
+	const __m128i E0_INIT = _mm_set_epi32((int)SHA1_H4, 0, 0, 0);
+
+	// SHA1RNDS4 has a long latency, so hash two blocks at a time.
+	// The two dependency chains are independent, which lets the
+	// CPU overlap them.
+	for (; count >= 2; count -= 2, pData += block_size * 2, pDigests += SHA1_MULTI_DIGEST_SIZE * 2) {
+		const uint8_t *pA = pData;
+		const uint8_t *pB = pData + block_size;
+		__m128i ABCD_A = ABCD_INIT, E0_A = E0_INIT;
+		__m128i ABCD_B = ABCD_INIT, E0_B = E0_INIT;
+		unsigned int tail_chunks, i;
+		size_t n;
+
+		for (n = full_chunks; n > 0; n--, pA += SHA1_CHUNK_SIZE, pB += SHA1_CHUNK_SIZE) {
+			sha1_shani_chunk(&ABCD_A, &E0_A, pA);
+			sha1_shani_chunk(&ABCD_B, &E0_B, pB);
+		}
+
+		tail_chunks = sha1_multi_make_tail(tail[0], pData, block_size);
+		sha1_multi_make_tail(tail[1], pData + block_size, block_size);
+		for (i = 0; i < tail_chunks; i++) {
+			sha1_shani_chunk(&ABCD_A, &E0_A, &tail[0][i * SHA1_CHUNK_SIZE]);
+			sha1_shani_chunk(&ABCD_B, &E0_B, &tail[1][i * SHA1_CHUNK_SIZE]);
+		}
+
+		sha1_shani_store_digest(&pDigests[0], ABCD_A, E0_A);
+		sha1_shani_store_digest(&pDigests[SHA1_MULTI_DIGEST_SIZE], ABCD_B, E0_B);
+	}
+
+	if (count > 0) {
+		// One block left.
+		const uint8_t *p = pData;
+		__m128i ABCD = ABCD_INIT, E0 = E0_INIT;
+		unsigned int tail_chunks, i;
+		size_t n;
+
+		for (n = full_chunks; n > 0; n--, p += SHA1_CHUNK_SIZE) {
+			sha1_shani_chunk(&ABCD, &E0, p);
+		}
+		tail_chunks = sha1_multi_make_tail(tail[0], pData, block_size);
+		for (i = 0; i < tail_chunks; i++) {
+			sha1_shani_chunk(&ABCD, &E0, &tail[0][i * SHA1_CHUNK_SIZE]);
+		}
+		sha1_shani_store_digest(pDigests, ABCD, E0);
+	}
+}
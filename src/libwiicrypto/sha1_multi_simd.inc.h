@@ -0,0 +1,176 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1_multi_simd.inc.h: Multi-buffer SHA-1. (SIMD template)              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file is included by the SIMD implementations.
+// Each SIMD lane holds the SHA-1 state of a separate block.
+//
+// The following must be defined before including this file:
+// - SHA1_MULTI_FN: Name of the sha1_multi_*() function.
+// - SHA1_LANES: Number of 32-bit lanes in vec_t.
+// - vec_t: Vector type.
+// - V_ADD, V_XOR, V_AND, V_OR: 32-bit lane-wise operations.
+// - V_SLLI, V_SRLI: 32-bit lane-wise shifts by an immediate.
+// - V_SET1: Broadcast a 32-bit value.
+// - V_STOREU: Store a vector to an unaligned uint32_t array.
+// - sha1_load_words(): Load 16 big-endian message words,
+//   transposed so each vector has one word from each lane.
+
+#ifndef SHA1_MULTI_FN
+# error SHA1_MULTI_FN must be defined before including sha1_multi_simd.inc.h.
+#endif
+
+#define V_ROL(x, n) V_OR(V_SLLI((x), (n)), V_SRLI((x), 32 - (n)))
+
+// SHA-1 round functions.
+#define SHA1_F1(b, c, d) V_XOR((d), V_AND((b), V_XOR((c), (d))))
+#define SHA1_F2(b, c, d) V_XOR(V_XOR((b), (c)), (d))
+#define SHA1_F3(b, c, d) V_OR(V_AND((b), (c)), V_AND((d), V_OR((b), (c))))
+#define SHA1_F4 SHA1_F2
+
+// Message schedule: w[0..15] are loaded; w[16..79] are calculated.
+#define SHA1_WL(t) (w[(t)])
+#define SHA1_WC(t) (w[(t) & 15] = V_ROL(V_XOR( \
+	V_XOR(w[((t) - 3) & 15], w[((t) - 8) & 15]), \
+	V_XOR(w[((t) - 14) & 15], w[(t) & 15])), 1))
+
+// Single SHA-1 round. The caller rotates the variables.
+#define SHA1_R(a, b, c, d, e, F, K, t, W) do { \
+	const vec_t wt_ = W(t); \
+	e = V_ADD(e, V_ADD(V_ADD(V_ROL((a), 5), F((b), (c), (d))), V_ADD((K), wt_))); \
+	b = V_ROL((b), 30); \
+} while (0)
+
+// Five SHA-1 rounds. Variables end up in their original positions.
+#define SHA1_5R(F, K, t, W) do { \
+	SHA1_R(a, b, c, d, e, F, K, (t) + 0, W); \
+	SHA1_R(e, a, b, c, d, F, K, (t) + 1, W); \
+	SHA1_R(d, e, a, b, c, F, K, (t) + 2, W); \
+	SHA1_R(c, d, e, a, b, F, K, (t) + 3, W); \
+	SHA1_R(b, c, d, e, a, F, K, (t) + 4, W); \
+} while (0)
+
+/**
+ * Process 64-byte chunks for all lanes.
+ * @param st		[in/out] SHA-1 state.
+ * @param p		[in/out] Data pointer for each lane. (Advanced by nchunks*64.)
+ * @param nchunks	[in] Number of chunks.
+ */
+static void sha1_simd_compress(vec_t st[5], const uint8_t *p[SHA1_LANES], size_t nchunks)
+{
+	const vec_t K1 = V_SET1(0x5A827999U);
+	const vec_t K2 = V_SET1(0x6ED9EBA1U);
+	const vec_t K3 = V_SET1(0x8F1BBCDCU);
+	const vec_t K4 = V_SET1(0xCA62C1D6U);
+	vec_t w[16];
+	unsigned int j;
+
+	for (; nchunks > 0; nchunks--) {
+		vec_t a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+
+		sha1_load_words(w, p);
+		for (j = 0; j < SHA1_LANES; j++) {
+			p[j] += SHA1_CHUNK_SIZE;
+		}
+
+		SHA1_5R(SHA1_F1, K1,  0, SHA1_WL);
+		SHA1_5R(SHA1_F1, K1,  5, SHA1_WL);
+		SHA1_5R(SHA1_F1, K1, 10, SHA1_WL);
+		SHA1_R(a, b, c, d, e, SHA1_F1, K1, 15, SHA1_WL);
+		SHA1_R(e, a, b, c, d, SHA1_F1, K1, 16, SHA1_WC);
+		SHA1_R(d, e, a, b, c, SHA1_F1, K1, 17, SHA1_WC);
+		SHA1_R(c, d, e, a, b, SHA1_F1, K1, 18, SHA1_WC);
+		SHA1_R(b, c, d, e, a, SHA1_F1, K1, 19, SHA1_WC);
+
+		SHA1_5R(SHA1_F2, K2, 20, SHA1_WC);
+		SHA1_5R(SHA1_F2, K2, 25, SHA1_WC);
+		SHA1_5R(SHA1_F2, K2, 30, SHA1_WC);
+		SHA1_5R(SHA1_F2, K2, 35, SHA1_WC);
+
+		SHA1_5R(SHA1_F3, K3, 40, SHA1_WC);
+		SHA1_5R(SHA1_F3, K3, 45, SHA1_WC);
+		SHA1_5R(SHA1_F3, K3, 50, SHA1_WC);
+		SHA1_5R(SHA1_F3, K3, 55, SHA1_WC);
+
+		SHA1_5R(SHA1_F4, K4, 60, SHA1_WC);
+		SHA1_5R(SHA1_F4, K4, 65, SHA1_WC);
+		SHA1_5R(SHA1_F4, K4, 70, SHA1_WC);
+		SHA1_5R(SHA1_F4, K4, 75, SHA1_WC);
+
+		st[0] = V_ADD(st[0], a);
+		st[1] = V_ADD(st[1], b);
+		st[2] = V_ADD(st[2], c);
+		st[3] = V_ADD(st[3], d);
+		st[4] = V_ADD(st[4], e);
+	}
+}
+
+/**
+ * Calculate SHA-1 digests of multiple equal-sized blocks.
+ * @param pDigests	[out] Digests. (count * SHA1_MULTI_DIGEST_SIZE bytes)
+ * @param pData		[in] Data blocks. (count * block_size bytes, contiguous)
+ * @param block_size	[in] Size of each block, in bytes.
+ * @param count		[in] Number of blocks.
+ */
+void SHA1_MULTI_FN(uint8_t *pDigests, const uint8_t *pData, size_t block_size, size_t count)
+{
+	uint8_t tail[SHA1_LANES][SHA1_CHUNK_SIZE * 2];
+	uint32_t out[5][SHA1_LANES];
+	const size_t full_chunks = block_size / SHA1_CHUNK_SIZE;
+	size_t i;
+
+	for (i = 0; i < count; i += SHA1_LANES) {
+		const uint8_t *p[SHA1_LANES];
+		vec_t st[5];
+		unsigned int lanes, tail_chunks = 1;
+		unsigned int j, k;
+
+		// If there aren't enough blocks left to fill all lanes,
+		// the last block is hashed in the unused lanes.
+		lanes = (count - i < SHA1_LANES ? (unsigned int)(count - i) : SHA1_LANES);
+		for (j = 0; j < SHA1_LANES; j++) {
+			p[j] = &pData[(i + (j < lanes ? j : lanes - 1)) * block_size];
+		}
+
+		st[0] = V_SET1(SHA1_H0);
+		st[1] = V_SET1(SHA1_H1);
+		st[2] = V_SET1(SHA1_H2);
+		st[3] = V_SET1(SHA1_H3);
+		st[4] = V_SET1(SHA1_H4);
+		sha1_simd_compress(st, p, full_chunks);
+
+		// Process the padding.
+		// NOTE: p[j] now points to the end of the full chunks.
+		for (j = 0; j < SHA1_LANES; j++) {
+			tail_chunks = sha1_multi_make_tail(tail[j],
+				p[j] - (full_chunks * SHA1_CHUNK_SIZE), block_size);
+			p[j] = tail[j];
+		}
+		sha1_simd_compress(st, p, tail_chunks);
+
+		// Store the digests.
+		for (k = 0; k < 5; k++) {
+			V_STOREU(out[k], st[k]);
+		}
+		for (j = 0; j < lanes; j++) {
+			uint8_t *const pDigest = &pDigests[(i + j) * SHA1_MULTI_DIGEST_SIZE];
+			for (k = 0; k < 5; k++) {
+				sha1_multi_store_be32(&pDigest[k * 4], out[k][j]);
+			}
+		}
+	}
+}
+
+#undef V_ROL
+#undef SHA1_F1
+#undef SHA1_F2
+#undef SHA1_F3
+#undef SHA1_F4
+#undef SHA1_WL
+#undef SHA1_WC
+#undef SHA1_R
+#undef SHA1_5R
@@ -0,0 +1,70 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1_multi_sse2.c: Multi-buffer SHA-1. (SSE2 version, 4 lanes)          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with SSE2 enabled.
+// (-msse2 on gcc/clang for i386)
+
+#include "sha1_multi_hw.h"
+
+// SSE2 intrinsics.
+#include <emmintrin.h>
+
+#define SHA1_MULTI_FN	sha1_multi_sse2
+#define SHA1_LANES	4
+typedef __m128i vec_t;
+
+#define V_ADD(a, b)	_mm_add_epi32((a), (b))
+#define V_XOR(a, b)	_mm_xor_si128((a), (b))
+#define V_AND(a, b)	_mm_and_si128((a), (b))
+#define V_OR(a, b)	_mm_or_si128((a), (b))
+#define V_SLLI(a, n)	_mm_slli_epi32((a), (n))
+#define V_SRLI(a, n)	_mm_srli_epi32((a), (n))
+#define V_SET1(x)	_mm_set1_epi32((int)(x))
+#define V_STOREU(p, a)	_mm_storeu_si128((__m128i*)(p), (a))
+
+/**
+ * Byteswap each 32-bit lane.
+ * SSE2 doesn't have PSHUFB, so swap the 16-bit halves,
+ * then swap the bytes within each half.
+ * @param x Vector.
+ * @return Byteswapped vector.
+ */
+static inline __m128i bswap32_sse2(__m128i x)
+{
+	x = _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+/**
+ * Load 16 message words from each lane.
+ * The words are transposed so w[t] has word t from every lane.
+ * @param w	[out] Message words.
+ * @param p	[in] Data pointer for each lane.
+ */
+static inline void sha1_load_words(__m128i w[16], const uint8_t *const p[SHA1_LANES])
+{
+	unsigned int k;
+	for (k = 0; k < 4; k++) {
+		const __m128i a0 = _mm_loadu_si128((const __m128i*)&p[0][k * 16]);
+		const __m128i a1 = _mm_loadu_si128((const __m128i*)&p[1][k * 16]);
+		const __m128i a2 = _mm_loadu_si128((const __m128i*)&p[2][k * 16]);
+		const __m128i a3 = _mm_loadu_si128((const __m128i*)&p[3][k * 16]);
+
+		// 4x4 transpose.
+		const __m128i t0 = _mm_unpacklo_epi32(a0, a1);
+		const __m128i t1 = _mm_unpacklo_epi32(a2, a3);
+		const __m128i t2 = _mm_unpackhi_epi32(a0, a1);
+		const __m128i t3 = _mm_unpackhi_epi32(a2, a3);
+		w[k * 4 + 0] = bswap32_sse2(_mm_unpacklo_epi64(t0, t1));
+		w[k * 4 + 1] = bswap32_sse2(_mm_unpackhi_epi64(t0, t1));
+		w[k * 4 + 2] = bswap32_sse2(_mm_unpacklo_epi64(t2, t3));
+		w[k * 4 + 3] = bswap32_sse2(_mm_unpackhi_epi64(t2, t3));
+	}
+}
+
+#include "sha1_multi_simd.inc.h"
@@ -0,0 +1,69 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * AeswBenchmark.cpp: AES wrapper throughput benchmark.                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Benchmark
+#include <benchmark/benchmark.h>
+
+#include "libwiicrypto/aesw.h"
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+// Wii sector payload size. (32 KB sector minus 1 KB of hashes)
+#define BENCH_SECTOR_DATA_SIZE	0x7C00U
+
+/**
+ * Benchmark AES-128-CBC on Wii sector payloads.
+ * @param state Benchmark state.
+ * @param impl AES implementation.
+ * @param decrypt If true, decrypt; otherwise, encrypt.
+ */
+static void BM_aesw(benchmark::State &state, AesImpl_e impl, bool decrypt)
+{
+	if (!aesw_impl_is_supported(impl)) {
+		state.SkipWithError("AES implementation is not supported on this CPU.");
+		return;
+	}
+
+	AesCtx *const aesw = aesw_new();
+	aesw_set_impl(aesw, impl);
+	static const uint8_t key[16] = {
+		0x2B,0x7E,0x15,0x16,0x28,0xAE,0xD2,0xA6,
+		0xAB,0xF7,0x15,0x88,0x09,0xCF,0x4F,0x3C
+	};
+	uint8_t iv[16] = {0};
+	aesw_set_key(aesw, key, sizeof(key));
+
+	vector<uint8_t> buf(BENCH_SECTOR_DATA_SIZE, 0xA5);
+	for (auto _ : state) {
+		// Each sector has its own IV.
+		aesw_set_iv(aesw, iv, sizeof(iv));
+		size_t size = (decrypt
+			? aesw_decrypt(aesw, buf.data(), buf.size())
+			: aesw_encrypt(aesw, buf.data(), buf.size()));
+		benchmark::DoNotOptimize(size);
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * BENCH_SECTOR_DATA_SIZE);
+
+	aesw_free(aesw);
+}
+
+BENCHMARK_CAPTURE(BM_aesw, encrypt_nettle, AESW_IMPL_NETTLE, false);
+BENCHMARK_CAPTURE(BM_aesw, decrypt_nettle, AESW_IMPL_NETTLE, true);
+BENCHMARK_CAPTURE(BM_aesw, encrypt_AESNI, AESW_IMPL_AESNI, false);
+BENCHMARK_CAPTURE(BM_aesw, decrypt_AESNI, AESW_IMPL_AESNI, true);
+BENCHMARK_CAPTURE(BM_aesw, encrypt_ARMv8_CE, AESW_IMPL_ARMV8_CE, false);
+BENCHMARK_CAPTURE(BM_aesw, decrypt_ARMv8_CE, AESW_IMPL_ARMV8_CE, true);
+
+} }
+
+BENCHMARK_MAIN();
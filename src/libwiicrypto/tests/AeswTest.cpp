@@ -0,0 +1,231 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * AeswTest.cpp: AES wrapper tests.                                        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/aesw.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <random>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+class AeswTest : public ::testing::TestWithParam<AesImpl_e>
+{
+	protected:
+		AeswTest()
+			: aesw(nullptr) { }
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+		/**
+		 * Is the implementation being tested supported by this CPU?
+		 * @return True if supported; false if not.
+		 */
+		bool isSupported(void) const;
+
+	public:
+		AesCtx *aesw;
+
+	public:
+		/**
+		 * Test case suffix generator.
+		 * @param info Test parameter information.
+		 * @return Test case suffix.
+		 */
+		static string test_case_suffix_generator(const ::testing::TestParamInfo<AesImpl_e> &info);
+};
+
+void AeswTest::SetUp(void)
+{
+	aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+	if (isSupported()) {
+		ASSERT_EQ(0, aesw_set_impl(aesw, GetParam()));
+	} else {
+		ASSERT_NE(0, aesw_set_impl(aesw, GetParam()));
+	}
+}
+
+void AeswTest::TearDown(void)
+{
+	aesw_free(aesw);
+}
+
+bool AeswTest::isSupported(void) const
+{
+	if (!aesw_impl_is_supported(GetParam())) {
+		fprintf(stderr, "*** %s is not supported on this system; skipping.\n",
+			aesw_impl_name(GetParam()));
+		return false;
+	}
+	return true;
+}
+
+// NIST SP 800-38A, F.2.1/F.2.2: CBC-AES128
+static const uint8_t sp800_38a_key[16] = {
+	0x2B,0x7E,0x15,0x16,0x28,0xAE,0xD2,0xA6,
+	0xAB,0xF7,0x15,0x88,0x09,0xCF,0x4F,0x3C
+};
+static const uint8_t sp800_38a_iv[16] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,
+	0x08,0x09,0x0A,0x0B,0x0C,0x0D,0x0E,0x0F
+};
+static const uint8_t sp800_38a_plaintext[64] = {
+	0x6B,0xC1,0xBE,0xE2,0x2E,0x40,0x9F,0x96,0xE9,0x3D,0x7E,0x11,0x73,0x93,0x17,0x2A,
+	0xAE,0x2D,0x8A,0x57,0x1E,0x03,0xAC,0x9C,0x9E,0xB7,0x6F,0xAC,0x45,0xAF,0x8E,0x51,
+	0x30,0xC8,0x1C,0x46,0xA3,0x5C,0xE4,0x11,0xE5,0xFB,0xC1,0x19,0x1A,0x0A,0x52,0xEF,
+	0xF6,0x9F,0x24,0x45,0xDF,0x4F,0x9B,0x17,0xAD,0x2B,0x41,0x7B,0xE6,0x6C,0x37,0x10
+};
+static const uint8_t sp800_38a_ciphertext[64] = {
+	0x76,0x49,0xAB,0xAC,0x81,0x19,0xB2,0x46,0xCE,0xE9,0x8E,0x9B,0x12,0xE9,0x19,0x7D,
+	0x50,0x86,0xCB,0x9B,0x50,0x72,0x19,0xEE,0x95,0xDB,0x11,0x3A,0x91,0x76,0x78,0xB2,
+	0x73,0xBE,0xD6,0xB8,0xE3,0xC1,0x74,0x3B,0x71,0x16,0xE6,0x9E,0x22,0x22,0x95,0x16,
+	0x3F,0xF1,0xCA,0xA1,0x68,0x1F,0xAC,0x09,0x12,0x0E,0xCA,0x30,0x75,0x86,0xE1,0xA7
+};
+
+/**
+ * Known-answer test: encryption.
+ */
+TEST_P(AeswTest, knownAnswerEncrypt)
+{
+	if (!isSupported())
+		return;
+
+	uint8_t buf[sizeof(sp800_38a_plaintext)];
+	memcpy(buf, sp800_38a_plaintext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_key(aesw, sp800_38a_key, sizeof(sp800_38a_key)));
+	ASSERT_EQ(0, aesw_set_iv(aesw, sp800_38a_iv, sizeof(sp800_38a_iv)));
+	ASSERT_EQ(sizeof(buf), aesw_encrypt(aesw, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(sp800_38a_ciphertext, buf, sizeof(buf)));
+}
+
+/**
+ * Known-answer test: decryption.
+ */
+TEST_P(AeswTest, knownAnswerDecrypt)
+{
+	if (!isSupported())
+		return;
+
+	uint8_t buf[sizeof(sp800_38a_ciphertext)];
+	memcpy(buf, sp800_38a_ciphertext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_key(aesw, sp800_38a_key, sizeof(sp800_38a_key)));
+	ASSERT_EQ(0, aesw_set_iv(aesw, sp800_38a_iv, sizeof(sp800_38a_iv)));
+	ASSERT_EQ(sizeof(buf), aesw_decrypt(aesw, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(sp800_38a_plaintext, buf, sizeof(buf)));
+}
+
+/**
+ * Compare against the nettle implementation using random data.
+ * Data is processed in multiple calls to verify IV chaining.
+ */
+TEST_P(AeswTest, compareWithNettle)
+{
+	if (!isSupported())
+		return;
+
+	AesCtx *const ref = aesw_new();
+	ASSERT_TRUE(ref != nullptr);
+	ASSERT_EQ(0, aesw_set_impl(ref, AESW_IMPL_NETTLE));
+
+	std::mt19937 rng(0x7C00);
+	uint8_t key[16], iv[16];
+	for (uint8_t &b : key) b = static_cast<uint8_t>(rng());
+	for (uint8_t &b : iv) b = static_cast<uint8_t>(rng());
+
+	// Sizes include a Wii sector payload and sizes that
+	// aren't multiples of the parallel decryption width.
+	static const size_t sizes[] = {16, 48, 0x3D0, 0x7C00, 0x7C00 + 7*16};
+	for (size_t size : sizes) {
+		vector<uint8_t> plain(size);
+		for (uint8_t &b : plain) b = static_cast<uint8_t>(rng());
+		vector<uint8_t> enc(plain), enc_ref(plain);
+
+		// Encrypt in two chained calls.
+		const size_t split = (size / 32) * 16;
+		ASSERT_EQ(0, aesw_set_key(aesw, key, sizeof(key)));
+		ASSERT_EQ(0, aesw_set_key(ref, key, sizeof(key)));
+		ASSERT_EQ(0, aesw_set_iv(aesw, iv, sizeof(iv)));
+		ASSERT_EQ(0, aesw_set_iv(ref, iv, sizeof(iv)));
+		if (split > 0) {
+			ASSERT_EQ(split, aesw_encrypt(aesw, enc.data(), split));
+		}
+		ASSERT_EQ(size - split, aesw_encrypt(aesw, enc.data() + split, size - split));
+		ASSERT_EQ(size, aesw_encrypt(ref, enc_ref.data(), size));
+		EXPECT_EQ(enc_ref, enc) << "Encryption mismatch; size == " << size;
+
+		// Decrypt in two chained calls.
+		ASSERT_EQ(0, aesw_set_iv(aesw, iv, sizeof(iv)));
+		if (split > 0) {
+			ASSERT_EQ(split, aesw_decrypt(aesw, enc.data(), split));
+		}
+		ASSERT_EQ(size - split, aesw_decrypt(aesw, enc.data() + split, size - split));
+		EXPECT_EQ(plain, enc) << "Decryption mismatch; size == " << size;
+	}
+
+	aesw_free(ref);
+}
+
+/**
+ * Test case suffix generator.
+ * @param info Test parameter information.
+ * @return Test case suffix.
+ */
+string AeswTest::test_case_suffix_generator(const ::testing::TestParamInfo<AesImpl_e> &info)
+{
+	string suffix = aesw_impl_name(info.param);
+
+	// Replace all non-alphanumeric characters with '_'.
+	// See gtest-param-util.h::IsValidParamName().
+	for (int i = (int)suffix.size()-1; i >= 0; i--) {
+		char chr = suffix[i];
+		if (!isalnum(chr) && chr != '_') {
+			suffix[i] = '_';
+		}
+	}
+
+	return suffix;
+}
+
+INSTANTIATE_TEST_CASE_P(aeswTest, AeswTest,
+	::testing::Values(
+		AESW_IMPL_NETTLE,
+		AESW_IMPL_AESNI,
+		AESW_IMPL_ARMV8_CE
+	), AeswTest::test_case_suffix_generator);
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: AES wrapper tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * Sha1MultiBenchmark.cpp: Multi-buffer SHA-1 throughput benchmark.        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Benchmark
+#include <benchmark/benchmark.h>
+
+#include "libwiicrypto/sha1_multi.h"
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+// Wii H0 hashes: 31 1 KB blocks per sector.
+#define BENCH_H0_BLOCK_SIZE	1024U
+#define BENCH_H0_BLOCK_COUNT	31U
+
+/**
+ * Benchmark the H0 hashes for a single Wii sector.
+ * @param state Benchmark state.
+ * @param impl SHA-1 implementation.
+ */
+static void BM_sha1_multi_H0(benchmark::State &state, Sha1MultiImpl_e impl)
+{
+	if (!sha1_multi_impl_is_supported(impl)) {
+		state.SkipWithError("SHA-1 implementation is not supported on this CPU.");
+		return;
+	}
+
+	vector<uint8_t> data(BENCH_H0_BLOCK_SIZE * BENCH_H0_BLOCK_COUNT, 0xA5);
+	vector<uint8_t> digests(BENCH_H0_BLOCK_COUNT * SHA1_MULTI_DIGEST_SIZE);
+	for (auto _ : state) {
+		sha1_multi_impl(impl, digests.data(), data.data(),
+			BENCH_H0_BLOCK_SIZE, BENCH_H0_BLOCK_COUNT);
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+BENCHMARK_CAPTURE(BM_sha1_multi_H0, nettle, SHA1_MULTI_IMPL_NETTLE);
+BENCHMARK_CAPTURE(BM_sha1_multi_H0, SSE2, SHA1_MULTI_IMPL_SSE2);
+BENCHMARK_CAPTURE(BM_sha1_multi_H0, AVX2, SHA1_MULTI_IMPL_AVX2);
+BENCHMARK_CAPTURE(BM_sha1_multi_H0, SHA_NI, SHA1_MULTI_IMPL_SHANI);
+
+} }
+
+BENCHMARK_MAIN();
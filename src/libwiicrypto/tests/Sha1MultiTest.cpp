@@ -0,0 +1,177 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * Sha1MultiTest.cpp: Multi-buffer SHA-1 tests.                            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/sha1_multi.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <random>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+class Sha1MultiTest : public ::testing::TestWithParam<Sha1MultiImpl_e>
+{
+	protected:
+		Sha1MultiTest() { }
+
+		/**
+		 * Is the implementation being tested supported by this CPU?
+		 * @return True if supported; false if not.
+		 */
+		bool isSupported(void) const;
+
+	public:
+		/**
+		 * Test case suffix generator.
+		 * @param info Test parameter information.
+		 * @return Test case suffix.
+		 */
+		static string test_case_suffix_generator(const ::testing::TestParamInfo<Sha1MultiImpl_e> &info);
+};
+
+bool Sha1MultiTest::isSupported(void) const
+{
+	if (!sha1_multi_impl_is_supported(GetParam())) {
+		fprintf(stderr, "*** %s is not supported on this system; skipping.\n",
+			sha1_multi_impl_name(GetParam()));
+		EXPECT_EQ(-ENOTSUP, sha1_multi_impl(GetParam(), nullptr, nullptr, 0, 0));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Known-answer test: FIPS 180-2 "abc" and "abcdbcdecdef..." in multiple lanes.
+ */
+TEST_P(Sha1MultiTest, knownAnswer)
+{
+	if (!isSupported())
+		return;
+
+	static const uint8_t abc_digest[SHA1_MULTI_DIGEST_SIZE] = {
+		0xA9,0x99,0x3E,0x36,0x47,0x06,0x81,0x6A,0xBA,0x3E,
+		0x25,0x71,0x78,0x50,0xC2,0x6C,0x9C,0xD0,0xD8,0x9D
+	};
+	static const char msg56[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	static const uint8_t msg56_digest[SHA1_MULTI_DIGEST_SIZE] = {
+		0x84,0x98,0x3E,0x44,0x1C,0x3B,0xD2,0x6E,0xBA,0xAE,
+		0x4A,0xA1,0xF9,0x51,0x29,0xE5,0xE5,0x46,0x70,0xF1
+	};
+
+	// 9 copies: one more than the widest SIMD implementation.
+	static const unsigned int count = 9;
+	vector<uint8_t> digests(count * SHA1_MULTI_DIGEST_SIZE);
+
+	string abc;
+	for (unsigned int i = 0; i < count; i++) {
+		abc += "abc";
+	}
+	ASSERT_EQ(0, sha1_multi_impl(GetParam(), digests.data(),
+		reinterpret_cast<const uint8_t*>(abc.data()), 3, count));
+	for (unsigned int i = 0; i < count; i++) {
+		EXPECT_EQ(0, memcmp(abc_digest, &digests[i * SHA1_MULTI_DIGEST_SIZE], SHA1_MULTI_DIGEST_SIZE))
+			<< "\"abc\" mismatch in block " << i;
+	}
+
+	string abc56;
+	for (unsigned int i = 0; i < count; i++) {
+		abc56 += msg56;
+	}
+	ASSERT_EQ(0, sha1_multi_impl(GetParam(), digests.data(),
+		reinterpret_cast<const uint8_t*>(abc56.data()), sizeof(msg56) - 1, count));
+	for (unsigned int i = 0; i < count; i++) {
+		EXPECT_EQ(0, memcmp(msg56_digest, &digests[i * SHA1_MULTI_DIGEST_SIZE], SHA1_MULTI_DIGEST_SIZE))
+			<< "56-byte message mismatch in block " << i;
+	}
+}
+
+/**
+ * Compare against the nettle implementation using random data.
+ */
+TEST_P(Sha1MultiTest, compareWithNettle)
+{
+	if (!isSupported())
+		return;
+
+	std::mt19937 rng(0x1024);
+
+	// Block sizes cover the padding edge cases, Wii H0 blocks (1 KB),
+	// and Wii H1 blocks. (H0 table: 620 bytes)
+	static const size_t block_sizes[] = {0, 1, 55, 56, 63, 64, 65, 119, 620, 1024};
+	for (size_t block_size : block_sizes) {
+		for (size_t count = 1; count <= 17; count++) {
+			vector<uint8_t> data(block_size * count);
+			for (uint8_t &b : data) b = static_cast<uint8_t>(rng());
+
+			vector<uint8_t> digests(count * SHA1_MULTI_DIGEST_SIZE);
+			vector<uint8_t> digests_ref(count * SHA1_MULTI_DIGEST_SIZE);
+			ASSERT_EQ(0, sha1_multi_impl(GetParam(), digests.data(), data.data(), block_size, count));
+			ASSERT_EQ(0, sha1_multi_impl(SHA1_MULTI_IMPL_NETTLE, digests_ref.data(), data.data(), block_size, count));
+			EXPECT_EQ(digests_ref, digests) << "block_size == " << block_size << ", count == " << count;
+		}
+	}
+}
+
+/**
+ * Test case suffix generator.
+ * @param info Test parameter information.
+ * @return Test case suffix.
+ */
+string Sha1MultiTest::test_case_suffix_generator(const ::testing::TestParamInfo<Sha1MultiImpl_e> &info)
+{
+	string suffix = sha1_multi_impl_name(info.param);
+
+	// Replace all non-alphanumeric characters with '_'.
+	// See gtest-param-util.h::IsValidParamName().
+	for (int i = (int)suffix.size()-1; i >= 0; i--) {
+		char chr = suffix[i];
+		if (!isalnum(chr) && chr != '_') {
+			suffix[i] = '_';
+		}
+	}
+
+	return suffix;
+}
+
+INSTANTIATE_TEST_CASE_P(sha1MultiTest, Sha1MultiTest,
+	::testing::Values(
+		SHA1_MULTI_IMPL_NETTLE,
+		SHA1_MULTI_IMPL_SSE2,
+		SHA1_MULTI_IMPL_AVX2,
+		SHA1_MULTI_IMPL_SHANI
+	), Sha1MultiTest::test_case_suffix_generator);
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: Multi-buffer SHA-1 tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
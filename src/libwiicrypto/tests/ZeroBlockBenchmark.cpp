@@ -0,0 +1,84 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * ZeroBlockBenchmark.cpp: Zero block detection throughput benchmark.      *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Benchmark
+#include <benchmark/benchmark.h>
+
+#include "libwiicrypto/zero_block.h"
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+// copyToGcm() buffer: 1 MB, checked in 4 KB blocks.
+#define BENCH_BUF_SIZE		1048576U
+#define BENCH_BLOCK_SIZE	4096U
+
+/**
+ * Benchmark scanning an all-zero 1 MB buffer in a single call.
+ * This is the best case for sparse disc images.
+ * @param state Benchmark state.
+ * @param impl Zero block implementation.
+ */
+static void BM_zero_block_find_empty(benchmark::State &state, ZeroBlockImpl_e impl)
+{
+	if (!zero_block_impl_is_supported(impl)) {
+		state.SkipWithError("Zero block implementation is not supported on this CPU.");
+		return;
+	}
+
+	const vector<uint8_t> data(BENCH_BUF_SIZE);
+	for (auto _ : state) {
+		size_t offset = zero_block_find_impl(impl, data.data(), BENCH_BUF_SIZE, BENCH_BLOCK_SIZE);
+		benchmark::DoNotOptimize(offset);
+	}
+	state.SetBytesProcessed(state.iterations() * BENCH_BUF_SIZE);
+}
+
+/**
+ * Benchmark checking every 4 KB block of a 1 MB buffer where
+ * each block has a single non-zero byte at the end.
+ * This is the worst case: one call per block, and all data is read.
+ * @param state Benchmark state.
+ * @param impl Zero block implementation.
+ */
+static void BM_zero_block_find_blocks(benchmark::State &state, ZeroBlockImpl_e impl)
+{
+	if (!zero_block_impl_is_supported(impl)) {
+		state.SkipWithError("Zero block implementation is not supported on this CPU.");
+		return;
+	}
+
+	vector<uint8_t> data(BENCH_BUF_SIZE);
+	for (size_t i = BENCH_BLOCK_SIZE - 1; i < BENCH_BUF_SIZE; i += BENCH_BLOCK_SIZE) {
+		data[i] = 0x01;
+	}
+	for (auto _ : state) {
+		for (size_t i = 0; i < BENCH_BUF_SIZE; i += BENCH_BLOCK_SIZE) {
+			size_t offset = zero_block_find_impl(impl, &data[i], BENCH_BLOCK_SIZE, BENCH_BLOCK_SIZE);
+			benchmark::DoNotOptimize(offset);
+		}
+	}
+	state.SetBytesProcessed(state.iterations() * BENCH_BUF_SIZE);
+}
+
+BENCHMARK_CAPTURE(BM_zero_block_find_empty, generic, ZERO_BLOCK_IMPL_GENERIC);
+BENCHMARK_CAPTURE(BM_zero_block_find_empty, SSE2, ZERO_BLOCK_IMPL_SSE2);
+BENCHMARK_CAPTURE(BM_zero_block_find_empty, AVX2, ZERO_BLOCK_IMPL_AVX2);
+BENCHMARK_CAPTURE(BM_zero_block_find_empty, NEON, ZERO_BLOCK_IMPL_NEON);
+
+BENCHMARK_CAPTURE(BM_zero_block_find_blocks, generic, ZERO_BLOCK_IMPL_GENERIC);
+BENCHMARK_CAPTURE(BM_zero_block_find_blocks, SSE2, ZERO_BLOCK_IMPL_SSE2);
+BENCHMARK_CAPTURE(BM_zero_block_find_blocks, AVX2, ZERO_BLOCK_IMPL_AVX2);
+BENCHMARK_CAPTURE(BM_zero_block_find_blocks, NEON, ZERO_BLOCK_IMPL_NEON);
+
+} }
+
+BENCHMARK_MAIN();
@@ -0,0 +1,144 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * ZeroBlockTest.cpp: Zero block detection tests.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/zero_block.h"
+
+// C includes. (C++ namespace)
+#include <cctype>
+#include <cstdio>
+
+// C++ includes.
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+class ZeroBlockTest : public ::testing::TestWithParam<ZeroBlockImpl_e>
+{
+	protected:
+		ZeroBlockTest() { }
+
+		/**
+		 * Is the implementation being tested supported by this CPU?
+		 * @return True if supported; false if not.
+		 */
+		bool isSupported(void) const;
+
+	public:
+		/**
+		 * Test case suffix generator.
+		 * @param info Test parameter information.
+		 * @return Test case suffix.
+		 */
+		static string test_case_suffix_generator(const ::testing::TestParamInfo<ZeroBlockImpl_e> &info);
+};
+
+bool ZeroBlockTest::isSupported(void) const
+{
+	if (!zero_block_impl_is_supported(GetParam())) {
+		fprintf(stderr, "*** %s is not supported on this system; skipping.\n",
+			zero_block_impl_name(GetParam()));
+		EXPECT_EQ((size_t)-1, zero_block_find_impl(GetParam(), nullptr, 0, 4096));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * All-zero buffers, including sizes that don't fill the unrolled loops.
+ */
+TEST_P(ZeroBlockTest, allZero)
+{
+	if (!isSupported())
+		return;
+
+	static const size_t sizes[] = {0, 64, 128, 192, 256, 320, 4096, 65536 + 192};
+	for (size_t size : sizes) {
+		const vector<uint8_t> data(size);
+		EXPECT_EQ(size, zero_block_find_impl(GetParam(), data.data(), size, ZERO_BLOCK_CHUNK_SIZE))
+			<< "size == " << size;
+	}
+}
+
+/**
+ * A single non-zero byte at every position in a buffer.
+ */
+TEST_P(ZeroBlockTest, singleByte)
+{
+	if (!isSupported())
+		return;
+
+	// 1 MB buffer, as used by copyToGcm(), with 4 KB blocks.
+	// Check every byte of the first 1 KB and a sparse set of the rest.
+	static const size_t size = 1048576;
+	static const size_t block_size = 4096;
+	vector<uint8_t> data(size);
+	for (size_t pos = 0; pos < size; pos += (pos < 1024 ? 1 : 4093)) {
+		data[pos] = 0x01;
+		EXPECT_EQ(pos - (pos % block_size),
+			zero_block_find_impl(GetParam(), data.data(), size, block_size))
+			<< "pos == " << pos;
+		EXPECT_EQ(pos - (pos % ZERO_BLOCK_CHUNK_SIZE),
+			zero_block_find_impl(GetParam(), data.data(), size, ZERO_BLOCK_CHUNK_SIZE))
+			<< "pos == " << pos;
+		data[pos] = 0;
+	}
+
+	// Last byte.
+	data[size-1] = 0x80;
+	EXPECT_EQ(size - block_size, zero_block_find_impl(GetParam(), data.data(), size, block_size));
+}
+
+string ZeroBlockTest::test_case_suffix_generator(const ::testing::TestParamInfo<ZeroBlockImpl_e> &info)
+{
+	string suffix = zero_block_impl_name(info.param);
+
+	// Replace all non-alphanumeric characters with '_'.
+	// See gtest-param-util.h::IsValidParamName().
+	for (int i = (int)suffix.size()-1; i >= 0; i--) {
+		char chr = suffix[i];
+		if (!isalnum(chr) && chr != '_') {
+			suffix[i] = '_';
+		}
+	}
+
+	return suffix;
+}
+
+INSTANTIATE_TEST_CASE_P(zeroBlockTest, ZeroBlockTest,
+	::testing::Values(
+		ZERO_BLOCK_IMPL_GENERIC,
+		ZERO_BLOCK_IMPL_SSE2,
+		ZERO_BLOCK_IMPL_AVX2,
+		ZERO_BLOCK_IMPL_NEON
+	), ZeroBlockTest::test_case_suffix_generator);
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: Zero block detection tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
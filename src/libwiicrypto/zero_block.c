@@ -0,0 +1,193 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * zero_block.c: Zero block detection.                                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "zero_block.h"
+#include "zero_block_hw.h"
+#include "cpuflags.h"
+
+#include <assert.h>
+
+typedef size_t (*zero_block_scan_fn)(const uint8_t *pData, size_t size);
+
+/**
+ * Find the first non-zero chunk using 64-bit words.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+static size_t zero_block_scan_generic(const uint8_t *pData, size_t size)
+{
+	const uint64_t *p64 = (const uint64_t*)pData;
+	size_t offset;
+
+	for (offset = 0; offset < size; offset += ZERO_BLOCK_CHUNK_SIZE, p64 += 8) {
+		uint64_t x = p64[0];
+		x |= p64[1];
+		x |= p64[2];
+		x |= p64[3];
+		x |= p64[4];
+		x |= p64[5];
+		x |= p64[6];
+		x |= p64[7];
+		if (x != 0) {
+			// Non-zero chunk.
+			break;
+		}
+	}
+	return offset;
+}
+
+/**
+ * Get the function for a zero block implementation.
+ * @param impl Zero block implementation.
+ * @return Function, or NULL if not supported.
+ */
+static zero_block_scan_fn zero_block_get_fn(ZeroBlockImpl_e impl)
+{
+	switch (impl) {
+		case ZERO_BLOCK_IMPL_GENERIC:
+			return zero_block_scan_generic;
+#ifdef HAVE_ZERO_BLOCK_SSE2
+		case ZERO_BLOCK_IMPL_SSE2:
+			if (wiicrypto_cpu_flags() & WIICRYPTO_CPUFLAG_X86_SSE2)
+				return zero_block_scan_sse2;
+			break;
+#endif /* HAVE_ZERO_BLOCK_SSE2 */
+#ifdef HAVE_ZERO_BLOCK_AVX2
+		case ZERO_BLOCK_IMPL_AVX2:
+			if (wiicrypto_cpu_flags() & WIICRYPTO_CPUFLAG_X86_AVX2)
+				return zero_block_scan_avx2;
+			break;
+#endif /* HAVE_ZERO_BLOCK_AVX2 */
+#ifdef HAVE_ZERO_BLOCK_NEON
+		case ZERO_BLOCK_IMPL_NEON:
+			// NEON is always available on ARM64.
+			return zero_block_scan_neon;
+#endif /* HAVE_ZERO_BLOCK_NEON */
+		default:
+			break;
+	}
+	return NULL;
+}
+
+/**
+ * Is the specified zero block implementation supported on this system?
+ * @param impl Zero block implementation.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int zero_block_impl_is_supported(ZeroBlockImpl_e impl)
+{
+	return (zero_block_get_fn(impl) != NULL);
+}
+
+/**
+ * Get the name of a zero block implementation.
+ * @param impl Zero block implementation.
+ * @return Name, or NULL if impl is invalid.
+ */
+const char *zero_block_impl_name(ZeroBlockImpl_e impl)
+{
+	static const char *const impl_names[ZERO_BLOCK_IMPL_MAX] = {
+		"generic",
+		"SSE2",
+		"AVX2",
+		"NEON",
+	};
+
+	assert(impl >= 0 && impl < ZERO_BLOCK_IMPL_MAX);
+	if (impl < 0 || impl >= ZERO_BLOCK_IMPL_MAX) {
+		return NULL;
+	}
+	return impl_names[impl];
+}
+
+/**
+ * Get the zero block implementation used by zero_block_find().
+ * @return Zero block implementation.
+ */
+ZeroBlockImpl_e zero_block_get_impl(void)
+{
+	// Order of preference, fastest first.
+	static const ZeroBlockImpl_e impl_order[] = {
+		ZERO_BLOCK_IMPL_AVX2,
+		ZERO_BLOCK_IMPL_SSE2,
+		ZERO_BLOCK_IMPL_NEON,
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(impl_order) / sizeof(impl_order[0]); i++) {
+		if (zero_block_impl_is_supported(impl_order[i])) {
+			return impl_order[i];
+		}
+	}
+	return ZERO_BLOCK_IMPL_GENERIC;
+}
+
+/**
+ * Find the first non-zero block using the specified scan function.
+ * @param fn		[in] Scan function.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of block_size)
+ * @param block_size	[in] Block size, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero block, or size if all blocks are zero.
+ */
+static inline size_t zero_block_find_int(zero_block_scan_fn fn,
+	const uint8_t *pData, size_t size, size_t block_size)
+{
+	size_t offset;
+
+	assert(block_size != 0);
+	assert(block_size % ZERO_BLOCK_CHUNK_SIZE == 0);
+	assert(size % block_size == 0);
+
+	// The first non-zero chunk is in the first non-zero block.
+	offset = fn(pData, size);
+	if (offset >= size) {
+		return size;
+	}
+	return offset - (offset % block_size);
+}
+
+/**
+ * Find the first block in a buffer that isn't all zeroes.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of block_size)
+ * @param block_size	[in] Block size, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero block, or size if all blocks are zero.
+ */
+size_t zero_block_find(const uint8_t *pData, size_t size, size_t block_size)
+{
+	zero_block_scan_fn fn = zero_block_get_fn(zero_block_get_impl());
+	assert(fn != NULL);
+	return zero_block_find_int(fn, pData, size, block_size);
+}
+
+/**
+ * Find the first block in a buffer that isn't all zeroes
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] Zero block implementation.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of block_size)
+ * @param block_size	[in] Block size, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero block, size if all blocks are zero,
+ *         or (size_t)-1 if impl isn't supported.
+ */
+size_t zero_block_find_impl(ZeroBlockImpl_e impl, const uint8_t *pData, size_t size, size_t block_size)
+{
+	zero_block_scan_fn fn;
+
+	if (impl < 0 || impl >= ZERO_BLOCK_IMPL_MAX) {
+		return (size_t)-1;
+	}
+	fn = zero_block_get_fn(impl);
+	if (!fn) {
+		return (size_t)-1;
+	}
+	return zero_block_find_int(fn, pData, size, block_size);
+}
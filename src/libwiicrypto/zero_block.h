@@ -0,0 +1,95 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * zero_block.h: Zero block detection.                                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Used to detect empty blocks when writing sparse disc images.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_ZERO_BLOCK_H__
+#define __RVTHTOOL_LIBWIICRYPTO_ZERO_BLOCK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Buffers are scanned in chunks of this size.
+// Sizes passed to the zero_block functions must be multiples of it.
+#define ZERO_BLOCK_CHUNK_SIZE 64
+
+/**
+ * Zero block detection implementations.
+ * zero_block_find() uses the fastest one supported by the CPU.
+ */
+typedef enum {
+	ZERO_BLOCK_IMPL_GENERIC	= 0,	// Portable C (64-bit words)
+	ZERO_BLOCK_IMPL_SSE2	= 1,	// x86 SSE2
+	ZERO_BLOCK_IMPL_AVX2	= 2,	// x86 AVX2
+	ZERO_BLOCK_IMPL_NEON	= 3,	// ARM64 NEON
+
+	ZERO_BLOCK_IMPL_MAX
+} ZeroBlockImpl_e;
+
+/**
+ * Is the specified zero block implementation supported on this system?
+ * @param impl Zero block implementation.
+ * @return True (non-zero) if supported; false (0) if not.
+ */
+int zero_block_impl_is_supported(ZeroBlockImpl_e impl);
+
+/**
+ * Get the name of a zero block implementation.
+ * @param impl Zero block implementation.
+ * @return Name, or NULL if impl is invalid.
+ */
+const char *zero_block_impl_name(ZeroBlockImpl_e impl);
+
+/**
+ * Get the zero block implementation used by zero_block_find().
+ * @return Zero block implementation.
+ */
+ZeroBlockImpl_e zero_block_get_impl(void);
+
+/**
+ * Find the first block in a buffer that isn't all zeroes.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of block_size)
+ * @param block_size	[in] Block size, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero block, or size if all blocks are zero.
+ */
+size_t zero_block_find(const uint8_t *pData, size_t size, size_t block_size);
+
+/**
+ * Find the first block in a buffer that isn't all zeroes
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] Zero block implementation.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of block_size)
+ * @param block_size	[in] Block size, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero block, size if all blocks are zero,
+ *         or (size_t)-1 if impl isn't supported.
+ */
+size_t zero_block_find_impl(ZeroBlockImpl_e impl, const uint8_t *pData, size_t size, size_t block_size);
+
+/**
+ * Check if a block is all zeroes.
+ * @param pData	[in] Block.
+ * @param size	[in] Block size, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return True (non-zero) if the block is all zeroes; false (0) if not.
+ */
+static inline int zero_block_is_empty(const uint8_t *pData, size_t size)
+{
+	return (zero_block_find(pData, size, size) == size);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_ZERO_BLOCK_H__ */
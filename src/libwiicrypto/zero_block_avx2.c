@@ -0,0 +1,59 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * zero_block_avx2.c: Zero block detection. (AVX2 version)                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with AVX2 enabled.
+// (-mavx2 on gcc/clang)
+
+#include "zero_block_hw.h"
+
+// AVX2 intrinsics.
+#include <immintrin.h>
+
+/**
+ * Find the first non-zero chunk using AVX2.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+size_t zero_block_scan_avx2(const uint8_t *pData, size_t size)
+{
+	size_t offset = 0;
+
+	// Check 256 bytes per iteration, then find the
+	// non-zero chunk if anything was set.
+	for (; offset + 256 <= size; offset += 256) {
+		const uint8_t *const p = &pData[offset];
+		__m256i y0 = _mm256_loadu_si256((const __m256i*)&p[0]);
+		__m256i y1 = _mm256_loadu_si256((const __m256i*)&p[32]);
+		__m256i y2 = _mm256_loadu_si256((const __m256i*)&p[64]);
+		__m256i y3 = _mm256_loadu_si256((const __m256i*)&p[96]);
+		y0 = _mm256_or_si256(y0, _mm256_loadu_si256((const __m256i*)&p[128]));
+		y1 = _mm256_or_si256(y1, _mm256_loadu_si256((const __m256i*)&p[160]));
+		y2 = _mm256_or_si256(y2, _mm256_loadu_si256((const __m256i*)&p[192]));
+		y3 = _mm256_or_si256(y3, _mm256_loadu_si256((const __m256i*)&p[224]));
+		y0 = _mm256_or_si256(_mm256_or_si256(y0, y1), _mm256_or_si256(y2, y3));
+		if (!_mm256_testz_si256(y0, y0)) {
+			// Found a non-zero chunk.
+			break;
+		}
+	}
+
+	// Check the remaining data one chunk at a time.
+	for (; offset < size; offset += ZERO_BLOCK_CHUNK_SIZE) {
+		const uint8_t *const p = &pData[offset];
+		__m256i y0 = _mm256_loadu_si256((const __m256i*)&p[0]);
+		y0 = _mm256_or_si256(y0, _mm256_loadu_si256((const __m256i*)&p[32]));
+		if (!_mm256_testz_si256(y0, y0)) {
+			break;
+		}
+	}
+
+	// Avoid AVX-SSE transition penalties in the caller.
+	_mm256_zeroupper();
+	return offset;
+}
@@ -0,0 +1,61 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * zero_block_hw.h: Zero block detection. (SIMD backends)                  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This is an internal header used by the zero_block_*.c files.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_ZERO_BLOCK_HW_H__
+#define __RVTHTOOL_LIBWIICRYPTO_ZERO_BLOCK_HW_H__
+
+#include "config.libwiicrypto.h"
+#include "zero_block.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Each backend finds the first non-zero ZERO_BLOCK_CHUNK_SIZE chunk.
+// zero_block_find() rounds the result down to the block size.
+
+#ifdef HAVE_ZERO_BLOCK_SSE2
+/**
+ * Find the first non-zero chunk using SSE2.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+size_t zero_block_scan_sse2(const uint8_t *pData, size_t size);
+#endif /* HAVE_ZERO_BLOCK_SSE2 */
+
+#ifdef HAVE_ZERO_BLOCK_AVX2
+/**
+ * Find the first non-zero chunk using AVX2.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+size_t zero_block_scan_avx2(const uint8_t *pData, size_t size);
+#endif /* HAVE_ZERO_BLOCK_AVX2 */
+
+#ifdef HAVE_ZERO_BLOCK_NEON
+/**
+ * Find the first non-zero chunk using ARM64 NEON.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+size_t zero_block_scan_neon(const uint8_t *pData, size_t size);
+#endif /* HAVE_ZERO_BLOCK_NEON */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_ZERO_BLOCK_HW_H__ */
@@ -0,0 +1,69 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * zero_block_neon.c: Zero block detection. (ARM64 NEON version)           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: NEON is always available on ARM64, so no special
+// compiler flags are needed.
+
+#include "zero_block_hw.h"
+
+// NEON intrinsics.
+#include <arm_neon.h>
+
+/**
+ * Check if a vector is non-zero.
+ * @param v Vector.
+ * @return True (non-zero) if any byte is non-zero.
+ */
+static inline int vec_is_nonzero(uint8x16_t v)
+{
+	return (vmaxvq_u32(vreinterpretq_u32_u8(v)) != 0);
+}
+
+/**
+ * Find the first non-zero chunk using ARM64 NEON.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+size_t zero_block_scan_neon(const uint8_t *pData, size_t size)
+{
+	size_t offset = 0;
+
+	// Check 256 bytes per iteration, then find the
+	// non-zero chunk if anything was set.
+	for (; offset + 256 <= size; offset += 256) {
+		const uint8_t *const p = &pData[offset];
+		uint8x16_t v0 = vld1q_u8(&p[0]);
+		uint8x16_t v1 = vld1q_u8(&p[16]);
+		uint8x16_t v2 = vld1q_u8(&p[32]);
+		uint8x16_t v3 = vld1q_u8(&p[48]);
+		unsigned int i;
+		for (i = 64; i < 256; i += 64) {
+			v0 = vorrq_u8(v0, vld1q_u8(&p[i]));
+			v1 = vorrq_u8(v1, vld1q_u8(&p[i+16]));
+			v2 = vorrq_u8(v2, vld1q_u8(&p[i+32]));
+			v3 = vorrq_u8(v3, vld1q_u8(&p[i+48]));
+		}
+		if (vec_is_nonzero(vorrq_u8(vorrq_u8(v0, v1), vorrq_u8(v2, v3)))) {
+			// Found a non-zero chunk.
+			break;
+		}
+	}
+
+	// Check the remaining data one chunk at a time.
+	for (; offset < size; offset += ZERO_BLOCK_CHUNK_SIZE) {
+		const uint8_t *const p = &pData[offset];
+		const uint8x16_t v = vorrq_u8(
+			vorrq_u8(vld1q_u8(&p[0]), vld1q_u8(&p[16])),
+			vorrq_u8(vld1q_u8(&p[32]), vld1q_u8(&p[48])));
+		if (vec_is_nonzero(v)) {
+			break;
+		}
+	}
+	return offset;
+}
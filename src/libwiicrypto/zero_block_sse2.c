@@ -0,0 +1,75 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * zero_block_sse2.c: Zero block detection. (SSE2 version)                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with SSE2 enabled.
+// (-msse2 on gcc/clang for i386)
+
+#include "zero_block_hw.h"
+
+// SSE2 intrinsics.
+#include <emmintrin.h>
+
+/**
+ * Check if a 64-byte chunk is non-zero.
+ * @param p Chunk.
+ * @return True (non-zero) if the chunk is non-zero.
+ */
+static inline int chunk_is_nonzero(const uint8_t *p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i*)&p[0]);
+	x = _mm_or_si128(x, _mm_loadu_si128((const __m128i*)&p[16]));
+	x = _mm_or_si128(x, _mm_loadu_si128((const __m128i*)&p[32]));
+	x = _mm_or_si128(x, _mm_loadu_si128((const __m128i*)&p[48]));
+	return (_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xFFFF);
+}
+
+/**
+ * Find the first non-zero chunk using SSE2.
+ * @param pData	[in] Data.
+ * @param size	[in] Size of pData, in bytes. (multiple of ZERO_BLOCK_CHUNK_SIZE)
+ * @return Offset of the first non-zero chunk, or size if all chunks are zero.
+ */
+size_t zero_block_scan_sse2(const uint8_t *pData, size_t size)
+{
+	size_t offset = 0;
+
+	// Check 256 bytes per iteration, then find the
+	// non-zero chunk if anything was set.
+	for (; offset + 256 <= size; offset += 256) {
+		const uint8_t *const p = &pData[offset];
+		__m128i x0 = _mm_loadu_si128((const __m128i*)&p[0]);
+		__m128i x1 = _mm_loadu_si128((const __m128i*)&p[16]);
+		__m128i x2 = _mm_loadu_si128((const __m128i*)&p[32]);
+		__m128i x3 = _mm_loadu_si128((const __m128i*)&p[48]);
+		x0 = _mm_or_si128(x0, _mm_loadu_si128((const __m128i*)&p[64]));
+		x1 = _mm_or_si128(x1, _mm_loadu_si128((const __m128i*)&p[80]));
+		x2 = _mm_or_si128(x2, _mm_loadu_si128((const __m128i*)&p[96]));
+		x3 = _mm_or_si128(x3, _mm_loadu_si128((const __m128i*)&p[112]));
+		x0 = _mm_or_si128(x0, _mm_loadu_si128((const __m128i*)&p[128]));
+		x1 = _mm_or_si128(x1, _mm_loadu_si128((const __m128i*)&p[144]));
+		x2 = _mm_or_si128(x2, _mm_loadu_si128((const __m128i*)&p[160]));
+		x3 = _mm_or_si128(x3, _mm_loadu_si128((const __m128i*)&p[176]));
+		x0 = _mm_or_si128(x0, _mm_loadu_si128((const __m128i*)&p[192]));
+		x1 = _mm_or_si128(x1, _mm_loadu_si128((const __m128i*)&p[208]));
+		x2 = _mm_or_si128(x2, _mm_loadu_si128((const __m128i*)&p[224]));
+		x3 = _mm_or_si128(x3, _mm_loadu_si128((const __m128i*)&p[240]));
+		x0 = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x0, _mm_setzero_si128())) != 0xFFFF) {
+			// Found a non-zero chunk.
+			break;
+		}
+	}
+
+	// Check the remaining data one chunk at a time.
+	for (; offset < size; offset += ZERO_BLOCK_CHUNK_SIZE) {
+		if (chunk_is_nonzero(&pData[offset])) {
+			break;
+		}
+	}
+	return offset;
+}
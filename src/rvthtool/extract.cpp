@@ -27,9 +27,16 @@
 
 // C includes. (C++ namespace)
 #include <cassert>
+#include <cctype>
 #include <cerrno>
 #include <cstdlib>
 
+// C++ includes.
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
 /**
  * RVT-H progress callback.
  * @param state		[in] Current progress.
@@ -148,6 +155,192 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
 	return ret;
 }
 
+// 'extract-all' progress state.
+struct ExtractAllProgress {
+	vector<uint32_t> lba_processed;	// Indexed by bank number.
+	vector<uint32_t> lba_total;	// Indexed by bank number.
+};
+
+/**
+ * RVT-H progress callback for 'extract-all'.
+ * Calls are serialized by RvtH::extractBanks().
+ * @param state		[in] Current progress.
+ * @param userdata	[in] ExtractAllProgress*
+ * @return True to continue; false to abort.
+ */
+static bool progress_callback_all(const RvtH_Progress_State *state, void *userdata)
+{
+	ExtractAllProgress *const progress = static_cast<ExtractAllProgress*>(userdata);
+	const unsigned int bank = state->bank_rvth;
+	assert(bank < progress->lba_total.size());
+	if (bank >= progress->lba_total.size())
+		return false;
+
+	switch (state->type) {
+		case RVTH_PROGRESS_EXTRACT:
+			progress->lba_processed[bank] = state->lba_processed;
+			progress->lba_total[bank] = state->lba_total;
+			if (state->lba_processed == state->lba_total) {
+				printf("\rBank %u: %u MiB copied.%-32s\n", bank+1,
+					state->lba_total / MEGABYTE, "");
+			}
+			break;
+		case RVTH_PROGRESS_RECRYPT:
+			if (state->lba_processed == 0) {
+				printf("\rBank %u: Recrypting the ticket(s) and TMD(s)...%-8s\n", bank+1, "");
+			}
+			return true;
+		default:
+			// FIXME
+			assert(false);
+			return false;
+	}
+
+	// Print the combined progress of all banks.
+	uint64_t lba_processed = 0, lba_total = 0;
+	unsigned int active = 0;
+	for (size_t i = 0; i < progress->lba_total.size(); i++) {
+		lba_processed += progress->lba_processed[i];
+		lba_total += progress->lba_total[i];
+		if (progress->lba_processed[i] != progress->lba_total[i]) {
+			active++;
+		}
+	}
+	printf("\rExtracting: %5u MiB / %5u MiB copied (%u bank%s active)...",
+		(unsigned int)(lba_processed / MEGABYTE),
+		(unsigned int)(lba_total / MEGABYTE),
+		active, (active == 1 ? "" : "s"));
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'extract-all' command.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param outdir	[in] Output directory for the extracted GCM images.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @return 0 on success; non-zero on error.
+ */
+int extract_all(const TCHAR *rvth_filename, const TCHAR *outdir, int recrypt_key, unsigned int flags)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		fputs("*** ERROR opening RVT-H device '", stderr);
+		_fputts(rvth_filename, stderr);
+		fprintf(stderr, "': %s\n", rvth_error(ret));
+		delete rvth;
+		return ret;
+	}
+
+	// Output directory prefix.
+	tstring prefix(outdir);
+	if (!prefix.empty() && prefix[prefix.size()-1] != _T('/')
+#ifdef _WIN32
+	    && prefix[prefix.size()-1] != _T('\\')
+#endif /* _WIN32 */
+	    )
+	{
+		prefix += _T('/');
+	}
+
+	// Find the banks to extract.
+	vector<unsigned int> banks;
+	vector<tstring> filenames;
+	const unsigned int bankCount = rvth->bankCount();
+	for (unsigned int bank = 0; bank < bankCount; bank++) {
+		const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
+		if (!entry)
+			continue;
+
+		switch (entry->type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				break;
+			case RVTH_BankType_Empty:
+			case RVTH_BankType_Wii_DL_Bank2:
+				// Nothing to extract.
+				continue;
+			default:
+				printf("Bank %u: Unknown bank type; skipping.\n", bank+1);
+				continue;
+		}
+		if (entry->is_deleted) {
+			printf("Bank %u: Deleted; skipping.\n", bank+1);
+			continue;
+		}
+
+		// Filename: BankN_ID6.gcm (or .ciso, .wbfs, .gcm.zst, .rvts)
+		// Non-alphanumeric characters in the game ID are replaced with '_'.
+		TCHAR buf[16];
+		_sntprintf(buf, ARRAY_SIZE(buf), _T("Bank%u_"), bank+1);
+		tstring filename(prefix);
+		filename += buf;
+		for (size_t i = 0; i < ARRAY_SIZE(entry->discHeader.id6); i++) {
+			const char chr = entry->discHeader.id6[i];
+			filename += (isalnum(static_cast<unsigned char>(chr)) ? static_cast<TCHAR>(chr) : _T('_'));
+		}
+		if (flags & RVTH_EXTRACT_FORMAT_CISO) {
+			filename += _T(".ciso");
+		} else if (flags & RVTH_EXTRACT_FORMAT_WBFS) {
+			filename += _T(".wbfs");
+		} else if (flags & RVTH_EXTRACT_FORMAT_ZSTD) {
+			filename += _T(".gcm.zst");
+		} else if (flags & RVTH_EXTRACT_FORMAT_STORE) {
+			filename += _T(".rvts");
+		} else {
+			filename += _T(".gcm");
+		}
+
+		printf("Bank %u: Extracting into '", bank+1);
+		_fputts(filename.c_str(), stdout);
+		fputs("'\n", stdout);
+		banks.push_back(bank);
+		filenames.push_back(std::move(filename));
+	}
+
+	if (banks.empty()) {
+		fputs("*** ERROR: No banks to extract.\n", stderr);
+		delete rvth;
+		return RVTH_ERROR_BANK_EMPTY;
+	}
+	putchar('\n');
+
+	vector<const TCHAR*> p_filenames(filenames.size());
+	for (size_t i = 0; i < filenames.size(); i++) {
+		p_filenames[i] = filenames[i].c_str();
+	}
+	vector<int> errs(banks.size(), 0);
+
+	ExtractAllProgress progress;
+	progress.lba_processed.resize(bankCount, 0);
+	progress.lba_total.resize(bankCount, 0);
+
+	ret = rvth->extractBanks(banks.data(), p_filenames.data(),
+		static_cast<unsigned int>(banks.size()), recrypt_key, flags,
+		progress_callback_all, &progress, errs.data());
+	putchar('\n');
+
+	// Print the results.
+	unsigned int ok = 0;
+	for (size_t i = 0; i < banks.size(); i++) {
+		if (errs[i] == 0) {
+			ok++;
+		} else {
+			// TODO: Delete the gcm file?
+			fprintf(stderr, "*** ERROR: Bank %u: %s\n", banks[i]+1, rvth_error(errs[i]));
+		}
+	}
+	printf("%u of %u bank%s extracted successfully.\n", ok,
+		static_cast<unsigned int>(banks.size()), (banks.size() == 1 ? "" : "s"));
+
+	delete rvth;
+	return ret;
+}
+
 /**
  * 'import' command.
  * @param rvth_filename	RVT-H device or disk image filename.
@@ -26,6 +26,16 @@ extern "C" {
  */
 int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags);
 
+/**
+ * 'extract-all' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param outdir	Output directory for the extracted GCM images.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @return 0 on success; non-zero on error.
+ */
+int extract_all(const TCHAR *rvth_filename, const TCHAR *outdir, int recrypt_key, unsigned int flags);
+
 /**
  * 'import' command.
  * @param rvth_filename	RVT-H device or disk image filename.
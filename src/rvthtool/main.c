@@ -18,6 +18,7 @@
 
 #include "librvth/config.librvth.h"
 #include "librvth/rvth.hpp"
+#include "librvth/reader/io_backend.h"
 #include "libwiicrypto/cert.h"
 #include "libwiicrypto/sig_tools.h"
 
@@ -28,6 +29,8 @@
 #include "list-banks.hpp"
 #include "extract.h"
 #include "undelete.h"
+#include "verify.h"
+#include "store.h"
 #include "query.h"
 
 #ifdef _MSC_VER
@@ -49,6 +52,22 @@
 # define ATTR_PRINTF(fmt, args)
 #endif
 
+// Long-only options.
+enum {
+	OPT_IO = 256,
+	OPT_IO_DEPTH,
+	OPT_UNBUFFERED,
+	OPT_NO_MMAP,
+	OPT_NO_IO_HINTS,
+	OPT_NO_CACHE,
+	OPT_BLOCK_CACHE,
+	OPT_BLOCK_CACHE_SIZE,
+	OPT_FORMAT,
+	OPT_ZSTD_LEVEL,
+	OPT_ZSTD_FRAME_SIZE,
+	OPT_SPLIT_SIZE,
+};
+
 // Uncomment this to display hidden options in the help message.
 //#define SHOW_HIDDEN_OPTIONS 1
 
@@ -95,6 +114,10 @@ static void print_help(const TCHAR *argv0)
 		"extract " DEVICE_NAME_EXAMPLE " bank# disc.gcm\n"
 		"- Extract the specified bank number from rvth.img to disc.gcm.\n"
 		"\n"
+		"extract-all " DEVICE_NAME_EXAMPLE " outdir\n"
+		"- Extract all banks from rvth.img into outdir concurrently.\n"
+		"  Images are named BankN_GAMEID.gcm, or .ciso/.wbfs/.gcm.zst/.rvts with --format.\n"
+		"\n"
 		"import " DEVICE_NAME_EXAMPLE " bank# disc.gcm\n"
 		"- Import disc.gcm into rvth.img at the specified bank number.\n"
 		"  The destination bank must be either empty or deleted.\n"
@@ -109,6 +132,19 @@ static void print_help(const TCHAR *argv0)
 		"- Undelete the specified bank number from the specified RVT-H device.\n"
 		"  [This command only works with RVT-H Readers, not disk images.]\n"
 		"\n"
+		"verify " DEVICE_NAME_EXAMPLE " bank#\n"
+		"- Verify the partition hashes of the specified Wii bank number.\n"
+		"\n"
+		"store info storedir\n"
+		"- Show how much space is saved by the chunk store in storedir.\n"
+		"\n"
+		"store verify storedir\n"
+		"- Check that the chunks in storedir aren't missing or corrupt.\n"
+		"\n"
+		"store gc storedir\n"
+		"- Delete chunks that aren't used by any image in storedir.\n"
+		"  This fails if images are being extracted into storedir.\n"
+		"\n"
 		"query\n"
 		"- Query all available RVT-H Reader devices and list them.\n"
 #ifndef HAVE_QUERY
@@ -126,6 +162,43 @@ static void print_help(const TCHAR *argv0)
 		"                            Importing to RVT-H will always use debug keys.\n"
 		"  -N, --ndev                Prepend extracted images with a 32 KB header\n"
 		"                            required by official SDK tools.\n"
+		"      --format=FMT          Format for extracted images:\n"
+		"                            gcm (default), ciso, wbfs, zstd, store\n"
+		"                            CISO and WBFS images aren't sparse files.\n"
+		"                            store writes a manifest (disc.rvts), and stores\n"
+		"                            the data in a chunk store in the same directory.\n"
+		"                            Data shared with other images is stored once.\n"
+		"                            zstd and store images can't be recrypted or used\n"
+		"                            with --ndev.\n"
+#ifndef HAVE_ZSTD
+		"                            [NOTE: zstd is not available on this system.]\n"
+#endif /* HAVE_ZSTD */
+		"      --zstd-level=N        Compression level for zstd images. (1-22; default is 3)\n"
+		"      --zstd-frame-size=MB  Size of each independently-compressed zstd frame.\n"
+		"                            (1-64; default is 2)\n"
+		"      --split-size=MB       Split extracted images into parts of this size,\n"
+		"                            named disc.gcm.part0, disc.gcm.part1, etc.\n"
+		"                            Use 'fat32' for FAT32 file systems. (4095 MB)\n"
+		"                            Split images are read by opening disc.gcm.part0.\n"
+		"      --io=MODE             Select the I/O backend for large transfers:\n"
+		"                            sync, uring, uring-direct\n"
+		"                            uring-direct uses O_DIRECT for aligned requests.\n"
+#ifndef HAVE_IO_URING
+		"                            [NOTE: Only sync is available on this system.]\n"
+#endif /* HAVE_IO_URING */
+		"      --io-depth=N          Number of requests in flight for io_uring.\n"
+		"      --unbuffered=MODE     Bypass the page cache when writing:\n"
+		"                            auto (RVT-H Reader devices only), always, never\n"
+		"      --no-mmap             Don't memory-map disc image files.\n"
+		"      --no-io-hints         Don't give the OS readahead and page cache hints\n"
+		"                            when extracting or importing. By default, copied\n"
+		"                            data is dropped from the page cache.\n"
+		"      --no-cache            Don't use the bank metadata cache. RVT-H Reader\n"
+		"                            bank tables are cached to speed up listing.\n"
+		"      --block-cache=N       Number of blocks to cache per bank for small\n"
+		"                            reads, e.g. disc headers. (0-1024; default is 16)\n"
+		"                            Use 0 to disable the block cache.\n"
+		"      --block-cache-size=KB Size of each cached block. (4-1024; default is 32)\n"
 #ifdef SHOW_HIDDEN_OPTIONS
 		"  -I, --ios=xx              Force IOSxx when importing a disc image to\n"
 		"                            an RVT-H Reader."
@@ -149,6 +222,25 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	// Default is -1, or "use existing IOS".
 	int ios_force = -1;
 
+	// I/O backend.
+	unsigned int io_flags = 0;
+	unsigned int io_depth = 0;	// 0 == default
+	RvtH_IO_Backend_e io_backend = rvth_io_get_backend(NULL, NULL);
+	RvtH_IO_Unbuffered_e io_unbuffered = rvth_io_get_unbuffered();
+	int io_mmap = rvth_io_get_mmap();
+	int io_hints = rvth_io_get_stream_hints();
+	int bank_cache = rvth_io_get_bank_cache();
+	unsigned int block_cache_size, block_cache_count;
+	rvth_io_get_block_cache(&block_cache_size, &block_cache_count);
+
+	// Zstandard settings.
+	int zstd_level;
+	unsigned int zstd_frame_size;
+	rvth_zstd_get_params(&zstd_level, &zstd_frame_size);
+
+	// Part size for split images. (0 == don't split)
+	long long split_size = 0;
+
 #ifdef _WIN32
 	// Set Win32 security options.
 	secoptions_init();
@@ -178,6 +270,18 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			{_T("recrypt"),	required_argument,	0, _T('k')},
 			{_T("ndev"),	no_argument,		0, _T('N')},
 			{_T("ios"),	required_argument,	0, _T('I')},
+			{_T("io"),	required_argument,	0, OPT_IO},
+			{_T("io-depth"),	required_argument,	0, OPT_IO_DEPTH},
+			{_T("unbuffered"),	required_argument,	0, OPT_UNBUFFERED},
+			{_T("no-mmap"),	no_argument,		0, OPT_NO_MMAP},
+			{_T("no-io-hints"),	no_argument,		0, OPT_NO_IO_HINTS},
+			{_T("no-cache"),	no_argument,		0, OPT_NO_CACHE},
+			{_T("block-cache"),	required_argument,	0, OPT_BLOCK_CACHE},
+			{_T("block-cache-size"),	required_argument,	0, OPT_BLOCK_CACHE_SIZE},
+			{_T("format"),	required_argument,	0, OPT_FORMAT},
+			{_T("zstd-level"),	required_argument,	0, OPT_ZSTD_LEVEL},
+			{_T("zstd-frame-size"),	required_argument,	0, OPT_ZSTD_FRAME_SIZE},
+			{_T("split-size"),	required_argument,	0, OPT_SPLIT_SIZE},
 			{_T("help"),	no_argument,		0, _T('h')},
 
 			{NULL, 0, 0, 0}
@@ -230,6 +334,157 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 				break;
 			}
 
+			case OPT_IO:
+				// I/O backend.
+				if (!_tcsicmp(optarg, _T("sync"))) {
+					io_backend = RVTH_IO_BACKEND_SYNC;
+					io_flags = 0;
+				} else if (!_tcsicmp(optarg, _T("uring"))) {
+					io_backend = RVTH_IO_BACKEND_URING;
+					io_flags = 0;
+				} else if (!_tcsicmp(optarg, _T("uring-direct"))) {
+					io_backend = RVTH_IO_BACKEND_URING;
+					io_flags = RVTH_IO_FLAG_DIRECT;
+				} else {
+					print_error(argv[0], _T("unknown I/O backend '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				if (!rvth_io_backend_is_supported(io_backend)) {
+					print_error(argv[0], _T("I/O backend '%s' is not supported on this system"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_IO_DEPTH: {
+				// io_uring queue depth.
+				TCHAR *endptr;
+				unsigned long io_depth_tmp = _tcstoul(optarg, &endptr, 10);
+				if (*endptr != _T('\0') || io_depth_tmp < 1 || io_depth_tmp > 4096) {
+					print_error(argv[0], _T("invalid I/O queue depth '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				io_depth = (unsigned int)io_depth_tmp;
+				break;
+			}
+
+			case OPT_UNBUFFERED:
+				// Unbuffered write policy.
+				if (!_tcsicmp(optarg, _T("auto"))) {
+					io_unbuffered = RVTH_IO_UNBUFFERED_AUTO;
+				} else if (!_tcsicmp(optarg, _T("always"))) {
+					io_unbuffered = RVTH_IO_UNBUFFERED_ALWAYS;
+				} else if (!_tcsicmp(optarg, _T("never"))) {
+					io_unbuffered = RVTH_IO_UNBUFFERED_NEVER;
+				} else {
+					print_error(argv[0], _T("unknown unbuffered write mode '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_NO_MMAP:
+				// Don't use memory-mapped Readers.
+				io_mmap = 0;
+				break;
+
+			case OPT_NO_IO_HINTS:
+				// Don't use page cache hints.
+				io_hints = 0;
+				break;
+
+			case OPT_NO_CACHE:
+				// Don't use the bank metadata cache.
+				bank_cache = 0;
+				break;
+
+			case OPT_BLOCK_CACHE: {
+				// Number of cached blocks per bank.
+				TCHAR *endptr;
+				unsigned long count_tmp = _tcstoul(optarg, &endptr, 10);
+				if (*endptr != _T('\0') || count_tmp > 1024) {
+					print_error(argv[0], _T("invalid block cache count '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				block_cache_count = (unsigned int)count_tmp;
+				break;
+			}
+
+			case OPT_BLOCK_CACHE_SIZE: {
+				// Block cache block size, in KB.
+				TCHAR *endptr;
+				unsigned long size_tmp = _tcstoul(optarg, &endptr, 10);
+				if (*endptr != _T('\0') || size_tmp < 4 || size_tmp > 1024 || (size_tmp % 4) != 0) {
+					print_error(argv[0], _T("invalid block cache size '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				block_cache_size = (unsigned int)(size_tmp * 1024U);
+				break;
+			}
+
+			case OPT_FORMAT:
+				// Output format for extracted images.
+				flags &= ~(RVTH_EXTRACT_FORMAT_CISO | RVTH_EXTRACT_FORMAT_WBFS |
+					   RVTH_EXTRACT_FORMAT_ZSTD | RVTH_EXTRACT_FORMAT_STORE);
+				if (!_tcsicmp(optarg, _T("gcm"))) {
+					// Default format.
+				} else if (!_tcsicmp(optarg, _T("ciso"))) {
+					flags |= RVTH_EXTRACT_FORMAT_CISO;
+				} else if (!_tcsicmp(optarg, _T("wbfs"))) {
+					flags |= RVTH_EXTRACT_FORMAT_WBFS;
+				} else if (!_tcsicmp(optarg, _T("zstd"))) {
+					if (!rvth_zstd_is_supported()) {
+						print_error(argv[0], _T("image format '%s' is not supported on this system"), optarg);
+						return EXIT_FAILURE;
+					}
+					flags |= RVTH_EXTRACT_FORMAT_ZSTD;
+				} else if (!_tcsicmp(optarg, _T("store"))) {
+					flags |= RVTH_EXTRACT_FORMAT_STORE;
+				} else {
+					print_error(argv[0], _T("unknown image format '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_ZSTD_LEVEL: {
+				// Zstandard compression level.
+				TCHAR *endptr;
+				unsigned long level_tmp = _tcstoul(optarg, &endptr, 10);
+				if (*endptr != _T('\0') || level_tmp < 1 || level_tmp > 22) {
+					print_error(argv[0], _T("invalid zstd compression level '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				zstd_level = (int)level_tmp;
+				break;
+			}
+
+			case OPT_ZSTD_FRAME_SIZE: {
+				// Zstandard frame size, in MB.
+				TCHAR *endptr;
+				unsigned long frame_size_tmp = _tcstoul(optarg, &endptr, 10);
+				if (*endptr != _T('\0') || frame_size_tmp < 1 || frame_size_tmp > 64) {
+					print_error(argv[0], _T("invalid zstd frame size '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				zstd_frame_size = (unsigned int)(frame_size_tmp * 1024U * 1024U);
+				break;
+			}
+
+			case OPT_SPLIT_SIZE: {
+				// Part size for split images, in MB.
+				TCHAR *endptr;
+				unsigned long split_size_tmp;
+				if (!_tcsicmp(optarg, _T("fat32"))) {
+					split_size = RVTH_IO_SPLIT_SIZE_FAT32;
+					break;
+				}
+				split_size_tmp = _tcstoul(optarg, &endptr, 10);
+				if (*endptr != _T('\0') || split_size_tmp > 1024UL*1024UL) {
+					print_error(argv[0], _T("invalid split size '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				split_size = (long long)split_size_tmp * 1024LL * 1024LL;
+				break;
+			}
+
 			case 'h':
 				print_help(argv[0]);
 				return EXIT_SUCCESS;
@@ -241,6 +496,24 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 		}
 	}
 
+	if ((flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) &&
+	    (flags & (RVTH_EXTRACT_FORMAT_CISO | RVTH_EXTRACT_FORMAT_WBFS |
+		      RVTH_EXTRACT_FORMAT_ZSTD | RVTH_EXTRACT_FORMAT_STORE)))
+	{
+		print_error(argv[0], _T("--ndev can only be used with --format=gcm"));
+		return EXIT_FAILURE;
+	}
+
+	// Select the I/O backend.
+	rvth_io_set_backend(io_backend, io_depth, io_flags);
+	rvth_io_set_unbuffered(io_unbuffered);
+	rvth_io_set_mmap(io_mmap);
+	rvth_io_set_stream_hints(io_hints);
+	rvth_io_set_bank_cache(bank_cache);
+	rvth_io_set_block_cache(block_cache_size, block_cache_count);
+	rvth_zstd_set_params(zstd_level, zstd_frame_size);
+	rvth_io_set_split_size(split_size);
+
 	// First argument after getopt-parsed arguments is set in optind.
 	if (optind >= argc) {
 		print_error(argv[0], _T("no parameters specified"));
@@ -275,6 +548,13 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			// Three or more parameters specified.
 			ret = extract(argv[optind+1], argv[optind+2], argv[optind+3], recrypt_key, flags);
 		}
+	} else if (!_tcscmp(argv[optind], _T("extract-all"))) {
+		// Extract all banks.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'extract-all'"));
+			return EXIT_FAILURE;
+		}
+		ret = extract_all(argv[optind+1], argv[optind+2], recrypt_key, flags);
 	} else if (!_tcscmp(argv[optind], _T("import"))) {
 		// Import a bank.
 		if (argc < optind+4) {
@@ -296,6 +576,36 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			return EXIT_FAILURE;
 		}
 		ret = undelete_bank(argv[optind+1], argv[optind+2]);
+	} else if (!_tcscmp(argv[optind], _T("verify"))) {
+		// Verify a bank.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'verify'"));
+			return EXIT_FAILURE;
+		} else if (argc == optind+2) {
+			// One parameter specified.
+			// Pass NULL as the bank number, which will be
+			// interpreted as bank 1 for single-disc images
+			// and an error for HDD images.
+			ret = verify(argv[optind+1], NULL);
+		} else {
+			ret = verify(argv[optind+1], argv[optind+2]);
+		}
+	} else if (!_tcscmp(argv[optind], _T("store"))) {
+		// Chunk store maintenance.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'store'"));
+			return EXIT_FAILURE;
+		}
+		if (!_tcscmp(argv[optind+1], _T("info"))) {
+			ret = store_info(argv[optind+2]);
+		} else if (!_tcscmp(argv[optind+1], _T("verify"))) {
+			ret = store_verify(argv[optind+2]);
+		} else if (!_tcscmp(argv[optind+1], _T("gc"))) {
+			ret = store_gc(argv[optind+2]);
+		} else {
+			print_error(argv[0], _T("unrecognized store command '%s'"), argv[optind+1]);
+			return EXIT_FAILURE;
+		}
 	} else if (!_tcscmp(argv[optind], _T("query"))) {
 		// Query RVT-H Reader devices.
 		// NOTE: Not checking HAVE_QUERY. If querying isn't available,
@@ -0,0 +1,126 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * store.cpp: Chunk store maintenance.                                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "store.h"
+
+#include "librvth/ChunkStore.hpp"
+#include "librvth/rvth_error.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Scan a chunk store and print its statistics.
+ * @param store_dir	[in] Chunk store directory.
+ * @param flags		[in] Scan flags. (See ChunkStore::ScanFlags.)
+ * @param pStats	[out] Statistics.
+ * @return 0 on success; non-zero on error.
+ */
+static int scan_and_print(const TCHAR *store_dir, unsigned int flags, ChunkStore::Stats *pStats)
+{
+	ChunkStore store(store_dir);
+	int ret = store.scan(pStats, flags);
+	if (ret != 0) {
+		fputs("*** ERROR scanning chunk store '", stderr);
+		_fputts(store_dir, stderr);
+		fprintf(stderr, "': %s\n", rvth_error(ret));
+		if (ret == -EBUSY) {
+			fputs("*** Disc images are being extracted into the chunk store.\n", stderr);
+		}
+		return ret;
+	}
+
+	#define MEGABYTE 1048576.0
+	fputs("Chunk store: ", stdout);
+	_fputts(store_dir, stdout);
+	putchar('\n');
+	printf("- Disc images: %u (%.1f MiB)\n",
+		pStats->manifests, (double)pStats->image_bytes / MEGABYTE);
+	printf("- Stored chunks: %llu (%.1f MiB)\n",
+		(unsigned long long)pStats->chunks, (double)pStats->chunk_bytes / MEGABYTE);
+	if (pStats->image_bytes > 0 && pStats->chunk_bytes > 0) {
+		printf("- Savings: %.2f:1\n",
+			(double)pStats->image_bytes / (double)pStats->chunk_bytes);
+	}
+	printf("- Unreferenced chunks: %llu (%.1f MiB)\n",
+		(unsigned long long)pStats->unreferenced,
+		(double)pStats->unreferenced_bytes / MEGABYTE);
+	if (pStats->missing > 0) {
+		printf("*** Missing chunks: %llu\n", (unsigned long long)pStats->missing);
+	}
+	if (pStats->corrupt > 0) {
+		printf("*** Corrupt chunks: %llu\n", (unsigned long long)pStats->corrupt);
+	}
+	return 0;
+}
+
+/**
+ * 'store info' command.
+ * @param store_dir	Chunk store directory.
+ * @return 0 on success; non-zero on error or if any chunks are missing.
+ */
+int store_info(const TCHAR *store_dir)
+{
+	ChunkStore::Stats stats;
+	int ret = scan_and_print(store_dir, 0, &stats);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (stats.missing > 0) {
+		fputs("*** Some disc images can't be read because chunks are missing.\n", stdout);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
+
+/**
+ * 'store verify' command.
+ * @param store_dir	Chunk store directory.
+ * @return 0 on success; non-zero on error or if any chunks are missing or corrupt.
+ */
+int store_verify(const TCHAR *store_dir)
+{
+	ChunkStore::Stats stats;
+	int ret = scan_and_print(store_dir, ChunkStore::SCAN_VERIFY, &stats);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (stats.missing > 0 || stats.corrupt > 0) {
+		fputs("*** Some disc images can't be read because chunks are missing or corrupt.\n", stdout);
+		if (stats.corrupt > 0) {
+			fputs("*** Extracting the original disc images again will replace the corrupt chunks.\n", stdout);
+		}
+		return EXIT_FAILURE;
+	}
+	fputs("All chunks are OK.\n", stdout);
+	return 0;
+}
+
+/**
+ * 'store gc' command.
+ * @param store_dir	Chunk store directory.
+ * @return 0 on success; non-zero on error.
+ */
+int store_gc(const TCHAR *store_dir)
+{
+	ChunkStore::Stats stats;
+	int ret = scan_and_print(store_dir, ChunkStore::SCAN_REMOVE_UNREFERENCED, &stats);
+	if (ret != 0) {
+		return ret;
+	}
+
+	printf("\nRemoved %llu unreferenced chunk%s (%.1f MiB).\n",
+		(unsigned long long)stats.unreferenced,
+		(stats.unreferenced == 1 ? "" : "s"),
+		(double)stats.unreferenced_bytes / MEGABYTE);
+	return 0;
+}
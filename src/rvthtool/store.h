@@ -0,0 +1,43 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * store.h: Chunk store maintenance.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_STORE_H__
+#define __RVTHTOOL_RVTHTOOL_STORE_H__
+
+#include "tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'store info' command.
+ * @param store_dir	Chunk store directory.
+ * @return 0 on success; non-zero on error or if any chunks are missing.
+ */
+int store_info(const TCHAR *store_dir);
+
+/**
+ * 'store verify' command.
+ * @param store_dir	Chunk store directory.
+ * @return 0 on success; non-zero on error or if any chunks are missing or corrupt.
+ */
+int store_verify(const TCHAR *store_dir);
+
+/**
+ * 'store gc' command.
+ * @param store_dir	Chunk store directory.
+ * @return 0 on success; non-zero on error.
+ */
+int store_gc(const TCHAR *store_dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_STORE_H__ */
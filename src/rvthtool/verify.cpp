@@ -0,0 +1,197 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * verify.cpp: Verify the hashes of a Wii disc image.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "verify.h"
+#include "list-banks.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+
+// C++ includes.
+#include <chrono>
+
+/**
+ * RVT-H progress callback.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	assert(state->type == RVTH_PROGRESS_VERIFY);
+	printf("\rVerifying: %4u MiB / %4u MiB processed...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * Get a partition type description.
+ * @param type	[in] Partition type.
+ * @param buf	[out] Buffer for non-standard partition types.
+ * @param size	[in] Size of buf.
+ * @return Partition type description.
+ */
+static const char *partition_type_name(uint32_t type, char *buf, size_t size)
+{
+	switch (type) {
+		case 0:
+			return "Game";
+		case 1:
+			return "Update";
+		case 2:
+			return "Channel";
+		default:
+			break;
+	}
+
+	// Non-standard partitions usually have an ASCII ID.
+	snprintf(buf, size, "0x%08X", type);
+	return buf;
+}
+
+/**
+ * 'verify' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @return 0 on success; non-zero on error or if any hashes are invalid.
+ */
+int verify(const TCHAR *rvth_filename, const TCHAR *s_bank)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		fputs("*** ERROR opening RVT-H device '", stderr);
+		_fputts(rvth_filename, stderr);
+		fprintf(stderr, "': %s\n", rvth_error(ret));
+		delete rvth;
+		return ret;
+	}
+
+	unsigned int bank;
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank >= rvth->bankCount()) {
+			fputs("*** ERROR: Invalid bank number '", stderr);
+			_fputts(s_bank, stderr);
+			fputs("'.\n", stderr);
+			delete rvth;
+			return -EINVAL;
+		}
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		// For HDD images or RVT-H Readers, this is an error.
+		if (rvth->bankCount() != 1) {
+			fprintf(stderr, "*** ERROR: Must specify a bank number for this RVT-H Reader%s.\n",
+				rvth->isHDD() ? "" : " disk image");
+			delete rvth;
+			return -EINVAL;
+		}
+		bank = 0;
+	}
+
+	// Print the bank information.
+	// TODO: Make sure the bank type is valid before printing the newline.
+	print_bank(rvth, bank);
+	putchar('\n');
+
+	// Wii discs can't have more than 31 partitions.
+	RvtH_Verify_Result results[32];
+	unsigned int count = ARRAY_SIZE(results);
+
+	printf("Verifying Bank %u...\n", bank+1);
+	const auto tStart = std::chrono::steady_clock::now();
+	ret = rvth->verifyWiiPartitions(bank, results, &count, progress_callback);
+	const auto tEnd = std::chrono::steady_clock::now();
+	if (ret != 0) {
+		fprintf(stderr, "*** ERROR: rvth_verify() failed: %s\n", rvth_error(ret));
+		delete rvth;
+		return ret;
+	}
+	putchar('\n');
+
+	static const char *const level_names[RVTH_VERIFY_LEVEL_MAX] = {
+		"none", "H0", "H1", "H2", "H3",
+	};
+
+	uint64_t bytes_verified = 0;
+	bool all_ok = true;
+	for (unsigned int i = 0; i < count; i++) {
+		const RvtH_Verify_Result *const result = &results[i];
+		char type_buf[16];
+		printf("Partition %u.%u (%s): ", result->vg, result->pt,
+			partition_type_name(result->type, type_buf, sizeof(type_buf)));
+		bytes_verified += (uint64_t)result->sector_count * (32*1024);
+
+		switch (result->status) {
+			case RVTH_VERIFY_STATUS_OK:
+				printf("OK (%u sectors)\n", result->sector_count);
+				break;
+			case RVTH_VERIFY_STATUS_UNENCRYPTED:
+				fputs("unencrypted; skipped\n", stdout);
+				break;
+			case RVTH_VERIFY_STATUS_BAD:
+				all_ok = false;
+				printf("*** BAD (%u of %u sectors)\n",
+					result->bad_sector_count, result->sector_count);
+				if (!result->tmd_ok) {
+					fputs("- H3 table does not match the TMD content hash.\n", stdout);
+				}
+				if (result->bad_sector_count != 0) {
+					assert(result->bad_level < RVTH_VERIFY_LEVEL_MAX);
+					printf("- First bad sector: %u (group %u, %s hash mismatch)\n",
+						result->bad_sector, result->bad_group,
+						level_names[result->bad_level % RVTH_VERIFY_LEVEL_MAX]);
+				}
+				break;
+			case RVTH_VERIFY_STATUS_ERROR:
+			default:
+				all_ok = false;
+				printf("*** ERROR: %s\n", rvth_error(result->err));
+				break;
+		}
+	}
+
+	// Throughput summary.
+	const double secs = std::chrono::duration<double>(tEnd - tStart).count();
+	const double mib = (double)bytes_verified / 1048576.0;
+	printf("\nVerified %.1f MiB in %.2f s", mib, secs);
+	if (secs > 0) {
+		printf(" (%.1f MiB/s)", mib / secs);
+	}
+	putchar('\n');
+
+	if (all_ok) {
+		printf("Bank %u verified successfully.\n", bank+1);
+	} else {
+		printf("*** Bank %u has errors.\n", bank+1);
+		ret = EXIT_FAILURE;
+	}
+
+	delete rvth;
+	return ret;
+}
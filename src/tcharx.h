@@ -39,6 +39,7 @@ typedef char TCHAR;
 #define _tfopen(filename, mode)		fopen((filename), (mode))
 #define _tmkdir(path, mode)		mkdir((path), (mode))
 #define _tremove(pathname)		remove(pathname)
+#define _trename(oldpath, newpath)	rename((oldpath), (newpath))
 
 #define _tprintf printf
 #define _ftprintf fprintf
@@ -48,6 +49,7 @@ typedef char TCHAR;
 #define _vsprintf vsprintf
 
 // stdlib.h
+#define _tgetenv(name)			getenv(name)
 #define _tcscmp(s1, s2)			strcmp((s1), (s2))
 #define _tcsicmp(s1, s2)		strcasecmp((s1), (s2))
 #define _tcsnicmp(s1, s2)		strncasecmp((s1), (s2), (n))